@@ -0,0 +1,488 @@
+#include <WinSock2.h>
+#include <Windows.h>
+#include <Psapi.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <stdexcept>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <random>
+
+#include "server/server.h"
+#include "client/client.h"
+#include "packet/packet.h"
+#include "packet/compression.h"
+#include "packet/checksum.h"
+
+#pragma comment (lib, "Ws2_32.lib")
+#pragma comment (lib, "Psapi.lib")
+
+/*
+	Loopback benchmarks behind the numbers in the README:
+
+		bench tls <certificate subject> [payload bytes] [round trips]
+		bench churn [threads] [seconds]
+		bench latency [endpoint] [round trips] [low latency, 0 or 1]
+		bench compression [payload bytes] [payloads]
+		bench checksum [payload bytes] [round trips]
+		bench idle [connections]
+
+	tls:	connection setup and request/response round trips over tcp:// and tls://, so the cost of the
+		encryption can be read off directly. The certificate has to be in the current user's store.
+
+	churn:	threads connect, finish the protocol handshake and disconnect again as fast as they can, for the
+		rate of connections the accept and receive threads keep up with.
+
+	latency:	ping-pong of small packets, with set_low_latency on both sides if asked for. Prints the
+		median and tail of the round trips.
+
+	compression:	ratio and throughput of the payload codec on generated records (field names repeat, values
+		don't), without and with a dictionary trained on other records of the same kind.
+
+	checksum:	CRC32C throughput, then round trips over tcp:// without and with feature_checksum, for what
+		the checksums cost a connection.
+
+	idle:	opens connections which finish the protocol handshake and then stay silent, and prints how much
+		private memory our process gained per connection. The client ends are plain sockets, they cost
+		kernel memory only. Connections are spread over 127.0.0.x, every address has about 64K ports.
+
+	Every mode runs server and client in this process over 127.0.0.1 and prints what it measured.
+*/
+
+namespace remote = forceinline::remote;
+namespace packets = remote::packets;
+
+using clock_type = std::chrono::steady_clock;
+using echo_packet = packets::text_packet< packets::packet_id::text_one >;
+
+double elapsed_since( clock_type::time_point start ) {
+	return std::chrono::duration< double >( clock_type::now( ) - start ).count( );
+}
+
+// Answers every text_one packet with a copy of itself
+void set_echo_handler( remote::async_server& server ) {
+	server.set_packet_handler( packets::packet_id::text_one, [ ]( remote::async_server* server, SOCKET from, const std::vector< char >& buffer, std::uint8_t flags ) {
+		echo_packet request( buffer, flags );
+		echo_packet response( request( ), flags );
+
+		server->send_packet( from, &response );
+	} );
+}
+
+// Client packet handlers are plain functions, so the responses are counted here
+struct {
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::uint32_t answered = 0;
+} responses;
+
+// Sends round_trips requests, each once the previous one came back, returns the seconds it took. The responses go to a
+// packet handler, send_packet with a handler polls for them and would measure its own polling interval
+double measure_round_trips( remote::async_client& client, std::size_t payload, std::uint32_t round_trips, std::vector< double >* samples = nullptr ) {
+	// The string goes out with its length in front of it, packets are 64 KiB at most
+	if ( payload + sizeof( std::size_t ) > packets::wire::max_packet_size )
+		throw std::invalid_argument( "bench: payload does not fit into a packet" );
+
+	client.set_packet_handler( packets::packet_id::text_one, [ ]( remote::async_client*, const std::vector< char >&, std::uint8_t ) {
+		{
+			std::lock_guard lock( responses.mtx );
+			responses.answered++;
+		}
+
+		responses.cv.notify_one( );
+	} );
+
+	responses.answered = 0;
+	auto start = clock_type::now( );
+
+	for ( std::uint32_t i = 0; i < round_trips; i++ ) {
+		echo_packet request( { std::string( payload, char( 'a' + i % 26 ) ) } );
+		auto sent = clock_type::now( );
+
+		client.send_packet( &request );
+
+		std::unique_lock lock( responses.mtx );
+
+		if ( !responses.cv.wait_for( lock, std::chrono::seconds( 5 ), [ & ]( ) { return responses.answered > i; } ) )
+			throw std::exception( "bench: a request was not answered" );
+
+		if ( samples )
+			samples->push_back( elapsed_since( sent ) );
+	}
+
+	auto seconds = elapsed_since( start );
+
+	client.set_packet_handler( packets::packet_id::text_one, nullptr );
+	return seconds;
+}
+
+void bench_tls( const std::string& certificate_subject, std::size_t payload, std::uint32_t round_trips ) {
+	constexpr int connections = 20;
+
+	for ( auto tls : { false, true } ) {
+		auto endpoint = std::string( tls ? "tls://127.0.0.1:27201" : "tcp://127.0.0.1:27200" );
+
+		remote::transport::tls_options_t options = { };
+		options.certificate_subject = certificate_subject;
+		options.verify_server = false;
+
+		remote::async_server server( endpoint );
+		set_echo_handler( server );
+
+		if ( tls )
+			server.set_tls_options( options );
+
+		server.start( );
+
+		// Connection setup, the TLS handshake included
+		auto start = clock_type::now( );
+
+		for ( int i = 0; i < connections; i++ ) {
+			remote::async_client client( endpoint );
+
+			if ( tls )
+				client.set_tls_options( options );
+
+			client.connect( );
+			client.disconnect( );
+		}
+
+		auto connect_seconds = elapsed_since( start );
+
+		remote::async_client client( endpoint );
+
+		if ( tls )
+			client.set_tls_options( options );
+
+		client.connect( );
+
+		auto seconds = measure_round_trips( client, payload, round_trips );
+
+		client.disconnect( );
+		server.close( );
+
+		std::cout << ( tls ? "tls" : "tcp" ) << ": connect " << connect_seconds * 1000.0 / connections << " ms, "
+			<< payload << " byte round trip " << seconds * 1000000.0 / round_trips << " us, "
+			<< 2.0 * payload * round_trips / seconds / ( 1024.0 * 1024.0 ) << " MB/s" << std::endl;
+	}
+}
+
+void bench_churn( int threads, int seconds ) {
+	remote::async_server server( "tcp://127.0.0.1:27202" );
+	server.start( );
+
+	std::atomic< std::uint64_t > connections = 0, failures = 0;
+	std::vector< std::thread > workers = { };
+
+	auto deadline = clock_type::now( ) + std::chrono::seconds( seconds );
+	auto start = clock_type::now( );
+
+	for ( int i = 0; i < threads; i++ ) {
+		workers.emplace_back( [ & ]( ) {
+			while ( clock_type::now( ) < deadline ) {
+				try {
+					remote::async_client client( "tcp://127.0.0.1:27202" );
+					client.connect( );
+					client.disconnect( );
+
+					connections++;
+				} catch ( const std::exception& ) {
+					failures++;
+				}
+			}
+		} );
+	}
+
+	for ( auto& worker : workers )
+		worker.join( );
+
+	auto elapsed = elapsed_since( start );
+	server.close( );
+
+	std::cout << "churn: " << connections << " connections from " << threads << " threads in " << elapsed << " s, "
+		<< connections / elapsed << " per second, " << failures << " failed" << std::endl;
+}
+
+void bench_latency( const std::string& endpoint, std::uint32_t round_trips, bool low_latency ) {
+	remote::transport::low_latency_config_t config = { };
+	config.enabled = low_latency;
+
+	remote::async_server server( endpoint );
+	set_echo_handler( server );
+	server.set_low_latency( config );
+	server.start( );
+
+	remote::async_client client( endpoint );
+	client.set_low_latency( config );
+	client.connect( );
+
+	// Warm up the connection and the caches first
+	measure_round_trips( client, 16, round_trips / 10 + 1 );
+
+	std::vector< double > samples = { };
+	measure_round_trips( client, 16, round_trips, &samples );
+
+	client.disconnect( );
+	server.close( );
+
+	std::sort( samples.begin( ), samples.end( ) );
+
+	auto percentile = [ & ]( double fraction ) {
+		return samples[ std::min( samples.size( ) - 1, std::size_t( fraction * samples.size( ) ) ) ] * 1000000.0;
+	};
+
+	std::cout << "latency (" << ( low_latency ? "low latency" : "default" ) << "): " << samples.size( ) << " round trips, median "
+		<< percentile( 0.5 ) << " us, 99% " << percentile( 0.99 ) << " us, max " << percentile( 1.0 ) << " us" << std::endl;
+}
+
+// Text records like many applications send them, the field names repeat and the values are random
+std::vector< char > make_record_payload( std::mt19937& random, std::size_t size ) {
+	std::string payload = "";
+
+	while ( payload.size( ) < size ) {
+		payload += "{\"id\":" + std::to_string( random( ) % 100000 ) + ",\"name\":\"player_" + std::to_string( random( ) % 1000 )
+			+ "\",\"x\":" + std::to_string( random( ) % 4096 ) + ",\"y\":" + std::to_string( random( ) % 4096 ) + ",\"state\":\""
+			+ ( random( ) % 2 ? "alive" : "dead" ) + "\"}";
+	}
+
+	payload.resize( size );
+	return { payload.begin( ), payload.end( ) };
+}
+
+void bench_compression( std::size_t payload_size, std::uint32_t payload_count ) {
+	std::mt19937 random( 1337 );
+
+	std::vector< std::vector< char > > payloads = { }, samples = { };
+	for ( std::uint32_t i = 0; i < payload_count; i++ )
+		payloads.push_back( make_record_payload( random, payload_size ) );
+
+	for ( std::uint32_t i = 0; i < 64; i++ )
+		samples.push_back( make_record_payload( random, payload_size ) );
+
+	auto dictionary = packets::compression::train_dictionary( samples );
+
+	for ( auto with_dictionary : { false, true } ) {
+		auto used_dictionary = with_dictionary ? &dictionary : nullptr;
+
+		std::vector< std::vector< char > > compressed( payloads.size( ) );
+		std::size_t compressed_bytes = 0, total_bytes = 0;
+
+		auto start = clock_type::now( );
+
+		for ( std::size_t i = 0; i < payloads.size( ); i++ ) {
+			// Payloads which don't get smaller are sent as they are
+			if ( !packets::compression::compress_payload( payloads[ i ].data( ), payloads[ i ].size( ), used_dictionary, compressed[ i ] ) )
+				compressed[ i ] = payloads[ i ];
+
+			compressed_bytes += compressed[ i ].size( );
+			total_bytes += payloads[ i ].size( );
+		}
+
+		auto compress_seconds = elapsed_since( start );
+
+		std::vector< char > decompressed = { };
+		start = clock_type::now( );
+
+		for ( std::size_t i = 0; i < payloads.size( ); i++ ) {
+			if ( compressed[ i ].size( ) == payloads[ i ].size( ) )
+				continue;
+
+			if ( !packets::compression::decompress_payload( compressed[ i ].data( ), compressed[ i ].size( ), used_dictionary, decompressed, std::uint32_t( payload_size ) ) || decompressed != payloads[ i ] )
+				throw std::exception( "bench: a payload did not survive the round trip" );
+		}
+
+		auto decompress_seconds = elapsed_since( start );
+		auto megabytes = total_bytes / ( 1024.0 * 1024.0 );
+
+		std::cout << "compression (" << ( with_dictionary ? "dictionary" : "no dictionary" ) << "): " << payloads.size( ) << " x " << payload_size
+			<< " bytes, ratio " << double( total_bytes ) / compressed_bytes << ", compress " << megabytes / compress_seconds << " MB/s, decompress "
+			<< megabytes / decompress_seconds << " MB/s" << std::endl;
+	}
+}
+
+void bench_checksum( std::size_t payload, std::uint32_t round_trips ) {
+	std::vector< char > buffer( 64 * 1024 );
+	std::mt19937 random( 1337 );
+
+	for ( auto& byte : buffer )
+		byte = char( random( ) );
+
+	// What crc32c picked for this CPU against the table version it falls back to
+	for ( auto portable : { false, true } ) {
+		constexpr int rounds = 4096;
+		std::uint32_t crc = 0;
+
+		auto start = clock_type::now( );
+
+		for ( int i = 0; i < rounds; i++ )
+			crc = portable ? ~packets::checksum::detail::update_portable( ~crc, buffer.data( ), buffer.size( ) ) : packets::checksum::crc32c( buffer.data( ), buffer.size( ), crc );
+
+		auto megabytes = double( rounds ) * buffer.size( ) / ( 1024.0 * 1024.0 );
+		std::cout << "crc32c (" << ( portable ? "portable" : "default" ) << "): " << megabytes / elapsed_since( start ) << " MB/s (" << crc << ")" << std::endl;
+	}
+
+	// Both connections stay up and take turns, so neither gets the quieter part of the run
+	remote::async_server plain_server( "tcp://127.0.0.1:27206" ), checksum_server( "tcp://127.0.0.1:27207" );
+	set_echo_handler( plain_server );
+	set_echo_handler( checksum_server );
+
+	plain_server.start( );
+	checksum_server.start( );
+
+	remote::async_client plain_client( "tcp://127.0.0.1:27206" ), checksum_client( "tcp://127.0.0.1:27207" );
+
+	// The client's default features plus the checksum
+	checksum_client.set_features( packets::wire::feature_compression | packets::wire::feature_large_frames | packets::wire::feature_delta | packets::wire::feature_checksum );
+
+	plain_client.connect( );
+	checksum_client.connect( );
+
+	if ( !( checksum_client.features( ) & packets::wire::feature_checksum ) )
+		throw std::exception( "bench: the server did not accept feature_checksum" );
+
+	constexpr std::uint32_t slices = 20;
+	double seconds[ 2 ] = { };
+
+	measure_round_trips( plain_client, payload, round_trips / 10 + 1 );
+	measure_round_trips( checksum_client, payload, round_trips / 10 + 1 );
+
+	for ( std::uint32_t i = 0; i < slices; i++ ) {
+		seconds[ 0 ] += measure_round_trips( plain_client, payload, round_trips / slices );
+		seconds[ 1 ] += measure_round_trips( checksum_client, payload, round_trips / slices );
+	}
+
+	plain_client.disconnect( );
+	checksum_client.disconnect( );
+	plain_server.close( );
+	checksum_server.close( );
+
+	for ( auto checksum : { false, true } ) {
+		std::cout << "round trips (" << ( checksum ? "checksum" : "no checksum" ) << "): " << payload << " bytes, "
+			<< seconds[ checksum ] * 1000000.0 / ( round_trips / slices * slices ) << " us, "
+			<< 2.0 * payload * ( round_trips / slices * slices ) / seconds[ checksum ] / ( 1024.0 * 1024.0 ) << " MB/s" << std::endl;
+	}
+
+	std::cout << "checksum overhead: " << ( seconds[ 1 ] / seconds[ 0 ] - 1.0 ) * 100.0 << "%" << std::endl;
+}
+
+std::size_t private_bytes( ) {
+	PROCESS_MEMORY_COUNTERS_EX counters = { };
+	GetProcessMemoryInfo( GetCurrentProcess( ), reinterpret_cast< PROCESS_MEMORY_COUNTERS* >( &counters ), sizeof counters );
+
+	return counters.PrivateUsage;
+}
+
+void bench_idle( std::uint32_t connection_count ) {
+	constexpr std::uint32_t connections_per_address = 50000;
+
+	remote::async_server server( "tcp://127.0.0.1:27208" );
+	server.start( );
+
+	sockaddr_in server_address = { };
+	server_address.sin_family = AF_INET;
+	server_address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	server_address.sin_port = htons( 27208 );
+
+	char handshake[ packets::wire::handshake_size ] = { };
+	packets::wire::encode_handshake( { packets::wire::protocol_version, 0 }, handshake );
+
+	// Our own bookkeeping must not show up in the measurement
+	std::vector< SOCKET > sockets = { };
+	sockets.reserve( connection_count );
+
+	auto before = private_bytes( );
+	auto start = clock_type::now( );
+
+	for ( std::uint32_t i = 0; i < connection_count; i++ ) {
+		auto connection = ::socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+
+		sockaddr_in local_address = { };
+		local_address.sin_family = AF_INET;
+		local_address.sin_addr.s_addr = htonl( INADDR_LOOPBACK + 1 + i / connections_per_address );
+
+		if ( connection == INVALID_SOCKET || bind( connection, reinterpret_cast< sockaddr* >( &local_address ), sizeof local_address ) == SOCKET_ERROR
+			|| ::connect( connection, reinterpret_cast< sockaddr* >( &server_address ), sizeof server_address ) == SOCKET_ERROR
+			|| send( connection, handshake, sizeof handshake, NULL ) != sizeof handshake ) {
+			std::cout << "idle: connection " << i << " failed, measuring the ones we have" << std::endl;
+
+			if ( connection != INVALID_SOCKET )
+				closesocket( connection );
+
+			break;
+		}
+
+		sockets.push_back( connection );
+	}
+
+	// The server answered every handshake once it negotiated the connection
+	for ( auto connection : sockets ) {
+		char acknowledgement[ packets::wire::handshake_size ] = { };
+
+		for ( int received = 0; received < int( sizeof acknowledgement ); ) {
+			auto length = recv( connection, acknowledgement + received, int( sizeof acknowledgement ) - received, NULL );
+
+			if ( length <= 0 )
+				throw std::exception( "bench: the server closed an idle connection" );
+
+			received += length;
+		}
+	}
+
+	auto elapsed = elapsed_since( start );
+	auto after = private_bytes( );
+
+	std::cout << "idle: " << sockets.size( ) << " connections in " << elapsed << " s, private memory +" << ( after - before ) / ( 1024.0 * 1024.0 )
+		<< " MB, " << double( after - before ) / std::max< std::size_t >( sockets.size( ), 1 ) << " bytes per connection" << std::endl;
+
+	for ( auto connection : sockets )
+		closesocket( connection );
+
+	server.close( );
+}
+
+int main( int argc, char** argv ) {
+	if ( argc < 2 ) {
+		std::cout << "usage: bench tls <certificate subject> [payload bytes] [round trips]" << std::endl;
+		std::cout << "       bench churn [threads] [seconds]" << std::endl;
+		std::cout << "       bench latency [endpoint] [round trips] [low latency, 0 or 1]" << std::endl;
+		std::cout << "       bench compression [payload bytes] [payloads]" << std::endl;
+		std::cout << "       bench checksum [payload bytes] [round trips]" << std::endl;
+		std::cout << "       bench idle [connections]" << std::endl;
+		return 1;
+	}
+
+	std::cout << std::fixed << std::setprecision( 2 );
+
+	try {
+		std::string mode = argv[ 1 ];
+
+		if ( mode == "tls" && argc > 2 )
+			bench_tls( argv[ 2 ], argc > 3 ? std::stoul( argv[ 3 ] ) : 4096, argc > 4 ? std::stoul( argv[ 4 ] ) : 10000 );
+		else if ( mode == "churn" )
+			bench_churn( argc > 2 ? std::stoi( argv[ 2 ] ) : 8, argc > 3 ? std::stoi( argv[ 3 ] ) : 5 );
+		else if ( mode == "latency" )
+			bench_latency( argc > 2 ? argv[ 2 ] : "tcp://127.0.0.1:27203", argc > 3 ? std::stoul( argv[ 3 ] ) : 100000, argc > 4 && std::stoi( argv[ 4 ] ) != 0 );
+		else if ( mode == "compression" )
+			bench_compression( argc > 2 ? std::stoul( argv[ 2 ] ) : 1024, argc > 3 ? std::stoul( argv[ 3 ] ) : 20000 );
+		else if ( mode == "checksum" )
+			bench_checksum( argc > 2 ? std::stoul( argv[ 2 ] ) : 16384, argc > 3 ? std::stoul( argv[ 3 ] ) : 20000 );
+		else if ( mode == "idle" )
+			bench_idle( argc > 2 ? std::stoul( argv[ 2 ] ) : 1000000 );
+		else {
+			std::cout << "bench: unknown mode or missing arguments" << std::endl;
+			return 1;
+		}
+	} catch ( const std::exception& e ) {
+		std::cout << e.what( ) << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
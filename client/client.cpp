@@ -1,6 +1,10 @@
 #include "client.h"
+#include "../transport/shm_channel.h"
+#include "../transport/memory_channel.h"
 #include <functional>
 #include <algorithm>
+#include <utility>
+#include <iterator>
 
 namespace forceinline::remote {
 	async_client::async_client( std::string_view ip, std::string_view port ) {
@@ -10,8 +14,18 @@ namespace forceinline::remote {
 		if ( port.empty( ) )
 			throw std::invalid_argument( "async_client::async_client: port argument is empty" );
 
-		m_ip = ip;
-		m_port = port;
+		m_endpoint.host = ip;
+		m_endpoint.port = port;
+	}
+
+	async_client::async_client( std::string_view endpoint ) {
+		if ( endpoint.empty( ) )
+			throw std::invalid_argument( "async_client::async_client: endpoint argument is empty" );
+
+		m_endpoint = transport::endpoint_t::parse( endpoint );
+
+		if ( ( m_endpoint.scheme == transport::scheme_t::tcp || m_endpoint.scheme == transport::scheme_t::tls ) && m_endpoint.host.empty( ) )
+			throw std::invalid_argument( "async_client::async_client: endpoint has no host" );
 	}
 
 	async_client::~async_client( ) {
@@ -20,7 +34,69 @@ namespace forceinline::remote {
 	}
 
 	void async_client::connect( ) {
-		if ( m_connected )
+		connect( INVALID_SOCKET );
+	}
+
+	std::vector< bool > async_client::connect_all( const std::vector< async_client* >& clients ) {
+	#ifdef WIN32
+		WSADATA wsa_data = { };
+		if ( WSAStartup( MAKEWORD( 2, 2 ), &wsa_data ) != 0 )
+			throw std::exception( "async_client::connect_all: WSAStartup call failed" );
+	#endif // WIN32
+
+		auto needs_socket = [ ]( async_client* client ) {
+			if ( client->m_connected || client->m_reconnecting || client->m_manual_pump )
+				return false;
+
+			return client->m_endpoint.scheme == transport::scheme_t::tcp || client->m_endpoint.scheme == transport::scheme_t::tls;
+		};
+
+		// Race the TCP connects of all clients first, they are what takes long if a host is down
+		std::vector< transport::connect_target_t > targets = { };
+		std::vector< std::size_t > target_clients = { };
+
+		for ( std::size_t i = 0; i < clients.size( ); i++ ) {
+			if ( !needs_socket( clients[ i ] ) )
+				continue;
+
+			targets.push_back( clients[ i ]->connect_target( ) );
+			target_clients.push_back( i );
+		}
+
+		auto target_sockets = transport::connect_all( targets );
+
+		std::vector< SOCKET > sockets( clients.size( ), INVALID_SOCKET );
+		for ( std::size_t i = 0; i < target_sockets.size( ); i++ )
+			sockets[ target_clients[ i ] ] = target_sockets[ i ];
+
+		// The handshakes are a few round trips each, a client which hangs in them must not hold up the others
+		std::vector< char > connected( clients.size( ), 0 );
+		std::vector< std::thread > threads = { };
+
+		for ( std::size_t i = 0; i < clients.size( ); i++ ) {
+			if ( needs_socket( clients[ i ] ) && sockets[ i ] == INVALID_SOCKET )
+				continue;
+
+			threads.emplace_back( [ & clients, & sockets, & connected, i ]( ) {
+				try {
+					clients[ i ]->connect( sockets[ i ] );
+					connected[ i ] = clients[ i ]->is_connected( );
+				} catch ( const std::exception& ) { }
+			} );
+		}
+
+		for ( auto& thread : threads )
+			thread.join( );
+
+	#ifdef WIN32
+		WSACleanup( );
+	#endif // WIN32
+
+		return std::vector< bool >( connected.begin( ), connected.end( ) );
+	}
+
+	void async_client::connect( SOCKET socket ) {
+		if ( m_connected || m_reconnecting )
 			return;
 
 	#ifdef WIN32
@@ -28,255 +104,1707 @@ namespace forceinline::remote {
 			throw std::exception( "async_client::connect: WSAStartup call failed" );
 	#endif // WIN32
 
-		struct addrinfo hints, * result;
-		ZeroMemory( &hints, sizeof( hints ) );
+		if ( m_manual_pump && m_endpoint.scheme != transport::scheme_t::memory )
+			throw std::invalid_argument( "async_client::connect: manual pumping requires a mem:// endpoint" );
 
-		hints.ai_family = AF_INET;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
+		if ( m_manual_pump && m_reconnect.enabled )
+			throw std::invalid_argument( "async_client::connect: reconnecting is not available with manual pumping" );
 
-		if ( getaddrinfo( m_ip.data( ), m_port.data( ), &hints, &result ) != 0 )
-			throw std::exception( "async_client::connect: getaddrinfo call failed" );
+		// The threads of a connection which dropped by itself (or gave up reconnecting) are done, but not joined yet
+		if ( m_reconnect_thread.joinable( ) )
+			m_reconnect_thread.join( );
 
-		// Create a socket
-		m_socket = ::socket( result->ai_family, result->ai_socktype, result->ai_protocol );
+		join_threads( );
 
-		if ( m_socket == INVALID_SOCKET )
-			throw std::exception( "async_client::connect: socket creation failed" );
+		m_receive_buffer.resize( m_buffer_size );
 
-		// Connect to the server
-		if ( ::connect( m_socket, result->ai_addr, int( result->ai_addrlen ) ) == SOCKET_ERROR )
-			throw std::exception( "async_client::connect: failed to connect to host" );
+		// Without low latency the process thread parks right away and is woken by the receive thread
+		if ( m_low_latency.enabled )
+			m_process_waiter.configure( m_low_latency.spin_count, m_low_latency.park_timeout );
+		else
+			m_process_waiter.configure( 0, std::chrono::milliseconds( 1 ) );
 
-		freeaddrinfo( result );
+		reset_connection_state( );
+		auto connection = open_connection( socket );
+
+		{
+			std::unique_lock lock( m_connection_mtx );
+			m_connection = std::move( connection );
+		}
 
 		// Mark the client as connected
 		m_connected = true;
+
+		// pump( ) does the work of our threads
+		if ( m_manual_pump )
+			return;
+
+		start_threads( );
+
+		if ( m_reconnect.enabled ) {
+			m_stopping = false;
+			m_reconnect_thread = std::thread( &async_client::supervise, this );
+		}
+	}
+
+	async_client::connection_t async_client::open_connection( SOCKET socket ) {
+		connection_t connection = { };
+		connection.id = m_connection_counter++;
+
+		// In-process servers are reached through a channel only, everything else needs a socket
+		if ( m_endpoint.scheme == transport::scheme_t::memory )
+			connection.channel = transport::memory_listener::connect( m_endpoint.path );
+		else if ( socket != INVALID_SOCKET )
+			connection.socket = socket;
+		else
+			connect_socket( connection );
+
+		try {
+			// The server tells us which shared memory mapping to use right after accepting us
+			if ( m_endpoint.scheme == transport::scheme_t::shm )
+				attach_shm_channel( connection );
+
+			// Encrypted connections finish the TLS handshake before our own
+			if ( m_endpoint.scheme == transport::scheme_t::tls )
+				attach_tls_channel( connection );
+
+			// Agree on the protocol features before sending any packets
+			if ( m_framing == packets::wire::framing_t::v2 )
+				perform_handshake( connection );
+
+			// Only plain TCP connections have a datagram channel next to them
+			if ( m_endpoint.scheme == transport::scheme_t::tcp && connection.features & packets::wire::feature_datagram )
+				open_datagram_socket( connection );
+		} catch ( const std::exception& ) {
+			close_connection( connection );
+			throw;
+		}
+
+		return connection;
+	}
+
+	void async_client::close_connection( connection_t& connection ) {
+		// Close our channel, the server notices this on its next read
+		if ( connection.channel ) {
+			connection.channel->close( );
+			connection.channel.reset( );
+		}
+
+		// Tell the server we disconnected
+		if ( connection.socket ) {
+			shutdown( connection.socket, SD_SEND );
+			closesocket( connection.socket );
+			connection.socket = NULL;
+		}
+
+		if ( connection.datagram_socket != INVALID_SOCKET ) {
+			closesocket( connection.datagram_socket );
+			connection.datagram_socket = INVALID_SOCKET;
+		}
+	}
+
+	void async_client::open_datagram_socket( connection_t& connection ) {
+		// The server's datagram channel listens on the port we are connected to
+		sockaddr_storage address = { };
+		int address_length = sizeof address;
+
+		if ( getpeername( connection.socket, reinterpret_cast< sockaddr* >( &address ), &address_length ) == SOCKET_ERROR )
+			return;
+
+		connection.datagram_socket = ::socket( address.ss_family, SOCK_DGRAM, IPPROTO_UDP );
+		if ( connection.datagram_socket == INVALID_SOCKET )
+			return;
+
+		// Lets the datagram thread see that we disconnected
+		DWORD timeout = 50;
+		setsockopt( connection.datagram_socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast< const char* >( &timeout ), sizeof timeout );
+
+		// Only sets where our datagrams go and which ones we accept, nothing is sent yet
+		if ( ::connect( connection.datagram_socket, reinterpret_cast< sockaddr* >( &address ), address_length ) == SOCKET_ERROR ) {
+			closesocket( connection.datagram_socket );
+			connection.datagram_socket = INVALID_SOCKET;
+		}
+	}
+
+	void async_client::reset_connection_state( ) {
+		{
+			std::lock_guard lock( m_outbound_mtx );
+			m_outbound_queue.clear( );
+			m_outbound_in_flight = false;
+		}
+
+		// Deltas never reach across connections
+		{
+			std::lock_guard lock( m_delta_mtx );
+			m_delta_states.clear( );
+		}
+
+		{
+			std::lock_guard lock( m_held_mtx );
+			m_held_packets.clear( );
+			m_held_bytes = 0;
+		}
+
+		// The next connection gets its own token
+		m_datagram_token = 0;
+		m_datagram_bound = false;
+		m_datagram_receiver = { };
+
+		{
+			std::lock_guard lock( m_datagram_mtx );
+			m_datagram_outbox = { };
+			m_datagram_sequences.clear( );
+			m_datagram_packets.clear( );
+		}
+
+		std::lock_guard lock( m_process_mtx );
+		m_packet_queue.clear( );
+		m_active_sink = { };
+		m_delta_bases.clear( );
+	}
+
+	void async_client::start_threads( ) {
 		m_receive_thread = std::thread( &async_client::receive, this );
 		m_process_thread = std::thread( &async_client::process_packets, this );
+		m_send_thread = std::thread( &async_client::send_frames, this );
+
+		if ( m_connection.datagram_socket != INVALID_SOCKET )
+			m_datagram_thread = std::thread( &async_client::receive_datagrams, this );
 	}
 
-	void async_client::disconnect( ) {
-		m_connected = false;
+	void async_client::join_threads( ) {
+		if ( m_send_thread.joinable( ) )
+			m_send_thread.join( );
 
-		// Wait for our threads to finish
 		if ( m_receive_thread.joinable( ) )
 			m_receive_thread.join( );
 		
 		if ( m_process_thread.joinable( ) )
 			m_process_thread.join( );
 
-		// Tell the server we disconnected
-		if ( m_socket ) {
-			shutdown( m_socket, SD_SEND );
-			closesocket( m_socket );
-			m_socket = NULL;
-		}
-		
-	#ifdef WIN32
-		WSACleanup( );
-	#endif // WIN32
+		if ( m_datagram_thread.joinable( ) )
+			m_datagram_thread.join( );
 	}
 
-	bool async_client::is_connected( ) {
-		return m_connected;
-	}
+	void async_client::connection_lost( ) {
+		// Waiting requests must see that we are reconnecting before they see that we are disconnected
+		if ( m_reconnect.enabled && !m_stopping )
+			m_reconnecting = true;
 
-	void async_client::set_packet_handler( std::uint16_t packet_id, packet_handler_client_fn handler ) {
-		if ( handler )
-			m_packet_handlers[ packet_id ] = handler;
-		else
-			m_packet_handlers.erase( packet_id );
+		{
+			std::lock_guard lock( m_reconnect_mtx );
+			m_connected = false;
+		}
+
+		// Nothing brings the connection back, coroutines don't have to wait for their timeout
+		if ( !m_reconnecting ) {
+			std::lock_guard lock( m_custom_mtx );
+			abandon_waiters( false );
+		}
+
+		// Their responses went down with the connection
+		drop_forwarded( false );
+
+		m_outbound_cv.notify_all( );
+		m_process_waiter.notify( );
+		m_reconnect_cv.notify_all( );
 	}
 
-	void async_client::send_packet( packets::packet_base::base_packet* packet ) {
-		if ( !packet )
-			return;
+	void async_client::supervise( ) {
+		// How often we check on the standby connection
+		const auto standby_interval = std::chrono::milliseconds( 100 );
 
-		send_packet_internal( packet, packet->flags( ) );
+		while ( true ) {
+			{
+				std::unique_lock lock( m_reconnect_mtx );
+				m_reconnect_cv.wait_for( lock, standby_interval, [ this ]( ) {
+					return m_stopping || !m_connected;
+				} );
+			}
+
+			if ( m_stopping )
+				return;
+
+			// Out of attempts, the next connect( ) starts over
+			if ( !m_connected && !fail_over( ) )
+				return;
+
+			if ( m_reconnect.standby )
+				maintain_standby( );
+		}
 	}
 
-	/*
-		This function is used for when you want to handle a packet response differently
-		than the standard handler, or if you want to deal with the response in the thread
-		you're calling this function from. For further clarification, see the example files.
+	bool async_client::fail_over( ) {
+		// Requests which can't be sent again will never be answered, don't let them wait for their timeout
+		{
+			std::lock_guard lock( m_custom_mtx );
+			for ( auto& [ identifier, request ] : m_in_flight_requests )
+				request.lost = !request.replay;
 
-		When using this function, it does NOT call the assigned packet id's handler but the
-		function that has been passed in the handler argument.
+			abandon_waiters( true );
+		}
 
-		timeout_seconds is the maximum time this function will wait for a response packet.
-		If a response does not arrive in time, it will return false.
-	*/
-	bool async_client::send_packet( packets::packet_base::base_packet* packet, std::function< bool( const std::vector< char >&, const std::uint8_t ) > handler, std::chrono::milliseconds timeout ) {
-		// Latest packet handler. In range of 1-127
-		std::uint8_t packet_identifier = generate_packet_identifier( );
+		// Our threads stop by themselves now that we are disconnected, a receive thread blocked in recv needs a nudge
+		if ( m_connection.socket )
+			shutdown( m_connection.socket, SD_BOTH );
 
-		// Send the packet with according flags
-		send_packet_internal( packet, packet_identifier );
-		
-		auto now = [ ]( ) {
-			return std::chrono::high_resolution_clock::now( );
-		};
+		join_threads( );
+		close_connection( m_connection );
+		reset_connection_state( );
 
-		// Wait for the packet to arrive within timeout limit		
-		auto time_sent = now( );
-		bool handler_result = false;
-		do {
-			m_custom_mtx.lock( );
+		connection_t connection = { };
+		transport::backoff delays( m_reconnect );
 
-			// See if we have a response packet queued
-			auto it = std::find_if( m_custom_process_queue.begin( ), m_custom_process_queue.end( ), [ packet_identifier ]( const custom_process_info_t& info ) {
-				return info.packet_identifier == packet_identifier;
-			} );
+		for ( std::uint32_t attempt = 0; !m_stopping; ) {
+			// The standby connection went through its handshakes already, so switching to it costs no round trip
+			if ( m_standby.socket || m_standby.channel ) {
+				if ( is_alive( m_standby ) ) {
+					connection = std::exchange( m_standby, { } );
+					break;
+				}
 
-			// Call the handler if a packet has been found
-			if ( it != m_custom_process_queue.end( ) ) {
-				handler_result = handler( it->packet_data, it->packet_identifier | 0b10000000 );
-				m_custom_process_queue.erase( it );
+				close_connection( m_standby );
+			}
+
+			// Don't let all clients of a restarted server come back at the same time
+			{
+				std::unique_lock lock( m_reconnect_mtx );
+				if ( m_reconnect_cv.wait_for( lock, delays.next( ), [ this ]( ) { return m_stopping.load( ); } ) )
+					break;
+			}
+
+			try {
+				connection = open_connection( );
+				break;
+			} catch ( const std::exception& ) { }
+
+			if ( m_reconnect.max_attempts && ++attempt >= m_reconnect.max_attempts )
 				break;
+		}
+
+		if ( m_stopping || ( !connection.socket && !connection.channel ) ) {
+			close_connection( connection );
+
+			// Whoever is still waiting for a response can stop now
+			{
+				std::lock_guard lock( m_custom_mtx );
+				for ( auto& [ identifier, request ] : m_in_flight_requests )
+					request.lost = true;
+
+				abandon_waiters( false );
 			}
-			
-			m_custom_mtx.unlock( );
-			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-		} while ( std::chrono::duration_cast< std::chrono::milliseconds >( now( ) - time_sent ) <= timeout );
 
-		m_custom_mtx.unlock( );
-		remove_packet_identifier( packet_identifier );
-		return handler_result;
-	}
+			{
+				std::lock_guard lock( m_held_mtx );
+				m_held_packets.clear( );
+				m_held_bytes = 0;
+			}
 
-	void async_client::send_packet_internal( packets::packet_base::base_packet* packet, std::uint8_t packet_flags ) {
-		// Return if our packet is invalid
-		if ( !packet )
-			return;
+			m_reconnecting = false;
+			return false;
+		}
 
-		packet_header_t header( packet );
+		{
+			// Nobody builds frames while we switch, and frames built for the old connection may not fit the new one
+			std::unique_lock connection_lock( m_connection_mtx );
 
-		// Set the packet flags if they don't match
-		if ( packet->flags( ) != packet_flags )
-			header.packet_flags = packet_flags;
+			{
+				std::lock_guard lock( m_outbound_mtx );
+				m_outbound_queue.clear( );
+			}
 
-		// Allocate a buffer into which we copy our packet data
-		std::vector< char > packet_buffer( sizeof packet_header_t + header.packet_size );
+			m_connection = std::move( connection );
 
-		// Copy the header and packet data into the buffer
-		memcpy( packet_buffer.data( ), &header, sizeof packet_header_t );
-		memcpy( packet_buffer.data( ) + sizeof packet_header_t, packet->data( ), header.packet_size );
+			// A standby connection may have been sent something already, the process thread starts with it
+			if ( !m_connection.pending.empty( ) ) {
+				std::lock_guard lock( m_process_mtx );
+				m_packet_queue = std::move( m_connection.pending );
+				m_connection.pending.clear( );
+				m_process_waiter.notify( );
+			}
 
-		// Lock the send function for other threads until we're done
-		std::lock_guard lock( m_send_mtx );
+			// The server forgot about our subscriptions along with the old connection
+			for ( auto& topic : subscribed_topics( ) ) {
+				auto packet = packets::topic_packet< packets::subscribe_packet_id >( topic );
+				queue_packet( packets::wire::frame_header_t( &packet ), packet.data( ) );
+			}
 
-		// Try to send our buffer
-		std::size_t bytes_sent = 0, total_bytes_sent = 0;
-		do {
-			bytes_sent = send( m_socket, packet_buffer.data( ) + total_bytes_sent, packet_buffer.size( ) - total_bytes_sent, NULL );
-			total_bytes_sent += bytes_sent;
-		} while ( bytes_sent > 0 && total_bytes_sent < packet_buffer.size( ) );
+			// Send the requests which are still waiting for their response again
+			std::unordered_set< std::uint8_t > replayed = { };
+			{
+				std::lock_guard lock( m_custom_mtx );
+				for ( auto& [ identifier, request ] : m_in_flight_requests ) {
+					if ( !request.replay )
+						continue;
 
-		// An error occurred, disconnect from server
-		if ( bytes_sent <= 0 )
-			m_connected = false;
-	}
+					enqueue_frame( priority_of( request.header.packet_id ), build_frame( request.header, request.data.data( ) ) );
+					replayed.insert( identifier );
+				}
+			}
 
-	void async_client::receive( ) {
-		// Create a temporary buffer
-		std::vector< char > temporary_buffer = std::vector< char >( m_buffer_size );
+			// Then what was sent while we reconnected, encoded for this connection. Replayed requests went out already
+			{
+				std::lock_guard lock( m_held_mtx );
+				for ( auto& [ header, data ] : m_held_packets ) {
+					if ( !replayed.count( header.packet_flags & 0x7F ) )
+						queue_packet( header, data.data( ) );
+				}
 
-		// Loop and receive
-		do {
-			// Check how many bytes we have received
-			int bytes_received = recv( m_socket, temporary_buffer.data( ), m_buffer_size, NULL );
+				m_held_packets.clear( );
+				m_held_bytes = 0;
+			}
 
-			// An error occurred, break out and disconnect
-			if ( bytes_received <= 0 )
-				break;
+			m_connected = true;
+		}
+
+		start_threads( );
+		m_reconnecting = false;
 
-			// Lock the process mutex
-			std::lock_guard lock( m_process_mtx );
+		return true;
+	}
 
-			// Copy the received bytes into our queue
-			m_packet_queue.insert( m_packet_queue.end( ), temporary_buffer.data( ), temporary_buffer.data( ) + bytes_received );
+	void async_client::maintain_standby( ) {
+		if ( m_standby.socket || m_standby.channel ) {
+			if ( is_alive( m_standby ) )
+				return;
 
-		} while ( m_connected );
+			close_connection( m_standby );
+		}
 
-		// Clear the temporary buffer and disconnect
-		temporary_buffer.clear( );
-		m_connected = false;
+		try {
+			m_standby = open_connection( );
+		} catch ( const std::exception& ) { }
 	}
 
-	void async_client::process_packets( ) {
-		while ( m_connected ) {
-			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-			std::lock_guard lock( m_process_mtx );
+	bool async_client::is_alive( connection_t& connection ) {
+		// The server only sends control frames on a connection we don't use, anything more and we start over with a new one
+		const std::size_t max_pending = 64 * 1024;
 
-			// Check if we have at least a packet header stored
-			if ( m_packet_queue.size( ) < sizeof packet_header_t )
-				continue;
+		std::vector< char > buffer( m_buffer_size );
 
-			// We have something to process, get the information about our packet
-			auto header = *reinterpret_cast< packet_header_t* >( m_packet_queue.data( ) );
+		while ( connection.pending.size( ) < max_pending ) {
+			int received = 0;
 
-			// Add the first 4 bytes to our packet size
-			std::uint16_t total_packet_size = sizeof packet_header_t + header.packet_size;
+			if ( connection.channel )
+				received = connection.channel->read( buffer.data( ), int( buffer.size( ) ) );
+			else {
+				WSAPOLLFD poll_fd = { connection.socket, POLLRDNORM, 0 };
+				auto ready = WSAPoll( &poll_fd, 1, 0 );
 
-			// Do we have a whole packet stored?
-			if ( m_packet_queue.size( ) < total_packet_size )
-				continue;
+				if ( ready == 0 )
+					return true;
 
-			// Does our packet have a handler?
-			if ( m_packet_handlers.find( header.packet_id ) != m_packet_handlers.end( ) || header.packet_flags & 0b10000000 /* Custom handler */ ) {
-				// Erase the packet header but keep the flags
-				m_packet_queue.erase( m_packet_queue.begin( ), m_packet_queue.begin( ) + sizeof packet_header_t );
+				received = ready > 0 ? recv( connection.socket, buffer.data( ), int( buffer.size( ) ), NULL ) : -1;
 
-				// Add the packet to custom processing queue if marked as one
-				if ( header.packet_flags & 0b10000000 ) {
-					// Create an info structure
-					custom_process_info_t info( header.packet_flags & 0x7F /* Extract the packet identifier */ );
-					
-					// Copy the packet buffer
-					info.packet_data = std::vector< char >( m_packet_queue.begin( ), m_packet_queue.begin( ) + header.packet_size );
+				// Readable without data is the server closing it
+				if ( received == 0 )
+					return false;
+			}
 
-					m_custom_mtx.lock( );
+			if ( received < 0 )
+				return false;
 
-					// Add it to the queue
-					m_custom_process_queue.push_back( info );
+			if ( received == 0 )
+				return true;
 
-					m_custom_mtx.unlock( );
-				} else {
-					if ( header.packet_flags & 0x7F )
-						header.packet_flags |= 0b10000000;
+			connection.pending.insert( connection.pending.end( ), buffer.data( ), buffer.data( ) + received );
+		}
 
-					// Call the packet handler
-					m_packet_handlers[ header.packet_id ]( this, m_packet_queue, header.packet_flags );
-				}
+		return false;
+	}
 
-				// Remove the packet from our queue
-				m_packet_queue.erase( m_packet_queue.begin( ), m_packet_queue.begin( ) + header.packet_size );
-			} else {
-				// Packet is invalid/has no handler, erase it
-				m_packet_queue.erase( m_packet_queue.begin( ), m_packet_queue.begin( ) + total_packet_size );
-			}
+	void async_client::disconnect( ) {
+		// Stop reconnecting first, it would bring the connection right back
+		{
+			std::lock_guard lock( m_reconnect_mtx );
+			m_stopping = true;
 		}
+
+		m_reconnect_cv.notify_all( );
+
+		if ( m_reconnect_thread.joinable( ) )
+			m_reconnect_thread.join( );
+
+		m_reconnecting = false;
+
+		// Give queued packets a chance to go out
+		if ( m_connected )
+			flush( std::chrono::milliseconds( 250 ) );
+
+		m_connected = false;
+		m_outbound_cv.notify_all( );
+		m_process_waiter.notify( );
+
+		{
+			std::lock_guard lock( m_custom_mtx );
+			abandon_waiters( false );
+		}
+
+		drop_forwarded( false );
+
+		// A receive thread blocked in recv would never see that we are disconnected
+		if ( m_connection.socket && !m_connection.channel )
+			shutdown( m_connection.socket, SD_BOTH );
+
+		// Wait for our threads to finish
+		join_threads( );
+
+		// Drop whatever did not make it out
+		m_outbound_queue.clear( );
+
+		close_connection( m_connection );
+		close_connection( m_standby );
+		
+	#ifdef WIN32
+		WSACleanup( );
+	#endif // WIN32
 	}
 
-	std::uint8_t async_client::generate_packet_identifier( ) {
-		// TODO: Don't assign packet identifiers if next one would be 1
+	bool async_client::is_connected( ) {
+		return m_connected;
+	}
 
-		if ( m_packet_identifiers.size( ) > 0 ) { 
-			std::uint8_t last_identifier = m_packet_identifiers.back( );
-			std::uint8_t next_identifier = ( ++last_identifier % 127 ) + 1; // 1-127
-			m_packet_identifiers.push_back( next_identifier );
-			
-			return next_identifier;
-		} else {
-			m_packet_identifiers.push_back( 1 );
-			return 1;
+	void async_client::set_packet_handler( std::uint16_t packet_id, packet_handler_client_fn handler, packets::packet_priority priority ) {
+		if ( handler ) {
+			m_packet_handlers[ packet_id ] = handler;
+			set_packet_priority( packet_id, priority );
+		} else
+			m_packet_handlers.erase( packet_id );
+	}
+
+	void async_client::set_batch_handler( std::uint16_t packet_id, batch_handler_client_fn handler, packets::packet_priority priority ) {
+		if ( handler ) {
+			m_batch_handlers[ packet_id ] = handler;
+			set_packet_priority( packet_id, priority );
+		} else
+			m_batch_handlers.erase( packet_id );
+	}
+
+	void async_client::set_packet_priority( std::uint16_t packet_id, packets::packet_priority priority ) {
+		if ( priority != packets::packet_priority::normal )
+			m_packet_priorities[ packet_id ] = priority;
+		else
+			m_packet_priorities.erase( packet_id );
+	}
+
+	bool async_client::flush( std::chrono::milliseconds timeout ) {
+		// Without a send thread we have to send everything ourselves
+		if ( m_manual_pump ) {
+			while ( m_connected && send_once( ) ) { }
+			return true;
 		}
+
+		std::unique_lock lock( m_outbound_mtx );
+
+		return m_outbound_cv.wait_for( lock, timeout, [ this ]( ) {
+			return ( m_outbound_queue.empty( ) && !m_outbound_in_flight ) || !m_connected;
+		} );
 	}
 
-	void async_client::remove_packet_identifier( std::uint8_t identifier ) {
-		m_packet_identifiers.erase( std::remove_if( m_packet_identifiers.begin( ), m_packet_identifiers.end( ), [ identifier ]( std::uint8_t id ) {
-			return id == identifier;
-		} ) );
+	void async_client::set_legacy_framing( bool legacy ) {
+		m_framing = legacy ? packets::wire::framing_t::legacy : packets::wire::framing_t::v2;
+	}
+
+	void async_client::set_features( std::uint32_t features ) {
+		m_features = features;
+	}
+
+	std::uint32_t async_client::features( ) {
+		std::shared_lock lock( m_connection_mtx );
+		return m_connection.features;
+	}
+
+	void async_client::set_compression( std::uint32_t threshold ) {
+		m_compression_threshold = threshold;
+	}
+
+	void async_client::set_max_decompressed_size( std::uint32_t size ) {
+		m_max_decompressed_size = size;
+	}
+
+	void async_client::set_compression_dictionary( std::uint16_t packet_id, const std::vector< char >& dictionary ) {
+		if ( !dictionary.empty( ) )
+			m_compression_dictionaries[ packet_id ] = dictionary;
+		else
+			m_compression_dictionaries.erase( packet_id );
+	}
+
+	void async_client::set_blob_sink( std::uint16_t packet_id, HANDLE file ) {
+		std::lock_guard lock( m_process_mtx );
+
+		if ( file && file != INVALID_HANDLE_VALUE )
+			m_blob_sinks[ packet_id ] = file;
+		else
+			m_blob_sinks.erase( packet_id );
+	}
+
+	void async_client::subscribe( std::string_view topic ) {
+		{
+			std::lock_guard lock( m_topic_mtx );
+			m_topics.emplace( topic );
+		}
+
+		auto packet = packets::topic_packet< packets::subscribe_packet_id >( topic );
+		send_packet( &packet );
+	}
+
+	void async_client::unsubscribe( std::string_view topic ) {
+		{
+			std::lock_guard lock( m_topic_mtx );
+			m_topics.erase( std::string( topic ) );
+		}
+
+		auto packet = packets::topic_packet< packets::unsubscribe_packet_id >( topic );
+		send_packet( &packet );
+	}
+
+	std::vector< std::string > async_client::subscribed_topics( ) {
+		std::lock_guard lock( m_topic_mtx );
+		return std::vector< std::string >( m_topics.begin( ), m_topics.end( ) );
+	}
+
+	void async_client::set_reconnect_policy( const transport::reconnect_policy_t& policy ) {
+		if ( m_connected || m_reconnecting )
+			throw std::exception( "async_client::set_reconnect_policy: already connected" );
+
+		m_reconnect = policy;
+	}
+
+	void async_client::set_idempotent( std::uint16_t packet_id, bool idempotent ) {
+		std::lock_guard lock( m_custom_mtx );
+
+		if ( idempotent )
+			m_idempotent_packets.insert( packet_id );
+		else
+			m_idempotent_packets.erase( packet_id );
+	}
+
+	void async_client::start_capture( const std::string& path ) {
+		auto capture = std::make_shared< diagnostics::capture_writer >( path, diagnostics::capture_role::client );
+
+		std::lock_guard lock( m_capture_mtx );
+		m_capture = std::move( capture );
+		m_capturing = true;
+	}
+
+	void async_client::stop_capture( ) {
+		std::shared_ptr< diagnostics::capture_writer > capture = nullptr;
+
+		{
+			std::lock_guard lock( m_capture_mtx );
+			capture.swap( m_capture );
+			m_capturing = false;
+		}
+
+		// The writer flushes the file once the last reference is gone
+	}
+
+	void async_client::capture( std::uint32_t connection_id, diagnostics::capture_direction direction, const char* data, std::size_t length ) {
+		if ( !m_capturing.load( std::memory_order_relaxed ) )
+			return;
+
+		std::shared_ptr< diagnostics::capture_writer > capture = nullptr;
+
+		{
+			std::lock_guard lock( m_capture_mtx );
+			capture = m_capture;
+		}
+
+		if ( capture )
+			capture->record( connection_id, direction, data, length );
+	}
+
+	void async_client::set_low_latency( const transport::low_latency_config_t& config ) {
+		if ( m_connected )
+			throw std::exception( "async_client::set_low_latency: already connected" );
+
+		m_low_latency = config;
+	}
+
+	void async_client::set_connect_options( const transport::connect_options_t& options ) {
+		if ( m_connected || m_reconnecting )
+			throw std::exception( "async_client::set_connect_options: already connected" );
+
+		m_connect_options = options;
+	}
+
+	void async_client::set_tls_options( const transport::tls_options_t& options ) {
+		if ( m_connected )
+			throw std::exception( "async_client::set_tls_options: already connected" );
+
+		m_tls_options = options;
+	}
+
+	void async_client::set_manual_pump( bool manual ) {
+		if ( m_connected )
+			throw std::exception( "async_client::set_manual_pump: already connected" );
+
+		m_manual_pump = manual;
+	}
+
+	void async_client::pump( ) {
+		if ( !m_manual_pump || !m_connected )
+			return;
+
+		// Take everything that is queued, without waiting for more
+		while ( m_connected ) {
+			auto received = receive_once( false );
+
+			if ( received < 0 ) {
+				connection_lost( );
+				return;
+			}
+
+			if ( received == 0 )
+				break;
+		}
+
+		if ( !process_once( ) ) {
+			connection_lost( );
+			return;
+		}
+
+		while ( m_connected && send_once( ) ) { }
+	}
+
+	void async_client::set_delta_encoding( std::uint16_t packet_id, std::uint32_t keyframe_interval ) {
+		if ( m_connected )
+			throw std::exception( "async_client::set_delta_encoding: already connected" );
+
+		if ( keyframe_interval )
+			m_delta_packets[ packet_id ] = keyframe_interval;
+		else
+			m_delta_packets.erase( packet_id );
+	}
+
+	void async_client::set_unreliable( std::uint16_t packet_id, bool unreliable ) {
+		if ( m_connected )
+			throw std::exception( "async_client::set_unreliable: already connected" );
+
+		if ( unreliable )
+			m_unreliable_packets.insert( packet_id );
+		else
+			m_unreliable_packets.erase( packet_id );
+	}
+
+	void async_client::send_packet( packets::packet_base::base_packet* packet ) {
+		if ( !packet )
+			return;
+
+		send_packet_internal( packet, packet->flags( ) );
+	}
+
+	/*
+		This function is used for when you want to handle a packet response differently
+		than the standard handler, or if you want to deal with the response in the thread
+		you're calling this function from. For further clarification, see the example files.
+
+		When using this function, it does NOT call the assigned packet id's handler but the
+		function that has been passed in the handler argument.
+
+		timeout_seconds is the maximum time this function will wait for a response packet.
+		If a response does not arrive in time, it will return false.
+	*/
+	bool async_client::send_packet( packets::packet_base::base_packet* packet, std::function< bool( const std::vector< char >&, const std::uint8_t ) > handler, std::chrono::milliseconds timeout ) {
+		// Latest packet handler. In range of 1-127
+		std::uint8_t packet_identifier = generate_packet_identifier( );
+
+		// Too many requests are waiting for their response already
+		if ( !packet_identifier )
+			return false;
+
+		// Remember the request, so a reconnect can send it again or tell us that it is lost
+		if ( m_reconnect.enabled && packet ) {
+			std::lock_guard lock( m_custom_mtx );
+
+			in_flight_request_t request = { };
+			request.header = packets::wire::frame_header_t( packet );
+			request.header.packet_flags = packet_identifier;
+			request.replay = m_idempotent_packets.count( request.header.packet_id ) != 0;
+
+			if ( request.replay )
+				request.data.assign( packet->data( ), packet->data( ) + request.header.packet_size );
+
+			m_in_flight_requests[ packet_identifier ] = std::move( request );
+		}
+
+		// Send the packet with according flags
+		send_packet_internal( packet, packet_identifier );
+		
+		auto now = [ ]( ) {
+			return std::chrono::high_resolution_clock::now( );
+		};
+
+		// Wait for the packet to arrive within timeout limit		
+		auto time_sent = now( );
+		bool handler_result = false;
+		do {
+			m_custom_mtx.lock( );
+
+			// See if we have a response packet queued
+			auto it = std::find_if( m_custom_process_queue.begin( ), m_custom_process_queue.end( ), [ packet_identifier ]( const custom_process_info_t& info ) {
+				return info.packet_identifier == packet_identifier;
+			} );
+
+			// Call the handler if a packet has been found
+			if ( it != m_custom_process_queue.end( ) ) {
+				handler_result = handler( it->packet_data, it->packet_identifier | 0b10000000 );
+				m_custom_process_queue.erase( it );
+				break;
+			}
+
+			// The response can't arrive anymore, there is no point in waiting for the timeout
+			auto request_it = m_in_flight_requests.find( packet_identifier );
+			if ( ( request_it != m_in_flight_requests.end( ) && request_it->second.lost ) || ( !m_connected && !m_reconnecting ) )
+				break;
+
+			// Out of time, every way out of the loop keeps the lock
+			if ( std::chrono::duration_cast< std::chrono::milliseconds >( now( ) - time_sent ) > timeout )
+				break;
+			
+			m_custom_mtx.unlock( );
+
+			// Nobody else is going to receive the response, send our packet and let the server answer it
+			if ( m_manual_pump && m_connected ) {
+				pump( );
+				m_connection.channel->wait_readable( std::chrono::milliseconds( 1 ) );
+				pump( );
+			} else
+				std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		} while ( true );
+
+		m_in_flight_requests.erase( packet_identifier );
+		m_custom_mtx.unlock( );
+		remove_packet_identifier( packet_identifier );
+		return handler_result;
+	}
+
+	async_client::request_awaiter async_client::request( packets::packet_base::base_packet* packet, std::chrono::milliseconds timeout ) {
+		return request_awaiter( this, packet, timeout );
+	}
+
+	bool async_client::request_awaiter::await_suspend( coro::task::handle_t handle ) {
+		if ( !m_packet || ( !m_client->m_connected && !m_client->m_reconnecting ) )
+			return false;
+
+		m_identifier = m_client->generate_packet_identifier( );
+
+		// Don't suspend at all, the response is empty
+		if ( !m_identifier )
+			return false;
+
+		auto& promise = handle.promise( );
+		m_waiter = promise.loop->make_waiter( promise.id );
+
+		// Register before sending, the response may arrive before we get to the timer
+		{
+			std::lock_guard lock( m_client->m_custom_mtx );
+			m_client->m_waiters[ m_identifier ] = m_waiter;
+
+			// Remember the request, so a reconnect can send it again or tell us that it is lost
+			if ( m_client->m_reconnect.enabled ) {
+				in_flight_request_t request = { };
+				request.header = packets::wire::frame_header_t( m_packet );
+				request.header.packet_flags = m_identifier;
+				request.replay = m_client->m_idempotent_packets.count( request.header.packet_id ) != 0;
+
+				if ( request.replay )
+					request.data.assign( m_packet->data( ), m_packet->data( ) + request.header.packet_size );
+
+				m_client->m_in_flight_requests[ m_identifier ] = std::move( request );
+			}
+		}
+
+		m_client->send_packet_internal( m_packet, m_identifier );
+		promise.loop->add_timer( coro::event_loop::clock::now( ) + m_timeout, m_waiter );
+
+		return true;
+	}
+
+	std::optional< std::vector< char > > async_client::request_awaiter::await_resume( ) {
+		if ( !m_identifier )
+			return std::nullopt;
+
+		{
+			std::lock_guard lock( m_client->m_custom_mtx );
+			m_client->m_waiters.erase( m_identifier );
+			m_client->m_in_flight_requests.erase( m_identifier );
+		}
+
+		m_client->remove_packet_identifier( m_identifier );
+		return std::move( m_waiter->response );
+	}
+
+	void async_client::set_forward_sink( forward_sink_fn sink ) {
+		if ( m_connected )
+			throw std::exception( "async_client::set_forward_sink: already connected" );
+
+		m_forward_sink = std::move( sink );
+	}
+
+	bool async_client::forward_frame( packets::wire::frame_header_t header, const char* data, std::uint64_t tag, std::chrono::milliseconds timeout ) {
+		if ( !m_connected || ( tag && !m_forward_sink ) )
+			return false;
+
+		// The frame is built for the connection we have now
+		std::shared_lock connection_lock( m_connection_mtx );
+
+		auto max_packet_size = m_connection.features & packets::wire::feature_large_frames ? packets::wire::max_large_packet_size : packets::wire::max_packet_size;
+		if ( header.packet_size > max_packet_size )
+			return false;
+
+		// Requests which were never answered give their identifier back
+		drop_forwarded( true );
+
+		if ( tag ) {
+			header.packet_flags = generate_packet_identifier( );
+
+			if ( !header.packet_flags )
+				return false;
+
+			// Registered before sending, the response may arrive right away
+			std::lock_guard lock( m_custom_mtx );
+			m_forwarded_requests[ header.packet_flags ] = { tag, std::chrono::steady_clock::now( ) + timeout };
+		}
+
+		// The data is copied once, straight into the frame
+		enqueue_frame( priority_of( header.packet_id ), build_frame( header, data ) );
+		return true;
+	}
+
+	bool async_client::forward_response( const packets::wire::frame_header_t& header, const char* data ) {
+		std::uint8_t identifier = header.packet_flags & 0x7F;
+		std::uint64_t tag = 0;
+
+		{
+			std::lock_guard lock( m_custom_mtx );
+
+			auto request_it = m_forwarded_requests.find( identifier );
+			if ( request_it == m_forwarded_requests.end( ) )
+				return false;
+
+			tag = request_it->second.tag;
+			m_forwarded_requests.erase( request_it );
+		}
+
+		remove_packet_identifier( identifier );
+		m_forward_sink( tag, &header, data );
+
+		return true;
+	}
+
+	void async_client::drop_forwarded( bool expired_only ) {
+		std::vector< std::uint64_t > tags = { };
+		{
+			std::lock_guard lock( m_custom_mtx );
+
+			auto now = std::chrono::steady_clock::now( );
+			for ( auto request_it = m_forwarded_requests.begin( ); request_it != m_forwarded_requests.end( ); ) {
+				if ( expired_only && request_it->second.deadline > now ) {
+					request_it++;
+					continue;
+				}
+
+				auto identifier = request_it->first;
+				m_packet_identifiers.erase( std::remove( m_packet_identifiers.begin( ), m_packet_identifiers.end( ), identifier ), m_packet_identifiers.end( ) );
+
+				tags.push_back( request_it->second.tag );
+				request_it = m_forwarded_requests.erase( request_it );
+			}
+		}
+
+		// Outside of our lock, the sink takes locks of its own
+		for ( auto tag : tags )
+			m_forward_sink( tag, nullptr, nullptr );
+	}
+
+	void async_client::send_packet_internal( packets::packet_base::base_packet* packet, std::uint8_t packet_flags ) {
+		// Return if our packet is invalid
+		if ( !packet )
+			return;
+
+		packets::wire::frame_header_t header( packet );
+
+		// Set the packet flags if they don't match
+		if ( packet->flags( ) != packet_flags )
+			header.packet_flags = packet_flags;
+
+		std::shared_lock lock( m_connection_mtx );
+
+		// The next connection may negotiate other features, so its frames are only built once we know them
+		if ( !m_connected && m_reconnecting ) {
+			std::lock_guard held_lock( m_held_mtx );
+
+			if ( m_held_bytes + header.packet_size <= m_max_held_bytes ) {
+				m_held_packets.emplace_back( header, std::vector< char >( packet->data( ), packet->data( ) + header.packet_size ) );
+				m_held_bytes += header.packet_size;
+			}
+
+			return;
+		}
+
+		queue_packet( header, packet->data( ) );
+	}
+
+	void async_client::queue_packet( packets::wire::frame_header_t header, const char* data ) {
+		// Latest-state packets take the datagram channel once it is bound, requests always need TCP
+		if ( m_datagram_bound && !( header.packet_flags & 0x7F ) && header.packet_size <= packets::datagram::max_packet_size && m_unreliable_packets.count( header.packet_id ) ) {
+			std::lock_guard lock( m_datagram_mtx );
+			m_datagram_outbox.append( m_datagram_token, ++m_datagram_sequences[ header.packet_id ], header, data );
+			return;
+		}
+
+		// Deltas have to be queued in the order they were encoded in, so we keep the lock until then
+		auto delta_it = m_delta_packets.find( header.packet_id );
+		if ( delta_it != m_delta_packets.end( ) && m_connection.features & packets::wire::feature_delta && header.packet_size < packets::wire::max_packet_size ) {
+			std::lock_guard lock( m_delta_mtx );
+
+			std::vector< char > encoded = { };
+			packets::delta::encode( m_delta_states[ header.packet_id ], data, header.packet_size, delta_it->second, encoded );
+
+			header.frame_flags |= packets::wire::frame_flag_delta;
+			header.packet_size = std::uint32_t( encoded.size( ) );
+
+			enqueue_frame( priority_of( header.packet_id ), build_frame( header, encoded.data( ) ) );
+			return;
+		}
+
+		// Queue the packet in its priority lane, the send thread takes it from there
+		enqueue_frame( priority_of( header.packet_id ), build_frame( header, data ) );
+	}
+
+	std::vector< char > async_client::build_frame( const packets::wire::frame_header_t& packet_header, const char* data ) {
+		auto header = packet_header;
+
+		// Compress the packet data if it is worth it and the server can decompress it. Forwarded frames may be compressed already
+		std::vector< char > compressed_data = { };
+		if ( m_connection.features & packets::wire::feature_compression && header.packet_size >= m_compression_threshold && !( header.frame_flags & packets::wire::frame_flag_compressed ) ) {
+			auto dictionary_it = m_compression_dictionaries.find( header.packet_id );
+			auto dictionary = dictionary_it != m_compression_dictionaries.end( ) ? &dictionary_it->second : nullptr;
+
+			if ( packets::compression::compress_payload( data, header.packet_size, dictionary, compressed_data ) ) {
+				header.frame_flags |= packets::wire::frame_flag_compressed;
+				header.packet_size = std::uint32_t( compressed_data.size( ) );
+				data = compressed_data.data( );
+			}
+		}
+
+		// Allocate a buffer into which we copy our packet data
+		std::vector< char > packet_buffer( packets::wire::max_header_size + header.packet_size + packets::checksum::checksum_size );
+
+		// Copy the header and packet data into the buffer
+		auto header_length = packets::wire::encode_header( m_framing, header, packet_buffer.data( ) );
+		memcpy( packet_buffer.data( ) + header_length, data, header.packet_size );
+
+		packet_buffer.resize( header_length + header.packet_size );
+
+		if ( m_connection.features & packets::wire::feature_checksum )
+			packets::checksum::append_checksum( packet_buffer );
+
+		return packet_buffer;
+	}
+
+	bool async_client::send_raw( const connection_t& connection, const char* data, std::size_t length ) {
+		capture( connection.id, diagnostics::capture_direction::sent, data, length );
+
+		// Try to send our buffer
+		int bytes_sent = 0;
+		std::size_t total_bytes_sent = 0;
+		do {
+			if ( connection.channel )
+				bytes_sent = connection.channel->write( data + total_bytes_sent, int( length - total_bytes_sent ) );
+			else
+				bytes_sent = send( connection.socket, data + total_bytes_sent, int( length - total_bytes_sent ), NULL );
+
+			if ( bytes_sent > 0 )
+				total_bytes_sent += bytes_sent;
+		} while ( bytes_sent > 0 && total_bytes_sent < length );
+
+		return total_bytes_sent == length;
+	}
+
+	bool async_client::read_exact( const connection_t& connection, char* buffer, int length, std::chrono::milliseconds timeout ) {
+		auto deadline = std::chrono::steady_clock::now( ) + timeout;
+
+		// Sockets time out by themselves, restore the default afterwards
+		if ( !connection.channel ) {
+			DWORD timeout_ms = DWORD( timeout.count( ) );
+			setsockopt( connection.socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast< const char* >( &timeout_ms ), sizeof timeout_ms );
+		}
+
+		int received = 0;
+		while ( received < length && std::chrono::steady_clock::now( ) < deadline ) {
+			int bytes_received = 0;
+
+			if ( connection.channel ) {
+				connection.channel->wait_readable( std::chrono::milliseconds( 1 ) );
+				bytes_received = connection.channel->read( buffer + received, length - received );
+			} else
+				bytes_received = recv( connection.socket, buffer + received, length - received, NULL );
+
+			if ( bytes_received < 0 || ( bytes_received == 0 && !connection.channel ) )
+				break;
+
+			received += bytes_received;
+		}
+
+		if ( !connection.channel ) {
+			DWORD no_timeout = 0;
+			setsockopt( connection.socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast< const char* >( &no_timeout ), sizeof no_timeout );
+		}
+
+		return received == length;
+	}
+
+	void async_client::perform_handshake( connection_t& connection ) {
+		char handshake[ packets::wire::handshake_size ] = { };
+		packets::wire::encode_handshake( { packets::wire::protocol_version, m_features }, handshake );
+
+		if ( !send_raw( connection, handshake, sizeof handshake ) )
+			throw std::exception( "async_client::connect: failed to send handshake" );
+
+		// Legacy servers never answer, they would wait for the rest of a packet that isn't one
+		char acknowledgement[ packets::wire::handshake_size ] = { };
+		if ( !read_exact( connection, acknowledgement, sizeof acknowledgement, m_handshake_timeout ) )
+			throw std::exception( "async_client::connect: no handshake response, server might only speak the legacy framing" );
+
+		packets::wire::handshake_t response = { };
+		if ( packets::wire::decode_handshake( acknowledgement, sizeof acknowledgement, response ) <= 0 || response.version != packets::wire::protocol_version )
+			throw std::exception( "async_client::connect: invalid handshake response" );
+
+		// The server can only take away features, never add them
+		connection.features = response.features & m_features;
+	}
+
+	void async_client::receive( ) {
+		transport::pin_current_thread( m_low_latency, 0 );
+
+		// Loop and receive, an error means we are disconnected
+		while ( m_connected && receive_once( true ) >= 0 ) { }
+
+		connection_lost( );
+	}
+
+	int async_client::receive_once( bool wait ) {
+		int bytes_received = 0;
+
+		if ( m_connection.channel ) {
+			// Wait for the channel so we can still notice a disconnect
+			if ( wait && !m_connection.channel->wait_readable( std::chrono::milliseconds( 1 ) ) )
+				return 0;
+
+			bytes_received = m_connection.channel->read( m_receive_buffer.data( ), m_buffer_size );
+
+			// Woken up without data
+			if ( bytes_received == 0 )
+				return 0;
+		} else {
+			// Busy-poll the socket for a while before we block in recv
+			if ( m_low_latency.enabled ) {
+				unsigned long queued_bytes = 0;
+
+				for ( std::uint32_t spins = 0; spins < m_low_latency.spin_count && queued_bytes == 0; spins++ )
+					ioctlsocket( m_connection.socket, FIONREAD, &queued_bytes );
+			}
+
+			// Check how many bytes we have received
+			bytes_received = recv( m_connection.socket, m_receive_buffer.data( ), m_buffer_size, NULL );
+		}
+
+		// An error occurred, disconnect
+		if ( bytes_received <= 0 )
+			return -1;
+
+		capture( m_connection.id, diagnostics::capture_direction::received, m_receive_buffer.data( ), bytes_received );
+
+		// Lock the process mutex
+		std::lock_guard lock( m_process_mtx );
+
+		const char* received_data = m_receive_buffer.data( );
+		std::size_t received_length = bytes_received;
+
+		// A blob is being streamed into a file, its data never touches our queue
+		if ( m_active_sink.remaining > 0 ) {
+			auto to_write = std::size_t( std::min< std::uint64_t >( received_length, m_active_sink.remaining ) );
+
+			if ( !write_to_sink( m_active_sink.file, received_data, to_write ) )
+				return -1;
+
+			if ( m_active_sink.checksummed )
+				m_active_sink.checksum = packets::checksum::crc32c( received_data, to_write, m_active_sink.checksum );
+
+			m_active_sink.remaining -= to_write;
+			m_active_sink.finished = m_active_sink.remaining == 0;
+
+			received_data += to_write;
+			received_length -= to_write;
+		}
+
+		// Copy the received bytes into our queue
+		m_packet_queue.insert( m_packet_queue.end( ), received_data, received_data + received_length );
+		m_process_waiter.notify( );
+
+		return bytes_received;
+	}
+
+	void async_client::process_packets( ) {
+		transport::pin_current_thread( m_low_latency, 1 );
+
+		while ( m_connected ) {
+			// Spins or parks until the receive thread has new data for us
+			m_process_waiter.wait( );
+
+			if ( !process_once( ) ) {
+				connection_lost( );
+				break;
+			}
+		}
+	}
+
+	bool async_client::process_once( ) {
+		std::lock_guard lock( m_process_mtx );
+
+		// Take every complete packet out of our receive buffer
+		if ( !extract_packets( m_ready_packets ) )
+			return false;
+
+		// Packets which arrived over the datagram channel are dispatched alongside them
+		{
+			std::lock_guard datagram_lock( m_datagram_mtx );
+
+			for ( auto& packet : m_datagram_packets ) {
+				if ( m_batch_handlers.find( packet.header.packet_id ) != m_batch_handlers.end( ) ) {
+					packet.batched = true;
+					packet.batch.add( packet.data.data( ), packet.data.size( ), packet.header.packet_flags );
+					packet.data.clear( );
+				}
+
+				m_ready_packets[ std::size_t( priority_of( packet.header.packet_id ) ) ].push_back( std::move( packet ) );
+			}
+
+			m_datagram_packets.clear( );
+		}
+
+		// Dispatch the most important packets first
+		for ( auto& packets : m_ready_packets ) {
+			for ( auto& packet : packets )
+				dispatch_packet( packet );
+
+			packets.clear( );
+		}
+
+		return true;
+	}
+
+	bool async_client::extract_packets( std::array< std::vector< ready_packet_t >, packets::packet_priority_count >& ready_packets ) {
+		auto max_packet_size = m_connection.features & packets::wire::feature_large_frames ? packets::wire::max_large_packet_size : packets::wire::max_packet_size;
+		auto checksum_size = m_connection.features & packets::wire::feature_checksum ? packets::checksum::checksum_size : 0;
+
+		// Where the batch of a packet id sits in the ready lists
+		std::unordered_map< std::uint16_t, std::size_t > batches = { };
+
+		// Walk over all complete packets and remove them from the queue in one go afterwards. The rest of a blob goes into its file directly.
+		std::size_t offset = 0;
+		while ( m_active_sink.remaining == 0 && ( m_active_sink.finished || offset < m_packet_queue.size( ) ) ) {
+			// Let the handler know a blob has arrived once its checksum checked out
+			if ( m_active_sink.finished ) {
+				if ( m_packet_queue.size( ) - offset < checksum_size )
+					break;
+
+				if ( checksum_size && packets::checksum::read_checksum( m_packet_queue.data( ) + offset ) != m_active_sink.checksum ) {
+					m_packet_queue.clear( );
+					return false;
+				}
+
+				offset += checksum_size;
+				finish_blob( );
+				continue;
+			}
+
+			// We have something to process, get the information about our packet
+			packets::wire::frame_header_t header = { };
+			auto header_length = packets::wire::decode_header( m_framing, m_packet_queue.data( ) + offset, m_packet_queue.size( ) - offset, header, max_packet_size );
+
+			// A malformed header means we can't trust anything after it anymore
+			if ( header_length < 0 ) {
+				m_packet_queue.clear( );
+				return false;
+			}
+
+			// Check if we have at least a packet header stored
+			if ( header_length == 0 )
+				break;
+
+			auto data = m_packet_queue.data( ) + offset + header_length;
+			bool compressed = header.frame_flags & packets::wire::frame_flag_compressed;
+
+			// Packets with a sink are written to their file as they arrive instead of being buffered
+			auto sink_it = m_blob_sinks.find( header.packet_id );
+
+			if ( sink_it != m_blob_sinks.end( ) && !compressed ) {
+				// Write what we already have, the receive thread takes care of the rest
+				auto to_write = std::min< std::size_t >( m_packet_queue.size( ) - offset - header_length, header.packet_size );
+				if ( !write_to_sink( sink_it->second, data, to_write ) )
+					return false;
+
+				m_active_sink.file = sink_it->second;
+				m_active_sink.header = header;
+				m_active_sink.remaining = header.packet_size - to_write;
+				m_active_sink.finished = m_active_sink.remaining == 0;
+
+				if ( checksum_size ) {
+					m_active_sink.checksummed = true;
+					m_active_sink.checksum = packets::checksum::crc32c( data, to_write, packets::checksum::crc32c( m_packet_queue.data( ) + offset, header_length ) );
+				}
+
+				offset += header_length + to_write;
+				continue;
+			}
+
+			// Do we have a whole packet stored?
+			std::size_t frame_size = header_length + header.packet_size, total_packet_size = frame_size + checksum_size;
+			if ( m_packet_queue.size( ) - offset < total_packet_size )
+				break;
+
+			// A frame that was corrupted on the way means we can't trust anything after it either, so we disconnect instead of resyncing
+			if ( checksum_size && packets::checksum::crc32c( m_packet_queue.data( ) + offset, frame_size ) != packets::checksum::read_checksum( m_packet_queue.data( ) + offset + frame_size ) ) {
+				m_packet_queue.clear( );
+				return false;
+			}
+
+			offset += total_packet_size;
+
+			bool response = header.packet_flags & 0b10000000 /* Custom handler */;
+			bool batched = !response && sink_it == m_blob_sinks.end( ) && m_batch_handlers.find( header.packet_id ) != m_batch_handlers.end( );
+			bool datagram_token = !response && header.packet_id == packets::datagram::token_packet_id;
+			bool handled = response || batched || datagram_token || sink_it != m_blob_sinks.end( ) || m_packet_handlers.find( header.packet_id ) != m_packet_handlers.end( );
+			bool delta = header.frame_flags & packets::wire::frame_flag_delta;
+
+			// Packet is invalid/has no handler, skip it. Deltas still have to update their base
+			if ( !handled && !delta )
+				continue;
+
+			// Responses to forwarded requests go back as they arrived, deltas once they are rebuilt
+			if ( response && !delta && m_forward_sink && forward_response( header, data ) )
+				continue;
+
+			ready_packet_t packet = { header };
+			auto data_size = std::size_t( header.packet_size );
+
+			// Decompress the packet data, handlers always see the original packet
+			if ( compressed ) {
+				auto dictionary_it = m_compression_dictionaries.find( header.packet_id );
+				auto dictionary = dictionary_it != m_compression_dictionaries.end( ) ? &dictionary_it->second : nullptr;
+
+				if ( !packets::compression::decompress_payload( data, header.packet_size, dictionary, packet.data, std::min( max_packet_size, m_max_decompressed_size ) ) ) {
+					m_packet_queue.clear( );
+					return false;
+				}
+
+				// Compressed packets for a sink can only be written once they are decompressed
+				if ( sink_it != m_blob_sinks.end( ) ) {
+					if ( !write_to_sink( sink_it->second, packet.data.data( ), packet.data.size( ) ) )
+						return false;
+
+					m_active_sink.header = header;
+					finish_blob( );
+					continue;
+				}
+
+				data = packet.data.data( );
+				data_size = packet.data.size( );
+			} else if ( !batched )
+				packet.data.assign( data, data + header.packet_size );
+
+			// Rebuild delta encoded packets from the previous packet of their id
+			if ( delta ) {
+				std::vector< char > decoded = { };
+
+				if ( !packets::delta::decode( m_delta_bases[ header.packet_id ], data, data_size, decoded ) ) {
+					m_packet_queue.clear( );
+					return false;
+				}
+
+				packet.data = std::move( decoded );
+				data = packet.data.data( );
+				data_size = packet.data.size( );
+
+				if ( response && m_forward_sink ) {
+					auto decoded_header = header;
+					decoded_header.frame_flags = 0;
+					decoded_header.packet_size = std::uint32_t( data_size );
+
+					if ( forward_response( decoded_header, data ) )
+						continue;
+				}
+
+				if ( !handled )
+					continue;
+			}
+
+			// The datagram thread binds the channel with the token, 0 means we can't use it (anymore)
+			if ( datagram_token ) {
+				if ( data_size >= packets::datagram::token_size ) {
+					m_datagram_bound = false;
+					m_datagram_token = packets::datagram::read_token( data );
+				}
+
+				continue;
+			}
+
+			auto& ready_list = ready_packets[ std::size_t( priority_of( header.packet_id ) ) ];
+
+			if ( batched ) {
+				// The batch is dispatched where its first packet would have been
+				auto [ batch_it, inserted ] = batches.try_emplace( header.packet_id, ready_list.size( ) );
+				if ( inserted ) {
+					ready_packet_t batch = { header };
+					batch.batched = true;
+					ready_list.push_back( std::move( batch ) );
+				}
+
+				auto packet_flags = header.packet_flags;
+				if ( packet_flags & 0x7F )
+					packet_flags |= 0b10000000;
+
+				ready_list[ batch_it->second ].batch.add( data, data_size, packet_flags );
+				continue;
+			}
+
+			ready_list.push_back( std::move( packet ) );
+		}
+
+		// Remove the packets from our queue
+		m_packet_queue.erase( m_packet_queue.begin( ), m_packet_queue.begin( ) + offset );
+		return true;
+	}
+
+	void async_client::dispatch_packet( ready_packet_t& packet ) {
+		auto& header = packet.header;
+
+		if ( packet.batched ) {
+			if ( auto batch_handler_it = m_batch_handlers.find( header.packet_id ); batch_handler_it != m_batch_handlers.end( ) )
+				batch_handler_it->second( this, packet.batch );
+
+			return;
+		}
+
+		// Add the packet to custom processing queue if marked as one
+		if ( header.packet_flags & 0b10000000 ) {
+			// Create an info structure
+			custom_process_info_t info( header.packet_flags & 0x7F /* Extract the packet identifier */ );
+			info.packet_data = std::move( packet.data );
+
+			std::lock_guard custom_lock( m_custom_mtx );
+
+			// Coroutines waiting for the response continue on their own loop
+			if ( auto waiter_it = m_waiters.find( info.packet_identifier ); waiter_it != m_waiters.end( ) ) {
+				if ( waiter_it->second->claim( ) ) {
+					waiter_it->second->response = std::move( info.packet_data );
+					waiter_it->second->wake( );
+				}
+
+				return;
+			}
+
+			// Add it to the queue
+			m_custom_process_queue.push_back( std::move( info ) );
+			return;
+		}
+
+		auto handler_it = m_packet_handlers.find( header.packet_id );
+		if ( handler_it == m_packet_handlers.end( ) )
+			return;
+
+		if ( header.packet_flags & 0x7F )
+			header.packet_flags |= 0b10000000;
+
+		// Call the packet handler
+		handler_it->second( this, packet.data, header.packet_flags );
+	}
+
+	void async_client::send_frames( ) {
+		transport::pin_current_thread( m_low_latency, 2 );
+
+		while ( m_connected ) {
+			{
+				std::unique_lock lock( m_outbound_mtx );
+				m_outbound_cv.wait_for( lock, std::chrono::milliseconds( 1 ), [ this ]( ) {
+					return !m_outbound_queue.empty( ) || !m_connected;
+				} );
+			}
+
+			send_once( );
+		}
+	}
+
+	bool async_client::send_once( ) {
+		// Everything queued for the datagram channel since the last round goes out together
+		bool sent_datagrams = send_datagrams( );
+
+		std::vector< char > frame = { };
+
+		{
+			std::lock_guard lock( m_outbound_mtx );
+
+			if ( !m_outbound_queue.pop( frame ) )
+				return sent_datagrams;
+
+			m_outbound_in_flight = true;
+		}
+
+		bool sent = false;
+		{
+			std::lock_guard lock( m_send_mtx );
+			sent = send_raw( m_connection, frame.data( ), frame.size( ) );
+		}
+
+		{
+			std::lock_guard lock( m_outbound_mtx );
+			m_outbound_in_flight = false;
+		}
+
+		m_outbound_cv.notify_all( );
+
+		// An error occurred, disconnect from server
+		if ( !sent ) {
+			connection_lost( );
+			return false;
+		}
+
+		return true;
+	}
+
+	bool async_client::send_datagrams( ) {
+		packets::datagram::outbox_t outbox = { };
+		{
+			std::lock_guard lock( m_datagram_mtx );
+
+			if ( m_datagram_outbox.empty( ) )
+				return false;
+
+			std::swap( outbox, m_datagram_outbox );
+		}
+
+		// Lost datagrams are what the channel is for, so errors are ignored
+		for ( auto& datagram : outbox.datagrams )
+			send( m_connection.datagram_socket, datagram.data( ), int( datagram.size( ) ), NULL );
+
+		return true;
+	}
+
+	void async_client::receive_datagrams( ) {
+		const auto bind_interval = std::chrono::milliseconds( 100 );
+
+		std::vector< char > buffer( packets::datagram::max_datagram_size );
+		std::vector< ready_packet_t > packets = { };
+		std::chrono::steady_clock::time_point last_bind = { };
+
+		while ( m_connected ) {
+			auto token = m_datagram_token.load( );
+
+			// Ask the server to bind our address until it answered, either datagram may get lost
+			if ( token && !m_datagram_bound && std::chrono::steady_clock::now( ) - last_bind >= bind_interval ) {
+				char data[ packets::datagram::token_size ] = { };
+				packets::datagram::write_token( token, data );
+
+				send( m_connection.datagram_socket, data, sizeof data, NULL );
+				last_bind = std::chrono::steady_clock::now( );
+			}
+
+			// Times out regularly, so we notice the disconnect and send the next bind datagram
+			auto length = recv( m_connection.datagram_socket, buffer.data( ), int( buffer.size( ) ), NULL );
+
+			// Read whatever else arrived in the meantime, so the process thread is woken once for all of it
+			while ( true ) {
+				if ( token && length >= int( packets::datagram::token_size ) && packets::datagram::read_token( buffer.data( ) ) == token ) {
+					m_datagram_bound = true;
+
+					packets::datagram::read_frames( buffer.data( ), std::size_t( length ), m_datagram_receiver, [ & ]( const packets::wire::frame_header_t& header, const char* packet_data ) {
+						bool handled = m_packet_handlers.find( header.packet_id ) != m_packet_handlers.end( ) || m_batch_handlers.find( header.packet_id ) != m_batch_handlers.end( );
+
+						// Responses never come this way
+						if ( !handled || header.packet_flags & 0x7F )
+							return;
+
+						ready_packet_t packet = { header };
+						packet.data.assign( packet_data, packet_data + header.packet_size );
+						packets.push_back( std::move( packet ) );
+					} );
+				}
+
+				u_long pending = 0;
+				if ( ioctlsocket( m_connection.datagram_socket, FIONREAD, &pending ) == SOCKET_ERROR || !pending )
+					break;
+
+				length = recv( m_connection.datagram_socket, buffer.data( ), int( buffer.size( ) ), NULL );
+			}
+
+			if ( packets.empty( ) )
+				continue;
+
+			{
+				std::lock_guard lock( m_datagram_mtx );
+				std::move( packets.begin( ), packets.end( ), std::back_inserter( m_datagram_packets ) );
+			}
+
+			packets.clear( );
+			m_process_waiter.notify( );
+		}
+	}
+
+	void async_client::enqueue_frame( packets::packet_priority priority, std::vector< char > frame ) {
+		{
+			std::lock_guard lock( m_outbound_mtx );
+			m_outbound_queue.push( priority, std::move( frame ) );
+		}
+
+		m_outbound_cv.notify_all( );
+	}
+
+	packets::packet_priority async_client::priority_of( std::uint16_t packet_id ) {
+		auto priority_it = m_packet_priorities.find( packet_id );
+		return priority_it != m_packet_priorities.end( ) ? priority_it->second : packets::packet_priority::normal;
+	}
+
+	void async_client::connect_socket( connection_t& connection ) {
+		if ( m_endpoint.scheme == transport::scheme_t::tcp || m_endpoint.scheme == transport::scheme_t::tls ) {
+			// Tries every address of the host with a timeout each, we may be called again and again while reconnecting
+			auto socket = transport::connect_one( connect_target( ) );
+
+			if ( socket == INVALID_SOCKET )
+				throw std::exception( "async_client::connect: failed to connect to host" );
+
+			connection.socket = socket;
+			return;
+		}
+
+		// Unix sockets and shared memory both connect to an AF_UNIX socket
+		sockaddr_un address = { };
+		address.sun_family = AF_UNIX;
+
+		if ( m_endpoint.path.size( ) >= sizeof address.sun_path )
+			throw std::invalid_argument( "async_client::connect: socket path too long" );
+
+		memcpy( address.sun_path, m_endpoint.path.data( ), m_endpoint.path.size( ) );
+
+		auto socket = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+
+		if ( socket == INVALID_SOCKET )
+			throw std::exception( "async_client::connect: socket creation failed" );
+
+		if ( ::connect( socket, reinterpret_cast< sockaddr* >( &address ), sizeof address ) == SOCKET_ERROR ) {
+			closesocket( socket );
+			throw std::exception( "async_client::connect: failed to connect to host" );
+		}
+
+		connection.socket = socket;
+	}
+
+	transport::connect_target_t async_client::connect_target( ) {
+		transport::connect_target_t target = { };
+		target.host = m_endpoint.host;
+		target.port = m_endpoint.port;
+		target.options = m_connect_options;
+		target.low_latency = m_low_latency;
+
+		return target;
+	}
+
+	void async_client::attach_shm_channel( connection_t& connection ) {
+		// Read the mapping name: [ uint8 length, char[ length ] name ]
+		std::uint8_t length = 0;
+		if ( !read_exact( connection, reinterpret_cast< char* >( &length ), 1, m_handshake_timeout ) || length == 0 )
+			throw std::exception( "async_client::connect: failed to receive channel name" );
+
+		std::string name( length, '\0' );
+		if ( !read_exact( connection, name.data( ), length, m_handshake_timeout ) )
+			throw std::exception( "async_client::connect: failed to receive channel name" );
+
+		auto channel = std::make_unique< transport::shm_channel >( name, false );
+
+		if ( m_low_latency.enabled )
+			channel->set_spin_count( m_low_latency.spin_count );
+
+		connection.channel = std::move( channel );
+	}
+
+	void async_client::attach_tls_channel( connection_t& connection ) {
+		auto options = m_tls_options;
+		if ( options.server_name.empty( ) )
+			options.server_name = m_endpoint.host;
+
+		connection.channel = std::make_shared< transport::tls_channel >( connection.socket, options, false );
+	}
+
+	bool async_client::write_to_sink( HANDLE file, const char* data, std::size_t length ) {
+		while ( length > 0 ) {
+			DWORD bytes_written = 0;
+
+			if ( !WriteFile( file, data, DWORD( std::min< std::size_t >( length, 0x7FFFFFFF ) ), &bytes_written, NULL ) || bytes_written == 0 )
+				return false;
+
+			data += bytes_written;
+			length -= bytes_written;
+		}
+
+		return true;
+	}
+
+	void async_client::finish_blob( ) {
+		auto header = m_active_sink.header;
+		m_active_sink = { };
+
+		// Responses go to the thread waiting for them, everything else to the packet handler
+		if ( header.packet_flags & 0b10000000 ) {
+			std::lock_guard lock( m_custom_mtx );
+
+			if ( auto waiter_it = m_waiters.find( header.packet_flags & 0x7F ); waiter_it != m_waiters.end( ) ) {
+				if ( waiter_it->second->claim( ) ) {
+					waiter_it->second->response.emplace( );
+					waiter_it->second->wake( );
+				}
+			} else
+				m_custom_process_queue.push_back( custom_process_info_t( header.packet_flags & 0x7F ) );
+		} else if ( auto handler_it = m_packet_handlers.find( header.packet_id ); handler_it != m_packet_handlers.end( ) ) {
+			if ( header.packet_flags & 0x7F )
+				header.packet_flags |= 0b10000000;
+
+			handler_it->second( this, { }, header.packet_flags );
+		}
+	}
+
+	std::uint8_t async_client::generate_packet_identifier( ) {
+		std::lock_guard lock( m_custom_mtx );
+
+		// Continue after the latest one, skipping those which still wait for their response. In range of 1-127
+		std::uint8_t next_identifier = m_packet_identifiers.empty( ) ? 1 : m_packet_identifiers.back( ) % 127 + 1;
+
+		for ( int i = 0; i < 127; i++, next_identifier = next_identifier % 127 + 1 ) {
+			if ( std::find( m_packet_identifiers.begin( ), m_packet_identifiers.end( ), next_identifier ) == m_packet_identifiers.end( ) ) {
+				m_packet_identifiers.push_back( next_identifier );
+				return next_identifier;
+			}
+		}
+
+		return 0;
+	}
+
+	void async_client::remove_packet_identifier( std::uint8_t identifier ) {
+		std::lock_guard lock( m_custom_mtx );
+
+		m_packet_identifiers.erase( std::remove_if( m_packet_identifiers.begin( ), m_packet_identifiers.end( ), [ identifier ]( std::uint8_t id ) {
+			return id == identifier;
+		} ), m_packet_identifiers.end( ) );
+	}
+
+	void async_client::abandon_waiters( bool keep_replayed ) {
+		for ( auto& [ identifier, waiter ] : m_waiters ) {
+			if ( auto request_it = m_in_flight_requests.find( identifier ); keep_replayed && request_it != m_in_flight_requests.end( ) && request_it->second.replay )
+				continue;
+
+			if ( waiter->claim( ) )
+				waiter->wake( );
+		}
 	}
 } // namespace forceinline::remote
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#include <afunix.h>
 
 #include <string>
 #include <thread>
@@ -8,53 +9,351 @@
 #include <functional>
 #include <unordered_map>
 #include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <condition_variable>
+#include <unordered_set>
+#include <atomic>
 
 #include "../packet/packet.h"
+#include "../packet/wire.h"
+#include "../packet/compression.h"
+#include "../packet/checksum.h"
+#include "../packet/priority.h"
+#include "../packet/batch.h"
+#include "../packet/topics.h"
+#include "../packet/delta.h"
+#include "../packet/datagram.h"
+#include "../transport/endpoint.h"
+#include "../transport/channel.h"
+#include "../transport/tls_channel.h"
+#include "../transport/connector.h"
+#include "../transport/low_latency.h"
+#include "../transport/reconnect.h"
+#include "../transport/event_waiter.h"
+#include "../diagnostics/capture.h"
+#include "../coro/task.h"
 
 #pragma comment (lib, "Ws2_32.lib")
 
 namespace forceinline::remote {
 	class async_client;
 	typedef void( *packet_handler_client_fn )( async_client* client, const std::vector< char >& data, const std::uint8_t flags );
+	typedef void( *batch_handler_client_fn )( async_client* client, const packets::packet_batch& batch );
+
+	// Receives the response to a forwarded request as it arrived, header is nullptr if the request is lost
+	typedef std::function< void( std::uint64_t tag, const packets::wire::frame_header_t* header, const char* data ) > forward_sink_fn;
 
 	class async_client {
 	public:
 		async_client( std::string_view ip, std::string_view port );
+
+		// Endpoint URI, see transport/endpoint.h
+		async_client( std::string_view endpoint );
 		~async_client( );
 
 		void connect( );
 		void disconnect( );
+
+		/*
+			Connects all clients at once. The TCP connects of every tcp:// and tls:// client race each other on
+			one thread, so a dead host costs its own timeouts only, then the handshakes run in parallel.
+			Returns whether each client is connected afterwards.
+		*/
+		static std::vector< bool > connect_all( const std::vector< async_client* >& clients );
 		
 		bool is_connected( );
 
-		void set_packet_handler( std::uint16_t packet_id, packet_handler_client_fn handler );
+		// Handlers of packets with a higher priority are called first
+		void set_packet_handler( std::uint16_t packet_id, packet_handler_client_fn handler, packets::packet_priority priority = packets::packet_priority::normal );
+
+		/*
+			Opt-in alternative to set_packet_handler: the handler is called once with all packets of this id
+			which were received since the last dispatch. Takes precedence over a packet handler for the same id.
+			Responses to send_packet( ..., handler ) are never batched.
+		*/
+		void set_batch_handler( std::uint16_t packet_id, batch_handler_client_fn handler, packets::packet_priority priority = packets::packet_priority::normal );
+
+		// Priority class for sending and dispatching a packet id, also for ids we have no handler for
+		void set_packet_priority( std::uint16_t packet_id, packets::packet_priority priority );
+
+		// Waits until all queued packets have been sent. Returns false on timeout.
+		bool flush( std::chrono::milliseconds timeout );
+
+		// Talk to servers which don't speak protocol version 2. Has to be set before connecting.
+		void set_legacy_framing( bool legacy );
+
+		// Optional protocol features (packets::wire::feature) we ask the server for. Has to be set before connecting.
+		void set_features( std::uint32_t features );
+
+		// Features the server accepted
+		std::uint32_t features( );
+
+		// Compress packets with at least threshold bytes of data if the server supports it
+		void set_compression( std::uint32_t threshold );
+
+		// Preset dictionary for a packet id, the server has to use the same one
+		void set_compression_dictionary( std::uint16_t packet_id, const std::vector< char >& dictionary );
+
+		// Largest packet we decompress, compressed packets which claim to be larger are dropped with their connection
+		void set_max_decompressed_size( std::uint32_t size );
+
+		/*
+			Writes the data of incoming packets with this id straight into a file (at its current position) as it
+			arrives, instead of buffering the whole packet. Once a packet has been written completely, its handler
+			is called with an empty buffer. Pass NULL to go back to normal packets.
+		*/
+		void set_blob_sink( std::uint16_t packet_id, HANDLE file );
+
+		// Packets the server publishes to a topic arrive at the handler of their packet id
+		void subscribe( std::string_view topic );
+		void unsubscribe( std::string_view topic );
+
+		/*
+			With manual pumping, connect( ) spawns no threads and pump( ) does one round of their work on the calling
+			thread instead: receive what is queued, dispatch it and send everything we queued. Only available for
+			mem:// endpoints. Waiting for the server (connect, send_packet with a handler) pumps a manually pumped
+			server on the same thread. Has to be set before connecting.
+		*/
+		void set_manual_pump( bool manual );
+		void pump( );
+
+		// Records all traffic into an append-only capture file (see diagnostics/capture.h), replay it with replay_main.cpp
+		void start_capture( const std::string& path );
+		void stop_capture( );
+
+		// Trades CPU time for latency (busy-polling, pinned threads), has to be set before connecting
+		void set_low_latency( const transport::low_latency_config_t& config );
+
+		// Timeouts of resolving and connecting for tcp:// and tls:// endpoints, has to be set before connecting
+		void set_connect_options( const transport::connect_options_t& options );
+
+		// Server name and certificate checks for tls:// endpoints, has to be set before connecting
+		void set_tls_options( const transport::tls_options_t& options );
+
+		/*
+			Reconnects by itself once the connection drops, see transport::reconnect_policy_t. Requests of idempotent
+			packet ids which were still waiting for their response are sent again on the new connection, all other
+			waiting requests fail right away. Packets queued but not sent yet are dropped. Has to be set before connecting.
+		*/
+		void set_reconnect_policy( const transport::reconnect_policy_t& policy );
+
+		// Requests of this id can be sent twice without harm, so they are replayed after a reconnect
+		void set_idempotent( std::uint16_t packet_id, bool idempotent = true );
+
+		/*
+			Sends packets of a fixed-size type as deltas against the previous packet of the id, with a full
+			keyframe every keyframe_interval packets. Only used if the server accepted packets::wire::feature_delta.
+			Has to be set before connecting, an interval of 0 turns it off.
+		*/
+		void set_delta_encoding( std::uint16_t packet_id, std::uint32_t keyframe_interval = packets::delta::default_keyframe_interval );
+
+		/*
+			Packets of this id go over the datagram channel once it is bound, see async_server::set_unreliable. Only
+			used if we asked for packets::wire::feature_datagram and the server accepted it. Has to be set before connecting.
+		*/
+		void set_unreliable( std::uint16_t packet_id, bool unreliable = true );
 
 		void send_packet( packets::packet_base::base_packet* packet );
 		bool send_packet( packets::packet_base::base_packet* packet, std::function< bool( const std::vector< char >& buffer, const std::uint8_t flags ) > handler, std::chrono::milliseconds timeout = std::chrono::milliseconds( 250 ) );
 
+		class request_awaiter {
+		public:
+			request_awaiter( async_client* client, packets::packet_base::base_packet* packet, std::chrono::milliseconds timeout ) : m_client( client ), m_packet( packet ), m_timeout( timeout ) { }
+
+			bool await_ready( ) const noexcept { return false; }
+			bool await_suspend( coro::task::handle_t handle );
+			std::optional< std::vector< char > > await_resume( );
+
+		private:
+			async_client* m_client = nullptr;
+			packets::packet_base::base_packet* m_packet = nullptr;
+			std::chrono::milliseconds m_timeout = { };
+
+			std::uint8_t m_identifier = 0;
+			std::shared_ptr< coro::waiter_t > m_waiter = nullptr;
+		};
+
+		/*
+			send_packet( ..., handler ) for coroutines, e.g. task handlers of a server (see coro/task.h) which call
+			another server: co_await it for the response, which is empty if there was none within timeout or the
+			request is lost. The coroutine is resumed on its own loop, the packet is sent when it is awaited.
+		*/
+		request_awaiter request( packets::packet_base::base_packet* packet, std::chrono::milliseconds timeout = std::chrono::milliseconds( 250 ) );
+
+		// Where responses to forward_frame requests go, has to be set before connecting
+		void set_forward_sink( forward_sink_fn sink );
+
+		/*
+			Used by relaying servers (async_server::set_relay_route): sends a frame another connection received
+			without decoding its data, which may still be compressed. Requests (tag set) are sent with one of our
+			identifiers and their response is handed to the forward sink with the tag. Returns false if the frame
+			was not sent, e.g. because all identifiers are waiting for their response.
+		*/
+		bool forward_frame( packets::wire::frame_header_t header, const char* data, std::uint64_t tag, std::chrono::milliseconds timeout );
+
 	private:
+		struct connection_t {
+			SOCKET socket = 0;
+
+			// Set if we talk to the server through something other than the socket
+			std::shared_ptr< transport::channel > channel = nullptr;
+
+			// Features the server accepted
+			std::uint32_t features = 0;
+
+			// Tells connections apart in captures
+			std::uint32_t id = 0;
+
+			// Connected to the server's datagram channel if it accepted packets::wire::feature_datagram
+			SOCKET datagram_socket = INVALID_SOCKET;
+
+			// What the server sent while this was the standby connection, e.g. the token of its datagram channel
+			std::vector< char > pending = { };
+		};
+
 		void send_packet_internal( packets::packet_base::base_packet* packet, std::uint8_t packet_flags );
 
+		// Encodes a packet with the features of the active connection and queues it, m_connection_mtx has to be held by the caller
+		void queue_packet( packets::wire::frame_header_t header, const char* data );
+
+		// m_connection_mtx has to be held by the caller, the frame is only valid for the active connection
+		std::vector< char > build_frame( const packets::wire::frame_header_t& header, const char* data );
+
+		// Writes the whole buffer, m_send_mtx has to be held by the caller for the active connection
+		bool send_raw( const connection_t& connection, const char* data, std::size_t length );
+
+		// Reads exactly length bytes while no thread is receiving from the connection
+		bool read_exact( const connection_t& connection, char* buffer, int length, std::chrono::milliseconds timeout );
+
+		void perform_handshake( connection_t& connection );
+
+		// Takes over a socket connect_all( ) connected already, INVALID_SOCKET to connect one ourselves
+		void connect( SOCKET socket );
+
+		// Connects and goes through all handshakes, throws on failure
+		connection_t open_connection( SOCKET socket = INVALID_SOCKET );
+		void close_connection( connection_t& connection );
+
+		// Forgets everything that belonged to the previous connection, our threads have to be stopped
+		void reset_connection_state( );
+
+		void start_threads( );
+		void join_threads( );
+
+		// Marks us as disconnected and wakes everyone who waits for the connection
+		void connection_lost( );
+
+		// Runs while reconnecting is enabled, brings the connection back once it dropped and keeps the standby one
+		void supervise( );
+		bool fail_over( );
+		void maintain_standby( );
+
+		// Reads what the server sent on the standby connection into its pending bytes, only EOF or an error means it is gone
+		bool is_alive( connection_t& connection );
+
+		std::vector< std::string > subscribed_topics( );
+
+		bool write_to_sink( HANDLE file, const char* data, std::size_t length );
+
+		// Calls the handler of a blob which has been written completely
+		void finish_blob( );
+
+		struct ready_packet_t {
+			packets::wire::frame_header_t header = { };
+			std::vector< char > data = { };
+
+			// Set for packets with a batch handler, data is empty then
+			bool batched = false;
+			packets::packet_batch batch = { };
+		};
+
 		void receive( );
 		void process_packets( );
+		void send_frames( );
+
+		// Binds the datagram channel and collects the packets which arrive over it
+		void receive_datagrams( );
+
+		// Opens the datagram socket once the server accepted packets::wire::feature_datagram
+		void open_datagram_socket( connection_t& connection );
+
+		// Sends the datagrams queued since the last round, returns whether there were any
+		bool send_datagrams( );
+
+		void capture( std::uint32_t connection_id, diagnostics::capture_direction direction, const char* data, std::size_t length );
 
+		// One round of the threads above, also used by pump( ). receive_once returns the bytes received, -1 on error
+		int receive_once( bool wait );
+		bool process_once( );
+		bool send_once( );
+
+		// Moves all complete packets into the ready lists of their priority class. Returns false if the stream is corrupt.
+		bool extract_packets( std::array< std::vector< ready_packet_t >, packets::packet_priority_count >& ready_packets );
+		void dispatch_packet( ready_packet_t& packet );
+
+		void enqueue_frame( packets::packet_priority priority, std::vector< char > frame );
+		packets::packet_priority priority_of( std::uint16_t packet_id );
+
+		void connect_socket( connection_t& connection );
+		transport::connect_target_t connect_target( );
+		void attach_shm_channel( connection_t& connection );
+		void attach_tls_channel( connection_t& connection );
+
+		// Returns 0 if all identifiers are waiting for their response
 		std::uint8_t generate_packet_identifier( );
 		void remove_packet_identifier( std::uint8_t identifier );
 
-		bool m_connected = false;
+		// Wakes the coroutines waiting for responses, m_custom_mtx has to be held by the caller. Replayed requests keep waiting if keep_replayed is set
+		void abandon_waiters( bool keep_replayed );
+
+		// Hands a response to the forward sink, returns false if it does not answer a forwarded request
+		bool forward_response( const packets::wire::frame_header_t& header, const char* data );
+
+		// Tells the forward sink that forwarded requests are lost, all of them or only those past their deadline
+		void drop_forwarded( bool expired_only );
 
-		SOCKET m_socket = 0;
+		std::atomic< bool > m_connected = false;
+
+		// The connection our threads use and the one we fail over to
+		connection_t m_connection = { }, m_standby = { };
+
+		// Held shared while frames are built for m_connection, exclusively while it is replaced
+		std::shared_mutex m_connection_mtx;
+
+		// Packets sent while we reconnect, they are encoded once we know what the new connection negotiated
+		std::mutex m_held_mtx;
+		std::vector< std::pair< packets::wire::frame_header_t, std::vector< char > > > m_held_packets = { };
+		std::size_t m_held_bytes = 0;
+		const std::size_t m_max_held_bytes = 1024 * 1024;
+		std::uint32_t m_connection_counter = 0;
 	
 	#ifdef WIN32
 		WSADATA m_wsa_data = { };
 	#endif // WIN32
 
-		std::thread m_receive_thread, m_process_thread;
+		std::thread m_receive_thread, m_process_thread, m_send_thread, m_datagram_thread;
 
-		std::string m_ip = "", m_port = "";
+		transport::endpoint_t m_endpoint = { };
+		transport::low_latency_config_t m_low_latency = { };
+		transport::tls_options_t m_tls_options = { };
+		transport::connect_options_t m_connect_options = { };
+		bool m_manual_pump = false;
+
+		// Set while capturing, the I/O threads keep their own reference to the writer while recording
+		std::mutex m_capture_mtx;
+		std::atomic< bool > m_capturing = false;
+		std::shared_ptr< diagnostics::capture_writer > m_capture = nullptr;
+
+		// Wakes the process thread when the receive thread buffered new data
+		transport::event_waiter m_process_waiter;
 
 		std::mutex m_send_mtx, m_process_mtx, m_custom_mtx;
 
+		// Used by one round of the receive and process threads
+		std::vector< char > m_receive_buffer = { };
+		std::array< std::vector< ready_packet_t >, packets::packet_priority_count > m_ready_packets = { };
+
 		const std::uint16_t m_buffer_size = 4096;
 		std::vector< char > m_packet_queue = { };
 		
@@ -65,24 +364,103 @@ namespace forceinline::remote {
 			std::vector< char > packet_data = { };
 		};
 
-		struct packet_header_t {
-			packet_header_t( packets::packet_base::base_packet* packet ) {
-				if ( !packet )
-					return;
+		packets::wire::framing_t m_framing = packets::wire::framing_t::v2;
+		std::uint32_t m_features = packets::wire::feature_compression | packets::wire::feature_large_frames | packets::wire::feature_delta;
 
-				packet_id = packet->id( );
-				packet_size = packet->size( );
-				packet_flags = packet->flags( );
-			}
+		// Keyframe interval of delta encoded packet ids
+		std::unordered_map< std::uint16_t, std::uint32_t > m_delta_packets = { };
 
-			std::uint16_t packet_id = 0;
-			std::uint16_t packet_size = 0;
-			std::uint8_t packet_flags = 0;
-		};
+		// Last packets we sent of delta encoded ids, m_delta_mtx is held until they are queued
+		std::mutex m_delta_mtx;
+		std::unordered_map< std::uint16_t, packets::delta::sender_state_t > m_delta_states = { };
+
+		// Last packet received per delta encoded id, protected by m_process_mtx
+		std::unordered_map< std::uint16_t, std::vector< char > > m_delta_bases = { };
+
+		// Compression is off until a threshold is set
+		std::uint32_t m_compression_threshold = UINT32_MAX;
+		std::uint32_t m_max_decompressed_size = packets::compression::default_max_decompressed_size;
+		std::unordered_map< std::uint16_t, std::vector< char > > m_compression_dictionaries = { };
+
+		std::unordered_map< std::uint16_t, HANDLE > m_blob_sinks = { };
+
+		// Datagram channel: the token the server gave this connection (0 until then), bound once the server answered us
+		std::unordered_set< std::uint16_t > m_unreliable_packets = { };
+		std::atomic< std::uint64_t > m_datagram_token = 0;
+		std::atomic< bool > m_datagram_bound = false;
+
+		// Datagrams waiting for the send thread and packets waiting for the process thread, protected by m_datagram_mtx
+		std::mutex m_datagram_mtx;
+		packets::datagram::outbox_t m_datagram_outbox = { };
+		std::unordered_map< std::uint16_t, std::uint32_t > m_datagram_sequences = { };
+		std::vector< ready_packet_t > m_datagram_packets = { };
+
+		// Only used by the datagram thread
+		packets::datagram::receiver_t m_datagram_receiver = { };
+
+		// Outbound frames, protected by m_outbound_mtx
+		std::mutex m_outbound_mtx;
+		std::condition_variable m_outbound_cv;
+		packets::outbound_lanes m_outbound_queue = { };
+		bool m_outbound_in_flight = false;
+
+		std::unordered_map< std::uint16_t, packets::packet_priority > m_packet_priorities = { };
+
+		// The blob we are currently streaming into a file, protected by m_process_mtx
+		struct active_sink_t {
+			HANDLE file = NULL;
+			std::uint64_t remaining = 0;
+			bool finished = false;
+			packets::wire::frame_header_t header = { };
+
+			// Running CRC32C of the frame, checked against its trailer once all data was written
+			bool checksummed = false;
+			std::uint32_t checksum = 0;
+		} m_active_sink = { };
+
+		const std::chrono::milliseconds m_handshake_timeout = std::chrono::seconds( 5 );
 
 		std::vector< std::uint8_t > m_packet_identifiers = { };
 		std::vector< custom_process_info_t > m_custom_process_queue = { };
 
+		transport::reconnect_policy_t m_reconnect = { };
+		std::thread m_reconnect_thread;
+
+		// Wakes the reconnect thread once we are disconnected
+		std::mutex m_reconnect_mtx;
+		std::condition_variable m_reconnect_cv;
+		std::atomic< bool > m_stopping = false, m_reconnecting = false;
+
+		struct in_flight_request_t {
+			packets::wire::frame_header_t header = { };
+
+			// Only kept for requests we replay
+			std::vector< char > data = { };
+
+			bool replay = false, lost = false;
+		};
+
+		// Requests waiting for their response while reconnecting is enabled, protected by m_custom_mtx
+		std::unordered_map< std::uint8_t, in_flight_request_t > m_in_flight_requests = { };
+		std::unordered_set< std::uint16_t > m_idempotent_packets = { };
+
+		// Coroutines waiting for their response by its identifier, protected by m_custom_mtx
+		std::unordered_map< std::uint8_t, std::shared_ptr< coro::waiter_t > > m_waiters = { };
+
+		struct forwarded_request_t {
+			std::uint64_t tag = 0;
+			std::chrono::steady_clock::time_point deadline = { };
+		};
+
+		// Forwarded requests by the identifier we sent them with, protected by m_custom_mtx. They are never replayed
+		forward_sink_fn m_forward_sink = nullptr;
+		std::unordered_map< std::uint8_t, forwarded_request_t > m_forwarded_requests = { };
+
+		// Subscribed again after a reconnect
+		std::mutex m_topic_mtx;
+		std::unordered_set< std::string > m_topics = { };
+
 		std::unordered_map< int, packet_handler_client_fn > m_packet_handlers = { };
+		std::unordered_map< int, batch_handler_client_fn > m_batch_handlers = { };
 	};
 } // namespace forceinline::remote
\ No newline at end of file
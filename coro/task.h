@@ -0,0 +1,276 @@
+#pragma once
+#include <coroutine>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include <map>
+
+/*
+	Coroutine packet handlers. A handler which returns a coro::task can co_await requests to other
+	servers (async_client::request), to clients of its own server (async_server::request) and timers
+	(coro::sleep_for). While it waits, the thread which runs it goes on with other packets, and once
+	what it waits for is there it continues on the loop it was started on: for server handlers, the
+	process thread of that server.
+*/
+
+namespace forceinline::remote::coro {
+	class event_loop;
+
+	class task {
+	public:
+		struct promise_type;
+		using handle_t = std::coroutine_handle< promise_type >;
+
+		// Hands the finished coroutine back to its loop, which frees it
+		struct final_awaiter {
+			bool await_ready( ) const noexcept { return false; }
+			void await_suspend( handle_t handle ) noexcept;
+			void await_resume( ) const noexcept { }
+		};
+
+		struct promise_type {
+			// Set by the loop before the coroutine first runs
+			event_loop* loop = nullptr;
+			std::uint64_t id = 0;
+
+			task get_return_object( ) { return task( handle_t::from_promise( *this ) ); }
+
+			// Runs once a loop took it over
+			std::suspend_always initial_suspend( ) const noexcept { return { }; }
+			final_awaiter final_suspend( ) const noexcept { return { }; }
+
+			void return_void( ) const noexcept { }
+
+			// Like exceptions of plain handlers, they leave through the thread which runs the handler
+			void unhandled_exception( ) { throw; }
+		};
+
+		task( task&& other ) noexcept : m_handle( std::exchange( other.m_handle, { } ) ) { }
+		task& operator=( task&& other ) = delete;
+
+		~task( ) {
+			if ( m_handle )
+				m_handle.destroy( );
+		}
+
+		handle_t release( ) {
+			return std::exchange( m_handle, { } );
+		}
+
+	private:
+		explicit task( handle_t handle ) : m_handle( handle ) { }
+
+		handle_t m_handle = { };
+	};
+
+	/*
+		Shared between a suspended coroutine and everything which may wake it up: a response, its timeout or
+		the connection dropping. Only the first one to claim it fills in the response and wakes the coroutine.
+	*/
+	struct waiter_t {
+		std::weak_ptr< event_loop > loop = { };
+		std::uint64_t id = 0;
+
+		std::atomic< bool > claimed = false;
+
+		// What the coroutine waited for, empty if it timed out or the connection dropped
+		std::optional< std::vector< char > > response = std::nullopt;
+
+		bool claim( ) {
+			return !claimed.exchange( true, std::memory_order_acq_rel );
+		}
+
+		// Resumes the coroutine on its loop, if that is still around
+		void wake( );
+	};
+
+	/*
+		Runs coroutines on the thread which calls run( ). Everything else is thread-safe: coroutines are
+		woken from any thread and resumed by the next run( ). Has to be owned by a shared_ptr.
+	*/
+	class event_loop : public std::enable_shared_from_this< event_loop > {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		~event_loop( ) {
+			close( );
+		}
+
+		// Called whenever a coroutine was woken, e.g. to wake the thread which calls run( )
+		void set_notify( std::function< void( ) > notify ) {
+			std::lock_guard lock( m_mtx );
+			m_notify = std::move( notify );
+		}
+
+		// Runs the coroutine until it first suspends
+		void spawn( task coroutine ) {
+			auto handle = coroutine.release( );
+			if ( !handle )
+				return;
+
+			std::uint64_t id = 0;
+			{
+				std::lock_guard lock( m_mtx );
+
+				if ( m_closed ) {
+					handle.destroy( );
+					return;
+				}
+
+				id = ++m_counter;
+				m_coroutines[ id ] = handle;
+			}
+
+			handle.promise( ).loop = this;
+			handle.promise( ).id = id;
+			handle.resume( );
+		}
+
+		// Resumes every coroutine which was woken or whose timer is due. Returns whether any was
+		bool run( ) {
+			{
+				std::lock_guard lock( m_mtx );
+
+				auto now = clock::now( );
+				while ( !m_timers.empty( ) && m_timers.begin( )->first <= now ) {
+					auto waiter = std::move( m_timers.begin( )->second );
+					m_timers.erase( m_timers.begin( ) );
+
+					if ( waiter->claim( ) )
+						m_ready.push_back( waiter->id );
+				}
+
+				if ( m_ready.empty( ) )
+					return false;
+
+				m_running.swap( m_ready );
+			}
+
+			for ( auto id : m_running ) {
+				task::handle_t handle = { };
+				{
+					std::lock_guard lock( m_mtx );
+
+					auto coroutine_it = m_coroutines.find( id );
+					if ( coroutine_it == m_coroutines.end( ) )
+						continue;
+
+					handle = coroutine_it->second;
+				}
+
+				handle.resume( );
+			}
+
+			m_running.clear( );
+			return true;
+		}
+
+		// Destroys every coroutine which is still suspended, later wake ups are ignored
+		void close( ) {
+			std::unordered_map< std::uint64_t, task::handle_t > coroutines = { };
+			{
+				std::lock_guard lock( m_mtx );
+
+				m_closed = true;
+				coroutines.swap( m_coroutines );
+				m_ready.clear( );
+				m_timers.clear( );
+			}
+
+			for ( auto& [ id, handle ] : coroutines )
+				handle.destroy( );
+		}
+
+		std::shared_ptr< waiter_t > make_waiter( std::uint64_t id ) {
+			auto waiter = std::make_shared< waiter_t >( );
+			waiter->loop = weak_from_this( );
+			waiter->id = id;
+
+			return waiter;
+		}
+
+		// Wakes the waiter's coroutine at time, unless something else claimed the waiter first
+		void add_timer( clock::time_point time, std::shared_ptr< waiter_t > waiter ) {
+			std::lock_guard lock( m_mtx );
+
+			if ( !m_closed )
+				m_timers.emplace( time, std::move( waiter ) );
+		}
+
+		// Queues a coroutine for the next run( ), from any thread
+		void post( std::uint64_t id ) {
+			std::lock_guard lock( m_mtx );
+
+			if ( m_closed )
+				return;
+
+			m_ready.push_back( id );
+
+			if ( m_notify )
+				m_notify( );
+		}
+
+		// Called by a coroutine which just finished
+		void finished( std::uint64_t id ) {
+			task::handle_t handle = { };
+			{
+				std::lock_guard lock( m_mtx );
+
+				auto coroutine_it = m_coroutines.find( id );
+				if ( coroutine_it == m_coroutines.end( ) )
+					return;
+
+				handle = coroutine_it->second;
+				m_coroutines.erase( coroutine_it );
+			}
+
+			handle.destroy( );
+		}
+
+	private:
+		std::mutex m_mtx;
+		bool m_closed = false;
+
+		// Suspended coroutines by id, ids are never reused so a late wake up can't hit the wrong one
+		std::uint64_t m_counter = 0;
+		std::unordered_map< std::uint64_t, task::handle_t > m_coroutines = { };
+
+		std::vector< std::uint64_t > m_ready = { }, m_running = { };
+		std::multimap< clock::time_point, std::shared_ptr< waiter_t > > m_timers = { };
+
+		std::function< void( ) > m_notify = nullptr;
+	};
+
+	inline void task::final_awaiter::await_suspend( handle_t handle ) noexcept {
+		handle.promise( ).loop->finished( handle.promise( ).id );
+	}
+
+	inline void waiter_t::wake( ) {
+		if ( auto owner = loop.lock( ) )
+			owner->post( id );
+	}
+
+	struct sleep_awaiter {
+		event_loop::clock::duration duration = { };
+
+		bool await_ready( ) const noexcept { return duration <= event_loop::clock::duration::zero( ); }
+
+		void await_suspend( task::handle_t handle ) {
+			auto& promise = handle.promise( );
+			promise.loop->add_timer( event_loop::clock::now( ) + duration, promise.loop->make_waiter( promise.id ) );
+		}
+
+		void await_resume( ) const noexcept { }
+	};
+
+	// Suspends the coroutine for at least duration, its loop checks its timers whenever it runs
+	inline sleep_awaiter sleep_for( event_loop::clock::duration duration ) {
+		return { duration };
+	}
+} // namespace forceinline::remote::coro
@@ -0,0 +1,195 @@
+#include "capture.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+namespace forceinline::remote::diagnostics {
+	namespace {
+		// Files grow in steps of at least this much, so we don't remap for every record
+		constexpr std::uint64_t g_growth_step = 64 << 20;
+	} // namespace
+
+	capture_writer::capture_writer( const std::string& path, capture_role role, std::size_t max_buffered ) : m_max_buffered( max_buffered ) {
+		m_file = CreateFileA( path.data( ), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+		if ( m_file == INVALID_HANDLE_VALUE )
+			throw std::exception( "capture_writer::capture_writer: failed to create capture file" );
+
+		if ( !map( g_growth_step ) ) {
+			CloseHandle( m_file );
+			throw std::exception( "capture_writer::capture_writer: failed to map capture file" );
+		}
+
+		capture_file_header_t header = { };
+		header.magic = capture_magic;
+		header.version = capture_version;
+		header.role = role;
+		header.start_time = std::uint64_t( std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::system_clock::now( ).time_since_epoch( ) ).count( ) );
+
+		append( reinterpret_cast< const char* >( &header ), sizeof header );
+
+		m_start_time = std::chrono::steady_clock::now( );
+		m_writer_thread = std::thread( &capture_writer::write_records, this );
+	}
+
+	capture_writer::~capture_writer( ) {
+		{
+			std::lock_guard lock( m_staging_mtx );
+			m_stopping = true;
+		}
+
+		m_staging_cv.notify_all( );
+
+		if ( m_writer_thread.joinable( ) )
+			m_writer_thread.join( );
+
+		unmap( );
+
+		// Cut off the part of the last growth step we didn't use
+		LARGE_INTEGER end = { };
+		end.QuadPart = LONGLONG( m_size );
+
+		SetFilePointerEx( m_file, end, NULL, FILE_BEGIN );
+		SetEndOfFile( m_file );
+		CloseHandle( m_file );
+	}
+
+	void capture_writer::record( std::uint64_t connection, capture_direction direction, const char* data, std::size_t length ) {
+		capture_record_header_t header = { };
+		header.timestamp = std::uint64_t( std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now( ) - m_start_time ).count( ) );
+		header.connection = connection;
+		header.length = std::uint32_t( length );
+		header.direction = direction;
+
+		std::lock_guard lock( m_staging_mtx );
+
+		// Never make the I/O threads wait for the disk
+		if ( m_staging.size( ) + sizeof header + length > m_max_buffered ) {
+			m_dropped_records++;
+			return;
+		}
+
+		auto header_data = reinterpret_cast< const char* >( &header );
+		m_staging.insert( m_staging.end( ), header_data, header_data + sizeof header );
+		m_staging.insert( m_staging.end( ), data, data + length );
+	}
+
+	void capture_writer::write_records( ) {
+		std::vector< char > records = { };
+		bool stopping = false;
+
+		while ( !stopping ) {
+			{
+				std::unique_lock lock( m_staging_mtx );
+				m_staging_cv.wait_for( lock, std::chrono::milliseconds( 1 ), [ this ]( ) {
+					return m_stopping;
+				} );
+
+				// Take everything staged in one go, the I/O threads keep appending to the empty buffer
+				records.swap( m_staging );
+				stopping = m_stopping;
+			}
+
+			if ( records.empty( ) )
+				continue;
+
+			if ( !append( records.data( ), records.size( ) ) )
+				m_dropped_records++;
+
+			records.clear( );
+		}
+	}
+
+	bool capture_writer::append( const char* data, std::size_t length ) {
+		if ( m_size + length > m_mapped_size && !map( std::max( m_mapped_size + g_growth_step, m_size + length ) ) )
+			return false;
+
+		memcpy( m_view + m_size, data, length );
+		m_size += length;
+
+		return true;
+	}
+
+	bool capture_writer::map( std::uint64_t size ) {
+		unmap( );
+
+		// Mapping a file beyond its end grows it
+		m_mapping = CreateFileMappingA( m_file, NULL, PAGE_READWRITE, DWORD( size >> 32 ), DWORD( size ), NULL );
+		if ( !m_mapping )
+			return false;
+
+		m_view = static_cast< char* >( MapViewOfFile( m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, std::size_t( size ) ) );
+		if ( !m_view ) {
+			CloseHandle( m_mapping );
+			m_mapping = NULL;
+			return false;
+		}
+
+		m_mapped_size = size;
+		return true;
+	}
+
+	void capture_writer::unmap( ) {
+		if ( m_view )
+			UnmapViewOfFile( m_view );
+
+		if ( m_mapping )
+			CloseHandle( m_mapping );
+
+		m_view = nullptr;
+		m_mapping = NULL;
+		m_mapped_size = 0;
+	}
+
+	capture_reader::capture_reader( const std::string& path ) {
+		m_file = CreateFileA( path.data( ), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+		if ( m_file == INVALID_HANDLE_VALUE )
+			throw std::exception( "capture_reader::capture_reader: failed to open capture file" );
+
+		LARGE_INTEGER size = { };
+		if ( !GetFileSizeEx( m_file, &size ) || std::uint64_t( size.QuadPart ) < sizeof m_header ) {
+			CloseHandle( m_file );
+			throw std::exception( "capture_reader::capture_reader: not a capture file" );
+		}
+
+		m_size = std::uint64_t( size.QuadPart );
+		m_mapping = CreateFileMappingA( m_file, NULL, PAGE_READONLY, 0, 0, NULL );
+		m_view = m_mapping ? static_cast< const char* >( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) ) : nullptr;
+
+		if ( m_view )
+			memcpy( &m_header, m_view, sizeof m_header );
+
+		if ( !m_view || m_header.magic != capture_magic || m_header.version != capture_version ) {
+			if ( m_view )
+				UnmapViewOfFile( m_view );
+
+			if ( m_mapping )
+				CloseHandle( m_mapping );
+
+			CloseHandle( m_file );
+			throw std::exception( "capture_reader::capture_reader: not a capture file" );
+		}
+
+		m_offset = sizeof m_header;
+	}
+
+	capture_reader::~capture_reader( ) {
+		UnmapViewOfFile( m_view );
+		CloseHandle( m_mapping );
+		CloseHandle( m_file );
+	}
+
+	bool capture_reader::next( capture_record_t& record ) {
+		if ( m_size - m_offset < sizeof record.header )
+			return false;
+
+		memcpy( &record.header, m_view + m_offset, sizeof record.header );
+
+		if ( m_size - m_offset - sizeof record.header < record.header.length )
+			return false;
+
+		record.data = m_view + m_offset + sizeof record.header;
+		m_offset += sizeof record.header + record.header.length;
+
+		return true;
+	}
+} // namespace forceinline::remote::diagnostics
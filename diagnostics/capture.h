@@ -0,0 +1,127 @@
+#pragma once
+#include <Windows.h>
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+
+/*
+	Traffic capture files. The file is append-only and written through a memory mapping:
+
+	[
+		capture_file_header_t
+		{ capture_record_header_t, char[ length ] data }...
+	]
+
+	Received data is recorded as it came off the socket/channel, including the handshake, so
+	replaying it over a new connection reproduces the exact byte stream. Sent data is recorded
+	frame by frame. All integers are little-endian.
+*/
+
+namespace forceinline::remote::diagnostics {
+	enum class capture_role : std::uint8_t {
+		server,
+		client
+	};
+
+	enum class capture_direction : std::uint8_t {
+		received,
+		sent
+	};
+
+	struct capture_file_header_t {
+		std::uint32_t magic = 0;
+		std::uint16_t version = 0;
+		capture_role role = capture_role::server;
+		std::uint8_t reserved = 0;
+
+		// When the capture started, in nanoseconds since the unix epoch
+		std::uint64_t start_time = 0;
+	};
+
+	struct capture_record_header_t {
+		// Nanoseconds since the capture started
+		std::uint64_t timestamp = 0;
+
+		// Socket of the client on the server, always 0 on a client
+		std::uint64_t connection = 0;
+
+		std::uint32_t length = 0;
+		capture_direction direction = capture_direction::received;
+		std::uint8_t reserved[ 3 ] = { };
+	};
+
+	constexpr std::uint32_t capture_magic = 0x50435246; // 'FRCP'
+	constexpr std::uint16_t capture_version = 1;
+
+	/*
+		The I/O threads only copy records into a staging buffer, a background thread moves them into
+		the mapped file. If the writer falls behind by more than max_buffered bytes, records are dropped
+		and counted instead of blocking the I/O threads.
+	*/
+	class capture_writer {
+	public:
+		capture_writer( const std::string& path, capture_role role, std::size_t max_buffered = 64 << 20 );
+		~capture_writer( );
+
+		void record( std::uint64_t connection, capture_direction direction, const char* data, std::size_t length );
+
+		std::uint64_t dropped_records( ) {
+			return m_dropped_records;
+		}
+
+	private:
+		void write_records( );
+
+		// Appends to the mapped file, growing it if needed
+		bool append( const char* data, std::size_t length );
+		bool map( std::uint64_t size );
+		void unmap( );
+
+		HANDLE m_file = INVALID_HANDLE_VALUE, m_mapping = NULL;
+		char* m_view = nullptr;
+		std::uint64_t m_mapped_size = 0, m_size = 0;
+
+		std::chrono::steady_clock::time_point m_start_time = { };
+		std::size_t m_max_buffered = 0;
+		std::atomic< std::uint64_t > m_dropped_records = 0;
+
+		std::mutex m_staging_mtx;
+		std::condition_variable m_staging_cv;
+		std::vector< char > m_staging = { };
+		bool m_stopping = false;
+
+		std::thread m_writer_thread;
+	};
+
+	struct capture_record_t {
+		capture_record_header_t header = { };
+		const char* data = nullptr;
+	};
+
+	// Reads a capture file through a read-only mapping
+	class capture_reader {
+	public:
+		capture_reader( const std::string& path );
+		~capture_reader( );
+
+		const capture_file_header_t& header( ) {
+			return m_header;
+		}
+
+		// Returns false at the end of the file or at a truncated record
+		bool next( capture_record_t& record );
+
+	private:
+		HANDLE m_file = INVALID_HANDLE_VALUE, m_mapping = NULL;
+		const char* m_view = nullptr;
+		std::uint64_t m_size = 0, m_offset = 0;
+
+		capture_file_header_t m_header = { };
+	};
+} // namespace forceinline::remote::diagnostics
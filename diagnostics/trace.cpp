@@ -0,0 +1,159 @@
+#include "trace.h"
+
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
+
+namespace forceinline::remote::diagnostics {
+	namespace {
+		std::atomic< std::uint64_t > g_tracer_counter = 0;
+
+		// Buffer of the tracer this thread recorded into last
+		struct thread_cache_t {
+			std::uint64_t tracer_id = 0;
+			void* buffer = nullptr;
+		};
+
+		thread_local thread_cache_t t_cache = { };
+
+		// Name of the span which ends with a stage
+		const char* span_name( trace_stage stage ) {
+			switch ( stage ) {
+				case trace_stage::process_lock: return "receive_queue";
+				case trace_stage::extracted: return "process_lock_wait";
+				case trace_stage::handler_begin: return "dispatch_queue";
+				case trace_stage::handler_end: return "handler";
+				case trace_stage::enqueued: return "handler";
+				case trace_stage::send_lock: return "outbound_queue";
+				case trace_stage::send_begin: return "send_lock_wait";
+				case trace_stage::send_end: return "send";
+				default: return "received";
+			}
+		}
+
+		struct exported_event_t {
+			trace_event_t event = { };
+			std::uint32_t thread_id = 0;
+		};
+	} // namespace
+
+	tracer::tracer( std::size_t events_per_thread ) {
+		// Round up to a power of two so the ring index is a mask
+		m_events_per_thread = 1;
+		while ( m_events_per_thread < events_per_thread )
+			m_events_per_thread <<= 1;
+
+		m_index_mask = m_events_per_thread - 1;
+		m_id = ++g_tracer_counter;
+
+		m_start_ticks = now( );
+		m_start_time = std::chrono::steady_clock::now( );
+	}
+
+	void tracer::set_sample_rate( std::uint32_t sample_rate ) {
+		m_sample_rate = sample_rate;
+	}
+
+	std::uint64_t& tracer::current( ) {
+		thread_local std::uint64_t trace_id = 0;
+		return trace_id;
+	}
+
+	tracer::thread_buffer_t* tracer::thread_buffer( ) {
+		if ( t_cache.tracer_id == m_id )
+			return static_cast< thread_buffer_t* >( t_cache.buffer );
+
+		std::lock_guard lock( m_buffer_mtx );
+
+		// The thread might have recorded into us before another tracer took over the cache
+		auto thread_id = std::uint32_t( GetCurrentThreadId( ) );
+		auto buffer_it = std::find_if( m_buffers.begin( ), m_buffers.end( ), [ thread_id ]( const auto& buffer ) {
+			return buffer->thread_id == thread_id;
+		} );
+
+		thread_buffer_t* buffer = nullptr;
+
+		if ( buffer_it == m_buffers.end( ) ) {
+			auto new_buffer = std::make_unique< thread_buffer_t >( );
+			new_buffer->thread_id = thread_id;
+			new_buffer->events = std::make_unique< trace_event_t[ ] >( m_events_per_thread );
+
+			buffer = new_buffer.get( );
+			m_buffers.push_back( std::move( new_buffer ) );
+		} else
+			buffer = buffer_it->get( );
+
+		t_cache = { m_id, buffer };
+		return buffer;
+	}
+
+	bool tracer::export_chrome_trace( const std::string& path ) {
+		std::vector< exported_event_t > events = { };
+
+		{
+			std::lock_guard lock( m_buffer_mtx );
+
+			for ( auto& buffer : m_buffers ) {
+				auto written = buffer->written.load( std::memory_order_acquire );
+				auto first = written > m_events_per_thread ? written - m_events_per_thread : 0;
+
+				std::vector< trace_event_t > copied( buffer->events.get( ), buffer->events.get( ) + m_events_per_thread );
+
+				// The thread kept recording while we copied, drop whatever it may have overwritten
+				auto written_after = buffer->written.load( std::memory_order_acquire );
+				if ( written_after >= m_events_per_thread )
+					first = std::max( first, written_after - m_events_per_thread + 1 );
+
+				for ( auto index = first; index < written; index++ )
+					events.push_back( { copied[ index & m_index_mask ], buffer->thread_id } );
+			}
+		}
+
+		// Calibrate the TSC against the steady clock, give it a few milliseconds if we were just created
+		auto elapsed = std::chrono::steady_clock::now( ) - m_start_time;
+		if ( elapsed < std::chrono::milliseconds( 10 ) ) {
+			std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) - elapsed );
+			elapsed = std::chrono::steady_clock::now( ) - m_start_time;
+		}
+
+		auto ticks_per_us = double( now( ) - m_start_ticks ) / std::chrono::duration< double, std::micro >( elapsed ).count( );
+		if ( ticks_per_us <= 0.0 )
+			return false;
+
+		auto to_us = [ & ]( std::uint64_t timestamp ) {
+			return double( std::int64_t( timestamp - m_start_ticks ) ) / ticks_per_us;
+		};
+
+		// Group the stages of every packet in the order they happened
+		std::stable_sort( events.begin( ), events.end( ), [ ]( const auto& lhs, const auto& rhs ) {
+			if ( lhs.event.trace_id != rhs.event.trace_id )
+				return lhs.event.trace_id < rhs.event.trace_id;
+
+			return lhs.event.timestamp < rhs.event.timestamp;
+		} );
+
+		std::ofstream file( path, std::ios::trunc );
+		if ( !file )
+			return false;
+
+		file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+		// One span per stage, from the previous stage of the same packet to this one, on the thread that ended it
+		for ( std::size_t i = 0; i < events.size( ); i++ ) {
+			auto& [ event, thread_id ] = events[ i ];
+
+			bool starts_trace = i == 0 || events[ i - 1 ].event.trace_id != event.trace_id;
+			auto begin = starts_trace ? to_us( event.timestamp ) : to_us( events[ i - 1 ].event.timestamp );
+			auto end = to_us( event.timestamp );
+
+			file << ( i == 0 ? "" : "," ) << "{\"name\":\"" << span_name( event.stage ) << "\",\"cat\":\"packet\""
+				<< ",\"ph\":\"" << ( starts_trace ? "i" : "X" ) << "\",\"s\":\"t\",\"pid\":1,\"tid\":" << thread_id
+				<< ",\"ts\":" << begin << ",\"dur\":" << std::max( 0.0, end - begin )
+				<< ",\"args\":{\"trace_id\":" << event.trace_id << ",\"packet_id\":" << event.packet_id << "}}";
+		}
+
+		file << "]}";
+		return bool( file );
+	}
+} // namespace forceinline::remote::diagnostics
@@ -0,0 +1,106 @@
+#pragma once
+#include <Windows.h>
+#include <intrin.h>
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace forceinline::remote::diagnostics {
+	// Pipeline stages a sampled packet passes through
+	enum class trace_stage : std::uint8_t {
+		received,		// recv returned the last bytes of the packet
+		process_lock,	// The process thread started waiting for the receive buffers
+		extracted,		// Taken out of the receive buffer
+		handler_begin,
+		handler_end,
+		enqueued,		// A response was queued for sending
+		send_lock,		// The send thread started waiting for the socket
+		send_begin,
+		send_end
+	};
+
+	struct trace_event_t {
+		std::uint64_t trace_id = 0;
+		std::uint64_t timestamp = 0; // TSC ticks
+		std::uint16_t packet_id = 0;
+		trace_stage stage = trace_stage::received;
+	};
+
+	/*
+		Sampled per-stage tracing. Every thread records into its own ring buffer, so recording a stage
+		is a couple of stores and never takes a lock. Packets which aren't sampled have a trace id of 0
+		and cost a single branch per stage. The buffers keep the most recent events_per_thread events.
+	*/
+	class tracer {
+	public:
+		tracer( std::size_t events_per_thread = 1 << 16 );
+
+		// Samples one in sample_rate packets, 0 turns tracing off
+		void set_sample_rate( std::uint32_t sample_rate );
+
+		bool enabled( ) {
+			return m_sample_rate.load( std::memory_order_relaxed ) != 0;
+		}
+
+		// Returns a trace id for the next packet, or 0 if it isn't sampled
+		std::uint64_t sample( ) {
+			auto sample_rate = m_sample_rate.load( std::memory_order_relaxed );
+			if ( sample_rate == 0 )
+				return 0;
+
+			auto count = m_sample_counter.fetch_add( 1, std::memory_order_relaxed );
+			return count % sample_rate == 0 ? count + 1 : 0;
+		}
+
+		static std::uint64_t now( ) {
+			return __rdtsc( );
+		}
+
+		// Records a stage of a sampled packet, does nothing for a trace id of 0
+		void record( std::uint64_t trace_id, std::uint16_t packet_id, trace_stage stage, std::uint64_t timestamp = now( ) ) {
+			if ( !trace_id )
+				return;
+
+			auto buffer = thread_buffer( );
+			auto index = buffer->written.load( std::memory_order_relaxed );
+
+			buffer->events[ index & m_index_mask ] = { trace_id, timestamp, packet_id, stage };
+			buffer->written.store( index + 1, std::memory_order_release );
+		}
+
+		// Trace id of the packet whose handler runs on this thread, so the responses it sends are traced too
+		static std::uint64_t& current( );
+
+		// Writes all recorded events as Chrome trace JSON (chrome://tracing, Perfetto). Can be called at any time.
+		bool export_chrome_trace( const std::string& path );
+
+	private:
+		struct thread_buffer_t {
+			std::uint32_t thread_id = 0;
+			std::atomic< std::uint64_t > written = 0;
+			std::unique_ptr< trace_event_t[ ] > events = nullptr;
+		};
+
+		thread_buffer_t* thread_buffer( );
+
+		// Distinguishes tracers in the per-thread cache, even if one is created where another one was
+		std::uint64_t m_id = 0;
+
+		std::atomic< std::uint32_t > m_sample_rate = 0;
+		std::atomic< std::uint64_t > m_sample_counter = 0;
+
+		std::size_t m_events_per_thread = 0, m_index_mask = 0;
+
+		// Used to convert TSC ticks to time on export
+		std::uint64_t m_start_ticks = 0;
+		std::chrono::steady_clock::time_point m_start_time = { };
+
+		std::mutex m_buffer_mtx;
+		std::vector< std::unique_ptr< thread_buffer_t > > m_buffers = { };
+	};
+} // namespace forceinline::remote::diagnostics
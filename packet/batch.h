@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <span>
+#include <type_traits>
+
+namespace forceinline::remote::packets {
+	namespace detail {
+		template < typename >
+		struct member_traits;
+
+		template < typename C, typename F >
+		struct member_traits< F C::* > {
+			using class_type = C;
+			using field_type = F;
+		};
+	} // namespace detail
+
+	/*
+		All packets of one id from one connection which were taken out of the receive buffer
+		together. The packet data is stored back to back in a single buffer.
+
+		Example usage in a batch handler:
+		auto positions = batch.as< packet_simple_t >( );			// every packet as a contiguous array
+		auto numbers = batch.column< &packet_simple_t::some_number >( );	// one field of every packet as an array
+	*/
+	class packet_batch {
+	public:
+		void add( const char* data, std::size_t size, std::uint8_t flags ) {
+			// Remember whether every packet so far had the same size, as( ) relies on it
+			if ( m_offsets.empty( ) )
+				m_packet_size = size;
+			else if ( size != m_packet_size )
+				m_same_size = false;
+
+			m_offsets.push_back( m_data.size( ) );
+			m_data.insert( m_data.end( ), data, data + size );
+			m_flags.push_back( flags );
+		}
+
+		// Amount of packets in this batch
+		std::size_t size( ) const {
+			return m_flags.size( );
+		}
+
+		bool empty( ) const {
+			return m_flags.empty( );
+		}
+
+		// Data of a single packet
+		std::span< const char > data( std::size_t index ) const {
+			auto end = index + 1 < m_offsets.size( ) ? m_offsets[ index + 1 ] : m_data.size( );
+			return std::span< const char >( m_data.data( ) + m_offsets[ index ], end - m_offsets[ index ] );
+		}
+
+		// Flags of a single packet, with the answer bit set if the packet has an identifier
+		std::uint8_t flags( std::size_t index ) const {
+			return m_flags[ index ];
+		}
+
+		/*
+			Views the data of a batch of simple_packet< T > as an array of T. The buffer is allocated with new
+			and every packet has the same size, so every element is properly aligned. Returns an empty span if
+			any packet does not have the size of T.
+		*/
+		template < typename T >
+		std::span< const T > as( ) const {
+			static_assert( std::is_trivially_copyable_v< T >, "packet_batch::as: T has to be trivially copyable" );
+
+			if ( empty( ) || !m_same_size || m_packet_size != sizeof T )
+				return { };
+
+			return std::span< const T >( reinterpret_cast< const T* >( m_data.data( ) ), size( ) );
+		}
+
+		// Gathers one field of every packet into its own array (struct-of-arrays), so handlers can vectorize over it
+		template < auto member >
+		auto column( ) const {
+			using class_type = typename detail::member_traits< decltype( member ) >::class_type;
+			using field_type = typename detail::member_traits< decltype( member ) >::field_type;
+
+			auto values = as< class_type >( );
+
+			std::vector< field_type > fields( values.size( ) );
+			for ( std::size_t i = 0; i < values.size( ); i++ )
+				fields[ i ] = values[ i ].*member;
+
+			return fields;
+		}
+
+		void clear( ) {
+			m_data.clear( );
+			m_offsets.clear( );
+			m_flags.clear( );
+			m_packet_size = 0;
+			m_same_size = true;
+		}
+
+	private:
+		std::vector< char > m_data = { };
+		std::vector< std::size_t > m_offsets = { };
+		std::vector< std::uint8_t > m_flags = { };
+
+		std::size_t m_packet_size = 0;
+		bool m_same_size = true;
+	};
+} // namespace forceinline::remote::packets
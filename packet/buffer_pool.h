@@ -0,0 +1,57 @@
+#pragma once
+#include <mutex>
+#include <vector>
+
+namespace forceinline::remote::packets {
+	/*
+		Receive buffers shared by all connections. A connection only borrows one while it has data in flight
+		and gives it back once everything was consumed, so idle connections own no buffer at all.
+	*/
+	class buffer_pool {
+	public:
+		// New buffers reserve buffer_capacity bytes, at most max_buffers no larger than max_capacity are kept around
+		buffer_pool( std::size_t buffer_capacity = 4096, std::size_t max_capacity = 64 * 1024, std::size_t max_buffers = 1024 )
+			: m_buffer_capacity( buffer_capacity ), m_max_capacity( max_capacity ), m_max_buffers( max_buffers ) { }
+
+		std::vector< char > acquire( ) {
+			{
+				std::lock_guard lock( m_mtx );
+
+				if ( !m_buffers.empty( ) ) {
+					auto buffer = std::move( m_buffers.back( ) );
+					m_buffers.pop_back( );
+
+					return buffer;
+				}
+			}
+
+			std::vector< char > buffer = { };
+			buffer.reserve( m_buffer_capacity );
+
+			return buffer;
+		}
+
+		// Takes the buffer's memory, the buffer is left empty without any capacity
+		void release( std::vector< char >& buffer ) {
+			std::vector< char > released = { };
+			released.swap( buffer );
+
+			// Buffers which grew for a large packet are freed instead of pinning that memory
+			if ( released.capacity( ) == 0 || released.capacity( ) > m_max_capacity )
+				return;
+
+			released.clear( );
+
+			std::lock_guard lock( m_mtx );
+
+			if ( m_buffers.size( ) < m_max_buffers )
+				m_buffers.push_back( std::move( released ) );
+		}
+
+	private:
+		std::size_t m_buffer_capacity = 0, m_max_capacity = 0, m_max_buffers = 0;
+
+		std::mutex m_mtx;
+		std::vector< std::vector< char > > m_buffers = { };
+	};
+} // namespace forceinline::remote::packets
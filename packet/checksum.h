@@ -0,0 +1,131 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#if defined( _M_X64 ) || defined( _M_IX86 )
+#include <intrin.h>
+#include <nmmintrin.h>
+#define FORCEINLINE_REMOTE_CRC32C_SSE42
+#endif
+
+namespace forceinline::remote::packets::checksum {
+	namespace detail {
+		// Reflected Castagnoli polynomial
+		constexpr std::uint32_t polynomial = 0x82F63B78;
+
+		// Slicing-by-8 tables for CPUs without SSE 4.2
+		constexpr std::array< std::array< std::uint32_t, 256 >, 8 > make_tables( ) {
+			std::array< std::array< std::uint32_t, 256 >, 8 > tables = { };
+
+			for ( std::uint32_t byte = 0; byte < 256; byte++ ) {
+				auto crc = byte;
+				for ( int bit = 0; bit < 8; bit++ )
+					crc = crc & 1 ? ( crc >> 1 ) ^ polynomial : crc >> 1;
+
+				tables[ 0 ][ byte ] = crc;
+			}
+
+			for ( std::uint32_t byte = 0; byte < 256; byte++ ) {
+				for ( std::size_t slice = 1; slice < 8; slice++ )
+					tables[ slice ][ byte ] = ( tables[ slice - 1 ][ byte ] >> 8 ) ^ tables[ 0 ][ tables[ slice - 1 ][ byte ] & 0xFF ];
+			}
+
+			return tables;
+		}
+
+		inline constexpr auto tables = make_tables( );
+
+		inline std::uint32_t update_portable( std::uint32_t crc, const char* data, std::size_t length ) {
+			for ( ; length >= 8; data += 8, length -= 8 ) {
+				std::uint32_t low = 0, high = 0;
+				memcpy( &low, data, sizeof low );
+				memcpy( &high, data + 4, sizeof high );
+
+				low ^= crc;
+				crc = tables[ 7 ][ low & 0xFF ] ^ tables[ 6 ][ ( low >> 8 ) & 0xFF ] ^ tables[ 5 ][ ( low >> 16 ) & 0xFF ] ^ tables[ 4 ][ low >> 24 ]
+					^ tables[ 3 ][ high & 0xFF ] ^ tables[ 2 ][ ( high >> 8 ) & 0xFF ] ^ tables[ 1 ][ ( high >> 16 ) & 0xFF ] ^ tables[ 0 ][ high >> 24 ];
+			}
+
+			for ( ; length > 0; data++, length-- )
+				crc = ( crc >> 8 ) ^ tables[ 0 ][ ( crc ^ std::uint8_t( *data ) ) & 0xFF ];
+
+			return crc;
+		}
+
+	#ifdef FORCEINLINE_REMOTE_CRC32C_SSE42
+		inline bool has_sse42( ) {
+			static const bool supported = [ ]( ) {
+				int info[ 4 ] = { };
+				__cpuid( info, 1 );
+
+				return ( info[ 2 ] & ( 1 << 20 ) ) != 0;
+			}( );
+
+			return supported;
+		}
+
+		// The crc32 instruction, 8 bytes at a time on x64
+		inline std::uint32_t update_sse42( std::uint32_t crc, const char* data, std::size_t length ) {
+		#ifdef _M_X64
+			std::uint64_t crc64 = crc;
+			for ( ; length >= 8; data += 8, length -= 8 ) {
+				std::uint64_t value = 0;
+				memcpy( &value, data, sizeof value );
+				crc64 = _mm_crc32_u64( crc64, value );
+			}
+
+			crc = std::uint32_t( crc64 );
+		#endif // _M_X64
+
+			for ( ; length >= 4; data += 4, length -= 4 ) {
+				std::uint32_t value = 0;
+				memcpy( &value, data, sizeof value );
+				crc = _mm_crc32_u32( crc, value );
+			}
+
+			for ( ; length > 0; data++, length-- )
+				crc = _mm_crc32_u8( crc, std::uint8_t( *data ) );
+
+			return crc;
+		}
+	#endif // FORCEINLINE_REMOTE_CRC32C_SSE42
+	} // namespace detail
+
+	// Bytes of the checksum which follows every frame on connections with wire::feature_checksum
+	constexpr std::size_t checksum_size = 4;
+
+	// CRC32C of data. Pass the result of a previous call as crc to continue it with more data
+	inline std::uint32_t crc32c( const char* data, std::size_t length, std::uint32_t crc = 0 ) {
+		crc = ~crc;
+
+	#ifdef FORCEINLINE_REMOTE_CRC32C_SSE42
+		if ( detail::has_sse42( ) )
+			return ~detail::update_sse42( crc, data, length );
+	#endif // FORCEINLINE_REMOTE_CRC32C_SSE42
+
+		return ~detail::update_portable( crc, data, length );
+	}
+
+	inline void write_checksum( std::uint32_t crc, char* out ) {
+		for ( std::size_t i = 0; i < checksum_size; i++ )
+			out[ i ] = char( ( crc >> ( i * 8 ) ) & 0xFF );
+	}
+
+	// Appends the checksum of everything in the frame
+	inline void append_checksum( std::vector< char >& frame ) {
+		auto crc = crc32c( frame.data( ), frame.size( ) );
+
+		frame.resize( frame.size( ) + checksum_size );
+		write_checksum( crc, frame.data( ) + frame.size( ) - checksum_size );
+	}
+
+	inline std::uint32_t read_checksum( const char* data ) {
+		std::uint32_t crc = 0;
+		for ( std::size_t i = 0; i < checksum_size; i++ )
+			crc |= std::uint32_t( std::uint8_t( data[ i ] ) ) << ( i * 8 );
+
+		return crc;
+	}
+} // namespace forceinline::remote::packets::checksum
@@ -0,0 +1,314 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <string_view>
+#include <algorithm>
+#include <unordered_map>
+#include "wire.h"
+
+/*
+	Small LZ4 block format codec used for payload compression.
+
+	A compressed payload looks like this:
+	[
+		x..		type : varint, ( uncompressed length << 1 ) | preset dictionary used
+		xx...	type : uint8[ ], LZ4 block
+	]
+
+	Preset dictionaries are set per packet id and have to be the same on both ends. They are
+	treated as data preceding the payload, so even the first bytes of a packet can be encoded
+	as matches. Use train_dictionary with a couple of real packets to build one.
+*/
+
+namespace forceinline::remote::packets::compression {
+	namespace detail {
+		constexpr int min_match = 4;
+		constexpr int last_literals = 5;
+		constexpr int match_find_limit = 12;
+		constexpr int max_offset = 0xFFFF;
+		constexpr int hash_log = 12;
+
+		inline std::uint32_t read32( const std::uint8_t* data ) {
+			std::uint32_t value = 0;
+			memcpy( &value, data, sizeof value );
+			return value;
+		}
+
+		inline std::uint32_t hash( std::uint32_t sequence ) {
+			return ( sequence * 2654435761u ) >> ( 32 - hash_log );
+		}
+
+		inline std::uint8_t* write_length( std::uint8_t* out, std::size_t length ) {
+			for ( ; length >= 255; length -= 255 )
+				*out++ = 255;
+
+			*out++ = std::uint8_t( length );
+			return out;
+		}
+
+		// Returns false if we ran out of input
+		inline bool read_length( const std::uint8_t*& in, const std::uint8_t* in_end, std::size_t& length ) {
+			std::uint8_t byte = 0;
+
+			do {
+				if ( in >= in_end )
+					return false;
+
+				byte = *in++;
+				length += byte;
+			} while ( byte == 255 );
+
+			return true;
+		}
+	} // namespace detail
+
+	// Decompressed size we accept by default, independent of how large frames may be
+	constexpr std::uint32_t default_max_decompressed_size = 16 * 1024 * 1024;
+
+	// Every byte of an LZ4 block produces at most 255 bytes of output
+	inline std::size_t decompress_bound( std::size_t size ) {
+		return size * 255 + 16;
+	}
+
+	inline std::size_t compress_bound( std::size_t size ) {
+		return size + size / 255 + 16;
+	}
+
+	// Returns the compressed size or 0 if it doesn't fit into capacity
+	inline std::size_t compress_block( const char* source, std::size_t source_size, char* destination, std::size_t capacity, const char* dictionary = nullptr, std::size_t dictionary_size = 0 ) {
+		using namespace detail;
+
+		// Only the last 64 KiB of a dictionary are reachable
+		if ( dictionary_size > max_offset ) {
+			dictionary += dictionary_size - max_offset;
+			dictionary_size = max_offset;
+		}
+
+		// Matches may reach back into the dictionary, so put both into one window
+		std::vector< std::uint8_t > window = { };
+		auto base = reinterpret_cast< const std::uint8_t* >( source );
+
+		if ( dictionary_size > 0 ) {
+			window.resize( dictionary_size + source_size );
+			memcpy( window.data( ), dictionary, dictionary_size );
+			memcpy( window.data( ) + dictionary_size, source, source_size );
+			base = window.data( );
+		}
+
+		auto input_start = dictionary_size, end = dictionary_size + source_size;
+		auto out = reinterpret_cast< std::uint8_t* >( destination ), out_end = out + capacity;
+
+		std::vector< std::uint32_t > table( std::size_t( 1 ) << hash_log, 0 );
+
+		// Prime the table with the dictionary
+		for ( std::size_t i = 0; i + min_match <= dictionary_size; i++ )
+			table[ hash( read32( base + i ) ) ] = std::uint32_t( i );
+
+		auto anchor = input_start, position = input_start;
+
+		while ( position + match_find_limit < end ) {
+			auto sequence = read32( base + position );
+			auto& slot = table[ hash( sequence ) ];
+			std::size_t candidate = slot;
+			slot = std::uint32_t( position );
+
+			if ( candidate >= position || position - candidate > max_offset || read32( base + candidate ) != sequence ) {
+				position++;
+				continue;
+			}
+
+			// Extend the match backwards into pending literals
+			while ( position > anchor && candidate > 0 && base[ position - 1 ] == base[ candidate - 1 ] ) {
+				position--;
+				candidate--;
+			}
+
+			// Extend forwards, the last bytes always have to be literals
+			std::size_t match_length = min_match;
+			while ( position + match_length < end - last_literals && base[ position + match_length ] == base[ candidate + match_length ] )
+				match_length++;
+
+			auto literal_length = position - anchor;
+			if ( std::size_t( out_end - out ) < 1 + literal_length + literal_length / 255 + 1 + 2 + match_length / 255 + 1 )
+				return 0;
+
+			auto token = out++;
+
+			if ( literal_length >= 15 ) {
+				*token = 15 << 4;
+				out = write_length( out, literal_length - 15 );
+			} else
+				*token = std::uint8_t( literal_length << 4 );
+
+			memcpy( out, base + anchor, literal_length );
+			out += literal_length;
+
+			auto offset = position - candidate;
+			*out++ = std::uint8_t( offset & 0xFF );
+			*out++ = std::uint8_t( offset >> 8 );
+
+			if ( match_length - min_match >= 15 ) {
+				*token |= 15;
+				out = write_length( out, match_length - min_match - 15 );
+			} else
+				*token |= std::uint8_t( match_length - min_match );
+
+			position += match_length;
+			anchor = position;
+
+			// Remember a position inside the match, helps with repetitive data
+			table[ hash( read32( base + position - 2 ) ) ] = std::uint32_t( position - 2 );
+		}
+
+		// Whatever is left is emitted as literals
+		auto literal_length = end - anchor;
+		if ( std::size_t( out_end - out ) < 1 + literal_length + literal_length / 255 + 1 )
+			return 0;
+
+		auto token = out++;
+
+		if ( literal_length >= 15 ) {
+			*token = 15 << 4;
+			out = write_length( out, literal_length - 15 );
+		} else
+			*token = std::uint8_t( literal_length << 4 );
+
+		memcpy( out, base + anchor, literal_length );
+		out += literal_length;
+
+		return std::size_t( out - reinterpret_cast< std::uint8_t* >( destination ) );
+	}
+
+	// Returns false if the block is malformed or does not decode to exactly destination_size bytes
+	inline bool decompress_block( const char* source, std::size_t source_size, char* destination, std::size_t destination_size, const char* dictionary = nullptr, std::size_t dictionary_size = 0 ) {
+		using namespace detail;
+
+		if ( dictionary_size > max_offset ) {
+			dictionary += dictionary_size - max_offset;
+			dictionary_size = max_offset;
+		}
+
+		auto in = reinterpret_cast< const std::uint8_t* >( source ), in_end = in + source_size;
+		auto out_start = reinterpret_cast< std::uint8_t* >( destination ), out = out_start, out_end = out + destination_size;
+		auto dictionary_end = reinterpret_cast< const std::uint8_t* >( dictionary ) + dictionary_size;
+
+		while ( in < in_end ) {
+			auto token = *in++;
+
+			std::size_t literal_length = token >> 4;
+			if ( literal_length == 15 && !read_length( in, in_end, literal_length ) )
+				return false;
+
+			if ( literal_length > std::size_t( in_end - in ) || literal_length > std::size_t( out_end - out ) )
+				return false;
+
+			memcpy( out, in, literal_length );
+			in += literal_length;
+			out += literal_length;
+
+			// The last sequence only has literals
+			if ( in == in_end )
+				break;
+
+			if ( in_end - in < 2 )
+				return false;
+
+			std::size_t offset = in[ 0 ] | ( in[ 1 ] << 8 );
+			in += 2;
+
+			std::size_t match_length = token & 15;
+			if ( match_length == 15 && !read_length( in, in_end, match_length ) )
+				return false;
+
+			match_length += min_match;
+
+			auto produced = std::size_t( out - out_start );
+			if ( offset == 0 || offset > produced + dictionary_size || match_length > std::size_t( out_end - out ) )
+				return false;
+
+			if ( offset <= produced && offset >= match_length )
+				memcpy( out, out - offset, match_length );
+			else {
+				// Overlapping or reaching into the dictionary, copy byte by byte
+				for ( std::size_t i = 0; i < match_length; i++ ) {
+					auto from = std::ptrdiff_t( produced + i ) - std::ptrdiff_t( offset );
+					out[ i ] = from >= 0 ? out_start[ from ] : dictionary_end[ from ];
+				}
+			}
+
+			out += match_length;
+		}
+
+		return out == out_end;
+	}
+
+	// Compresses a payload, returns false if compression would not make it smaller
+	inline bool compress_payload( const char* data, std::size_t size, const std::vector< char >* dictionary, std::vector< char >& out ) {
+		char prefix[ 5 ] = { };
+		auto prefix_length = wire::write_varint( std::uint32_t( size << 1 ) | ( dictionary ? 1 : 0 ), prefix );
+
+		out.resize( prefix_length + compress_bound( size ) );
+		memcpy( out.data( ), prefix, prefix_length );
+
+		auto compressed_size = compress_block( data, size, out.data( ) + prefix_length, out.size( ) - prefix_length,
+			dictionary ? dictionary->data( ) : nullptr, dictionary ? dictionary->size( ) : 0 );
+
+		if ( compressed_size == 0 || prefix_length + compressed_size >= size )
+			return false;
+
+		out.resize( prefix_length + compressed_size );
+		return true;
+	}
+
+	inline bool decompress_payload( const char* data, std::size_t size, const std::vector< char >* dictionary, std::vector< char >& out, std::uint32_t max_size ) {
+		std::uint32_t prefix = 0;
+		auto prefix_length = wire::read_varint( data, size, prefix );
+
+		if ( prefix_length <= 0 || ( prefix >> 1 ) > max_size )
+			return false;
+
+		// Don't allocate whatever size the sender claims if the block can't possibly expand to it
+		if ( ( prefix >> 1 ) > decompress_bound( size - prefix_length ) )
+			return false;
+
+		// The sender used a dictionary we don't have
+		bool uses_dictionary = prefix & 1;
+		if ( uses_dictionary && !dictionary )
+			return false;
+
+		out.resize( prefix >> 1 );
+		return decompress_block( data + prefix_length, size - prefix_length, out.data( ), out.size( ),
+			uses_dictionary ? dictionary->data( ) : nullptr, uses_dictionary ? dictionary->size( ) : 0 );
+	}
+
+	/*
+		Builds a preset dictionary from sample packets by collecting the byte sequences which occur
+		most often across them. The most frequent ones go last so they end up with the shortest offsets.
+	*/
+	inline std::vector< char > train_dictionary( const std::vector< std::vector< char > >& samples, std::size_t max_size = 16 * 1024 ) {
+		constexpr std::size_t segment_size = 8;
+
+		std::unordered_map< std::string_view, std::uint32_t > counts = { };
+		for ( auto& sample : samples ) {
+			for ( std::size_t i = 0; i + segment_size <= sample.size( ); i++ )
+				counts[ std::string_view( sample.data( ) + i, segment_size ) ]++;
+		}
+
+		std::vector< std::pair< std::string_view, std::uint32_t > > segments( counts.begin( ), counts.end( ) );
+		std::sort( segments.begin( ), segments.end( ), [ ]( const auto& a, const auto& b ) {
+			return a.second > b.second;
+		} );
+
+		// A segment seen only once won't help
+		std::vector< std::string_view > selected = { };
+		for ( std::size_t i = 0; i < segments.size( ) && segments[ i ].second > 1 && ( selected.size( ) + 1 ) * segment_size <= max_size; i++ )
+			selected.push_back( segments[ i ].first );
+
+		std::vector< char > dictionary = { };
+		for ( auto it = selected.rbegin( ); it != selected.rend( ); it++ )
+			dictionary.insert( dictionary.end( ), it->begin( ), it->end( ) );
+
+		return dictionary;
+	}
+} // namespace forceinline::remote::packets::compression
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include "wire.h"
+
+/*
+	Datagram channel, used with packets::wire::feature_datagram ( x = 1 byte, integers are little-endian )
+	[
+		xxxxxxxx	type : uint64, token the server gave the connection
+	]
+	followed by any number of frames:
+	[
+		xxxx		type : uint32, sequence number of the packet among the packets of its id
+		x..			frame header (see wire.h), frame flags are always 0
+		xx...		packet data
+	]
+
+	The server sends the token over TCP with token_packet_id once the handshake is done. A datagram without
+	frames binds the address it came from to the connection of its token, the server answers it with one.
+	Packets older than the latest one of their id which arrived already are stale and dropped.
+*/
+
+namespace forceinline::remote::packets::datagram {
+	// Carries the token over TCP, a token of 0 means the channel can't be used (anymore)
+	constexpr std::uint16_t token_packet_id = 0xFFFC;
+
+	// Stays below the usual path MTU after IP and UDP headers, so datagrams are never fragmented
+	constexpr std::size_t max_datagram_size = 1200;
+
+	constexpr std::size_t token_size = 8;
+	constexpr std::size_t sequence_size = 4;
+
+	// Largest packet data which still fits into a datagram on its own, bigger packets go over TCP
+	constexpr std::uint32_t max_packet_size = std::uint32_t( max_datagram_size - token_size - sequence_size - wire::max_header_size );
+
+	inline void write_token( std::uint64_t token, char* out ) {
+		for ( int i = 0; i < 8; i++ )
+			out[ i ] = char( ( token >> ( 8 * i ) ) & 0xFF );
+	}
+
+	inline std::uint64_t read_token( const char* data ) {
+		std::uint64_t token = 0;
+		for ( int i = 0; i < 8; i++ )
+			token |= std::uint64_t( std::uint8_t( data[ i ] ) ) << ( 8 * i );
+
+		return token;
+	}
+
+	// Packs frames into as few datagrams as possible
+	struct outbox_t {
+		std::vector< std::vector< char > > datagrams = { };
+
+		bool empty( ) const {
+			return datagrams.empty( );
+		}
+
+		void append( std::uint64_t token, std::uint32_t sequence, const wire::frame_header_t& header, const char* data ) {
+			char frame_header[ sequence_size + wire::max_header_size ] = { };
+			for ( int i = 0; i < 4; i++ )
+				frame_header[ i ] = char( ( sequence >> ( 8 * i ) ) & 0xFF );
+
+			auto frame_header_length = sequence_size + wire::encode_header( header, frame_header + sequence_size );
+
+			// Start a new datagram once the frame doesn't fit into the last one anymore
+			if ( datagrams.empty( ) || datagrams.back( ).size( ) + frame_header_length + header.packet_size > max_datagram_size ) {
+				datagrams.emplace_back( token_size );
+				datagrams.back( ).reserve( max_datagram_size );
+				write_token( token, datagrams.back( ).data( ) );
+			}
+
+			auto& datagram = datagrams.back( );
+			datagram.insert( datagram.end( ), frame_header, frame_header + frame_header_length );
+			datagram.insert( datagram.end( ), data, data + header.packet_size );
+		}
+	};
+
+	// Latest sequence number received per packet id
+	struct receiver_t {
+		std::unordered_map< std::uint16_t, std::uint32_t > latest = { };
+
+		// Whether the packet is newer than the latest of its id, sequence numbers wrap around
+		bool accept( std::uint16_t packet_id, std::uint32_t sequence ) {
+			auto [ latest_it, inserted ] = latest.try_emplace( packet_id, sequence );
+			if ( inserted )
+				return true;
+
+			if ( std::int32_t( sequence - latest_it->second ) <= 0 )
+				return false;
+
+			latest_it->second = sequence;
+			return true;
+		}
+	};
+
+	// Calls handler( header, data ) for every frame of a datagram which is not stale. Returns false if the datagram is malformed
+	template < typename handler_t >
+	bool read_frames( const char* data, std::size_t length, receiver_t& receiver, handler_t&& handler ) {
+		for ( std::size_t offset = token_size; offset < length; ) {
+			if ( length - offset < sequence_size )
+				return false;
+
+			std::uint32_t sequence = 0;
+			for ( int i = 0; i < 4; i++ )
+				sequence |= std::uint32_t( std::uint8_t( data[ offset + i ] ) ) << ( 8 * i );
+
+			offset += sequence_size;
+
+			wire::frame_header_t header = { };
+			auto header_length = wire::decode_header( data + offset, length - offset, header );
+
+			if ( header_length <= 0 || header.frame_flags || length - offset - header_length < header.packet_size )
+				return false;
+
+			offset += header_length;
+
+			if ( receiver.accept( header.packet_id, sequence ) )
+				handler( header, data + offset );
+
+			offset += header.packet_size;
+		}
+
+		return true;
+	}
+} // namespace forceinline::remote::packets::datagram
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace forceinline::remote::packets::delta {
+	/*
+		Delta encoding for fixed-size packets which are sent over and over with only a few fields changing.
+		The packet data is split into chunks; a delta frame carries a bitmask of the chunks which changed
+		since the previous packet of the same id on the connection, followed by only those chunks. Every
+		keyframe_interval packets (and whenever the size changes) the whole packet is sent as a keyframe.
+
+		Data of a frame with wire::frame_flag_delta:
+		keyframe: [ uint8 frame_keyframe, char[ size ] data ]
+		delta:    [ uint8 frame_delta, uint8[ ( chunks + 7 ) / 8 ] changed_mask, char[ ] changed_chunks ]
+	*/
+	constexpr std::size_t chunk_size = 4;
+	constexpr std::uint32_t default_keyframe_interval = 32;
+
+	enum frame_kind : std::uint8_t {
+		frame_keyframe,
+		frame_delta
+	};
+
+	// Last packet the sender sent for a packet id
+	struct sender_state_t {
+		std::vector< char > last = { };
+		std::uint32_t since_keyframe = 0;
+	};
+
+	inline std::size_t chunk_count( std::size_t size ) {
+		return ( size + chunk_size - 1 ) / chunk_size;
+	}
+
+	// Encodes data against the last sent packet and remembers it for the next one
+	inline void encode( sender_state_t& state, const char* data, std::size_t size, std::uint32_t keyframe_interval, std::vector< char >& out ) {
+		out.clear( );
+
+		auto chunks = chunk_count( size );
+		auto mask_size = ( chunks + 7 ) / 8;
+
+		bool keyframe = state.last.size( ) != size || state.since_keyframe + 1 >= keyframe_interval;
+
+		if ( !keyframe ) {
+			out.resize( 1 + mask_size );
+			out[ 0 ] = char( frame_delta );
+
+			for ( std::size_t chunk = 0; chunk < chunks; chunk++ ) {
+				auto offset = chunk * chunk_size;
+				auto length = std::min( chunk_size, size - offset );
+
+				if ( !memcmp( data + offset, state.last.data( ) + offset, length ) )
+					continue;
+
+				out[ 1 + chunk / 8 ] |= char( 1 << ( chunk % 8 ) );
+				out.insert( out.end( ), data + offset, data + offset + length );
+			}
+
+			// Everything changed, a keyframe is just as small and resets the interval
+			keyframe = out.size( ) >= 1 + size;
+		}
+
+		if ( keyframe ) {
+			out.resize( 1 + size );
+			out[ 0 ] = char( frame_keyframe );
+			memcpy( out.data( ) + 1, data, size );
+
+			state.since_keyframe = 0;
+		} else
+			state.since_keyframe++;
+
+		state.last.assign( data, data + size );
+	}
+
+	// Rebuilds a packet from a keyframe or a delta against base, which is updated. Returns false if the data is malformed
+	inline bool decode( std::vector< char >& base, const char* data, std::size_t size, std::vector< char >& out ) {
+		if ( size < 1 )
+			return false;
+
+		if ( std::uint8_t( data[ 0 ] ) == frame_keyframe ) {
+			base.assign( data + 1, data + size );
+			out = base;
+			return true;
+		}
+
+		// A delta without a keyframe before it can't be applied
+		if ( std::uint8_t( data[ 0 ] ) != frame_delta || base.empty( ) )
+			return false;
+
+		auto chunks = chunk_count( base.size( ) );
+		auto mask_size = ( chunks + 7 ) / 8;
+
+		if ( size < 1 + mask_size )
+			return false;
+
+		auto mask = data + 1;
+		auto changed = data + 1 + mask_size;
+		auto end = data + size;
+
+		for ( std::size_t chunk = 0; chunk < chunks; chunk++ ) {
+			if ( !( mask[ chunk / 8 ] & ( 1 << ( chunk % 8 ) ) ) )
+				continue;
+
+			auto offset = chunk * chunk_size;
+			auto length = std::min( chunk_size, base.size( ) - offset );
+
+			if ( std::size_t( end - changed ) < length )
+				return false;
+
+			memcpy( base.data( ) + offset, changed, length );
+			changed += length;
+		}
+
+		if ( changed != end )
+			return false;
+
+		out = base;
+		return true;
+	}
+} // namespace forceinline::remote::packets::delta
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+namespace forceinline::remote::packets::hash {
+	namespace detail {
+		constexpr std::uint64_t prime_1 = 0x9E3779B185EBCA87ull;
+		constexpr std::uint64_t prime_2 = 0xC2B2AE3D27D4EB4Full;
+		constexpr std::uint64_t prime_3 = 0x165667B19E3779F9ull;
+		constexpr std::uint64_t prime_4 = 0x85EBCA77C2B2AE63ull;
+		constexpr std::uint64_t prime_5 = 0x27D4EB2F165667C5ull;
+
+		inline std::uint64_t rotl( std::uint64_t value, int bits ) {
+			return ( value << bits ) | ( value >> ( 64 - bits ) );
+		}
+
+		inline std::uint64_t read64( const char* data ) {
+			std::uint64_t value = 0;
+			memcpy( &value, data, sizeof value );
+			return value;
+		}
+
+		inline std::uint32_t read32( const char* data ) {
+			std::uint32_t value = 0;
+			memcpy( &value, data, sizeof value );
+			return value;
+		}
+
+		inline std::uint64_t round( std::uint64_t accumulator, std::uint64_t input ) {
+			accumulator += input * prime_2;
+			return rotl( accumulator, 31 ) * prime_1;
+		}
+
+		inline std::uint64_t merge_round( std::uint64_t accumulator, std::uint64_t value ) {
+			accumulator ^= round( 0, value );
+			return accumulator * prime_1 + prime_4;
+		}
+	} // namespace detail
+
+	// XXH64, fast enough to hash every request of a cached packet id
+	inline std::uint64_t xxh64( const char* data, std::size_t length, std::uint64_t seed = 0 ) {
+		using namespace detail;
+
+		auto end = data + length;
+		std::uint64_t result = 0;
+
+		if ( length >= 32 ) {
+			std::uint64_t v1 = seed + prime_1 + prime_2, v2 = seed + prime_2, v3 = seed, v4 = seed - prime_1;
+
+			for ( ; data + 32 <= end; data += 32 ) {
+				v1 = round( v1, read64( data ) );
+				v2 = round( v2, read64( data + 8 ) );
+				v3 = round( v3, read64( data + 16 ) );
+				v4 = round( v4, read64( data + 24 ) );
+			}
+
+			result = rotl( v1, 1 ) + rotl( v2, 7 ) + rotl( v3, 12 ) + rotl( v4, 18 );
+			result = merge_round( result, v1 );
+			result = merge_round( result, v2 );
+			result = merge_round( result, v3 );
+			result = merge_round( result, v4 );
+		} else
+			result = seed + prime_5;
+
+		result += std::uint64_t( length );
+
+		for ( ; data + 8 <= end; data += 8 )
+			result = rotl( result ^ round( 0, read64( data ) ), 27 ) * prime_1 + prime_4;
+
+		if ( data + 4 <= end ) {
+			result = rotl( result ^ ( std::uint64_t( read32( data ) ) * prime_1 ), 23 ) * prime_2 + prime_3;
+			data += 4;
+		}
+
+		for ( ; data < end; data++ )
+			result = rotl( result ^ ( std::uint64_t( std::uint8_t( *data ) ) * prime_5 ), 11 ) * prime_1;
+
+		result ^= result >> 33;
+		result *= prime_2;
+		result ^= result >> 29;
+		result *= prime_3;
+		result ^= result >> 32;
+
+		return result;
+	}
+} // namespace forceinline::remote::packets::hash
@@ -1,7 +1,7 @@
 #pragma once
 
 /*
-	Example packet layout( x = 1 byte )
+	Legacy packet layout( x = 1 byte ), protocol version 2 is described in wire.h
 	[
 		xx		type : uint16, specifies packet id
 		xx		type : uint16, specifies packet data length
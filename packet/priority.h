@@ -0,0 +1,150 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <memory>
+
+namespace forceinline::remote::packets {
+	/*
+		Priority classes, configured per packet id. Each class has its own outbound queue per connection
+		and received packets are dispatched in this order, so a heartbeat does not have to wait behind
+		megabytes of bulk data.
+	*/
+	enum class packet_priority : std::uint8_t {
+		control,	// Always sent and dispatched first
+		high,
+		normal,		// Used for packets without a configured priority
+		bulk
+	};
+
+	constexpr std::size_t packet_priority_count = 4;
+
+	// How many frames a class may send in a row before lower classes get their turn. Control is strict.
+	constexpr std::uint32_t packet_priority_weights[ packet_priority_count ] = { 0, 8, 4, 1 };
+
+	// Outbound frames of one connection, one queue per priority class
+	class outbound_lanes {
+	public:
+		// The trace id travels with the frame, see diagnostics/trace.h
+		void push( packet_priority priority, std::vector< char > frame, std::uint64_t trace_id = 0 ) {
+			m_bytes += frame.size( );
+			m_lanes[ std::size_t( priority ) ].push_back( { std::move( frame ), trace_id } );
+		}
+
+		/*
+			Queues a frame which is shared with other connections, it is only copied once it is sent. With a
+			conflation key, a frame with the same key which is still queued is replaced instead. Returns false
+			if the frame replaced another one.
+		*/
+		bool push_shared( packet_priority priority, std::shared_ptr< const std::vector< char > > frame, std::uint64_t conflation_key = 0, std::uint64_t trace_id = 0 ) {
+			auto& lane = m_lanes[ std::size_t( priority ) ];
+
+			if ( conflation_key ) {
+				for ( auto it = lane.rbegin( ); it != lane.rend( ); it++ ) {
+					if ( it->conflation_key != conflation_key )
+						continue;
+
+					m_bytes += frame->size( );
+					m_bytes -= it->size( );
+
+					it->shared = std::move( frame );
+					it->trace_id = trace_id;
+					return false;
+				}
+			}
+
+			m_bytes += frame->size( );
+			lane.push_back( { { }, trace_id, std::move( frame ), conflation_key } );
+			return true;
+		}
+
+		bool pop( std::vector< char >& frame ) {
+			std::uint64_t trace_id = 0;
+			return pop( frame, trace_id );
+		}
+
+		// Takes the next frame to send: control first, the other classes by weighted round-robin
+		bool pop( std::vector< char >& frame, std::uint64_t& trace_id ) {
+			if ( !m_lanes[ 0 ].empty( ) )
+				return take( 0, frame, trace_id );
+
+			for ( int round = 0; round < 2; round++ ) {
+				for ( std::size_t lane = 1; lane < packet_priority_count; lane++ ) {
+					if ( m_lanes[ lane ].empty( ) || m_served[ lane ] >= packet_priority_weights[ lane ] )
+						continue;
+
+					m_served[ lane ]++;
+					return take( lane, frame, trace_id );
+				}
+
+				// Every class with frames used up its turn, start a new round
+				for ( auto& served : m_served )
+					served = 0;
+			}
+
+			return false;
+		}
+
+		bool empty( ) {
+			for ( auto& lane : m_lanes ) {
+				if ( !lane.empty( ) )
+					return false;
+			}
+
+			return true;
+		}
+
+		// Amount of bytes waiting to be sent
+		std::size_t bytes( ) {
+			return m_bytes;
+		}
+
+		std::size_t frames( ) {
+			std::size_t frames = 0;
+			for ( auto& lane : m_lanes )
+				frames += lane.size( );
+
+			return frames;
+		}
+
+		void clear( ) {
+			for ( auto& lane : m_lanes )
+				lane.clear( );
+
+			m_bytes = 0;
+		}
+
+	private:
+		struct queued_frame_t {
+			std::vector< char > data = { };
+			std::uint64_t trace_id = 0;
+
+			// Set instead of data for frames shared between connections
+			std::shared_ptr< const std::vector< char > > shared = nullptr;
+			std::uint64_t conflation_key = 0;
+
+			std::size_t size( ) const {
+				return shared ? shared->size( ) : data.size( );
+			}
+		};
+
+		bool take( std::size_t lane, std::vector< char >& frame, std::uint64_t& trace_id ) {
+			auto& queued = m_lanes[ lane ].front( );
+
+			if ( queued.shared )
+				frame = *queued.shared;
+			else
+				frame = std::move( queued.data );
+
+			trace_id = queued.trace_id;
+			m_lanes[ lane ].pop_front( );
+			m_bytes -= frame.size( );
+
+			return true;
+		}
+
+		std::deque< queued_frame_t > m_lanes[ packet_priority_count ] = { };
+		std::uint32_t m_served[ packet_priority_count ] = { };
+		std::size_t m_bytes = 0;
+	};
+} // namespace forceinline::remote::packets
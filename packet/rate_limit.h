@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+namespace forceinline::remote::packets {
+	struct rate_limit_t {
+		// Sustained amount per second, 0 for no limit
+		double rate = 0.0;
+
+		// How much can be used at once after being idle, 0 for one second worth of rate
+		double burst = 0.0;
+	};
+
+	enum class limit_action : std::uint8_t {
+		// Over-limit packets stay in the receive buffer until there are tokens again. Later packets of the
+		// connection wait behind them, so their order is kept
+		delay,
+
+		// Over-limit packets are dropped
+		shed
+	};
+
+	struct admission_options_t {
+		// Packets per connection, the limits of packet ids (set_rate_limit) apply on top of this
+		rate_limit_t packets = { };
+
+		// Received bytes per connection, we stop reading from a connection while it is over its limit
+		rate_limit_t bytes = { };
+
+		limit_action action = limit_action::delay;
+
+		// Stop reading from a connection while it has more bytes than this waiting to be processed, 0 for no limit
+		std::size_t max_buffered_bytes = 0;
+
+		// Packets of a single connection dispatched per round, 0 for no limit
+		std::uint32_t dispatch_budget = 0;
+
+		// Packets of all connections together dispatched per round, 0 for no limit
+		std::uint32_t max_round_packets = 0;
+	};
+
+	// Classic token bucket. Tokens refill at the rate of its limit, up to its burst
+	class token_bucket {
+	public:
+		token_bucket( ) = default;
+
+		token_bucket( const rate_limit_t& limit ) : m_limit( limit ), m_last_refill( std::chrono::steady_clock::now( ) ) {
+			m_tokens = capacity( );
+		}
+
+		bool limited( ) const {
+			return m_limit.rate > 0.0;
+		}
+
+		// Whether there are at least this many tokens
+		bool available( double tokens, std::chrono::steady_clock::time_point now ) {
+			if ( !limited( ) )
+				return true;
+
+			refill( now );
+			return m_tokens >= tokens;
+		}
+
+		// Takes tokens even if there are not enough of them. The debt is paid back before anything is available again
+		void take( double tokens, std::chrono::steady_clock::time_point now ) {
+			if ( !limited( ) )
+				return;
+
+			refill( now );
+			m_tokens -= tokens;
+		}
+
+	private:
+		double capacity( ) const {
+			return m_limit.burst > 0.0 ? m_limit.burst : std::max( m_limit.rate, 1.0 );
+		}
+
+		void refill( std::chrono::steady_clock::time_point now ) {
+			if ( now <= m_last_refill )
+				return;
+
+			auto elapsed = std::chrono::duration< double >( now - m_last_refill ).count( );
+			m_tokens = std::min( capacity( ), m_tokens + elapsed * m_limit.rate );
+			m_last_refill = now;
+		}
+
+		rate_limit_t m_limit = { };
+		double m_tokens = 0.0;
+		std::chrono::steady_clock::time_point m_last_refill = { };
+	};
+} // namespace forceinline::remote::packets
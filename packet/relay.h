@@ -0,0 +1,25 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace forceinline::remote::packets {
+	enum class relay_balance : std::uint8_t {
+		// All packets of a connection go to the same upstream while it is connected, so their order is kept
+		connection,
+
+		// Every packet goes to the next upstream in turn
+		round_robin
+	};
+
+	struct relay_route_t {
+		// Endpoint URIs of the servers packets are forwarded to (see transport/endpoint.h)
+		std::vector< std::string > upstreams = { };
+
+		relay_balance balance = relay_balance::connection;
+
+		// Requests whose response did not arrive within this time are forgotten, the client times out on its own
+		std::chrono::milliseconds timeout = std::chrono::seconds( 5 );
+	};
+} // namespace forceinline::remote::packets
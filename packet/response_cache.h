@@ -0,0 +1,115 @@
+#pragma once
+#include <list>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <unordered_map>
+
+#include "wire.h"
+
+namespace forceinline::remote::packets {
+	struct cached_response_t {
+		wire::frame_header_t header = { };
+
+		// The response carried the identifier of its request, a hit answers with the identifier of the new request
+		bool answer = false;
+
+		std::vector< char > data = { };
+
+		// Compressed once when it is stored, empty if compression is off or did not pay off
+		std::vector< char > compressed = { };
+	};
+
+	struct cache_entry_t {
+		std::uint16_t packet_id = 0;
+
+		// Compared on every hit, so a hash collision can never return the wrong responses
+		std::vector< char > request = { };
+		std::vector< cached_response_t > responses = { };
+
+		std::chrono::steady_clock::time_point expires = { };
+
+		std::size_t size( ) const {
+			auto bytes = sizeof( cache_entry_t ) + request.size( );
+			for ( auto& response : responses )
+				bytes += sizeof( cached_response_t ) + response.data.size( ) + response.compressed.size( );
+
+			return bytes;
+		}
+	};
+
+	// Responses keyed by a hash of their request, evicts the least recently used entries once it holds too many bytes
+	class response_cache {
+	public:
+		void set_capacity( std::size_t max_bytes ) {
+			m_capacity = max_bytes;
+			evict( );
+		}
+
+		// Returns nullptr on a miss, expired entries are dropped
+		std::shared_ptr< const cache_entry_t > find( std::uint64_t key, std::uint16_t packet_id, const char* request, std::size_t size, std::chrono::steady_clock::time_point now ) {
+			auto entry_it = m_entries.find( key );
+			if ( entry_it == m_entries.end( ) )
+				return nullptr;
+
+			auto& [ entry, order_it ] = entry_it->second;
+
+			if ( entry->expires <= now ) {
+				erase( entry_it );
+				return nullptr;
+			}
+
+			if ( entry->packet_id != packet_id || entry->request.size( ) != size || memcmp( entry->request.data( ), request, size ) != 0 )
+				return nullptr;
+
+			// Most recently used entries live at the front
+			m_order.splice( m_order.begin( ), m_order, order_it );
+			return entry;
+		}
+
+		void insert( std::uint64_t key, std::shared_ptr< const cache_entry_t > entry ) {
+			if ( auto entry_it = m_entries.find( key ); entry_it != m_entries.end( ) )
+				erase( entry_it );
+
+			auto size = entry->size( );
+			if ( size > m_capacity )
+				return;
+
+			m_order.push_front( key );
+			m_entries.emplace( key, std::make_pair( std::move( entry ), m_order.begin( ) ) );
+			m_size += size;
+
+			evict( );
+		}
+
+		// Drops every entry of a packet id, 0 drops everything
+		void invalidate( std::uint16_t packet_id ) {
+			for ( auto entry_it = m_entries.begin( ); entry_it != m_entries.end( ); ) {
+				if ( !packet_id || entry_it->second.first->packet_id == packet_id )
+					entry_it = erase( entry_it );
+				else
+					++entry_it;
+			}
+		}
+
+	private:
+		using entry_map_t = std::unordered_map< std::uint64_t, std::pair< std::shared_ptr< const cache_entry_t >, std::list< std::uint64_t >::iterator > >;
+
+		entry_map_t::iterator erase( entry_map_t::iterator entry_it ) {
+			m_size -= entry_it->second.first->size( );
+			m_order.erase( entry_it->second.second );
+			return m_entries.erase( entry_it );
+		}
+
+		void evict( ) {
+			while ( m_size > m_capacity && !m_order.empty( ) )
+				erase( m_entries.find( m_order.back( ) ) );
+		}
+
+		std::size_t m_capacity = 64 * 1024 * 1024, m_size = 0;
+
+		std::list< std::uint64_t > m_order = { };
+		entry_map_t m_entries = { };
+	};
+} // namespace forceinline::remote::packets
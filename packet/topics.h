@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include "packet_base.h"
+
+namespace forceinline::remote::packets {
+	/*
+		Clients subscribe to and unsubscribe from topics with these packet ids, the data of the packet is
+		the name of the topic. Don't use them for your own packets.
+	*/
+	constexpr std::uint16_t subscribe_packet_id = 0xFFFE;
+	constexpr std::uint16_t unsubscribe_packet_id = 0xFFFD;
+
+	constexpr std::size_t max_topic_length = 0xFF;
+
+	struct topic_options_t {
+		// Subscribers only get the latest packet of the topic which is still waiting to be sent to them
+		bool conflate = false;
+
+		// Subscribers with more bytes than this waiting to be sent are slow and skipped, 0 for no limit
+		std::size_t max_queued_bytes = 0;
+
+		// Disconnect slow subscribers instead of skipping them
+		bool disconnect_slow = false;
+	};
+
+	// Carries a topic name for the packet ids above
+	template < std::uint16_t pkt_id >
+	class topic_packet : public packet_base::base_packet {
+	public:
+		topic_packet( std::string_view topic ) : m_topic( topic.substr( 0, max_topic_length ) ) { }
+
+		virtual char* data( ) {
+			return m_topic.data( );
+		}
+
+		virtual std::uint16_t size( ) {
+			return std::uint16_t( m_topic.size( ) );
+		}
+
+		virtual void read( const std::vector< char >& buffer ) {
+			m_topic.assign( buffer.data( ), std::min( buffer.size( ), max_topic_length ) );
+		}
+
+		virtual std::uint16_t id( ) {
+			return pkt_id;
+		}
+
+		const std::string& topic( ) {
+			return m_topic;
+		}
+
+	private:
+		std::string m_topic = "";
+	};
+} // namespace forceinline::remote::packets
@@ -0,0 +1,233 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "packet_base.h"
+
+/*
+	Wire format, protocol version 2 ( x = 1 byte, integers are little-endian )
+	[
+		x..		type : varint, ( packet id << 3 ) | frame flags
+		x..		type : varint, specifies packet data length
+		x		type : uint8, specifies packet flags
+		xx...	type : uint8[ ], byte array with length of above mentioned length
+	]
+
+	Packet ids below 16 with less than 128 bytes of data therefore only need 3 bytes of header.
+
+	Before sending any packet, the client sends a handshake which the server answers with the
+	subset of features it accepted for this connection:
+	[
+		xxxx	type : uint32, magic ( "FIR2" )
+		x		type : uint8, protocol version
+		xxxx	type : uint32, feature bits
+	]
+
+	Clients which start with a packet instead of the handshake speak the legacy framing
+	(see packet_base.h) and are served with it for the rest of the connection.
+
+	With feature_checksum, every frame in both directions is followed by the CRC32C of its header and
+	data (see checksum.h). A frame with a wrong checksum closes the connection:
+	[
+		xxxx	type : uint32, CRC32C
+	]
+*/
+
+namespace forceinline::remote::packets::wire {
+	constexpr std::uint32_t handshake_magic = 0x32524946; // "FIR2"
+	constexpr std::uint8_t protocol_version = 2;
+	constexpr std::size_t handshake_size = 9;
+
+	// Optional features, negotiated per connection
+	enum feature : std::uint32_t {
+		feature_compression = 1 << 0,
+		feature_checksum = 1 << 1,
+		feature_large_frames = 1 << 2,
+		feature_delta = 1 << 3,
+
+		// Unreliable packets may also go over UDP (see datagram.h), tcp:// only
+		feature_datagram = 1 << 4
+	};
+
+	// Frame flags are stored in the low bits of the id varint and describe how the packet data is encoded
+	constexpr int frame_flag_bits = 3;
+
+	enum frame_flag : std::uint8_t {
+		// Packet data is LZ4 compressed (see compression.h)
+		frame_flag_compressed = 1 << 0,
+
+		// Packet data is a keyframe or a delta against the previous packet of the id (see delta.h)
+		frame_flag_delta = 1 << 1
+	};
+
+	// Largest packet data length without and with feature_large_frames
+	constexpr std::uint32_t max_packet_size = 0xFFFF;
+	constexpr std::uint32_t max_large_packet_size = 0x3FFFFFFF;
+
+	// id (3 bytes), length (5 bytes), flags (1 byte)
+	constexpr std::size_t max_header_size = 9;
+
+	// The legacy header was memcpy'd as a struct, including its padding byte
+	constexpr std::size_t legacy_header_size = 6;
+
+	enum class framing_t : std::uint8_t {
+		unknown,
+		legacy,
+		v2
+	};
+
+	struct frame_header_t {
+		frame_header_t( ) { }
+
+		frame_header_t( packet_base::base_packet* packet ) {
+			if ( !packet )
+				return;
+
+			packet_id = packet->id( );
+			packet_size = packet->size( );
+			packet_flags = packet->flags( );
+		}
+
+		std::uint16_t packet_id = 0;
+		std::uint32_t packet_size = 0;
+		std::uint8_t packet_flags = 0;
+		std::uint8_t frame_flags = 0;
+	};
+
+	struct handshake_t {
+		std::uint8_t version = protocol_version;
+		std::uint32_t features = 0;
+	};
+
+	inline std::size_t write_varint( std::uint32_t value, char* out ) {
+		std::size_t length = 0;
+
+		while ( value >= 0x80 ) {
+			out[ length++ ] = char( ( value & 0x7F ) | 0x80 );
+			value >>= 7;
+		}
+
+		out[ length++ ] = char( value );
+		return length;
+	}
+
+	// Returns the amount of bytes consumed, 0 if more data is needed or -1 if the varint is malformed
+	inline int read_varint( const char* data, std::size_t length, std::uint32_t& value ) {
+		value = 0;
+
+		for ( std::size_t i = 0; i < 5; i++ ) {
+			if ( i >= length )
+				return 0;
+
+			auto byte = std::uint8_t( data[ i ] );
+			value |= std::uint32_t( byte & 0x7F ) << ( 7 * i );
+
+			if ( !( byte & 0x80 ) )
+				return int( i + 1 );
+		}
+
+		return -1;
+	}
+
+	inline std::size_t encode_header( const frame_header_t& header, char* out ) {
+		auto length = write_varint( ( std::uint32_t( header.packet_id ) << frame_flag_bits ) | header.frame_flags, out );
+		length += write_varint( header.packet_size, out + length );
+		out[ length++ ] = char( header.packet_flags );
+
+		return length;
+	}
+
+	// Returns the header length, 0 if more data is needed or -1 if the header is malformed
+	inline int decode_header( const char* data, std::size_t length, frame_header_t& header, std::uint32_t max_size = max_packet_size ) {
+		std::uint32_t id_field = 0, packet_size = 0;
+
+		auto id_length = read_varint( data, length, id_field );
+		if ( id_length <= 0 )
+			return id_length;
+
+		auto size_length = read_varint( data + id_length, length - id_length, packet_size );
+		if ( size_length <= 0 )
+			return size_length;
+
+		// A corrupt length would desync the stream, reject it right away
+		if ( ( id_field >> frame_flag_bits ) > 0xFFFF || packet_size > max_size )
+			return -1;
+
+		auto header_length = std::size_t( id_length + size_length + 1 );
+		if ( length < header_length )
+			return 0;
+
+		header.packet_id = std::uint16_t( id_field >> frame_flag_bits );
+		header.frame_flags = std::uint8_t( id_field & ( ( 1 << frame_flag_bits ) - 1 ) );
+		header.packet_size = packet_size;
+		header.packet_flags = std::uint8_t( data[ header_length - 1 ] );
+
+		return int( header_length );
+	}
+
+	inline std::size_t encode_legacy_header( const frame_header_t& header, char* out ) {
+		out[ 0 ] = char( header.packet_id & 0xFF );
+		out[ 1 ] = char( header.packet_id >> 8 );
+		out[ 2 ] = char( header.packet_size & 0xFF );
+		out[ 3 ] = char( ( header.packet_size >> 8 ) & 0xFF );
+		out[ 4 ] = char( header.packet_flags );
+		out[ 5 ] = 0;
+
+		return legacy_header_size;
+	}
+
+	inline int decode_legacy_header( const char* data, std::size_t length, frame_header_t& header ) {
+		if ( length < legacy_header_size )
+			return 0;
+
+		auto bytes = reinterpret_cast< const std::uint8_t* >( data );
+
+		header.packet_id = std::uint16_t( bytes[ 0 ] | ( bytes[ 1 ] << 8 ) );
+		header.packet_size = std::uint32_t( bytes[ 2 ] | ( bytes[ 3 ] << 8 ) );
+		header.packet_flags = bytes[ 4 ];
+		header.frame_flags = 0;
+
+		return int( legacy_header_size );
+	}
+
+	// Encodes or decodes a header with the given framing
+	inline std::size_t encode_header( framing_t framing, const frame_header_t& header, char* out ) {
+		return framing == framing_t::legacy ? encode_legacy_header( header, out ) : encode_header( header, out );
+	}
+
+	inline int decode_header( framing_t framing, const char* data, std::size_t length, frame_header_t& header, std::uint32_t max_size = max_packet_size ) {
+		return framing == framing_t::legacy ? decode_legacy_header( data, length, header ) : decode_header( data, length, header, max_size );
+	}
+
+	inline std::size_t encode_handshake( const handshake_t& handshake, char* out ) {
+		for ( int i = 0; i < 4; i++ ) {
+			out[ i ] = char( ( handshake_magic >> ( 8 * i ) ) & 0xFF );
+			out[ 5 + i ] = char( ( handshake.features >> ( 8 * i ) ) & 0xFF );
+		}
+
+		out[ 4 ] = char( handshake.version );
+		return handshake_size;
+	}
+
+	// Returns handshake_size if a handshake was decoded, 0 if more data is needed or -1 if this is not a handshake
+	inline int decode_handshake( const char* data, std::size_t length, handshake_t& handshake ) {
+		auto bytes = reinterpret_cast< const std::uint8_t* >( data );
+
+		// Compare as much of the magic as we have
+		for ( std::size_t i = 0; i < 4 && i < length; i++ ) {
+			if ( bytes[ i ] != ( ( handshake_magic >> ( 8 * i ) ) & 0xFF ) )
+				return -1;
+		}
+
+		if ( length < handshake_size )
+			return 0;
+
+		handshake.version = bytes[ 4 ];
+		handshake.features = 0;
+
+		for ( int i = 0; i < 4; i++ )
+			handshake.features |= std::uint32_t( bytes[ 5 + i ] ) << ( 8 * i );
+
+		return int( handshake_size );
+	}
+} // namespace forceinline::remote::packets::wire
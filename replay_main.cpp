@@ -0,0 +1,167 @@
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <afunix.h>
+
+#include <iostream>
+#include <thread>
+#include <cstdlib>
+#include <unordered_map>
+
+#include "diagnostics/capture.h"
+#include "transport/endpoint.h"
+
+#pragma comment (lib, "Ws2_32.lib")
+
+/*
+	Replays a capture file against a server:
+
+		replay <capture file> <endpoint> [speed]
+
+	Every connection in the capture gets its own connection to the server, which receives the exact
+	bytes the original clients sent, handshake included. A speed of 1 keeps the original timing, 2 is
+	twice as fast and 0 sends everything as fast as possible. Captures made by a server replay what
+	its clients sent, captures made by a client replay what that client sent.
+*/
+
+namespace remote = forceinline::remote;
+namespace diagnostics = remote::diagnostics;
+
+SOCKET open_connection( const remote::transport::endpoint_t& endpoint ) {
+	if ( endpoint.scheme == remote::transport::scheme_t::tcp ) {
+		struct addrinfo hints, * result;
+		ZeroMemory( &hints, sizeof( hints ) );
+
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = IPPROTO_TCP;
+
+		if ( getaddrinfo( endpoint.host.empty( ) ? "127.0.0.1" : endpoint.host.data( ), endpoint.port.data( ), &hints, &result ) != 0 )
+			throw std::exception( "replay: getaddrinfo call failed" );
+
+		SOCKET connection = ::socket( result->ai_family, result->ai_socktype, result->ai_protocol );
+
+		if ( connection == INVALID_SOCKET || ::connect( connection, result->ai_addr, int( result->ai_addrlen ) ) == SOCKET_ERROR )
+			throw std::exception( "replay: failed to connect to host" );
+
+		freeaddrinfo( result );
+		return connection;
+	}
+
+	if ( endpoint.scheme != remote::transport::scheme_t::unix_socket )
+		throw std::exception( "replay: only tcp:// and unix:// endpoints can be replayed against" );
+
+	sockaddr_un address = { };
+	address.sun_family = AF_UNIX;
+
+	if ( endpoint.path.size( ) >= sizeof address.sun_path )
+		throw std::invalid_argument( "replay: socket path too long" );
+
+	memcpy( address.sun_path, endpoint.path.data( ), endpoint.path.size( ) );
+
+	SOCKET connection = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+
+	if ( connection == INVALID_SOCKET || ::connect( connection, reinterpret_cast< sockaddr* >( &address ), sizeof address ) == SOCKET_ERROR )
+		throw std::exception( "replay: failed to connect to host" );
+
+	return connection;
+}
+
+// Throws away whatever the server answered, so it never blocks on a full socket buffer
+void drain( SOCKET connection ) {
+	char buffer[ 4096 ];
+
+	unsigned long queued_bytes = 0;
+	while ( ioctlsocket( connection, FIONREAD, &queued_bytes ) == 0 && queued_bytes > 0 ) {
+		if ( recv( connection, buffer, sizeof buffer, NULL ) <= 0 )
+			break;
+	}
+}
+
+bool send_all( SOCKET connection, const char* data, std::size_t length ) {
+	std::size_t total_bytes_sent = 0;
+
+	while ( total_bytes_sent < length ) {
+		int bytes_sent = send( connection, data + total_bytes_sent, int( length - total_bytes_sent ), NULL );
+		if ( bytes_sent <= 0 )
+			return false;
+
+		total_bytes_sent += bytes_sent;
+	}
+
+	return true;
+}
+
+int main( int argc, char** argv ) {
+	if ( argc < 3 ) {
+		std::cout << "usage: replay <capture file> <endpoint> [speed, 1 = original timing, 0 = as fast as possible]" << std::endl;
+		return 1;
+	}
+
+	WSADATA wsa_data = { };
+	if ( WSAStartup( MAKEWORD( 2, 2 ), &wsa_data ) != 0 )
+		return 1;
+
+	std::unordered_map< std::uint64_t, SOCKET > connections = { };
+
+	try {
+		diagnostics::capture_reader reader( argv[ 1 ] );
+		auto endpoint = remote::transport::endpoint_t::parse( argv[ 2 ] );
+		auto speed = argc > 3 ? std::atof( argv[ 3 ] ) : 1.0;
+
+		// Replay what was sent to the server
+		auto direction = reader.header( ).role == diagnostics::capture_role::server ? diagnostics::capture_direction::received : diagnostics::capture_direction::sent;
+
+		std::uint64_t records = 0, bytes = 0;
+		auto start = std::chrono::steady_clock::now( );
+
+		diagnostics::capture_record_t record = { };
+		while ( reader.next( record ) ) {
+			if ( record.header.direction != direction )
+				continue;
+
+			// Wait until the record is due, scaled by our speed
+			if ( speed > 0.0 ) {
+				auto due = start + std::chrono::nanoseconds( std::uint64_t( double( record.header.timestamp ) / speed ) );
+
+				while ( std::chrono::steady_clock::now( ) < due ) {
+					for ( auto& [ id, connection ] : connections )
+						drain( connection );
+
+					std::this_thread::sleep_for( std::min< std::chrono::steady_clock::duration >( due - std::chrono::steady_clock::now( ), std::chrono::milliseconds( 1 ) ) );
+				}
+			}
+
+			auto& connection = connections[ record.header.connection ];
+			if ( !connection )
+				connection = open_connection( endpoint );
+
+			if ( !send_all( connection, record.data, record.header.length ) ) {
+				std::cout << "connection " << record.header.connection << " was closed by the server" << std::endl;
+				break;
+			}
+
+			records++;
+			bytes += record.header.length;
+
+			if ( records % 64 == 0 )
+				drain( connection );
+		}
+
+		// Give the server a moment to answer before we hang up
+		std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+
+		auto elapsed = std::chrono::duration< double >( std::chrono::steady_clock::now( ) - start ).count( );
+		std::cout << "replayed " << records << " records (" << bytes << " bytes) over " << connections.size( ) << " connections in " << elapsed << "s" << std::endl;
+	} catch ( const std::exception& e ) {
+		std::cout << e.what( ) << std::endl;
+	}
+
+	for ( auto& [ id, connection ] : connections ) {
+		drain( connection );
+		shutdown( connection, SD_SEND );
+		closesocket( connection );
+	}
+
+	WSACleanup( );
+	return 0;
+}
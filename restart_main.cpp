@@ -0,0 +1,191 @@
+#include <WinSock2.h>
+#include <Windows.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+#include "server/server.h"
+#include "client/client.h"
+#include "packet/packet.h"
+
+/*
+	Restarts a server under load and checks that no packet was lost or answered twice:
+
+		restart
+
+	The first process starts a server and clients which keep sending numbered packets. While they are
+	sending, it starts a copy of itself which calls take_over, and hands everything off to it. Every
+	client then checks that it got exactly one answer to each of its packets, in the order it sent them,
+	and that both servers answered some of them. Returns the number of clients which did not.
+*/
+
+namespace remote = forceinline::remote;
+namespace packets = remote::packets;
+
+using number_packet = packets::simple_packet< packets::packet_simple_t, packets::packet_id::simple >;
+using stop_packet = packets::text_packet< packets::packet_id::text_one >;
+
+constexpr const char* endpoint = "tcp://127.0.0.1:27300";
+constexpr int client_count = 8;
+constexpr std::uint32_t packets_per_client = 2000;
+
+// The server answers with the number plus one and tells which process it is, the client's index comes back too
+float generation = 1.f;
+
+// Client packet handlers are plain functions, the answers are kept here by client index
+std::mutex answers_mtx;
+std::vector< std::pair< std::uint32_t, float > > answers[ client_count ] = { };
+
+std::atomic< bool > stopping = false;
+
+void answer_number( remote::async_server* server, SOCKET from, const std::vector< char >& data, std::uint8_t flags ) {
+	number_packet request( data, flags );
+
+	request( ).some_number++;
+	request( ).some_float = generation;
+
+	number_packet response( request( ), flags );
+	server->send_packet( from, &response );
+}
+
+void set_handlers( remote::async_server& server ) {
+	server.set_packet_handler( packets::packet_id::simple, answer_number );
+
+	server.set_packet_handler( packets::packet_id::text_one, [ ]( remote::async_server*, SOCKET, const std::vector< char >&, std::uint8_t ) {
+		stopping = true;
+	} );
+}
+
+std::string handoff_path( ) {
+	char directory[ MAX_PATH ] = { };
+	GetTempPathA( sizeof directory, directory );
+
+	return std::string( directory ) + "restart_test.handoff";
+}
+
+// The new process: takes over and answers until the first process is done checking
+int run_successor( ) {
+	generation = 2.f;
+
+	remote::async_server server( endpoint );
+	set_handlers( server );
+	server.take_over( handoff_path( ) );
+
+	for ( int i = 0; i < 6000 && !stopping; i++ )
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+
+	server.close( );
+	return stopping ? 0 : 1;
+}
+
+void send_numbers( int index ) {
+	remote::async_client client( endpoint );
+
+	client.set_packet_handler( packets::packet_id::simple, [ ]( remote::async_client*, const std::vector< char >& data, std::uint8_t flags ) {
+		number_packet answer( data, flags );
+
+		std::lock_guard lock( answers_mtx );
+		answers[ answer( ).some_array[ 0 ] ].emplace_back( answer( ).some_number, answer( ).some_float );
+	} );
+
+	client.connect( );
+
+	for ( std::uint32_t i = 0; i < packets_per_client; i++ ) {
+		number_packet packet( { i, 0.f, { char( index ), 0, 0 } } );
+		client.send_packet( &packet );
+
+		// A steady stream, so the hand-off happens in the middle of it
+		if ( i % 20 == 0 )
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+
+	// Wait for the last answers
+	for ( int i = 0; i < 1000; i++ ) {
+		{
+			std::lock_guard lock( answers_mtx );
+			if ( answers[ index ].size( ) >= packets_per_client )
+				break;
+		}
+
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+	}
+
+	client.disconnect( );
+}
+
+int main( int argc, char** argv ) {
+	try {
+		if ( argc > 1 && std::string( argv[ 1 ] ) == "successor" )
+			return run_successor( );
+
+		remote::async_server server( endpoint );
+		set_handlers( server );
+		server.start( );
+
+		std::vector< std::thread > clients = { };
+		for ( int i = 0; i < client_count; i++ )
+			clients.emplace_back( send_numbers, i );
+
+		// Let the clients get going before the restart
+		std::this_thread::sleep_for( std::chrono::milliseconds( 200 ) );
+
+		STARTUPINFOA startup_info = { };
+		startup_info.cb = sizeof startup_info;
+
+		PROCESS_INFORMATION process_info = { };
+		auto command_line = "\"" + std::string( argv[ 0 ] ) + "\" successor";
+
+		if ( !CreateProcessA( NULL, command_line.data( ), NULL, NULL, FALSE, 0, NULL, NULL, &startup_info, &process_info ) )
+			throw std::exception( "restart: failed to start the successor" );
+
+		auto handed_off = server.hand_off( handoff_path( ) );
+
+		for ( auto& client : clients )
+			client.join( );
+
+		int failed = handed_off ? 0 : client_count;
+
+		for ( int i = 0; handed_off && i < client_count; i++ ) {
+			bool in_order = answers[ i ].size( ) == packets_per_client;
+			int by_successor = 0;
+
+			for ( std::uint32_t j = 0; in_order && j < packets_per_client; j++ ) {
+				in_order &= answers[ i ][ j ].first == j + 1;
+				by_successor += answers[ i ][ j ].second == 2.f;
+			}
+
+			bool passed = in_order && by_successor > 0 && by_successor < int( packets_per_client );
+			failed += !passed;
+
+			std::cout << "client " << i << ": " << answers[ i ].size( ) << " answers, " << by_successor << " by the successor, "
+				<< ( passed ? "passed" : "FAILED" ) << std::endl;
+		}
+
+		// The successor serves our connections now, tell it we are done
+		{
+			remote::async_client client( endpoint );
+			client.connect( );
+
+			stop_packet packet( { "stop" } );
+			client.send_packet( &packet );
+			client.flush( std::chrono::seconds( 5 ) );
+			client.disconnect( );
+		}
+
+		WaitForSingleObject( process_info.hProcess, 10000 );
+		CloseHandle( process_info.hProcess );
+		CloseHandle( process_info.hThread );
+
+		if ( !handed_off )
+			std::cout << "restart: hand_off failed" << std::endl;
+
+		return failed;
+	} catch ( const std::exception& e ) {
+		std::cout << e.what( ) << std::endl;
+		return 1;
+	}
+}
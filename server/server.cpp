@@ -1,16 +1,59 @@
 #include "server.h"
+#include "../transport/shm_channel.h"
+#include "../transport/memory_channel.h"
+#include "../transport/handoff.h"
 #include <algorithm>
+#include <cstdio>
+#include <iterator>
 
 namespace forceinline::remote {
-	async_server::async_server( std::string_view port ) {
-		if ( port.empty( ) )
-			throw std::invalid_argument( "async_server::async_server: port argument empty" );
+	namespace {
+		// Responses the handler of a cached packet id sends to its client, collected by send_packet_internal
+		struct response_recording_t {
+			async_server* server = nullptr;
+			SOCKET from = 0;
+			std::uint8_t request_flags = 0;
+
+			// Cleared if the handler sent something we can't replay
+			bool cacheable = true;
+			std::vector< packets::cached_response_t > responses = { };
+		};
+
+		thread_local response_recording_t* current_recording = nullptr;
+
+		// Continues crc with length bytes of a file, starting at offset
+		bool checksum_file( HANDLE file, std::uint64_t offset, std::uint32_t length, std::uint32_t& crc ) {
+			std::vector< char > file_buffer( std::min< std::uint32_t >( length, 64 * 1024 ) );
+
+			for ( std::uint32_t total_read = 0; total_read < length; ) {
+				OVERLAPPED position = { };
+				position.Offset = DWORD( ( offset + total_read ) & 0xFFFFFFFF );
+				position.OffsetHigh = DWORD( ( offset + total_read ) >> 32 );
+
+				DWORD bytes_read = 0;
+				if ( !ReadFile( file, file_buffer.data( ), DWORD( std::min< std::size_t >( file_buffer.size( ), length - total_read ) ), &bytes_read, &position ) || bytes_read == 0 )
+					return false;
+
+				crc = packets::checksum::crc32c( file_buffer.data( ), bytes_read, crc );
+				total_read += bytes_read;
+			}
+
+			return true;
+		}
+	} // namespace
+
+	async_server::async_server( std::string_view endpoint ) {
+		if ( endpoint.empty( ) )
+			throw std::invalid_argument( "async_server::async_server: endpoint argument empty" );
 
-		m_port = port;
+		m_endpoint = transport::endpoint_t::parse( endpoint );
 	}
 
 	async_server::~async_server( ) {
 		close( );
+
+		// Their threads call back into us
+		m_upstreams.clear( );
 		m_packet_handlers.clear( );
 	}
 
@@ -23,52 +66,271 @@ namespace forceinline::remote {
 			throw std::exception( "async_server::start: WSAStartup call failed" );
 	#endif // WIN32
 
-		struct addrinfo* result, hints;
-		ZeroMemory( &hints, sizeof( hints ) );
+		if ( m_manual_pump && m_endpoint.scheme != transport::scheme_t::memory )
+			throw std::invalid_argument( "async_server::start: manual pumping requires a mem:// endpoint" );
+
+		if ( m_endpoint.scheme == transport::scheme_t::tls && m_tls_options.certificate_subject.empty( ) )
+			throw std::invalid_argument( "async_server::start: tls:// endpoints need a certificate, see set_tls_options" );
+
+		// Relayed packets have nowhere to go until our upstreams are connected
+		connect_upstreams( );
+
+		// Create, bind and listen on the socket for our transport
+		create_listen_socket( );
+
+		launch( );
+	}
+
+	void async_server::take_over( const std::string& path, std::chrono::milliseconds timeout ) {
+		if ( m_running )
+			throw std::exception( "async_server::take_over: already running" );
+
+		if ( m_manual_pump || ( m_endpoint.scheme != transport::scheme_t::tcp && m_endpoint.scheme != transport::scheme_t::unix_socket ) )
+			throw std::invalid_argument( "async_server::take_over: only tcp:// and unix:// servers can be handed off" );
+
+	#ifdef WIN32
+		if ( WSAStartup( MAKEWORD( 2, 2 ), &m_wsa_data ) != 0 )
+			throw std::exception( "async_server::take_over: WSAStartup call failed" );
+	#endif // WIN32
+
+		connect_upstreams( );
+
+		transport::handoff::state_t state = { };
+		auto predecessor = transport::handoff::connect_to_predecessor( path, timeout, state );
+
+		m_server_socket = transport::handoff::open( state.listener );
+
+		if ( m_server_socket == INVALID_SOCKET ) {
+			closesocket( predecessor );
+			throw std::exception( "async_server::take_over: failed to open the listening socket" );
+		}
+
+		// Pick the connections up where the old process left them
+		for ( auto& connection : state.connections ) {
+			SOCKET client = transport::handoff::open( connection.protocol_info );
+
+			if ( client == INVALID_SOCKET )
+				continue;
+
+			add_client( client );
+
+			{
+				std::lock_guard lock( m_connection_mtx );
+
+				auto& info = m_connection_info[ client ];
+				info.framing = packets::wire::framing_t( connection.framing );
+
+				// The datagram channel stays with the old process, the client goes back to TCP for everything
+				info.features = connection.features & ~packets::wire::feature_datagram;
+
+				if ( connection.features & packets::wire::feature_datagram )
+					send_datagram_token( client, 0 );
+			}
+
+			if ( !connection.receive_buffer.empty( ) ) {
+				m_packet_queue[ client ] = std::move( connection.receive_buffer );
+				m_ready_clients.push_back( client );
+			}
+
+			for ( auto& [ packet_id, base ] : connection.delta_bases )
+				m_delta_bases[ client ][ packet_id ] = std::move( base );
+
+			for ( auto& topic : connection.topics )
+				subscribe( client, topic );
+		}
+
+		// The old process may close its handles now
+		transport::handoff::acknowledge( predecessor );
+		closesocket( predecessor );
+
+		launch( );
+	}
+
+	bool async_server::hand_off( const std::string& path, std::chrono::milliseconds timeout ) {
+		if ( !m_running )
+			throw std::exception( "async_server::hand_off: not running" );
+
+		if ( m_manual_pump || ( m_endpoint.scheme != transport::scheme_t::tcp && m_endpoint.scheme != transport::scheme_t::unix_socket ) )
+			throw std::invalid_argument( "async_server::hand_off: only tcp:// and unix:// servers can be handed off" );
+
+		DWORD process_id = 0;
+		auto successor = transport::handoff::wait_for_successor( path, timeout, process_id );
+
+		if ( successor == INVALID_SOCKET )
+			return false;
+
+		// Nothing is accepted or received from here on, new data waits in the socket buffers for the new process
+		m_running = false;
+		stop_threads( );
+
+		// Answer what we already received completely and send everything that is queued
+		process_once( );
+
+		// Half a frame can't be passed on, clients whose socket stays full until the timeout are dropped instead
+		for ( auto deadline = std::chrono::steady_clock::now( ) + timeout; m_outbound_frames || !m_partial_writes.empty( ); ) {
+			if ( send_once( ) )
+				continue;
+
+			if ( std::chrono::steady_clock::now( ) >= deadline ) {
+				for ( auto& [ client, frame ] : m_partial_writes )
+					schedule_disconnect( client );
+
+				for ( auto& [ client, lanes ] : m_outbound_queues )
+					schedule_disconnect( client );
+
+				break;
+			}
+
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		}
+
+		// Connections which are about to be closed are not handed off
+		std::vector< SOCKET > disconnected_clients = { };
+		{
+			std::lock_guard lock( m_disconnect_mtx );
+			disconnected_clients.swap( m_disconnect_queue );
+		}
+
+		for ( auto& client : disconnected_clients )
+			close_client_connection( client );
+
+		transport::handoff::state_t state = { };
+		bool duplicated = transport::handoff::duplicate( m_server_socket, process_id, state.listener );
+
+		for ( auto client : m_connected_clients ) {
+			if ( !duplicated )
+				break;
+
+			transport::handoff::connection_state_t connection = { };
+			duplicated = transport::handoff::duplicate( client, process_id, connection.protocol_info );
+
+			auto& info = m_connection_info[ client ];
+			connection.framing = std::uint8_t( info.framing );
+			connection.features = info.features;
+
+			// Partial packets and packets held back by rate limits
+			if ( auto queue_it = m_packet_queue.find( client ); queue_it != m_packet_queue.end( ) )
+				connection.receive_buffer = queue_it->second;
+
+			for ( auto& [ packet_id, base ] : m_delta_bases[ client ] )
+				connection.delta_bases.emplace_back( packet_id, base );
+
+			if ( auto subscription_it = m_subscriptions.find( client ); subscription_it != m_subscriptions.end( ) )
+				connection.topics = subscription_it->second;
+
+			state.connections.push_back( std::move( connection ) );
+		}
+
+		// If the new process did not take everything over, we keep serving our clients ourselves
+		if ( !duplicated || !transport::handoff::send_state( successor, state, timeout ) ) {
+			closesocket( successor );
+			launch( );
+			return false;
+		}
+
+		closesocket( successor );
+
+		// The sockets live on in the new process, so only close our handles. Shutting them down would end the connections
+		closesocket( m_server_socket );
+		m_server_socket = 0;
+
+		if ( m_datagram_socket != INVALID_SOCKET ) {
+			closesocket( m_datagram_socket );
+			m_datagram_socket = INVALID_SOCKET;
+		}
 
-		hints.ai_family = AF_INET;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
-		hints.ai_flags = AI_PASSIVE;
+		for ( auto& client_socket : m_connected_clients )
+			closesocket( client_socket );
 
-		if ( getaddrinfo( NULL, m_port.data( ), &hints, &result ) != 0 )
-			throw std::exception( "" );
+		forget_connections( );
 
-		// Create a socket
-		m_server_socket = ::socket( result->ai_family, result->ai_socktype, result->ai_protocol );
+	#ifdef WIN32
+		WSACleanup( );
+	#endif // WIN32
 
-		if ( m_server_socket == INVALID_SOCKET )
-			throw std::exception( "" );
+		return true;
+	}
 
-		// Bind the socket
-		if ( bind( m_server_socket, result->ai_addr, int( result->ai_addrlen ) ) == SOCKET_ERROR )
-			throw std::exception( "" );
+	void async_server::launch( ) {
+		m_receive_buffer.resize( m_buffer_size );
 
-		// Listen on the socket
-		if ( listen( m_server_socket, SOMAXCONN ) == SOCKET_ERROR )
-			throw std::exception( "" );
+		// Without low latency the process thread parks right away and is woken by the receive thread
+		if ( m_low_latency.enabled )
+			m_process_waiter.configure( m_low_latency.spin_count, m_low_latency.park_timeout );
+		else
+			m_process_waiter.configure( 0, std::chrono::milliseconds( 1 ) );
 
-		freeaddrinfo( result );
+		// Suspended task handlers which were woken are resumed by the process thread. A failed hand off keeps its loop
+		if ( !m_loop ) {
+			m_loop = std::make_shared< coro::event_loop >( );
+			m_loop->set_notify( [ this ]( ) {
+				m_process_waiter.notify( );
+			} );
+		}
 
 		// Mark the server as running
 		m_running = true;
 
+		// pump( ) does the work of our threads
+		if ( m_manual_pump )
+			return;
+
 		// Start our threads
 		m_accept_thread = std::thread( &async_server::accept, this );
 		m_receive_thread = std::thread( &async_server::receive, this );
 		m_process_thread = std::thread( &async_server::process_packets, this );
+		m_send_thread = std::thread( &async_server::send_frames, this );
+
+		if ( m_datagram_socket != INVALID_SOCKET )
+			m_datagram_thread = std::thread( &async_server::receive_datagrams, this );
 	}
 
 	void async_server::close( ) {
-		if ( !m_running || !m_server_socket )
+		bool memory = m_endpoint.scheme == transport::scheme_t::memory;
+
+		if ( !m_running || ( !m_server_socket && !memory ) )
 			return;
 
+		// Give queued packets a chance to go out
+		flush( std::chrono::milliseconds( 250 ) );
+
 		// Shut our socket down
-		closesocket( m_server_socket );
+		if ( memory )
+			transport::memory_listener::stop( m_endpoint.path );
+		else
+			closesocket( m_server_socket );
 
 		// Let the threads know we're not running anymore
 		m_running = false;
 
+		stop_threads( );
+
+		// The datagram and send threads use this socket until they are stopped
+		if ( m_datagram_socket != INVALID_SOCKET ) {
+			closesocket( m_datagram_socket );
+			m_datagram_socket = INVALID_SOCKET;
+		}
+
+		// Shut down the connection
+		for ( auto& client_socket : m_connected_clients ) {
+			if ( transport::is_memory_socket( client_socket ) )
+				continue;
+
+			shutdown( client_socket, SD_SEND );
+			closesocket( client_socket );
+		}
+
+		forget_connections( );
+
+	#ifdef WIN32
+		WSACleanup( );
+	#endif // WIN32
+	}
+
+	void async_server::stop_threads( ) {
+		// Wake the process thread in case it is parked
+		m_process_waiter.notify( );
+
 		// Wait for our threads to finish
 		if ( m_accept_thread.joinable( ) )
 			m_accept_thread.join( );
@@ -79,271 +341,2769 @@ namespace forceinline::remote {
 		if ( m_process_thread.joinable( ) )
 			m_process_thread.join( );
 
-		// Shut down the connection
-		for ( auto& client_socket : m_connected_clients ) {
-			shutdown( client_socket, SD_SEND );
-			closesocket( client_socket );
-		}
+		if ( m_datagram_thread.joinable( ) )
+			m_datagram_thread.join( );
+
+		m_outbound_cv.notify_all( );
+		if ( m_send_thread.joinable( ) )
+			m_send_thread.join( );
+
+		// Connections accepted in the last round still have to be closed or handed off with the others
+		adopt_accepted_clients( );
+	}
+
+	void async_server::forget_connections( ) {
+		// Responses of our upstreams can't reach anybody anymore, stop them first so they don't race us
+		disconnect_upstreams( );
 
 		// Clear the packet queue
 		m_packet_queue.clear( );
+		m_ready_clients.clear( );
+		m_admission_states.clear( );
+		m_receive_buckets.clear( );
+
+		// Drop whatever did not make it out
+		m_outbound_queues.clear( );
+		m_outbound_frames = 0;
+		m_outbound_in_flight -= std::min( m_outbound_in_flight, m_partial_writes.size( ) );
+		m_partial_writes.clear( );
+		m_framing_deadlines.clear( );
+
+		// Forget everything we negotiated
+		for ( auto& [ client, info ] : m_connection_info )
+			destroy_context( client, info );
+
+		m_connection_info.clear( );
+
+		{
+			std::lock_guard lock( m_accept_mtx );
+			m_context_clients.clear( );
+		}
+		m_disconnect_queue.clear( );
+
+		// Close all channels
+		{
+			std::lock_guard lock( m_channel_mtx );
+			for ( auto& [ client, channel ] : m_channels )
+				channel->close( );
+
+			m_channels.clear( );
+		}
+
+		// Nobody is subscribed to anything anymore
+		{
+			std::lock_guard lock( m_topic_mtx );
+			for ( auto& [ topic, state ] : m_topics )
+				state.subscribers.clear( );
+
+			m_subscriptions.clear( );
+		}
+
+		m_delta_bases.clear( );
+		m_receive_timestamps.clear( );
+		m_datagram_tokens.clear( );
+
+		{
+			std::lock_guard lock( m_datagram_mtx );
+			m_datagram_outboxes.clear( );
+			m_datagram_packets.clear( );
+		}
+
+		// Task handlers which are still waiting won't be resumed anymore
+		if ( m_loop ) {
+			m_loop->close( );
+			m_loop = nullptr;
+		}
+
+		m_waiters.clear( );
+
+		// Connections still in their TLS handshake never became clients
+		for ( auto& [ client, handshake ] : m_tls_handshakes )
+			closesocket( client );
+
+		m_tls_handshakes.clear( );
 
 		// Erase all our clients
 		m_connected_clients.clear( );
-
-	#ifdef WIN32
-		WSACleanup( );
-	#endif // WIN32
+		m_poll_fds.clear( );
+		m_poll_fds_stale = false;
 	}
 
 	bool async_server::is_running( ) {
 		return m_running;
 	}
 
-	void async_server::set_packet_handler( std::uint16_t packet_id, packet_handler_server_fn handler ) {
-		if ( handler )
+	void async_server::set_packet_handler( std::uint16_t packet_id, packet_handler_server_fn handler, packets::packet_priority priority ) {
+		if ( handler ) {
 			m_packet_handlers[ packet_id ] = handler;
-		else
+			set_packet_priority( packet_id, priority );
+		} else
 			m_packet_handlers.erase( packet_id );
 	}
 
-	void async_server::send_packet( SOCKET to, packets::packet_base::base_packet* packet ) {
-		send_packet_internal( to, packet, packet->flags( ) );
+	void async_server::set_batch_handler( std::uint16_t packet_id, batch_handler_server_fn handler, packets::packet_priority priority ) {
+		if ( handler ) {
+			m_batch_handlers[ packet_id ] = handler;
+			set_packet_priority( packet_id, priority );
+		} else
+			m_batch_handlers.erase( packet_id );
 	}
 
-	bool async_server::send_packet( SOCKET to, packets::packet_base::base_packet* packet, std::function< bool( SOCKET, const std::vector< char >&, const std::uint8_t ) > handler, std::chrono::milliseconds timeout ) {
-		// Latest packet handler. In range of 1-127
-		std::uint8_t packet_identifier = generate_packet_identifier( to );
+	void async_server::set_task_handler( std::uint16_t packet_id, task_handler_server_fn handler, packets::packet_priority priority ) {
+		if ( handler ) {
+			m_task_handlers[ packet_id ] = handler;
+			set_packet_priority( packet_id, priority );
+		} else
+			m_task_handlers.erase( packet_id );
+	}
 
-		// Send the packet with according flags
-		send_packet_internal( to, packet, packet_identifier );
+	void async_server::set_packet_priority( std::uint16_t packet_id, packets::packet_priority priority ) {
+		if ( priority != packets::packet_priority::normal )
+			m_packet_priorities[ packet_id ] = priority;
+		else
+			m_packet_priorities.erase( packet_id );
+	}
 
-		auto now = [ ]( ) {
-			return std::chrono::high_resolution_clock::now( );
-		};
+	bool async_server::flush( std::chrono::milliseconds timeout ) {
+		// Without a send thread we have to send everything ourselves
+		if ( m_manual_pump ) {
+			while ( send_once( ) ) { }
+			return m_outbound_frames == 0 && m_partial_writes.empty( );
+		}
 
-		// Wait for the packet to arrive within timeout limit		
-		auto time_sent = now( );
-		bool handler_result = false;
-		do {
-			m_custom_mtx.lock( );
+		std::unique_lock lock( m_outbound_mtx );
 
-			auto& queue = m_custom_process_queue[ to ];
+		return m_outbound_cv.wait_for( lock, timeout, [ this ]( ) {
+			return ( m_outbound_frames == 0 && m_outbound_in_flight == 0 ) || !m_running;
+		} );
+	}
 
-			// See if we have a response packet queued
-			auto it = std::find_if( queue.begin( ), queue.end( ), [ packet_identifier ]( const custom_process_info_t& info ) {
-				return info.packet_identifier == packet_identifier;
-			} );
+	void async_server::set_features( std::uint32_t features ) {
+		m_features = features;
+	}
 
-			// Call the handler if a packet has been found
-			if ( it != queue.end( ) ) {
-				handler_result = handler( to, it->packet_data, it->packet_identifier | 0b10000000 );
-				queue.erase( it );
-				m_custom_mtx.unlock( );
-				break;
-			}
+	void async_server::set_legacy_detection_timeout( std::chrono::milliseconds timeout ) {
+		m_legacy_detection_timeout = timeout;
+	}
 
-			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-		} while ( std::chrono::duration_cast< std::chrono::milliseconds >( now( ) - time_sent ) <= timeout );
+	void async_server::set_large_frames( std::uint32_t max_size ) {
+		m_features |= packets::wire::feature_large_frames;
+		m_max_large_packet_size = std::clamp( max_size, packets::wire::max_packet_size, packets::wire::max_large_packet_size );
+	}
 
-		m_custom_mtx.unlock( );
-		remove_packet_identifier( to, packet_identifier );
-		return handler_result;
+	void async_server::set_compression( std::uint32_t threshold ) {
+		m_compression_threshold = threshold;
 	}
 
-	void async_server::send_packet_internal( SOCKET to, packets::packet_base::base_packet* packet, std::uint8_t packet_flags ) {
-		// Return if our packet is invalid or we have no one to send our packet to
-		if ( !to || !packet )
-			return;
+	void async_server::set_max_decompressed_size( std::uint32_t size ) {
+		m_max_decompressed_size = size;
+	}
 
-		packet_header_t header( packet );
+	void async_server::set_compression_dictionary( std::uint16_t packet_id, const std::vector< char >& dictionary ) {
+		if ( !dictionary.empty( ) )
+			m_compression_dictionaries[ packet_id ] = dictionary;
+		else
+			m_compression_dictionaries.erase( packet_id );
+	}
 
-		// Set the packet flags if they don't match
-		if ( packet->flags( ) != packet_flags )
-			header.packet_flags = packet_flags;
+	std::size_t async_server::publish( std::string_view topic, packets::packet_base::base_packet* packet ) {
+		if ( !packet )
+			return 0;
 
-		// Allocate a buffer into which we copy our packet data
-		std::vector< char > packet_buffer( sizeof packet_header_t + header.packet_size );
+		packets::wire::frame_header_t header( packet );
+		auto priority = priority_of( header.packet_id );
+		auto trace_id = diagnostics::tracer::current( );
 
-		// Copy the header and packet data into the buffer
-		memcpy( packet_buffer.data( ), &header, sizeof packet_header_t );
-		memcpy( packet_buffer.data( ) + sizeof packet_header_t, packet->data( ), header.packet_size );
+		std::lock_guard topic_lock( m_topic_mtx );
 
-		// Lock the mutex
-		std::lock_guard lock( m_send_mtx );
+		auto topic_it = m_topics.find( std::string( topic ) );
+		if ( topic_it == m_topics.end( ) || topic_it->second.subscribers.empty( ) )
+			return 0;
 
-		// Try to send our buffer
-		std::size_t bytes_sent = 0, total_bytes_sent = 0;
-		do {
-			bytes_sent = send( to, packet_buffer.data( ) + total_bytes_sent, packet_buffer.size( ) - total_bytes_sent, NULL );
-			total_bytes_sent += bytes_sent;
-		} while ( bytes_sent > 0 && total_bytes_sent < packet_buffer.size( ) );
+		auto& [ key, configured, options, subscribers ] = topic_it->second;
 
-		// An error occurred, remove the client
-		if ( bytes_sent <= 0 )
-			close_client_connection( to );
-	}
+		// Subscribers only differ in framing and the features which change the encoding
+		struct encoded_frame_t {
+			packets::wire::framing_t framing = packets::wire::framing_t::unknown;
+			std::uint32_t features = 0;
+			std::shared_ptr< const std::vector< char > > frame = nullptr;
+		};
 
-	void async_server::accept( ) {
-		while ( m_running ) {
-			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		std::vector< encoded_frame_t > encoded_frames = { };
+		auto data = packet->data( );
 
-			// Accept an incoming connection
-			SOCKET client = ::accept( m_server_socket, NULL, NULL );
+		auto frame_for = [ & ]( const topic_subscriber_t& subscriber ) {
+			auto features = subscriber.features & ( packets::wire::feature_compression | packets::wire::feature_checksum | packets::wire::feature_large_frames );
 
-			// Error check
-			if ( client == INVALID_SOCKET )
-				continue;
+			for ( auto& encoded : encoded_frames ) {
+				if ( encoded.framing == subscriber.framing && encoded.features == features )
+					return encoded.frame;
+			}
 
-			// Lock mutex
-			std::lock_guard lock( m_client_mtx );
+			auto frame = std::make_shared< const std::vector< char > >( build_frame( subscriber.framing, features, header, data ) );
+			encoded_frames.push_back( { subscriber.framing, features, frame } );
 
-			// Add the client to our list
-			m_connected_clients.push_back( client );
-		}
-	}
+			return frame;
+		};
 
-	void async_server::receive( ) {
-		// Create a temporary buffer
-		std::vector< char > temporary_buffer( m_buffer_size );
+		std::size_t queued = 0;
 
-		while ( m_running ) {
-			std::lock_guard cl_lock( m_client_mtx );
+		{
+			std::lock_guard lock( m_outbound_mtx );
 
-			// Loop over all our connected clients
-			for ( auto& client : m_connected_clients ) {
-				// Query the queued bytes for a socket
-				unsigned long queued_bytes = 0;
-				ioctlsocket( client, FIONREAD, &queued_bytes );
+			for ( auto& subscriber : subscribers ) {
+				auto& lanes = m_outbound_queues[ subscriber.socket ];
 
-				// Does our connection have any bytes queued?
-				if ( queued_bytes > 0 ) {
-					// Receive the bytes
-					int received = recv( client, temporary_buffer.data( ), m_buffer_size, NULL );
+				// Don't let a slow subscriber pile up packets it can't keep up with, the send thread skips it meanwhile
+				if ( options.max_queued_bytes && lanes.bytes( ) > options.max_queued_bytes ) {
+					if ( options.disconnect_slow )
+						schedule_disconnect( subscriber.socket );
 
-					// Did we have an error?
-					if ( received <= 0 ) {
-						close_client_connection( client );
-						continue;
-					}
+					continue;
+				}
 
-					// Lock mutex
-					std::lock_guard pp_lock( m_process_mtx );
+				if ( lanes.push_shared( priority, frame_for( subscriber ), options.conflate ? key : 0, trace_id ) )
+					m_outbound_frames++;
 
-					// Get the client buffer and fill it with the data we received
-					auto& packet_buffer = m_packet_queue[ client ];
-					packet_buffer.insert( packet_buffer.end( ), temporary_buffer.data( ), temporary_buffer.data( ) + received );
-				}
+				queued++;
 			}
+
+			m_outbound_generation++;
 		}
 
-		//Clear our buffer
-		temporary_buffer.clear( );
+		m_tracer.record( trace_id, header.packet_id, diagnostics::trace_stage::enqueued );
+		m_outbound_cv.notify_all( );
+
+		return queued;
 	}
 
-	void async_server::process_packets( ) {
-		while ( m_running ) {
-			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-			std::lock_guard lock( m_process_mtx );
+	void async_server::set_topic_options( std::string_view topic, const packets::topic_options_t& options ) {
+		std::lock_guard lock( m_topic_mtx );
 
-			// Process any packets
-			for ( auto& to_process : m_packet_queue ) {
-				auto& from = to_process.first;
-				auto& packet_buffer = to_process.second;		
+		auto [ topic_it, inserted ] = m_topics.try_emplace( std::string( topic ) );
+		if ( inserted )
+			topic_it->second.key = ++m_topic_counter;
 
-				// Check if we have at least a packet header stored
-				if ( packet_buffer.size( ) < sizeof packet_header_t )
-					continue;
+		topic_it->second.configured = true;
+		topic_it->second.options = options;
+	}
 
-				// We have something to process, get the information about our packet
-				auto header = *reinterpret_cast< packet_header_t* >( packet_buffer.data( ) );
+	std::size_t async_server::subscriber_count( std::string_view topic ) {
+		std::lock_guard lock( m_topic_mtx );
 
-				// Add the first 4 bytes to our packet size
-				std::uint16_t total_packet_size = sizeof packet_header_t + header.packet_size;
+		auto topic_it = m_topics.find( std::string( topic ) );
+		return topic_it != m_topics.end( ) ? topic_it->second.subscribers.size( ) : 0;
+	}
 
-				// Do we have a whole packet stored?
-				if ( packet_buffer.size( ) < total_packet_size )
-					continue;
+	void async_server::subscribe( SOCKET client, const std::string& topic ) {
+		topic_subscriber_t subscriber = { client };
 
-				// Does our packet have a handler?
-				if ( m_packet_handlers.find( header.packet_id ) != m_packet_handlers.end( ) || header.packet_flags & 0b10000000 /* Custom handler */ ) {
-					// Erase the packet header
-					packet_buffer.erase( packet_buffer.begin( ), packet_buffer.begin( ) + sizeof packet_header_t );
+		{
+			std::lock_guard lock( m_connection_mtx );
 
-					// Add the packet to custom processing queue if marked as one
-					if ( header.packet_flags & 0b10000000 ) {
-						// Create an info structure
-						custom_process_info_t info( header.packet_flags & 0x7F /* Extract the packet identifier */ );
+			auto info_it = m_connection_info.find( client );
+			if ( info_it == m_connection_info.end( ) )
+				return;
 
-						// Copy the packet buffer
-						info.packet_data = std::vector< char >( packet_buffer.begin( ), packet_buffer.begin( ) + header.packet_size );
+			subscriber.framing = info_it->second.framing;
+			subscriber.features = info_it->second.features;
+		}
 
-						std::lock_guard custom_lock( m_custom_mtx );
+		std::lock_guard lock( m_topic_mtx );
 
-						// Add it to the queue
-						m_custom_process_queue[ from ].push_back( info );
-					} else {
-						// If the packet has an identifier, mark it as an answer packet
-						if ( header.packet_flags & 0x7F )
-							header.packet_flags |= 0b10000000;
+		auto [ topic_it, inserted ] = m_topics.try_emplace( topic );
+		if ( inserted )
+			topic_it->second.key = ++m_topic_counter;
 
-						// Call the packet handler
-						m_packet_handlers[ header.packet_id ]( this, to_process.first /* from socket */, packet_buffer, header.packet_flags );
-					}
+		auto& subscribers = topic_it->second.subscribers;
+		if ( std::any_of( subscribers.begin( ), subscribers.end( ), [ client ]( const auto& entry ) { return entry.socket == client; } ) )
+			return;
 
-					// Remove the packet from our queue
-					packet_buffer.erase( packet_buffer.begin( ), packet_buffer.begin( ) + header.packet_size );
-				} else {
-					// Packet is invalid/has no handler, erase it
-					packet_buffer.erase( packet_buffer.begin( ), packet_buffer.begin( ) + total_packet_size );
-				}
-			}
+		subscribers.push_back( subscriber );
+		m_subscriptions[ client ].push_back( topic );
+	}
+
+	void async_server::unsubscribe( SOCKET client, const std::string& topic ) {
+		std::lock_guard lock( m_topic_mtx );
+
+		if ( auto topic_it = m_topics.find( topic ); topic_it != m_topics.end( ) ) {
+			auto& subscribers = topic_it->second.subscribers;
+			subscribers.erase( std::remove_if( subscribers.begin( ), subscribers.end( ), [ client ]( const auto& entry ) {
+				return entry.socket == client;
+			} ), subscribers.end( ) );
+
+			if ( subscribers.empty( ) && !topic_it->second.configured )
+				m_topics.erase( topic_it );
+		}
+
+		if ( auto subscription_it = m_subscriptions.find( client ); subscription_it != m_subscriptions.end( ) ) {
+			auto& topics = subscription_it->second;
+			topics.erase( std::remove( topics.begin( ), topics.end( ), topic ), topics.end( ) );
+
+			if ( topics.empty( ) )
+				m_subscriptions.erase( subscription_it );
 		}
 	}
 
-	void async_server::close_client_connection( SOCKET client ) {
-		std::lock_guard cl_lock( m_client_mtx );
-		std::lock_guard pp_lock( m_process_mtx );
+	void async_server::set_tracing( std::uint32_t sample_rate ) {
+		m_tracer.set_sample_rate( sample_rate );
+	}
 
-		// Find our clients position
-		auto queue_it = m_packet_queue.find( client );
-		auto conn_it = std::find( m_connected_clients.begin( ), m_connected_clients.end( ), client );
+	bool async_server::export_trace( const std::string& path ) {
+		return m_tracer.export_chrome_trace( path );
+	}
 
-		if ( queue_it != m_packet_queue.end( ) )
-			m_packet_queue.erase( queue_it );
+	void async_server::start_capture( const std::string& path ) {
+		auto capture = std::make_shared< diagnostics::capture_writer >( path, diagnostics::capture_role::server );
 
-		// Is our client in our list?
-		if ( conn_it == m_connected_clients.end( ) )
-			return;
+		std::lock_guard lock( m_capture_mtx );
+		m_capture = std::move( capture );
+		m_capturing = true;
+	}
 
-		// Shut the connection down
-		shutdown( *conn_it, SD_SEND );
-		closesocket( *conn_it );
+	void async_server::stop_capture( ) {
+		std::shared_ptr< diagnostics::capture_writer > capture = nullptr;
 
-		// Remove our client
-		m_connected_clients.erase( conn_it );
+		{
+			std::lock_guard lock( m_capture_mtx );
+			capture.swap( m_capture );
+			m_capturing = false;
+		}
+
+		// The writer flushes the file once the last reference is gone
 	}
 
-	std::uint8_t async_server::generate_packet_identifier( SOCKET to ) {
-		// TODO: Don't assign packet identifiers if next one would be 1
-		auto& identifiers = m_packet_identifiers[ to ];
+	void async_server::capture( SOCKET connection, diagnostics::capture_direction direction, const char* data, std::size_t length ) {
+		if ( !m_capturing.load( std::memory_order_relaxed ) )
+			return;
 
-		if ( identifiers.size( ) > 0 ) {
-			std::uint8_t last_identifier = identifiers.back( );
-			std::uint8_t next_identifier = ( ++last_identifier % 127 ) + 1; // 1-127
-			identifiers.push_back( next_identifier );
+		std::shared_ptr< diagnostics::capture_writer > capture = nullptr;
 
-			return next_identifier;
-		} else {
-			identifiers.push_back( 1 );
-			return 1;
+		{
+			std::lock_guard lock( m_capture_mtx );
+			capture = m_capture;
 		}
+
+		if ( capture )
+			capture->record( std::uint64_t( connection ), direction, data, length );
 	}
 
-	void async_server::remove_packet_identifier( SOCKET to, std::uint8_t identifier ) {
-		auto& identifiers = m_packet_identifiers[ to ];
-		identifiers.erase( std::remove_if( identifiers.begin( ), identifiers.end( ), [ identifier ]( std::uint8_t id ) {
-			return id == identifier;
-		} ) );
+	void async_server::set_admission_options( const packets::admission_options_t& options ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_admission_options: already running" );
+
+		m_admission = options;
+	}
+
+	void async_server::set_rate_limit( std::uint16_t packet_id, const packets::rate_limit_t& limit ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_rate_limit: already running" );
+
+		if ( limit.rate > 0.0 )
+			m_rate_limits[ packet_id ] = limit;
+		else
+			m_rate_limits.erase( packet_id );
+	}
+
+	void async_server::set_response_cache( std::uint16_t packet_id, std::chrono::milliseconds ttl ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_response_cache: already running" );
+
+		if ( ttl.count( ) > 0 )
+			m_cached_packets[ packet_id ] = ttl;
+		else
+			m_cached_packets.erase( packet_id );
+	}
+
+	void async_server::set_response_cache_size( std::size_t max_bytes ) {
+		std::lock_guard lock( m_cache_mtx );
+		m_response_cache.set_capacity( max_bytes );
+	}
+
+	void async_server::invalidate_response_cache( std::uint16_t packet_id ) {
+		std::lock_guard lock( m_cache_mtx );
+		m_response_cache.invalidate( packet_id );
+	}
+
+	void async_server::set_relay_route( std::uint16_t packet_id, const packets::relay_route_t& route ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_relay_route: already running" );
+
+		if ( route.upstreams.empty( ) ) {
+			m_relay_routes.erase( packet_id );
+			return;
+		}
+
+		relay_state_t state = { };
+		state.balance = route.balance;
+		state.timeout = route.timeout;
+
+		for ( auto& endpoint : route.upstreams ) {
+			auto& upstream = m_upstreams[ endpoint ];
+
+			if ( !upstream ) {
+				upstream = std::make_unique< async_client >( endpoint );
+
+				// A restarted backend must not take the route down with it
+				transport::reconnect_policy_t policy = { };
+				policy.enabled = true;
+				upstream->set_reconnect_policy( policy );
+
+				upstream->set_forward_sink( [ this ]( std::uint64_t tag, const packets::wire::frame_header_t* header, const char* data ) {
+					relay_response( tag, header, data );
+				} );
+			}
+
+			state.upstreams.push_back( upstream.get( ) );
+		}
+
+		m_relay_routes[ packet_id ] = std::move( state );
+	}
+
+	void async_server::set_unreliable( std::uint16_t packet_id, bool unreliable ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_unreliable: already running" );
+
+		if ( unreliable )
+			m_unreliable_packets.insert( packet_id );
+		else
+			m_unreliable_packets.erase( packet_id );
+	}
+
+	void async_server::set_low_latency( const transport::low_latency_config_t& config ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_low_latency: already running" );
+
+		m_low_latency = config;
+	}
+
+	void async_server::set_manual_pump( bool manual ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_manual_pump: already running" );
+
+		m_manual_pump = manual;
+	}
+
+	void async_server::set_memory_channel_options( const transport::memory_channel_options_t& options ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_memory_channel_options: already running" );
+
+		m_memory_options = options;
+	}
+
+	void async_server::set_tls_options( const transport::tls_options_t& options ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_tls_options: already running" );
+
+		m_tls_options = options;
+	}
+
+	void async_server::pump( ) {
+		if ( !m_manual_pump || !m_running )
+			return;
+
+		accept_once( );
+		receive_once( );
+		process_once( );
+
+		while ( send_once( ) ) { }
+	}
+
+	void async_server::set_delta_encoding( std::uint16_t packet_id, std::uint32_t keyframe_interval ) {
+		if ( m_running )
+			throw std::exception( "async_server::set_delta_encoding: already running" );
+
+		if ( keyframe_interval )
+			m_delta_packets[ packet_id ] = keyframe_interval;
+		else
+			m_delta_packets.erase( packet_id );
+	}
+
+	void async_server::send_packet( SOCKET to, packets::packet_base::base_packet* packet ) {
+		send_packet_internal( to, packet, packet->flags( ) );
+	}
+
+	bool async_server::send_packet( SOCKET to, packets::packet_base::base_packet* packet, std::function< bool( SOCKET, const std::vector< char >&, const std::uint8_t ) > handler, std::chrono::milliseconds timeout ) {
+		// Latest packet handler. In range of 1-127
+		std::uint8_t packet_identifier = generate_packet_identifier( to );
+
+		// The client has too many requests to answer already
+		if ( !packet_identifier )
+			return false;
+
+		// Send the packet with according flags
+		send_packet_internal( to, packet, packet_identifier );
+
+		auto now = [ ]( ) {
+			return std::chrono::high_resolution_clock::now( );
+		};
+
+		// Wait for the packet to arrive within timeout limit		
+		auto time_sent = now( );
+		bool handler_result = false;
+		bool answered = false;
+		do {
+			{
+				std::lock_guard lock( m_custom_mtx );
+
+				if ( auto queue_it = m_custom_process_queue.find( to ); queue_it != m_custom_process_queue.end( ) ) {
+					auto& queue = queue_it->second;
+
+					// See if we have a response packet queued
+					auto it = std::find_if( queue.begin( ), queue.end( ), [ packet_identifier ]( const custom_process_info_t& info ) {
+						return info.packet_identifier == packet_identifier;
+					} );
+
+					// Call the handler if a packet has been found
+					if ( it != queue.end( ) ) {
+						handler_result = handler( to, it->packet_data, it->packet_identifier | 0b10000000 );
+						queue.erase( it );
+
+						// Idle clients keep no queue around
+						if ( queue.empty( ) )
+							m_custom_process_queue.erase( queue_it );
+
+						answered = true;
+					}
+				}
+			}
+
+			if ( answered )
+				break;
+
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		} while ( std::chrono::duration_cast< std::chrono::milliseconds >( now( ) - time_sent ) <= timeout );
+
+		remove_packet_identifier( to, packet_identifier );
+		return handler_result;
+	}
+
+	async_server::request_awaiter async_server::request( SOCKET to, packets::packet_base::base_packet* packet, std::chrono::milliseconds timeout ) {
+		return request_awaiter( this, to, packet, timeout );
+	}
+
+	bool async_server::request_awaiter::await_suspend( coro::task::handle_t handle ) {
+		if ( !m_packet )
+			return false;
+
+		m_identifier = m_server->generate_packet_identifier( m_to );
+
+		// Don't suspend at all, the response is empty
+		if ( !m_identifier )
+			return false;
+
+		auto& promise = handle.promise( );
+		m_waiter = promise.loop->make_waiter( promise.id );
+
+		// Register before sending, the response may arrive before we get to the timer
+		{
+			std::lock_guard lock( m_server->m_custom_mtx );
+			m_server->m_waiters[ m_to ][ m_identifier ] = m_waiter;
+		}
+
+		m_server->send_packet_internal( m_to, m_packet, m_identifier );
+		promise.loop->add_timer( coro::event_loop::clock::now( ) + m_timeout, m_waiter );
+
+		return true;
+	}
+
+	std::optional< std::vector< char > > async_server::request_awaiter::await_resume( ) {
+		if ( !m_identifier )
+			return std::nullopt;
+
+		{
+			std::lock_guard lock( m_server->m_custom_mtx );
+
+			if ( auto waiters_it = m_server->m_waiters.find( m_to ); waiters_it != m_server->m_waiters.end( ) ) {
+				waiters_it->second.erase( m_identifier );
+
+				if ( waiters_it->second.empty( ) )
+					m_server->m_waiters.erase( waiters_it );
+			}
+		}
+
+		m_server->remove_packet_identifier( m_to, m_identifier );
+		return std::move( m_waiter->response );
+	}
+
+	bool async_server::send_file( SOCKET to, std::uint16_t packet_id, HANDLE file, std::uint64_t offset, std::uint32_t length, std::uint8_t flags ) {
+		if ( !to || !file || file == INVALID_HANDLE_VALUE )
+			return false;
+
+		char header_buffer[ packets::wire::max_header_size ] = { };
+		bool checksummed = false;
+		auto header_length = encode_blob_header( to, packet_id, length, flags, header_buffer, checksummed );
+
+		if ( !header_length )
+			return false;
+
+		auto channel = find_channel( to );
+
+		// Packets queued before the file go out first. Only this client waits for the file, the send thread serves the others
+		client_release_t release = { this, to };
+		if ( !acquire_client( to ) ) {
+			schedule_disconnect( to );
+			return false;
+		}
+
+		char trailer[ packets::checksum::checksum_size ] = { };
+		auto crc = packets::checksum::crc32c( header_buffer, header_length );
+
+		// Channels have no kernel path, stream the file through a small buffer instead
+		if ( channel ) {
+			if ( !send_raw( to, header_buffer, header_length ) ) {
+				schedule_disconnect( to );
+				return false;
+			}
+
+			std::vector< char > file_buffer( std::min< std::uint32_t >( length, 64 * 1024 ) );
+			for ( std::uint32_t total_read = 0; total_read < length; ) {
+				OVERLAPPED position = { };
+				position.Offset = DWORD( ( offset + total_read ) & 0xFFFFFFFF );
+				position.OffsetHigh = DWORD( ( offset + total_read ) >> 32 );
+
+				DWORD bytes_read = 0;
+				if ( !ReadFile( file, file_buffer.data( ), DWORD( std::min< std::size_t >( file_buffer.size( ), length - total_read ) ), &bytes_read, &position ) || bytes_read == 0 ) {
+					// The header is out already, the stream can't be recovered
+					schedule_disconnect( to );
+					return false;
+				}
+
+				if ( !send_raw( to, file_buffer.data( ), bytes_read ) ) {
+					schedule_disconnect( to );
+					return false;
+				}
+
+				if ( checksummed )
+					crc = packets::checksum::crc32c( file_buffer.data( ), bytes_read, crc );
+
+				total_read += bytes_read;
+			}
+
+			packets::checksum::write_checksum( crc, trailer );
+
+			if ( checksummed && !send_raw( to, trailer, sizeof trailer ) ) {
+				schedule_disconnect( to );
+				return false;
+			}
+
+			return true;
+		}
+
+		// The kernel never hands the data to us, so the checksum needs a pass over the file first
+		if ( checksummed ) {
+			if ( !checksum_file( file, offset, length, crc ) )
+				return false;
+
+			packets::checksum::write_checksum( crc, trailer );
+		}
+
+		// The header goes out in front of the file data within the same call, the checksum behind it
+		TRANSMIT_FILE_BUFFERS buffers = { };
+		buffers.Head = header_buffer;
+		buffers.HeadLength = DWORD( header_length );
+
+		if ( checksummed ) {
+			buffers.Tail = trailer;
+			buffers.TailLength = DWORD( sizeof trailer );
+		}
+
+		OVERLAPPED overlapped = { };
+		overlapped.Offset = DWORD( offset & 0xFFFFFFFF );
+		overlapped.OffsetHigh = DWORD( offset >> 32 );
+		overlapped.hEvent = WSACreateEvent( );
+
+		bool success = TransmitFile( to, file, length, 0, &overlapped, &buffers, TF_USE_KERNEL_APC ) || WSAGetLastError( ) == WSA_IO_PENDING;
+
+		if ( success ) {
+			DWORD bytes_sent = 0, transfer_flags = 0;
+			success = WSAGetOverlappedResult( to, &overlapped, &bytes_sent, TRUE, &transfer_flags ) && bytes_sent == header_length + length + buffers.TailLength;
+		}
+
+		WSACloseEvent( overlapped.hEvent );
+
+		if ( !success )
+			schedule_disconnect( to );
+
+		return success;
+	}
+
+	bool async_server::send_blob( SOCKET to, std::uint16_t packet_id, const char* data, std::uint32_t length, std::uint8_t flags ) {
+		if ( !to || ( !data && length ) )
+			return false;
+
+		char header_buffer[ packets::wire::max_header_size ] = { };
+		bool checksummed = false;
+		auto header_length = encode_blob_header( to, packet_id, length, flags, header_buffer, checksummed );
+
+		if ( !header_length )
+			return false;
+
+		char trailer[ packets::checksum::checksum_size ] = { };
+		if ( checksummed )
+			packets::checksum::write_checksum( packets::checksum::crc32c( data, length, packets::checksum::crc32c( header_buffer, header_length ) ), trailer );
+
+		// Header, data and checksum
+		WSABUF buffers[ 3 ] = { { ULONG( header_length ), header_buffer }, { ULONG( length ), const_cast< char* >( data ) }, { ULONG( sizeof trailer ), trailer } };
+		DWORD buffer_count = checksummed ? 3 : 2;
+
+		auto channel = find_channel( to );
+
+		// Packets queued before the blob go out first
+		client_release_t release = { this, to };
+		if ( !acquire_client( to ) ) {
+			schedule_disconnect( to );
+			return false;
+		}
+
+		// Gather everything in one call so the data is never copied in userspace, channels take it piece by piece. A full socket takes the rest below
+		DWORD bytes_sent = 0;
+		bool success = channel || WSASend( to, buffers, buffer_count, &bytes_sent, 0, NULL, NULL ) != SOCKET_ERROR || WSAGetLastError( ) == WSAEWOULDBLOCK;
+
+		// Send whatever did not make it in the first go
+		for ( DWORD i = 0; i < buffer_count && success; i++ ) {
+			auto skipped = std::min< DWORD >( bytes_sent, buffers[ i ].len );
+			bytes_sent -= skipped;
+
+			if ( skipped < buffers[ i ].len )
+				success = send_raw( to, buffers[ i ].buf + skipped, buffers[ i ].len - skipped );
+		}
+
+		if ( !success )
+			schedule_disconnect( to );
+
+		return success;
+	}
+
+	std::size_t async_server::encode_blob_header( SOCKET to, std::uint16_t packet_id, std::uint32_t length, std::uint8_t flags, char* out, bool& checksummed ) {
+		std::lock_guard lock( m_connection_mtx );
+
+		auto info_it = m_connection_info.find( to );
+		if ( info_it == m_connection_info.end( ) || info_it->second.framing == packets::wire::framing_t::unknown )
+			return 0;
+
+		auto& info = info_it->second;
+
+		// Only v2 with large frames can carry more than 64 KiB
+		bool large_frames = info.framing == packets::wire::framing_t::v2 && info.features & packets::wire::feature_large_frames;
+		if ( length > ( large_frames ? packets::wire::max_large_packet_size : packets::wire::max_packet_size ) )
+			return 0;
+
+		packets::wire::frame_header_t header = { };
+		header.packet_id = packet_id;
+		header.packet_size = length;
+		header.packet_flags = flags;
+
+		checksummed = info.framing == packets::wire::framing_t::v2 && info.features & packets::wire::feature_checksum;
+		return packets::wire::encode_header( info.framing, header, out );
+	}
+
+	void async_server::send_packet_internal( SOCKET to, packets::packet_base::base_packet* packet, std::uint8_t packet_flags ) {
+		// Return if our packet is invalid or we have no one to send our packet to
+		if ( !to || !packet )
+			return;
+
+		packets::wire::frame_header_t header( packet );
+
+		// Set the packet flags if they don't match
+		if ( packet->flags( ) != packet_flags )
+			header.packet_flags = packet_flags;
+
+		// Remember what the handler of a cached request answers
+		if ( auto recording = current_recording; recording && recording->server == this && recording->from == to ) {
+			if ( m_delta_packets.find( header.packet_id ) != m_delta_packets.end( ) )
+				recording->cacheable = false;
+			else {
+				packets::cached_response_t response = { header };
+				response.answer = recording->request_flags & 0x7F && header.packet_flags == recording->request_flags;
+				response.data.assign( packet->data( ), packet->data( ) + header.packet_size );
+				recording->responses.push_back( std::move( response ) );
+			}
+		}
+
+		auto framing = packets::wire::framing_t::unknown;
+		std::uint32_t features = 0;
+
+		{
+			std::lock_guard lock( m_connection_mtx );
+
+			auto info_it = m_connection_info.find( to );
+			if ( info_it == m_connection_info.end( ) )
+				return;
+
+			// We don't know how to talk to this client yet, send it once we do
+			if ( info_it->second.framing == packets::wire::framing_t::unknown ) {
+				auto& info = info_it->second;
+
+				// A client which never tells us could make us hold anything, let it go instead
+				if ( info.pending_bytes + header.packet_size > m_max_pending_bytes ) {
+					info.pending_frames.clear( );
+					info.pending_bytes = 0;
+
+					schedule_disconnect( to );
+					return;
+				}
+
+				auto data = packet->data( );
+				info.pending_frames.emplace_back( header, std::vector< char >( data, data + header.packet_size ) );
+				info.pending_bytes += header.packet_size;
+
+				return;
+			}
+
+			framing = info_it->second.framing;
+			features = info_it->second.features;
+
+			// Latest-state packets take the datagram channel once the client bound it, requests always need TCP
+			auto& datagram = info_it->second.datagram;
+			if ( datagram && datagram->address_length && !( header.packet_flags & 0x7F ) && header.packet_size <= packets::datagram::max_packet_size && m_unreliable_packets.count( header.packet_id ) ) {
+				std::lock_guard datagram_lock( m_datagram_mtx );
+
+				auto& outbox = m_datagram_outboxes[ to ];
+				outbox.address = datagram->address;
+				outbox.address_length = datagram->address_length;
+				outbox.outbox.append( datagram->token, ++datagram->sequences[ header.packet_id ], header, packet->data( ) );
+
+				return;
+			}
+
+			// Deltas have to be queued in the order they were encoded in, so we keep the lock until then
+			auto delta_it = m_delta_packets.find( header.packet_id );
+			if ( delta_it != m_delta_packets.end( ) && features & packets::wire::feature_delta && header.packet_size < packets::wire::max_packet_size ) {
+				std::vector< char > encoded = { };
+				auto& delta_states = info_it->second.delta_states;
+				if ( !delta_states )
+					delta_states = std::make_unique< std::unordered_map< std::uint16_t, packets::delta::sender_state_t > >( );
+
+				packets::delta::encode( ( *delta_states )[ header.packet_id ], packet->data( ), header.packet_size, delta_it->second, encoded );
+
+				header.frame_flags |= packets::wire::frame_flag_delta;
+				header.packet_size = std::uint32_t( encoded.size( ) );
+
+				enqueue_frame( to, priority_of( header.packet_id ), build_frame( framing, features, header, encoded.data( ) ), diagnostics::tracer::current( ) );
+				return;
+			}
+		}
+
+		// Queue the packet in its priority lane, the send thread takes it from there
+		// Responses sent from a traced handler are traced as well
+		enqueue_frame( to, priority_of( header.packet_id ), build_frame( framing, features, header, packet->data( ) ), diagnostics::tracer::current( ) );
+	}
+
+	std::vector< char > async_server::build_frame( packets::wire::framing_t framing, std::uint32_t features, const packets::wire::frame_header_t& packet_header, const char* data ) {
+		auto header = packet_header;
+
+		// Compress the packet data if it is worth it and the client can decompress it. Relayed frames may be compressed already
+		std::vector< char > compressed_data = { };
+		if ( framing == packets::wire::framing_t::v2 && features & packets::wire::feature_compression && header.packet_size >= m_compression_threshold && !( header.frame_flags & packets::wire::frame_flag_compressed ) ) {
+			auto dictionary_it = m_compression_dictionaries.find( header.packet_id );
+			auto dictionary = dictionary_it != m_compression_dictionaries.end( ) ? &dictionary_it->second : nullptr;
+
+			if ( packets::compression::compress_payload( data, header.packet_size, dictionary, compressed_data ) ) {
+				header.frame_flags |= packets::wire::frame_flag_compressed;
+				header.packet_size = std::uint32_t( compressed_data.size( ) );
+				data = compressed_data.data( );
+			}
+		}
+
+		// Allocate a buffer into which we copy our packet data
+		std::vector< char > packet_buffer( packets::wire::max_header_size + header.packet_size + packets::checksum::checksum_size );
+
+		// Copy the header and packet data into the buffer
+		auto header_length = packets::wire::encode_header( framing, header, packet_buffer.data( ) );
+		memcpy( packet_buffer.data( ) + header_length, data, header.packet_size );
+
+		packet_buffer.resize( header_length + header.packet_size );
+
+		if ( framing == packets::wire::framing_t::v2 && features & packets::wire::feature_checksum )
+			packets::checksum::append_checksum( packet_buffer );
+
+		return packet_buffer;
+	}
+
+	bool async_server::send_raw( SOCKET to, const char* data, std::size_t length ) {
+		capture( to, diagnostics::capture_direction::sent, data, length );
+		return write_all( to, data, length );
+	}
+
+	bool async_server::write_all( SOCKET to, const char* data, std::size_t length ) {
+		for ( std::size_t total_bytes_sent = 0; total_bytes_sent < length; ) {
+			auto bytes_sent = write_some( to, data + total_bytes_sent, length - total_bytes_sent );
+
+			if ( bytes_sent < 0 )
+				return false;
+
+			total_bytes_sent += bytes_sent;
+
+			// The client's socket is full, wait until it takes more
+			if ( total_bytes_sent < length ) {
+				WSAPOLLFD poll_fd = { to, POLLWRNORM, 0 };
+				if ( WSAPoll( &poll_fd, 1, 100 ) < 0 || poll_fd.revents & ( POLLERR | POLLHUP | POLLNVAL ) )
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	int async_server::write_some( SOCKET to, const char* data, std::size_t length ) {
+		std::size_t total_bytes_sent = 0;
+
+		// Channel writes wait until they took something, so they get the whole buffer right away as they always did
+		if ( auto channel = find_channel( to ) ) {
+			while ( total_bytes_sent < length ) {
+				auto bytes_sent = channel->write( data + total_bytes_sent, int( length - total_bytes_sent ) );
+
+				if ( bytes_sent <= 0 )
+					return -1;
+
+				total_bytes_sent += bytes_sent;
+			}
+
+			return int( total_bytes_sent );
+		}
+
+		// Client sockets don't block, whatever doesn't fit is left for later
+		while ( total_bytes_sent < length ) {
+			auto bytes_sent = send( to, data + total_bytes_sent, int( length - total_bytes_sent ), NULL );
+
+			if ( bytes_sent == SOCKET_ERROR )
+				return WSAGetLastError( ) == WSAEWOULDBLOCK ? int( total_bytes_sent ) : -1;
+
+			total_bytes_sent += bytes_sent;
+		}
+
+		return int( total_bytes_sent );
+	}
+
+	bool async_server::acquire_client( SOCKET to ) {
+		// Another file or blob for the same client goes after the one being sent
+		{
+			std::unique_lock lock( m_outbound_mtx );
+			m_outbound_cv.wait( lock, [ this, to ]( ) {
+				return !m_exclusive_clients.count( to );
+			} );
+
+			m_exclusive_clients[ to ] = false;
+		}
+
+		// The send thread doesn't pick the client anymore, take over the frame it did not finish
+		popped_frame_t partial = { };
+		{
+			std::lock_guard send_lock( m_send_mtx );
+
+			if ( auto partial_it = m_partial_writes.find( to ); partial_it != m_partial_writes.end( ) ) {
+				partial = std::move( partial_it->second );
+				m_partial_writes.erase( partial_it );
+			}
+		}
+
+		bool success = true;
+
+		if ( partial.to ) {
+			success = write_all( to, partial.data.data( ) + partial.offset, partial.data.size( ) - partial.offset );
+			m_tracer.record( partial.trace_id, 0, diagnostics::trace_stage::send_end );
+
+			{
+				std::lock_guard lock( m_outbound_mtx );
+				m_outbound_in_flight--;
+			}
+
+			m_outbound_cv.notify_all( );
+		}
+
+		return success && send_queued_frames( to );
+	}
+
+	void async_server::release_client( SOCKET to ) {
+		bool closed = false;
+		{
+			std::lock_guard lock( m_outbound_mtx );
+
+			if ( auto exclusive_it = m_exclusive_clients.find( to ); exclusive_it != m_exclusive_clients.end( ) ) {
+				closed = exclusive_it->second;
+				m_exclusive_clients.erase( exclusive_it );
+			}
+
+			m_outbound_generation++;
+		}
+
+		m_outbound_cv.notify_all( );
+
+		// The connection was closed while we were writing to it, its socket was left open for us
+		if ( closed && !transport::is_memory_socket( to ) )
+			closesocket( to );
+	}
+
+	bool async_server::send_queued_frames( SOCKET to ) {
+		std::vector< popped_frame_t > frames = { };
+		{
+			std::lock_guard lock( m_outbound_mtx );
+
+			auto queue_it = m_outbound_queues.find( to );
+			if ( queue_it == m_outbound_queues.end( ) )
+				return true;
+
+			for ( popped_frame_t frame = { to }; queue_it->second.pop( frame.data, frame.trace_id ); frame = { to } )
+				frames.push_back( std::move( frame ) );
+
+			m_outbound_frames -= frames.size( );
+			m_outbound_in_flight += frames.size( );
+			m_outbound_queues.erase( queue_it );
+		}
+
+		bool success = true;
+
+		for ( auto& frame : frames ) {
+			m_tracer.record( frame.trace_id, 0, diagnostics::trace_stage::send_lock );
+			m_tracer.record( frame.trace_id, 0, diagnostics::trace_stage::send_begin );
+
+			success = success && send_raw( to, frame.data.data( ), frame.data.size( ) );
+
+			m_tracer.record( frame.trace_id, 0, diagnostics::trace_stage::send_end );
+		}
+
+		{
+			std::lock_guard lock( m_outbound_mtx );
+			m_outbound_in_flight -= frames.size( );
+		}
+
+		m_outbound_cv.notify_all( );
+
+		return success;
+	}
+
+	bool async_server::negotiate( SOCKET client, std::vector< char >& packet_buffer, packets::wire::framing_t& framing, std::uint32_t& features, void*& context ) {
+		{
+			std::lock_guard lock( m_connection_mtx );
+
+			auto info_it = m_connection_info.find( client );
+			if ( info_it == m_connection_info.end( ) )
+				return false;
+
+			// Already known, this is the common case
+			if ( info_it->second.framing != packets::wire::framing_t::unknown ) {
+				// A v2 client whose handshake came after we assumed legacy framing already got legacy frames
+				if ( info_it->second.framing_assumed ) {
+					packets::wire::handshake_t handshake = { };
+					auto result = packets::wire::decode_handshake( packet_buffer.data( ), packet_buffer.size( ), handshake );
+
+					if ( result == 0 )
+						return false;
+
+					if ( result > 0 ) {
+						packet_buffer.clear( );
+						schedule_disconnect( client );
+						return false;
+					}
+
+					info_it->second.framing_assumed = false;
+				}
+
+				framing = info_it->second.framing;
+				features = info_it->second.features;
+				context = info_it->second.context;
+				return true;
+			}
+		}
+
+		// Protocol v2 clients start with a handshake, anything else is a legacy packet header
+		packets::wire::handshake_t handshake = { };
+		auto result = packets::wire::decode_handshake( packet_buffer.data( ), packet_buffer.size( ), handshake );
+
+		if ( result == 0 )
+			return false;
+
+		if ( result > 0 ) {
+			packet_buffer.erase( packet_buffer.begin( ), packet_buffer.begin( ) + result );
+
+			framing = packets::wire::framing_t::v2;
+			features = handshake.features & m_features;
+
+			if ( m_datagram_socket == INVALID_SOCKET )
+				features &= ~packets::wire::feature_datagram;
+		} else {
+			framing = packets::wire::framing_t::legacy;
+			features = 0;
+		}
+
+		// Answer with the features we accepted. Nothing else can be queued for this client before we set its framing
+		if ( framing == packets::wire::framing_t::v2 ) {
+			std::vector< char > acknowledgement( packets::wire::handshake_size );
+			packets::wire::encode_handshake( { packets::wire::protocol_version, features }, acknowledgement.data( ) );
+
+			enqueue_frame( client, packets::packet_priority::control, std::move( acknowledgement ) );
+		}
+
+		std::lock_guard lock( m_connection_mtx );
+
+		auto& info = m_connection_info[ client ];
+
+		// We assumed legacy framing while looking at the data, which only works out if that is what it was
+		if ( info.framing != packets::wire::framing_t::unknown ) {
+			if ( framing != info.framing ) {
+				packet_buffer.clear( );
+				schedule_disconnect( client );
+				return false;
+			}
+
+			info.framing_assumed = false;
+			context = info.context;
+			return true;
+		}
+
+		info.framing = framing;
+		info.features = features;
+		context = info.context;
+
+		// Queue everything that was sent before we knew how to frame it, still holding the lock so nothing overtakes it
+		for ( auto& [ header, data ] : info.pending_frames )
+			enqueue_frame( client, priority_of( header.packet_id ), build_frame( framing, features, header, data.data( ) ) );
+
+		info.pending_frames.clear( );
+		info.pending_bytes = 0;
+
+		// The client binds its datagram channel with a token only it knows
+		if ( features & packets::wire::feature_datagram ) {
+			std::uint64_t token = 0;
+			while ( !token || m_datagram_tokens.count( token ) )
+				token = m_token_random( );
+
+			info.datagram = std::make_unique< datagram_state_t >( );
+			info.datagram->token = token;
+			m_datagram_tokens[ token ] = client;
+
+			send_datagram_token( client, token );
+		}
+
+		return true;
+	}
+
+	void async_server::accept( ) {
+		transport::pin_current_thread( m_low_latency, 3 );
+
+		// accept_once drains the whole backlog until accept would block
+		if ( m_endpoint.scheme != transport::scheme_t::memory ) {
+			unsigned long non_blocking = 1;
+			ioctlsocket( m_server_socket, FIONBIO, &non_blocking );
+		}
+
+		while ( m_running ) {
+			// Sockets wait for connections in accept_once, in-process connections are polled
+			if ( m_endpoint.scheme == transport::scheme_t::memory )
+				std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+
+			accept_once( );
+		}
+	}
+
+	void async_server::accept_once( ) {
+		// In-process clients are picked up from our listener and get a pseudo socket
+		if ( m_endpoint.scheme == transport::scheme_t::memory ) {
+			while ( auto channel = transport::memory_listener::accept( m_endpoint.path ) ) {
+				auto client = transport::make_memory_socket( ++m_channel_counter );
+
+				{
+					std::lock_guard lock( m_channel_mtx );
+					m_channels[ client ] = channel;
+				}
+
+				add_client( client );
+			}
+
+			return;
+		}
+
+		// Wait for a connection a millisecond at a time, so we notice when we have to stop
+		WSAPOLLFD poll_fd = { m_server_socket, POLLRDNORM, 0 };
+		if ( WSAPoll( &poll_fd, 1, 1 ) <= 0 )
+			return;
+
+		// Take every connection that is waiting, a reconnect storm must not be drained one poll at a time
+		while ( m_running ) {
+			SOCKET client = ::accept( m_server_socket, NULL, NULL );
+
+			// WSAEWOULDBLOCK once the backlog is empty
+			if ( client == INVALID_SOCKET )
+				return;
+
+			// Accepted sockets inherit non-blocking mode from the listener, which is what add_client wants. The shared memory and TLS setup expect blocking sockets
+			if ( m_endpoint.scheme == transport::scheme_t::shm || m_endpoint.scheme == transport::scheme_t::tls ) {
+				unsigned long non_blocking = 0;
+				ioctlsocket( client, FIONBIO, &non_blocking );
+			}
+
+			// Shared memory clients get their ring pair before they are visible to the other threads, TLS clients go to
+			// the receive thread which finishes their handshake without holding up the accept thread
+			try {
+				if ( m_endpoint.scheme == transport::scheme_t::shm )
+					attach_shm_channel( client );
+				else if ( m_endpoint.scheme == transport::scheme_t::tls ) {
+					start_tls_handshake( client );
+					continue;
+				}
+			} catch ( const std::exception& ) {
+				closesocket( client );
+				continue;
+			}
+
+			add_client( client );
+		}
+	}
+
+	void async_server::add_client( SOCKET client ) {
+		// The send thread never waits for a single client's socket, sockets taken over from another process need this too
+		if ( m_endpoint.scheme == transport::scheme_t::tcp || m_endpoint.scheme == transport::scheme_t::unix_socket ) {
+			unsigned long non_blocking = 1;
+			ioctlsocket( client, FIONBIO, &non_blocking );
+		}
+
+		// The framing is detected once the client sends its first bytes
+		{
+			std::lock_guard info_lock( m_connection_mtx );
+			m_connection_info.erase( client );
+
+			auto now = std::chrono::steady_clock::now( );
+			m_connection_info[ client ].connected_at = now;
+			m_framing_deadlines.emplace_back( client, now + m_legacy_detection_timeout );
+		}
+
+		// The receive thread picks the client up at the start of its next round, we never wait for it to finish one
+		{
+			std::lock_guard lock( m_accept_mtx );
+			m_accepted_clients.push_back( client );
+
+			// The process thread makes its context before it looks at any of its data
+			if ( m_context_type_info.construct )
+				m_context_clients.push_back( client );
+		}
+
+		if ( m_context_type_info.construct )
+			m_process_waiter.notify( );
+	}
+
+	void async_server::adopt_accepted_clients( ) {
+		std::lock_guard lock( m_accept_mtx );
+
+		if ( !m_accepted_clients.empty( ) || !m_accepted_handshakes.empty( ) )
+			m_poll_fds_stale = true;
+
+		m_connected_clients.insert( m_connected_clients.end( ), m_accepted_clients.begin( ), m_accepted_clients.end( ) );
+		m_accepted_clients.clear( );
+
+		for ( auto& handshake : m_accepted_handshakes )
+			m_tls_handshakes[ handshake.client ] = std::move( handshake );
+
+		m_accepted_handshakes.clear( );
+	}
+
+	void async_server::receive( ) {
+		transport::pin_current_thread( m_low_latency, 0 );
+
+		while ( m_running )
+			receive_once( );
+	}
+
+	void async_server::receive_once( ) {
+		std::vector< SOCKET > disconnected_clients = { };
+		bool received_any = false;
+
+		// Pick up connections other threads want closed
+		{
+			std::lock_guard lock( m_disconnect_mtx );
+			disconnected_clients.swap( m_disconnect_queue );
+		}
+
+		// Shared memory and in-process channels have no socket to wait on, they are read on every pass
+		bool poll_sockets = m_endpoint.scheme != transport::scheme_t::shm && m_endpoint.scheme != transport::scheme_t::memory;
+
+		if ( poll_sockets ) {
+			{
+				std::lock_guard cl_lock( m_client_mtx );
+
+				auto now = std::chrono::steady_clock::now( );
+
+				adopt_accepted_clients( );
+				expire_tls_handshakes( now );
+				update_poll_fds( now );
+			}
+
+			// Only this thread adds or closes clients, so the sockets stay valid while we wait without the lock. The
+			// timeout is how long new clients and disconnects wait for us
+			if ( m_poll_fds.empty( ) )
+				std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+			else if ( WSAPoll( m_poll_fds.data( ), ULONG( m_poll_fds.size( ) ), m_low_latency.enabled ? 0 : 1 ) <= 0 ) {
+				for ( auto& poll_fd : m_poll_fds )
+					poll_fd.revents = 0;
+			}
+		}
+
+		auto now = std::chrono::steady_clock::now( );
+		expire_framing_detection( now );
+
+		{
+			std::lock_guard cl_lock( m_client_mtx );
+
+			if ( poll_sockets ) {
+				// Only the sockets which have something for us, or were closed
+				for ( auto& poll_fd : m_poll_fds ) {
+					if ( !poll_fd.revents )
+						continue;
+
+					// The data finishing a handshake can carry the first records, the client is read right away then
+					if ( !m_tls_handshakes.empty( ) && m_tls_handshakes.count( poll_fd.fd ) && !continue_tls_handshake( poll_fd.fd ) )
+						continue;
+
+					// TLS decrypts whole records, take all of them since the socket won't tell us about what is left
+					int received = 0;
+					do {
+						received = receive_from( poll_fd.fd, now );
+						received_any |= received > 0;
+					} while ( received > 0 && m_endpoint.scheme == transport::scheme_t::tls );
+
+					// Close the connection once we released the client lock
+					if ( received < 0 )
+						disconnected_clients.push_back( poll_fd.fd );
+				}
+			} else {
+				adopt_accepted_clients( );
+
+				for ( auto& client : m_connected_clients ) {
+					// Clients over their limits are left alone, the data piles up on their side
+					if ( !may_receive( client, now ) )
+						continue;
+
+					auto received = receive_from( client, now );
+					received_any |= received > 0;
+
+					// Close the connection once we released the client lock
+					if ( received < 0 )
+						disconnected_clients.push_back( client );
+				}
+			}
+		}
+
+		if ( received_any )
+			m_process_waiter.notify( );
+
+		for ( auto& client : disconnected_clients )
+			close_client_connection( client );
+	}
+
+	void async_server::update_poll_fds( std::chrono::steady_clock::time_point now ) {
+		if ( m_poll_fds_stale ) {
+			m_poll_fds.clear( );
+
+			for ( auto client : m_connected_clients )
+				m_poll_fds.push_back( { client, POLLRDNORM, 0 } );
+
+			for ( auto& [ client, handshake ] : m_tls_handshakes )
+				m_poll_fds.push_back( { client, POLLRDNORM, 0 } );
+
+			m_poll_fds_stale = false;
+		}
+
+		// Clients over their limits are left alone, the data piles up on their side. We still hear if they hang up
+		if ( m_admission.bytes.rate > 0.0 || m_admission.max_buffered_bytes ) {
+			for ( auto& poll_fd : m_poll_fds )
+				poll_fd.events = may_receive( poll_fd.fd, now ) ? POLLRDNORM : 0;
+		}
+	}
+
+	bool async_server::continue_tls_handshake( SOCKET client ) {
+		auto handshake_it = m_tls_handshakes.find( client );
+		auto established = false;
+
+		try {
+			established = handshake_it->second.channel->continue_handshake( );
+		} catch ( const std::exception& ) {
+			closesocket( client );
+			m_tls_handshakes.erase( handshake_it );
+			m_poll_fds_stale = true;
+
+			return false;
+		}
+
+		if ( !established )
+			return false;
+
+		{
+			std::lock_guard lock( m_channel_mtx );
+			m_channels[ client ] = handshake_it->second.channel;
+		}
+
+		m_tls_handshakes.erase( handshake_it );
+		m_poll_fds_stale = true;
+
+		add_client( client );
+		adopt_accepted_clients( );
+
+		return true;
+	}
+
+	void async_server::expire_framing_detection( std::chrono::steady_clock::time_point now ) {
+		std::lock_guard lock( m_connection_mtx );
+
+		while ( !m_framing_deadlines.empty( ) && m_framing_deadlines.front( ).second <= now ) {
+			auto client = m_framing_deadlines.front( ).first;
+			m_framing_deadlines.pop_front( );
+
+			// The client may have spoken up, left, or its socket may belong to a newer connection by now
+			auto info_it = m_connection_info.find( client );
+			if ( info_it == m_connection_info.end( ) || info_it->second.framing != packets::wire::framing_t::unknown || now < info_it->second.connected_at + m_legacy_detection_timeout )
+				continue;
+
+			// Only legacy clients wait for us to talk first, send what they missed
+			auto& info = info_it->second;
+			info.framing = packets::wire::framing_t::legacy;
+			info.features = 0;
+			info.framing_assumed = true;
+
+			for ( auto& [ header, data ] : info.pending_frames )
+				enqueue_frame( client, priority_of( header.packet_id ), build_frame( info.framing, info.features, header, data.data( ) ) );
+
+			info.pending_frames.clear( );
+			info.pending_bytes = 0;
+		}
+	}
+
+	void async_server::expire_tls_handshakes( std::chrono::steady_clock::time_point now ) {
+		for ( auto it = m_tls_handshakes.begin( ); it != m_tls_handshakes.end( ); ) {
+			if ( now < it->second.deadline ) {
+				++it;
+				continue;
+			}
+
+			closesocket( it->first );
+			it = m_tls_handshakes.erase( it );
+			m_poll_fds_stale = true;
+		}
+	}
+
+	int async_server::receive_from( SOCKET client, std::chrono::steady_clock::time_point now ) {
+		int received = 0;
+
+		if ( auto channel = find_channel( client ) ) {
+			// Channels can be read without blocking, 0 means nothing is queued
+			received = channel->read( m_receive_buffer.data( ), m_buffer_size );
+
+			if ( received == 0 )
+				return 0;
+		} else {
+			received = recv( client, m_receive_buffer.data( ), m_buffer_size, NULL );
+
+			// Client sockets don't block, the data may have been taken already
+			if ( received == SOCKET_ERROR && WSAGetLastError( ) == WSAEWOULDBLOCK )
+				return 0;
+		}
+
+		// Did we have an error?
+		if ( received <= 0 )
+			return -1;
+
+		capture( client, diagnostics::capture_direction::received, m_receive_buffer.data( ), received );
+
+		if ( m_admission.bytes.rate > 0.0 )
+			m_receive_buckets[ client ].take( received, now );
+
+		// Lock mutex
+		std::lock_guard pp_lock( m_process_mtx );
+
+		// Get the client buffer and fill it with the data we received. Clients only borrow one while data is in flight
+		auto [ queue_it, inserted ] = m_packet_queue.try_emplace( client );
+		auto& packet_buffer = queue_it->second;
+
+		// The client lines up for the process thread
+		if ( inserted ) {
+			packet_buffer = m_buffer_pool.acquire( );
+			m_ready_clients.push_back( client );
+		}
+
+		packet_buffer.insert( packet_buffer.end( ), m_receive_buffer.data( ), m_receive_buffer.data( ) + received );
+
+		if ( m_tracer.enabled( ) )
+			m_receive_timestamps[ client ] = diagnostics::tracer::now( );
+
+		return received;
+	}
+
+	bool async_server::may_receive( SOCKET client, std::chrono::steady_clock::time_point now ) {
+		if ( m_admission.bytes.rate > 0.0 ) {
+			auto bucket_it = m_receive_buckets.try_emplace( client, m_admission.bytes ).first;
+			if ( !bucket_it->second.available( 1.0, now ) )
+				return false;
+		}
+
+		if ( m_admission.max_buffered_bytes ) {
+			std::lock_guard lock( m_process_mtx );
+
+			if ( auto queue_it = m_packet_queue.find( client ); queue_it != m_packet_queue.end( ) && queue_it->second.size( ) > m_admission.max_buffered_bytes )
+				return false;
+		}
+
+		return true;
+	}
+
+	void async_server::process_packets( ) {
+		transport::pin_current_thread( m_low_latency, 1 );
+
+		while ( m_running ) {
+			// Spins or parks until the receive thread has new data for us
+			m_process_waiter.wait( );
+			process_once( );
+		}
+	}
+
+	void async_server::process_once( ) {
+		if ( m_tracer.enabled( ) )
+			m_process_lock_timestamp = diagnostics::tracer::now( );
+
+		std::lock_guard lock( m_process_mtx );
+
+		create_contexts( );
+
+		auto now = std::chrono::steady_clock::now( );
+		auto remaining = m_admission.max_round_packets ? std::size_t( m_admission.max_round_packets ) : SIZE_MAX;
+		bool budget_exhausted = false;
+
+		// Take complete packets out of our receive buffers, clients take turns in the order they got data
+		for ( auto turns = m_ready_clients.size( ); turns > 0 && remaining > 0; turns-- ) {
+			auto client = m_ready_clients.front( );
+			m_ready_clients.pop_front( );
+
+			auto queue_it = m_packet_queue.find( client );
+			if ( queue_it == m_packet_queue.end( ) )
+				continue;
+
+			auto budget = m_admission.dispatch_budget ? std::min< std::size_t >( m_admission.dispatch_budget, remaining ) : remaining;
+			auto extracted = extract_packets( client, queue_it->second, m_ready_packets, budget, now );
+
+			// The client may have more, come back for it in the next round
+			if ( extracted == budget )
+				budget_exhausted = true;
+
+			remaining -= extracted;
+
+			// Clients whose data was consumed completely give their buffer back, the others line up again. If we ran out
+			// of our round's budget, the clients we didn't get to are still in front
+			if ( queue_it->second.empty( ) ) {
+				m_buffer_pool.release( queue_it->second );
+				m_packet_queue.erase( queue_it );
+			} else
+				m_ready_clients.push_back( client );
+		}
+
+		take_datagram_packets( now );
+
+		// Dispatch the most important packets first
+		for ( auto& packets : m_ready_packets ) {
+			for ( auto& packet : packets )
+				dispatch_packet( packet );
+
+			packets.clear( );
+		}
+
+		// Continue the task handlers whose responses or timers came in
+		m_loop->run( );
+
+		// Packets left behind by a budget don't have to wait for new data. Rate limited ones are retried when the
+		// process thread wakes up by itself
+		if ( budget_exhausted )
+			m_process_waiter.notify( );
+	}
+
+	std::size_t async_server::extract_packets( SOCKET from, std::vector< char >& packet_buffer, std::array< std::vector< ready_packet_t >, packets::packet_priority_count >& ready_packets, std::size_t budget, std::chrono::steady_clock::time_point now ) {
+		// Wait until we know which framing the client speaks
+		auto framing = packets::wire::framing_t::unknown;
+		std::uint32_t features = 0;
+		void* context = nullptr;
+
+		if ( !negotiate( from, packet_buffer, framing, features, context ) )
+			return 0;
+
+		auto max_packet_size = features & packets::wire::feature_large_frames ? m_max_large_packet_size : packets::wire::max_packet_size;
+		auto checksum_size = features & packets::wire::feature_checksum ? packets::checksum::checksum_size : 0;
+
+		// Where the batch of a packet id sits in the ready lists
+		std::unordered_map< std::uint16_t, std::size_t > batches = { };
+
+		// Walk over all complete packets and remove them from the buffer in one go afterwards
+		std::size_t offset = 0, extracted = 0;
+		while ( offset < packet_buffer.size( ) && extracted < budget ) {
+			// We have something to process, get the information about our packet
+			packets::wire::frame_header_t header = { };
+			auto header_length = packets::wire::decode_header( framing, packet_buffer.data( ) + offset, packet_buffer.size( ) - offset, header, max_packet_size );
+
+			// A malformed header means we can't trust anything after it anymore
+			if ( header_length < 0 ) {
+				packet_buffer.clear( );
+				schedule_disconnect( from );
+				return extracted;
+			}
+
+			// Check if we have at least a packet header stored
+			if ( header_length == 0 )
+				break;
+
+			// Do we have a whole packet stored?
+			std::size_t frame_size = header_length + header.packet_size, total_packet_size = frame_size + checksum_size;
+			if ( packet_buffer.size( ) - offset < total_packet_size )
+				break;
+
+			// A frame that was corrupted on the way means we can't trust anything after it either, so we disconnect instead of resyncing
+			if ( checksum_size && packets::checksum::crc32c( packet_buffer.data( ) + offset, frame_size ) != packets::checksum::read_checksum( packet_buffer.data( ) + offset + frame_size ) ) {
+				packet_buffer.clear( );
+				schedule_disconnect( from );
+				return extracted;
+			}
+
+			auto data = packet_buffer.data( ) + offset + header_length;
+			offset += total_packet_size;
+
+			bool response = header.packet_flags & 0b10000000 /* Custom handler */;
+			bool topic_request = !response && ( header.packet_id == packets::subscribe_packet_id || header.packet_id == packets::unsubscribe_packet_id );
+			bool relayed = !response && !topic_request && m_relay_routes.find( header.packet_id ) != m_relay_routes.end( );
+			bool batched = !response && !topic_request && !relayed && m_batch_handlers.find( header.packet_id ) != m_batch_handlers.end( );
+			bool handled = response || batched || relayed || m_packet_handlers.find( header.packet_id ) != m_packet_handlers.end( ) || m_task_handlers.find( header.packet_id ) != m_task_handlers.end( ) || m_context_handlers.find( header.packet_id ) != m_context_handlers.end( );
+			bool delta = header.frame_flags & packets::wire::frame_flag_delta;
+
+			// Packet is invalid/has no handler, skip it. Deltas still have to update their base
+			if ( !handled && !topic_request && !delta )
+				continue;
+
+			// Over its limits, a packet either waits in the buffer for a later round or is dropped. Responses to our own requests are always let through
+			bool admitted = response || admit( from, header.packet_id, now );
+
+			if ( !admitted && m_admission.action == packets::limit_action::delay ) {
+				offset -= total_packet_size;
+				break;
+			}
+
+			if ( !admitted && !delta )
+				continue;
+
+			if ( admitted )
+				extracted++;
+
+			// Relayed packets go upstream as they arrived, only deltas are rebuilt first because their base is ours
+			if ( relayed && !delta ) {
+				relay_frame( from, header, data );
+				continue;
+			}
+
+			ready_packet_t packet = { from, header };
+			auto data_size = std::size_t( header.packet_size );
+
+			// Decompress the packet data, handlers always see the original packet
+			if ( header.frame_flags & packets::wire::frame_flag_compressed ) {
+				auto dictionary_it = m_compression_dictionaries.find( header.packet_id );
+				auto dictionary = dictionary_it != m_compression_dictionaries.end( ) ? &dictionary_it->second : nullptr;
+
+				if ( !packets::compression::decompress_payload( data, header.packet_size, dictionary, packet.data, std::min( max_packet_size, m_max_decompressed_size ) ) ) {
+					packet_buffer.clear( );
+					schedule_disconnect( from );
+					return extracted;
+				}
+
+				data = packet.data.data( );
+				data_size = packet.data.size( );
+			} else if ( !batched )
+				packet.data.assign( data, data + header.packet_size );
+
+			// Rebuild delta encoded packets from the previous packet of their id
+			if ( delta ) {
+				std::vector< char > decoded = { };
+
+				if ( !packets::delta::decode( m_delta_bases[ from ][ header.packet_id ], data, data_size, decoded ) ) {
+					packet_buffer.clear( );
+					schedule_disconnect( from );
+					return extracted;
+				}
+
+				packet.data = std::move( decoded );
+				data = packet.data.data( );
+				data_size = packet.data.size( );
+
+				if ( !admitted || ( !handled && !topic_request ) )
+					continue;
+			}
+
+			if ( relayed ) {
+				auto decoded_header = header;
+				decoded_header.frame_flags = 0;
+				decoded_header.packet_size = std::uint32_t( data_size );
+
+				relay_frame( from, decoded_header, data );
+				continue;
+			}
+
+			// Subscriptions are handled right away, they never reach a handler
+			if ( topic_request ) {
+				std::string topic( data, std::min( data_size, packets::max_topic_length ) );
+
+				if ( header.packet_id == packets::subscribe_packet_id )
+					subscribe( from, topic );
+				else
+					unsubscribe( from, topic );
+
+				continue;
+			}
+
+			// Requests we already know the answer to never reach their handler
+			if ( !response && !batched && m_context_handlers.find( header.packet_id ) == m_context_handlers.end( ) ) {
+				if ( m_cached_packets.find( header.packet_id ) != m_cached_packets.end( ) ) {
+					packet.cached = true;
+					packet.cache_key = packets::hash::xxh64( data, data_size, header.packet_id );
+
+					auto request_flags = header.packet_flags;
+					if ( request_flags & 0x7F )
+						request_flags |= 0b10000000;
+
+					if ( serve_from_cache( from, header.packet_id, request_flags, packet.cache_key, data, data_size ) )
+						continue;
+				}
+			}
+
+			auto& ready_list = ready_packets[ std::size_t( priority_of( header.packet_id ) ) ];
+
+			if ( batched ) {
+				// The batch is dispatched where its first packet would have been
+				auto [ batch_it, inserted ] = batches.try_emplace( header.packet_id, ready_list.size( ) );
+				if ( inserted ) {
+					ready_packet_t batch = { from, header };
+					batch.batched = true;
+					batch.trace_id = trace_extraction( from, header.packet_id );
+					ready_list.push_back( std::move( batch ) );
+				}
+
+				// If the packet has an identifier, mark it as an answer packet
+				auto packet_flags = header.packet_flags;
+				if ( packet_flags & 0x7F )
+					packet_flags |= 0b10000000;
+
+				ready_list[ batch_it->second ].batch.add( data, data_size, packet_flags );
+				continue;
+			}
+
+			packet.trace_id = trace_extraction( from, header.packet_id );
+			packet.context = context;
+			ready_list.push_back( std::move( packet ) );
+		}
+
+		// Remove the packets from our queue
+		packet_buffer.erase( packet_buffer.begin( ), packet_buffer.begin( ) + offset );
+		return extracted;
+	}
+
+	bool async_server::admit( SOCKET from, std::uint16_t packet_id, std::chrono::steady_clock::time_point now ) {
+		auto limit_it = m_rate_limits.find( packet_id );
+		if ( m_admission.packets.rate <= 0.0 && limit_it == m_rate_limits.end( ) )
+			return true;
+
+		auto& state = m_admission_states.try_emplace( from, admission_state_t { m_admission.packets } ).first->second;
+		auto packet_id_bucket = limit_it != m_rate_limits.end( ) ? &state.packet_ids.try_emplace( packet_id, limit_it->second ).first->second : nullptr;
+
+		// Only take tokens if both buckets have them
+		if ( !state.packets.available( 1.0, now ) || ( packet_id_bucket && !packet_id_bucket->available( 1.0, now ) ) )
+			return false;
+
+		state.packets.take( 1.0, now );
+		if ( packet_id_bucket )
+			packet_id_bucket->take( 1.0, now );
+
+		return true;
+	}
+
+	std::uint64_t async_server::trace_extraction( SOCKET from, std::uint16_t packet_id ) {
+		auto trace_id = m_tracer.sample( );
+		if ( !trace_id )
+			return 0;
+
+		if ( auto timestamp_it = m_receive_timestamps.find( from ); timestamp_it != m_receive_timestamps.end( ) )
+			m_tracer.record( trace_id, packet_id, diagnostics::trace_stage::received, timestamp_it->second );
+
+		m_tracer.record( trace_id, packet_id, diagnostics::trace_stage::process_lock, m_process_lock_timestamp );
+		m_tracer.record( trace_id, packet_id, diagnostics::trace_stage::extracted );
+
+		return trace_id;
+	}
+
+	void async_server::dispatch_packet( ready_packet_t& packet ) {
+		auto& header = packet.header;
+
+		m_tracer.record( packet.trace_id, header.packet_id, diagnostics::trace_stage::handler_begin );
+		diagnostics::tracer::current( ) = packet.trace_id;
+
+		dispatch_to_handler( packet );
+
+		diagnostics::tracer::current( ) = 0;
+		m_tracer.record( packet.trace_id, header.packet_id, diagnostics::trace_stage::handler_end );
+	}
+
+	void async_server::dispatch_to_handler( ready_packet_t& packet ) {
+		auto& header = packet.header;
+
+		if ( packet.batched ) {
+			if ( auto batch_handler_it = m_batch_handlers.find( header.packet_id ); batch_handler_it != m_batch_handlers.end( ) )
+				batch_handler_it->second( this, packet.from, packet.batch );
+
+			return;
+		}
+
+		// Add the packet to custom processing queue if marked as one
+		if ( header.packet_flags & 0b10000000 ) {
+			// Create an info structure
+			custom_process_info_t info( header.packet_flags & 0x7F /* Extract the packet identifier */ );
+			info.packet_data = std::move( packet.data );
+
+			std::lock_guard custom_lock( m_custom_mtx );
+
+			// Task handlers waiting for the response continue on the process thread, right after this round
+			if ( auto waiters_it = m_waiters.find( packet.from ); waiters_it != m_waiters.end( ) ) {
+				if ( auto waiter_it = waiters_it->second.find( info.packet_identifier ); waiter_it != waiters_it->second.end( ) ) {
+					if ( waiter_it->second->claim( ) ) {
+						waiter_it->second->response = std::move( info.packet_data );
+						waiter_it->second->wake( );
+					}
+
+					return;
+				}
+			}
+
+			// Add it to the queue
+			m_custom_process_queue[ packet.from ].push_back( std::move( info ) );
+			return;
+		}
+
+		// If the packet has an identifier, mark it as an answer packet
+		if ( header.packet_flags & 0x7F )
+			header.packet_flags |= 0b10000000;
+
+		if ( auto task_handler_it = m_task_handlers.find( header.packet_id ); task_handler_it != m_task_handlers.end( ) ) {
+			m_loop->spawn( task_handler_it->second( this, packet.from, std::move( packet.data ), header.packet_flags ) );
+			return;
+		}
+
+		// The context can't go away while we dispatch, closing a connection takes m_process_mtx
+		if ( auto context_handler_it = m_context_handlers.find( header.packet_id ); context_handler_it != m_context_handlers.end( ) ) {
+			if ( packet.context )
+				context_handler_it->second.invoke( context_handler_it->second.handler, this, packet.from, packet.context, packet.data, header.packet_flags );
+
+			return;
+		}
+
+		auto handler_it = m_packet_handlers.find( header.packet_id );
+		if ( handler_it == m_packet_handlers.end( ) )
+			return;
+
+		if ( packet.cached ) {
+			dispatch_cached( packet, handler_it->second );
+			return;
+		}
+
+		// Call the packet handler
+		handler_it->second( this, packet.from, packet.data, header.packet_flags );
+	}
+
+	void async_server::dispatch_cached( ready_packet_t& packet, packet_handler_server_fn handler ) {
+		auto& header = packet.header;
+
+		// An identical request earlier in this round may have filled the cache already
+		if ( serve_from_cache( packet.from, header.packet_id, header.packet_flags, packet.cache_key, packet.data.data( ), packet.data.size( ) ) )
+			return;
+
+		response_recording_t recording = { this, packet.from, header.packet_flags };
+
+		current_recording = &recording;
+		handler( this, packet.from, packet.data, header.packet_flags );
+		current_recording = nullptr;
+
+		if ( !recording.cacheable || recording.responses.empty( ) )
+			return;
+
+		auto entry = std::make_shared< packets::cache_entry_t >( );
+		entry->packet_id = header.packet_id;
+		entry->request = packet.data;
+		entry->expires = std::chrono::steady_clock::now( ) + m_cached_packets[ header.packet_id ];
+
+		// Compress once now instead of on every hit
+		for ( auto& response : recording.responses ) {
+			if ( response.header.packet_size >= m_compression_threshold ) {
+				auto dictionary_it = m_compression_dictionaries.find( response.header.packet_id );
+				auto dictionary = dictionary_it != m_compression_dictionaries.end( ) ? &dictionary_it->second : nullptr;
+
+				if ( !packets::compression::compress_payload( response.data.data( ), response.header.packet_size, dictionary, response.compressed ) )
+					response.compressed.clear( );
+			}
+
+			entry->responses.push_back( std::move( response ) );
+		}
+
+		std::lock_guard lock( m_cache_mtx );
+		m_response_cache.insert( packet.cache_key, std::move( entry ) );
+	}
+
+	bool async_server::serve_from_cache( SOCKET to, std::uint16_t packet_id, std::uint8_t packet_flags, std::uint64_t key, const char* data, std::size_t size ) {
+		std::shared_ptr< const packets::cache_entry_t > entry = nullptr;
+		{
+			std::lock_guard lock( m_cache_mtx );
+			entry = m_response_cache.find( key, packet_id, data, size, std::chrono::steady_clock::now( ) );
+		}
+
+		if ( !entry )
+			return false;
+
+		auto framing = packets::wire::framing_t::unknown;
+		std::uint32_t features = 0;
+
+		{
+			std::lock_guard lock( m_connection_mtx );
+
+			auto info_it = m_connection_info.find( to );
+			if ( info_it == m_connection_info.end( ) )
+				return true;
+
+			framing = info_it->second.framing;
+			features = info_it->second.features;
+		}
+
+		bool compress = framing == packets::wire::framing_t::v2 && features & packets::wire::feature_compression;
+		bool checksummed = framing == packets::wire::framing_t::v2 && features & packets::wire::feature_checksum;
+
+		for ( auto& response : entry->responses ) {
+			auto header = response.header;
+			auto payload = response.data.data( );
+
+			if ( response.answer )
+				header.packet_flags = packet_flags;
+
+			if ( compress && !response.compressed.empty( ) ) {
+				header.frame_flags |= packets::wire::frame_flag_compressed;
+				header.packet_size = std::uint32_t( response.compressed.size( ) );
+				payload = response.compressed.data( );
+			}
+
+			// Only the header is encoded per hit, the payload is copied as it is
+			std::vector< char > frame( packets::wire::max_header_size + header.packet_size + packets::checksum::checksum_size );
+			auto header_length = packets::wire::encode_header( framing, header, frame.data( ) );
+			memcpy( frame.data( ) + header_length, payload, header.packet_size );
+			frame.resize( header_length + header.packet_size );
+
+			if ( checksummed )
+				packets::checksum::append_checksum( frame );
+
+			enqueue_frame( to, priority_of( header.packet_id ), std::move( frame ) );
+		}
+
+		return true;
+	}
+
+	void async_server::send_frames( ) {
+		transport::pin_current_thread( m_low_latency, 2 );
+
+		while ( m_running ) {
+			if ( send_once( ) )
+				continue;
+
+			// Nothing went out: wait for new frames. Clients whose socket was full are tried again after a millisecond
+			std::unique_lock lock( m_outbound_mtx );
+			m_outbound_cv.wait_for( lock, std::chrono::milliseconds( 1 ), [ this ]( ) {
+				return m_outbound_generation != m_sent_generation || !m_running;
+			} );
+		}
+	}
+
+	bool async_server::send_once( ) {
+		// Everything queued for the datagram channel since the last round goes out together
+		bool sent_datagrams = send_datagrams( );
+
+		auto& frames = m_popped_frames;
+
+		// Held from popping to sending, so a socket is never written to after its connection was closed. Writes don't block
+		std::unique_lock send_lock( m_send_mtx );
+
+		{
+			std::lock_guard lock( m_outbound_mtx );
+			m_sent_generation = m_outbound_generation;
+
+			// One frame per client and round. Clients whose socket is full finish their frame first, those busy with a file or blob are left alone
+			for ( auto queue_it = m_outbound_queues.begin( ); queue_it != m_outbound_queues.end( ); ) {
+				auto& [ client, lanes ] = *queue_it;
+
+				if ( m_partial_writes.count( client ) || m_exclusive_clients.count( client ) ) {
+					++queue_it;
+					continue;
+				}
+
+				popped_frame_t frame = { client };
+
+				if ( lanes.pop( frame.data, frame.trace_id ) ) {
+					frames.push_back( std::move( frame ) );
+					m_outbound_frames--;
+					m_outbound_in_flight++;
+				}
+
+				// Idle clients keep no queues around
+				if ( lanes.empty( ) )
+					queue_it = m_outbound_queues.erase( queue_it );
+				else
+					++queue_it;
+			}
+		}
+
+		// Frames a socket did not take completely last round continue where they stopped
+		for ( auto& [ client, frame ] : m_partial_writes )
+			frames.push_back( std::move( frame ) );
+
+		m_partial_writes.clear( );
+
+		if ( frames.empty( ) )
+			return sent_datagrams;
+
+		// Frames wait for the ones in front of them in this round
+		for ( auto& frame : frames ) {
+			if ( !frame.offset )
+				m_tracer.record( frame.trace_id, 0, diagnostics::trace_stage::send_lock );
+		}
+
+		bool progress = sent_datagrams;
+		std::size_t finished = 0;
+
+		for ( auto& frame : frames ) {
+			if ( !frame.offset ) {
+				m_tracer.record( frame.trace_id, 0, diagnostics::trace_stage::send_begin );
+				capture( frame.to, diagnostics::capture_direction::sent, frame.data.data( ), frame.data.size( ) );
+			}
+
+			auto bytes_sent = write_some( frame.to, frame.data.data( ) + frame.offset, frame.data.size( ) - frame.offset );
+
+			// An error occurred, remove the client
+			if ( bytes_sent < 0 ) {
+				schedule_disconnect( frame.to );
+				finished++;
+				continue;
+			}
+
+			progress |= bytes_sent > 0;
+			frame.offset += bytes_sent;
+
+			// Its socket is full, the other clients don't wait for it
+			if ( frame.offset < frame.data.size( ) ) {
+				m_partial_writes.emplace( frame.to, std::move( frame ) );
+				continue;
+			}
+
+			m_tracer.record( frame.trace_id, 0, diagnostics::trace_stage::send_end );
+			finished++;
+		}
+
+		send_lock.unlock( );
+
+		if ( finished ) {
+			std::lock_guard lock( m_outbound_mtx );
+			m_outbound_in_flight -= finished;
+		}
+
+		frames.clear( );
+		m_outbound_cv.notify_all( );
+
+		return progress;
+	}
+
+	void async_server::enqueue_frame( SOCKET to, packets::packet_priority priority, std::vector< char > frame, std::uint64_t trace_id ) {
+		m_tracer.record( trace_id, 0, diagnostics::trace_stage::enqueued );
+
+		{
+			std::lock_guard lock( m_outbound_mtx );
+
+			m_outbound_queues[ to ].push( priority, std::move( frame ), trace_id );
+			m_outbound_frames++;
+			m_outbound_generation++;
+		}
+
+		m_outbound_cv.notify_all( );
+	}
+
+	packets::packet_priority async_server::priority_of( std::uint16_t packet_id ) {
+		auto priority_it = m_packet_priorities.find( packet_id );
+		return priority_it != m_packet_priorities.end( ) ? priority_it->second : packets::packet_priority::normal;
+	}
+
+	void async_server::close_client_connection( SOCKET client ) {
+		std::lock_guard cl_lock( m_client_mtx );
+		std::lock_guard pp_lock( m_process_mtx );
+
+		// Find our clients position
+		auto queue_it = m_packet_queue.find( client );
+		auto conn_it = std::find( m_connected_clients.begin( ), m_connected_clients.end( ), client );
+
+		if ( queue_it != m_packet_queue.end( ) ) {
+			m_packet_queue.erase( queue_it );
+			std::erase( m_ready_clients, client );
+		}
+
+		m_receive_timestamps.erase( client );
+		m_delta_bases.erase( client );
+		m_admission_states.erase( client );
+		m_receive_buckets.erase( client );
+
+		// Its responses won't come anymore
+		{
+			std::lock_guard custom_lock( m_custom_mtx );
+			abandon_waiters( client );
+		}
+
+		// Responses our upstreams still send for it must not reach whoever gets its socket next
+		{
+			std::lock_guard relay_lock( m_relay_mtx );
+
+			for ( auto request_it = m_relayed_requests.begin( ); request_it != m_relayed_requests.end( ); ) {
+				if ( request_it->second.from == client )
+					request_it = m_relayed_requests.erase( request_it );
+				else
+					request_it++;
+			}
+		}
+
+		// Remove the client from all topics it subscribed to
+		std::vector< std::string > topics = { };
+		{
+			std::lock_guard topic_lock( m_topic_mtx );
+
+			if ( auto subscription_it = m_subscriptions.find( client ); subscription_it != m_subscriptions.end( ) )
+				topics = subscription_it->second;
+		}
+
+		for ( auto& topic : topics )
+			unsubscribe( client, topic );
+
+		// Taken out of the map, the context lives in it until we destroyed it
+		decltype( m_connection_info )::node_type info_node = { };
+		{
+			std::lock_guard info_lock( m_connection_mtx );
+
+			if ( auto info_it = m_connection_info.find( client ); info_it != m_connection_info.end( ) ) {
+				if ( info_it->second.datagram )
+					m_datagram_tokens.erase( info_it->second.datagram->token );
+
+				info_node = m_connection_info.extract( info_it );
+			}
+		}
+
+		{
+			std::lock_guard datagram_lock( m_datagram_mtx );
+			m_datagram_outboxes.erase( client );
+		}
+
+		// No handler runs while we hold m_process_mtx, so none can still be using it
+		if ( info_node )
+			destroy_context( client, info_node.mapped( ) );
+
+		// Drop the packets we didn't get to send. A frame its socket did not take completely must not reach whoever gets the socket next
+		bool writing = false;
+		{
+			std::lock_guard send_lock( m_send_mtx );
+			std::lock_guard outbound_lock( m_outbound_mtx );
+
+			if ( auto outbound_it = m_outbound_queues.find( client ); outbound_it != m_outbound_queues.end( ) ) {
+				m_outbound_frames -= std::min( m_outbound_frames, outbound_it->second.frames( ) );
+				m_outbound_queues.erase( outbound_it );
+			}
+
+			if ( m_partial_writes.erase( client ) )
+				m_outbound_in_flight--;
+
+			// send_file or send_blob is writing to it, the socket is closed once it is done
+			if ( auto exclusive_it = m_exclusive_clients.find( client ); exclusive_it != m_exclusive_clients.end( ) ) {
+				exclusive_it->second = true;
+				writing = true;
+			}
+		}
+
+		m_outbound_cv.notify_all( );
+
+		// Close the channel, if there is one
+		{
+			std::lock_guard ch_lock( m_channel_mtx );
+
+			if ( auto channel_it = m_channels.find( client ); channel_it != m_channels.end( ) ) {
+				channel_it->second->close( );
+				m_channels.erase( channel_it );
+			}
+		}
+
+		// Is our client in our list? It may not have been picked up from the accept queue yet
+		if ( conn_it == m_connected_clients.end( ) ) {
+			adopt_accepted_clients( );
+
+			conn_it = std::find( m_connected_clients.begin( ), m_connected_clients.end( ), client );
+			if ( conn_it == m_connected_clients.end( ) )
+				return;
+		}
+
+		// Shut the connection down, memory connections only have their channel. A writer still using the socket fails from here on
+		if ( !transport::is_memory_socket( *conn_it ) ) {
+			shutdown( *conn_it, writing ? SD_BOTH : SD_SEND );
+
+			if ( !writing )
+				closesocket( *conn_it );
+		}
+
+		// Remove our client
+		m_connected_clients.erase( conn_it );
+		m_poll_fds_stale = true;
+	}
+
+	void async_server::connect_upstreams( ) {
+		if ( m_upstreams.empty( ) )
+			return;
+
+		std::vector< async_client* > upstreams = { };
+		for ( auto& [ endpoint, upstream ] : m_upstreams )
+			upstreams.push_back( upstream.get( ) );
+
+		async_client::connect_all( upstreams );
+
+		// Upstreams which are down are skipped until they reconnect, but a route needs at least one to begin with
+		for ( auto& [ packet_id, route ] : m_relay_routes ) {
+			if ( std::none_of( route.upstreams.begin( ), route.upstreams.end( ), [ ]( async_client* upstream ) { return upstream->is_connected( ); } ) ) {
+				disconnect_upstreams( );
+				throw std::exception( "async_server::connect_upstreams: no upstream of a relay route could be reached" );
+			}
+		}
+	}
+
+	void async_server::disconnect_upstreams( ) {
+		for ( auto& [ endpoint, upstream ] : m_upstreams )
+			upstream->disconnect( );
+
+		std::lock_guard lock( m_relay_mtx );
+		m_relayed_requests.clear( );
+	}
+
+	void async_server::relay_frame( SOCKET from, packets::wire::frame_header_t header, const char* data ) {
+		auto& route = m_relay_routes[ header.packet_id ];
+
+		// Connections stick to their upstream, skipping it only while it is down
+		auto count = route.upstreams.size( );
+		auto first = route.balance == packets::relay_balance::connection ? std::hash< SOCKET >{ }( from ) % count : route.next++ % count;
+
+		async_client* upstream = nullptr;
+		for ( std::size_t i = 0; i < count && !upstream; i++ ) {
+			if ( route.upstreams[ ( first + i ) % count ]->is_connected( ) )
+				upstream = route.upstreams[ ( first + i ) % count ];
+		}
+
+		// Like a lost packet, requests time out on the client
+		if ( !upstream )
+			return;
+
+		std::vector< char > decompressed = { };
+		if ( header.frame_flags & packets::wire::frame_flag_compressed && !( upstream->features( ) & packets::wire::feature_compression ) && !decompress_relayed( header, data, decompressed ) )
+			return;
+
+		// Requests are found again by their tag, the upstream sends them with an identifier of its own
+		std::uint64_t tag = 0;
+		if ( header.packet_flags & 0x7F ) {
+			std::lock_guard lock( m_relay_mtx );
+
+			tag = ++m_relay_counter;
+			m_relayed_requests[ tag ] = { from, std::uint8_t( header.packet_flags & 0x7F ) };
+		}
+
+		if ( !upstream->forward_frame( header, data, tag, route.timeout ) && tag ) {
+			std::lock_guard lock( m_relay_mtx );
+			m_relayed_requests.erase( tag );
+		}
+	}
+
+	void async_server::relay_response( std::uint64_t tag, const packets::wire::frame_header_t* upstream_header, const char* data ) {
+		relayed_request_t request = { };
+		{
+			std::lock_guard lock( m_relay_mtx );
+
+			auto request_it = m_relayed_requests.find( tag );
+			if ( request_it == m_relayed_requests.end( ) )
+				return;
+
+			request = request_it->second;
+			m_relayed_requests.erase( request_it );
+		}
+
+		// The upstream lost the request, the client times out like it would without us in between
+		if ( !upstream_header )
+			return;
+
+		auto header = *upstream_header;
+		header.packet_flags = 0b10000000 | request.identifier;
+
+		auto framing = packets::wire::framing_t::unknown;
+		std::uint32_t features = 0;
+		{
+			std::lock_guard lock( m_connection_mtx );
+
+			auto info_it = m_connection_info.find( request.from );
+			if ( info_it == m_connection_info.end( ) || info_it->second.framing == packets::wire::framing_t::unknown )
+				return;
+
+			framing = info_it->second.framing;
+			features = info_it->second.features;
+		}
+
+		std::vector< char > decompressed = { };
+		if ( header.frame_flags & packets::wire::frame_flag_compressed && !( framing == packets::wire::framing_t::v2 && features & packets::wire::feature_compression ) && !decompress_relayed( header, data, decompressed ) )
+			return;
+
+		auto max_packet_size = features & packets::wire::feature_large_frames ? packets::wire::max_large_packet_size : packets::wire::max_packet_size;
+		if ( header.packet_size > max_packet_size )
+			return;
+
+		enqueue_frame( request.from, priority_of( header.packet_id ), build_frame( framing, features, header, data ) );
+	}
+
+	bool async_server::decompress_relayed( packets::wire::frame_header_t& header, const char*& data, std::vector< char >& buffer ) {
+		auto dictionary_it = m_compression_dictionaries.find( header.packet_id );
+		auto dictionary = dictionary_it != m_compression_dictionaries.end( ) ? &dictionary_it->second : nullptr;
+
+		if ( !packets::compression::decompress_payload( data, header.packet_size, dictionary, buffer, std::min( packets::wire::max_large_packet_size, m_max_decompressed_size ) ) )
+			return false;
+
+		header.frame_flags &= std::uint8_t( ~packets::wire::frame_flag_compressed );
+		header.packet_size = std::uint32_t( buffer.size( ) );
+		data = buffer.data( );
+
+		return true;
+	}
+
+	void* async_server::find_context( SOCKET client ) {
+		std::lock_guard lock( m_connection_mtx );
+
+		auto info_it = m_connection_info.find( client );
+		return info_it != m_connection_info.end( ) ? info_it->second.context : nullptr;
+	}
+
+	void async_server::create_contexts( ) {
+		std::vector< SOCKET > clients = { };
+		{
+			std::lock_guard lock( m_accept_mtx );
+			clients.swap( m_context_clients );
+		}
+
+		auto& type = m_context_type_info;
+
+		for ( auto client : clients ) {
+			connection_info_t* info = nullptr;
+			{
+				std::lock_guard lock( m_connection_mtx );
+
+				// Closed already. Closing takes m_process_mtx, so the record stays put while we hold it
+				auto info_it = m_connection_info.find( client );
+				if ( info_it == m_connection_info.end( ) || info_it->second.context )
+					continue;
+
+				info = &info_it->second;
+			}
+
+			// Contexts which don't fit our storage get their own allocation
+			void* storage = info->context_storage.buffer;
+			bool fits = type.size <= sizeof info->context_storage.buffer && type.alignment <= alignof( std::max_align_t );
+
+			if ( !fits )
+				storage = ::operator new( type.size, std::align_val_t( type.alignment ) );
+
+			type.construct( storage );
+
+			{
+				std::lock_guard lock( m_connection_mtx );
+				info->context = storage;
+			}
+
+			if ( type.on_connect )
+				type.invoke( type.on_connect, this, client, storage );
+		}
+	}
+
+	void async_server::destroy_context( SOCKET client, connection_info_t& info ) {
+		if ( !info.context )
+			return;
+
+		auto& type = m_context_type_info;
+
+		if ( type.on_disconnect )
+			type.invoke( type.on_disconnect, this, client, info.context );
+
+		type.destroy( info.context );
+
+		if ( info.context != info.context_storage.buffer )
+			::operator delete( info.context, std::align_val_t( type.alignment ) );
+
+		info.context = nullptr;
+	}
+
+	void async_server::create_datagram_socket( const sockaddr* address, int address_length ) {
+		m_datagram_socket = ::socket( address->sa_family, SOCK_DGRAM, IPPROTO_UDP );
+
+		if ( m_datagram_socket == INVALID_SOCKET )
+			return;
+
+		// Same as the listener, IPv4 clients reach an IPv6 wildcard address too
+		if ( address->sa_family == AF_INET6 ) {
+			DWORD v6_only = 0;
+			setsockopt( m_datagram_socket, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast< const char* >( &v6_only ), sizeof v6_only );
+		}
+
+		// Lets the datagram thread see that we stopped
+		DWORD timeout = 50;
+		setsockopt( m_datagram_socket, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast< const char* >( &timeout ), sizeof timeout );
+
+		// A client which went away must not make recvfrom fail for everybody else
+		BOOL report_resets = FALSE;
+		DWORD bytes_returned = 0;
+		WSAIoctl( m_datagram_socket, SIO_UDP_CONNRESET, &report_resets, sizeof report_resets, NULL, 0, &bytes_returned, NULL, NULL );
+
+		if ( bind( m_datagram_socket, address, address_length ) == SOCKET_ERROR ) {
+			closesocket( m_datagram_socket );
+			m_datagram_socket = INVALID_SOCKET;
+		}
+	}
+
+	void async_server::send_datagram_token( SOCKET client, std::uint64_t token ) {
+		auto& info = m_connection_info[ client ];
+
+		char data[ packets::datagram::token_size ] = { };
+		packets::datagram::write_token( token, data );
+
+		packets::wire::frame_header_t header = { };
+		header.packet_id = packets::datagram::token_packet_id;
+		header.packet_size = sizeof data;
+
+		enqueue_frame( client, packets::packet_priority::control, build_frame( info.framing, info.features, header, data ) );
+	}
+
+	void async_server::receive_datagrams( ) {
+		std::vector< char > buffer( packets::datagram::max_datagram_size );
+		std::vector< ready_packet_t > packets = { };
+
+		while ( m_running ) {
+			sockaddr_storage address = { };
+			int address_length = sizeof address;
+
+			// Times out regularly, datagrams which are too large for us fail with WSAEMSGSIZE
+			auto length = recvfrom( m_datagram_socket, buffer.data( ), int( buffer.size( ) ), 0, reinterpret_cast< sockaddr* >( &address ), &address_length );
+
+			// Read whatever else arrived in the meantime, so the process thread is woken once for all of it
+			while ( true ) {
+				if ( length >= int( packets::datagram::token_size ) )
+					handle_datagram( address, address_length, buffer.data( ), std::size_t( length ), packets );
+
+				u_long pending = 0;
+				if ( ioctlsocket( m_datagram_socket, FIONREAD, &pending ) == SOCKET_ERROR || !pending )
+					break;
+
+				address_length = sizeof address;
+				length = recvfrom( m_datagram_socket, buffer.data( ), int( buffer.size( ) ), 0, reinterpret_cast< sockaddr* >( &address ), &address_length );
+			}
+
+			if ( packets.empty( ) )
+				continue;
+
+			{
+				std::lock_guard lock( m_datagram_mtx );
+				std::move( packets.begin( ), packets.end( ), std::back_inserter( m_datagram_packets ) );
+			}
+
+			packets.clear( );
+			m_process_waiter.notify( );
+		}
+	}
+
+	void async_server::handle_datagram( const sockaddr_storage& address, int address_length, const char* data, std::size_t length, std::vector< ready_packet_t >& packets ) {
+		auto token = packets::datagram::read_token( data );
+
+		{
+			std::lock_guard lock( m_connection_mtx );
+
+			auto token_it = m_datagram_tokens.find( token );
+			if ( token_it == m_datagram_tokens.end( ) )
+				return;
+
+			auto client = token_it->second;
+			auto& datagram = *m_connection_info[ client ].datagram;
+
+			// We answer wherever the client's latest datagram came from, its address may change behind a NAT
+			datagram.address = address;
+			datagram.address_length = address_length;
+
+			packets::datagram::read_frames( data, length, datagram.receiver, [ & ]( const packets::wire::frame_header_t& header, const char* packet_data ) {
+				bool handled = m_packet_handlers.count( header.packet_id ) || m_batch_handlers.count( header.packet_id ) || m_task_handlers.count( header.packet_id ) || m_context_handlers.count( header.packet_id );
+
+				// Requests and responses never come this way
+				if ( !handled || header.packet_flags & 0x7F )
+					return;
+
+				ready_packet_t packet = { client, header };
+				packet.data.assign( packet_data, packet_data + header.packet_size );
+				packets.push_back( std::move( packet ) );
+			} );
+		}
+
+		// A datagram without packets binds the channel, the client waits for our answer
+		if ( length == packets::datagram::token_size )
+			sendto( m_datagram_socket, data, int( length ), 0, reinterpret_cast< const sockaddr* >( &address ), address_length );
+	}
+
+	void async_server::take_datagram_packets( std::chrono::steady_clock::time_point now ) {
+		std::vector< ready_packet_t > packets = { };
+		{
+			std::lock_guard lock( m_datagram_mtx );
+			packets.swap( m_datagram_packets );
+		}
+
+		if ( packets.empty( ) )
+			return;
+
+		std::lock_guard lock( m_connection_mtx );
+
+		for ( auto& packet : packets ) {
+			// The connection may have been closed after the datagram arrived
+			auto info_it = m_connection_info.find( packet.from );
+			if ( info_it == m_connection_info.end( ) )
+				continue;
+
+			// Over their limits, datagrams are dropped. They are stale by the time tokens are back anyway
+			if ( !admit( packet.from, packet.header.packet_id, now ) )
+				continue;
+
+			packet.context = info_it->second.context;
+
+			auto& ready_list = m_ready_packets[ std::size_t( priority_of( packet.header.packet_id ) ) ];
+
+			if ( m_batch_handlers.count( packet.header.packet_id ) && !m_context_handlers.count( packet.header.packet_id ) ) {
+				packet.batched = true;
+				packet.batch.add( packet.data.data( ), packet.data.size( ), packet.header.packet_flags );
+				packet.data.clear( );
+			}
+
+			ready_list.push_back( std::move( packet ) );
+		}
+	}
+
+	bool async_server::send_datagrams( ) {
+		std::unordered_map< SOCKET, datagram_outbox_t > outboxes = { };
+		{
+			std::lock_guard lock( m_datagram_mtx );
+
+			if ( m_datagram_outboxes.empty( ) )
+				return false;
+
+			outboxes.swap( m_datagram_outboxes );
+		}
+
+		// Lost datagrams are what the channel is for, so errors are ignored
+		for ( auto& [ client, outbox ] : outboxes ) {
+			for ( auto& datagram : outbox.outbox.datagrams )
+				sendto( m_datagram_socket, datagram.data( ), int( datagram.size( ) ), 0, reinterpret_cast< const sockaddr* >( &outbox.address ), outbox.address_length );
+		}
+
+		return true;
+	}
+
+	void async_server::schedule_disconnect( SOCKET client ) {
+		std::lock_guard lock( m_disconnect_mtx );
+
+		if ( std::find( m_disconnect_queue.begin( ), m_disconnect_queue.end( ), client ) == m_disconnect_queue.end( ) )
+			m_disconnect_queue.push_back( client );
+	}
+
+	void async_server::create_listen_socket( ) {
+		// In-process clients find us by name, with manual pumping a waiting client drives us
+		if ( m_endpoint.scheme == transport::scheme_t::memory ) {
+			std::function< void( ) > idle_callback = nullptr;
+			if ( m_manual_pump )
+				idle_callback = [ this ]( ) { pump( ); };
+
+			transport::memory_listener::listen( m_endpoint.path, m_memory_options, idle_callback );
+			return;
+		}
+
+		if ( m_endpoint.scheme == transport::scheme_t::tcp || m_endpoint.scheme == transport::scheme_t::tls ) {
+			struct addrinfo* result, hints;
+			ZeroMemory( &hints, sizeof( hints ) );
+
+			// Let the host decide between IPv4 and IPv6
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_protocol = IPPROTO_TCP;
+			hints.ai_flags = AI_PASSIVE;
+
+			if ( getaddrinfo( m_endpoint.host.empty( ) ? NULL : m_endpoint.host.data( ), m_endpoint.port.data( ), &hints, &result ) != 0 )
+				throw std::exception( "async_server::start: failed to resolve the listen address" );
+
+			// Take the first address we can listen on
+			m_server_socket = 0;
+			const char* error = "async_server::start: no address to listen on";
+
+			for ( auto address = result; address; address = address->ai_next ) {
+				auto listener = ::socket( address->ai_family, address->ai_socktype, address->ai_protocol );
+
+				if ( listener == INVALID_SOCKET ) {
+					error = "async_server::start: socket creation failed";
+					continue;
+				}
+
+				// An IPv6 wildcard address takes IPv4 clients as well
+				if ( address->ai_family == AF_INET6 ) {
+					DWORD v6_only = 0;
+					setsockopt( listener, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast< const char* >( &v6_only ), sizeof v6_only );
+				}
+
+				// Accepted sockets inherit these
+				transport::apply_socket_options( listener, m_low_latency );
+
+				if ( bind( listener, address->ai_addr, int( address->ai_addrlen ) ) == SOCKET_ERROR )
+					error = "async_server::start: failed to bind the listen address";
+				else if ( listen( listener, SOMAXCONN ) == SOCKET_ERROR )
+					error = "async_server::start: failed to listen on the listen address";
+				else {
+					m_server_socket = listener;
+					break;
+				}
+
+				closesocket( listener );
+			}
+
+			freeaddrinfo( result );
+
+			if ( !m_server_socket )
+				throw std::exception( error );
+
+			// Clients find the datagram channel on the same port, which we only know now if we were given port 0
+			if ( m_endpoint.scheme == transport::scheme_t::tcp ) {
+				sockaddr_storage address = { };
+				int address_length = sizeof address;
+
+				if ( getsockname( m_server_socket, reinterpret_cast< sockaddr* >( &address ), &address_length ) != SOCKET_ERROR )
+					create_datagram_socket( reinterpret_cast< sockaddr* >( &address ), address_length );
+			}
+
+			return;
+		}
+
+		// Unix sockets and shared memory both listen on an AF_UNIX socket
+		sockaddr_un address = { };
+		address.sun_family = AF_UNIX;
+
+		if ( m_endpoint.path.size( ) >= sizeof address.sun_path )
+			throw std::invalid_argument( "async_server::start: socket path too long" );
+
+		memcpy( address.sun_path, m_endpoint.path.data( ), m_endpoint.path.size( ) );
+
+		// Remove the socket file a previous run might have left behind
+		std::remove( m_endpoint.path.data( ) );
+
+		auto listener = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+
+		if ( listener == INVALID_SOCKET )
+			throw std::exception( "async_server::start: socket creation failed" );
+
+		const char* error = nullptr;
+
+		if ( bind( listener, reinterpret_cast< sockaddr* >( &address ), sizeof address ) == SOCKET_ERROR )
+			error = "async_server::start: failed to bind unix socket";
+		else if ( listen( listener, SOMAXCONN ) == SOCKET_ERROR )
+			error = "async_server::start: failed to listen on unix socket";
+
+		// Don't keep a dead socket around as our listener
+		if ( error ) {
+			closesocket( listener );
+			m_server_socket = 0;
+
+			throw std::exception( error );
+		}
+
+		m_server_socket = listener;
+	}
+
+	void async_server::attach_shm_channel( SOCKET client ) {
+		// Mapping names have to be unique across all servers on this machine
+		auto name = "forceinline_remote_" + std::to_string( GetCurrentProcessId( ) ) + "_" + std::to_string( m_channel_counter++ );
+		auto channel = std::make_shared< transport::shm_channel >( name, true );
+
+		if ( m_low_latency.enabled )
+			channel->set_spin_count( m_low_latency.spin_count );
+
+		// Let the client know which mapping to open: [ uint8 length, char[ length ] name ]
+		std::vector< char > message( 1 + name.size( ) );
+		message[ 0 ] = char( name.size( ) );
+		memcpy( message.data( ) + 1, name.data( ), name.size( ) );
+
+		if ( send( client, message.data( ), int( message.size( ) ), NULL ) != int( message.size( ) ) )
+			throw std::exception( "async_server::attach_shm_channel: failed to send channel name" );
+
+		std::lock_guard lock( m_channel_mtx );
+		m_channels[ client ] = channel;
+	}
+
+	void async_server::start_tls_handshake( SOCKET client ) {
+		// Only picks up our certificate, the client's hello is answered once the receive thread sees it
+		tls_handshake_t handshake = { client, std::make_shared< transport::tls_channel >( client, m_tls_options, true, true ), std::chrono::steady_clock::now( ) + m_tls_options.handshake_timeout };
+
+		std::lock_guard lock( m_accept_mtx );
+		m_accepted_handshakes.push_back( std::move( handshake ) );
+	}
+
+	std::shared_ptr< transport::channel > async_server::find_channel( SOCKET client ) {
+		// Plain socket transports never have channels, skip the lookup
+		if ( m_endpoint.scheme != transport::scheme_t::shm && m_endpoint.scheme != transport::scheme_t::memory && m_endpoint.scheme != transport::scheme_t::tls )
+			return nullptr;
+
+		std::lock_guard lock( m_channel_mtx );
+
+		auto it = m_channels.find( client );
+		return it != m_channels.end( ) ? it->second : nullptr;
+	}
+
+	std::uint8_t async_server::generate_packet_identifier( SOCKET to ) {
+		std::lock_guard lock( m_custom_mtx );
+		auto& identifiers = m_packet_identifiers[ to ];
+
+		// Continue after the latest one, skipping those which still wait for their response. In range of 1-127
+		std::uint8_t next_identifier = identifiers.empty( ) ? 1 : identifiers.back( ) % 127 + 1;
+
+		for ( int i = 0; i < 127; i++, next_identifier = next_identifier % 127 + 1 ) {
+			if ( std::find( identifiers.begin( ), identifiers.end( ), next_identifier ) == identifiers.end( ) ) {
+				identifiers.push_back( next_identifier );
+				return next_identifier;
+			}
+		}
+
+		return 0;
+	}
+
+	void async_server::remove_packet_identifier( SOCKET to, std::uint8_t identifier ) {
+		std::lock_guard lock( m_custom_mtx );
+
+		auto identifiers_it = m_packet_identifiers.find( to );
+		if ( identifiers_it == m_packet_identifiers.end( ) )
+			return;
+
+		auto& identifiers = identifiers_it->second;
+		identifiers.erase( std::remove_if( identifiers.begin( ), identifiers.end( ), [ identifier ]( std::uint8_t id ) {
+			return id == identifier;
+		} ), identifiers.end( ) );
+
+		if ( identifiers.empty( ) )
+			m_packet_identifiers.erase( identifiers_it );
+	}
+
+	void async_server::abandon_waiters( SOCKET client ) {
+		auto waiters_it = m_waiters.find( client );
+		if ( waiters_it == m_waiters.end( ) )
+			return;
+
+		for ( auto& [ identifier, waiter ] : waiters_it->second ) {
+			if ( waiter->claim( ) )
+				waiter->wake( );
+		}
 	}
-} // namespace forceinline::remote
\ No newline at end of file
+} // namespace forceinline::remote
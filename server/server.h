@@ -2,48 +2,497 @@
 
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#include <afunix.h>
+#include <MSWSock.h>
 
 #include <string>
 #include <thread>
 #include <mutex>
 #include <unordered_map>
 #include <functional>
+#include <memory>
+#include <array>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_set>
+#include <typeindex>
+#include <random>
+#include <deque>
+#include <new>
 
 #include "../packet/packet_base.h"
+#include "../packet/wire.h"
+#include "../packet/compression.h"
+#include "../packet/priority.h"
+#include "../packet/batch.h"
+#include "../packet/topics.h"
+#include "../packet/delta.h"
+#include "../packet/rate_limit.h"
+#include "../packet/hash.h"
+#include "../packet/response_cache.h"
+#include "../packet/buffer_pool.h"
+#include "../packet/checksum.h"
+#include "../packet/relay.h"
+#include "../packet/datagram.h"
+#include "../transport/endpoint.h"
+#include "../transport/channel.h"
+#include "../transport/memory_channel.h"
+#include "../transport/tls_channel.h"
+#include "../transport/low_latency.h"
+#include "../transport/event_waiter.h"
+#include "../diagnostics/trace.h"
+#include "../diagnostics/capture.h"
+#include "../coro/task.h"
+#include "../client/client.h"
 
 #pragma comment (lib, "Ws2_32.lib")
+#pragma comment (lib, "Mswsock.lib")
 
 namespace forceinline::remote {
 	class async_server;
 	typedef void( *packet_handler_server_fn )( async_server* server, SOCKET from, const std::vector< char >& data, std::uint8_t flags  );
+	typedef void( *batch_handler_server_fn )( async_server* server, SOCKET from, const packets::packet_batch& batch );
+
+	// The handler owns its data, it may need it after it was suspended
+	typedef coro::task( *task_handler_server_fn )( async_server* server, SOCKET from, std::vector< char > data, std::uint8_t flags );
 
 	class async_server {
 	public:
-		async_server( std::string_view port );
+		// Either a port to listen on with TCP or an endpoint URI (see transport/endpoint.h)
+		async_server( std::string_view endpoint );
 		~async_server( );
 
 		void start( );
 		void close( );
 
+		/*
+			Hot restart: hands our listening socket and all client connections to a new process which called
+			take_over( path ), then stops without disconnecting anyone. Packets which were received completely are
+			dispatched and everything queued is sent first, whatever else was received moves to the new process.
+			Only for tcp:// and unix:// endpoints. Task handlers which are still suspended are dropped. Returns false
+			if no process took over within the timeout, we keep running then.
+		*/
+		bool hand_off( const std::string& path, std::chrono::milliseconds timeout = std::chrono::seconds( 10 ) );
+
+		// Starts like start( ), but with the sockets of a server which is handing them off at path
+		void take_over( const std::string& path, std::chrono::milliseconds timeout = std::chrono::seconds( 10 ) );
+
 		bool is_running( );
 
-		void set_packet_handler( std::uint16_t packet_id, packet_handler_server_fn handler );
+		// Handlers of packets with a higher priority are called first, and their responses are sent first
+		void set_packet_handler( std::uint16_t packet_id, packet_handler_server_fn handler, packets::packet_priority priority = packets::packet_priority::normal );
+
+		/*
+			Opt-in alternative to set_packet_handler: the handler is called once with all packets of this id
+			which were received from a client since the last dispatch. Takes precedence over a packet handler
+			for the same id. Responses to send_packet( ..., handler ) are never batched.
+		*/
+		void set_batch_handler( std::uint16_t packet_id, batch_handler_server_fn handler, packets::packet_priority priority = packets::packet_priority::normal );
+
+		/*
+			Opt-in alternative to set_packet_handler for handlers which have to wait for something, e.g. a request to
+			another server: the handler is a coroutine (see coro/task.h) which is resumed on the process thread once
+			what it awaits is there, other packets are processed in the meantime. Its responses are not cached.
+		*/
+		void set_task_handler( std::uint16_t packet_id, task_handler_server_fn handler, packets::packet_priority priority = packets::packet_priority::normal );
+
+		/*
+			Gives every connection an object of type T, constructed once it is accepted and destroyed when it is
+			closed, stored with our own state of the connection (small objects right in it). Both are done on the
+			process thread: on_connect runs before any packet of the connection is dispatched, on_disconnect after the
+			last one, right before the object is destroyed. Connections which are handed off are closed as far as
+			their context is concerned, the new process makes new ones. Has to be set before start.
+		*/
+		template < typename T >
+		void set_connection_context( void( *on_connect )( async_server* server, SOCKET client, T& context ) = nullptr, void( *on_disconnect )( async_server* server, SOCKET client, T& context ) = nullptr ) {
+			if ( m_running )
+				throw std::exception( "async_server::set_connection_context: already running" );
+
+			m_context_type = typeid( T );
+			m_context_handlers.clear( );
+
+			m_context_type_info = { sizeof( T ), alignof( T ),
+				[ ]( void* storage ) { new ( storage ) T( ); },
+				[ ]( void* context ) { static_cast< T* >( context )->~T( ); },
+				reinterpret_cast< void( * )( ) >( on_connect ), reinterpret_cast< void( * )( ) >( on_disconnect ),
+				[ ]( void( *callback )( ), async_server* server, SOCKET client, void* context ) {
+					reinterpret_cast< void( * )( async_server*, SOCKET, T& ) >( callback )( server, client, *static_cast< T* >( context ) );
+				}
+			};
+		}
+
+		/*
+			Like set_packet_handler, but the handler is passed the context of the connection (see set_connection_context),
+			which T has to match. Takes precedence over a packet handler for the same id, its responses are not cached.
+		*/
+		template < typename T >
+		void set_context_handler( std::uint16_t packet_id, void( *handler )( async_server* server, SOCKET from, T& context, const std::vector< char >& data, std::uint8_t flags ), packets::packet_priority priority = packets::packet_priority::normal ) {
+			if ( !handler ) {
+				m_context_handlers.erase( packet_id );
+				return;
+			}
+
+			if ( m_context_type != typeid( T ) )
+				throw std::invalid_argument( "async_server::set_context_handler: T is not the type given to set_connection_context" );
+
+			m_context_handlers[ packet_id ] = { reinterpret_cast< void( * )( ) >( handler ), [ ]( void( *erased )( ), async_server* server, SOCKET from, void* context, const std::vector< char >& data, std::uint8_t flags ) {
+				reinterpret_cast< decltype( handler ) >( erased )( server, from, *static_cast< T* >( context ), data, flags );
+			} };
+
+			set_packet_priority( packet_id, priority );
+		}
+
+		// The context of a connection for code which is not passed it, e.g. task handlers. nullptr if the connection is gone or T does not match
+		template < typename T >
+		T* connection_context( SOCKET client ) {
+			if ( m_context_type != typeid( T ) )
+				return nullptr;
+
+			return static_cast< T* >( find_context( client ) );
+		}
+
+		// Priority class for sending and dispatching a packet id, also for ids we have no handler for
+		void set_packet_priority( std::uint16_t packet_id, packets::packet_priority priority );
+
+		// Waits until all queued packets have been sent. Returns false on timeout.
+		bool flush( std::chrono::milliseconds timeout );
+
+		// Optional protocol features (packets::wire::feature) we accept when a client asks for them
+		void set_features( std::uint32_t features );
+
+		/*
+			Accepts packets::wire::feature_large_frames, clients may then send packets with up to max_size bytes
+			of data. Off by default, as every client could make us buffer a whole packet of that size.
+		*/
+		void set_large_frames( std::uint32_t max_size = packets::wire::max_large_packet_size );
+
+		/*
+			Clients which send nothing within timeout of connecting are served with the legacy framing, so legacy
+			clients which only listen get their packets too. Protocol v2 clients send their handshake right away.
+		*/
+		void set_legacy_detection_timeout( std::chrono::milliseconds timeout );
+
+		// Compress packets with at least threshold bytes of data for clients which support it
+		void set_compression( std::uint32_t threshold );
+
+		// Preset dictionary for a packet id, clients have to use the same one
+		void set_compression_dictionary( std::uint16_t packet_id, const std::vector< char >& dictionary );
+
+		// Largest packet we decompress, compressed packets which claim to be larger are dropped with their connection
+		void set_max_decompressed_size( std::uint32_t size );
+
+		/*
+			Sends a packet to every client subscribed to a topic. The packet is encoded once per kind of
+			connection and the frame is shared between all subscribers. Returns the amount of subscribers
+			the packet was queued for.
+		*/
+		std::size_t publish( std::string_view topic, packets::packet_base::base_packet* packet );
+
+		// Conflation and slow consumer handling of a topic, see packets::topic_options_t
+		void set_topic_options( std::string_view topic, const packets::topic_options_t& options );
+
+		std::size_t subscriber_count( std::string_view topic );
+
+		// Traces one in sample_rate received packets through our pipeline, 0 turns tracing off
+		void set_tracing( std::uint32_t sample_rate );
+
+		// Writes the traced packets as Chrome trace JSON, open it in chrome://tracing or Perfetto
+		bool export_trace( const std::string& path );
+
+		/*
+			With manual pumping, start( ) spawns no threads and pump( ) does one round of their work on the calling
+			thread instead: accept, receive, dispatch and send everything queued. Only available for mem:// endpoints,
+			where clients waiting for us during connect drive the pump themselves. Has to be set before start.
+		*/
+		void set_manual_pump( bool manual );
+		void pump( );
+
+		// Partial reads/writes and buffer limits of mem:// connections, has to be set before start
+		void set_memory_channel_options( const transport::memory_channel_options_t& options );
+
+		// Certificate of tls:// servers, has to be set before start
+		void set_tls_options( const transport::tls_options_t& options );
+
+		/*
+			Records all traffic into an append-only capture file (see diagnostics/capture.h) without blocking our
+			threads, replay it with replay_main.cpp. Bodies sent with send_file/send_blob are not recorded.
+		*/
+		void start_capture( const std::string& path );
+		void stop_capture( );
+
+		/*
+			Limits what a single connection can make us do: token buckets for the packets and bytes it sends, and
+			how many of its packets are dispatched per round. Connections are served round-robin, so a busy client
+			can't starve the others. Has to be set before start, see packets::admission_options_t.
+		*/
+		void set_admission_options( const packets::admission_options_t& options );
+
+		// Packets of this id each connection may send, on top of the limits of the connection. Has to be set before start
+		void set_rate_limit( std::uint16_t packet_id, const packets::rate_limit_t& limit );
+
+		/*
+			Caches the responses the handler of a packet id sends back for a request, keyed by a hash of the
+			request's data. Identical requests within ttl are answered from the cache without calling the
+			handler, so only use it for read-only requests which are answered with send_packet. Identical
+			requests received in the same round wait for the first one's handler. A ttl of 0 turns it off.
+			Has to be set before start.
+		*/
+		void set_response_cache( std::uint16_t packet_id, std::chrono::milliseconds ttl );
+
+		// Bytes all cached requests and responses together may take up, the least recently used are evicted first
+		void set_response_cache_size( std::size_t max_bytes );
+
+		// Drops the cached responses of a packet id (e.g. because the data they were built from changed), 0 for all
+		void invalidate_response_cache( std::uint16_t packet_id = 0 );
+
+		/*
+			Forwards packets of this id to upstream servers instead of handling them: only the frame header is
+			parsed, the data goes through as it arrived and responses find their way back to the client which
+			sent the request. Takes precedence over the handlers of the id. Upstreams are connected by start,
+			which throws if a route has none it can reach. Has to be set before start, no upstreams turn it off.
+		*/
+		void set_relay_route( std::uint16_t packet_id, const packets::relay_route_t& route );
+
+		// Trades CPU time for latency (busy-polling, pinned threads), has to be set before start
+		void set_low_latency( const transport::low_latency_config_t& config );
+
+		/*
+			Sends packets of a fixed-size type as deltas against the previous packet of the id on each connection,
+			with a full keyframe every keyframe_interval packets. Only used for clients with packets::wire::feature_delta.
+			Has to be set before start, an interval of 0 turns it off.
+		*/
+		void set_delta_encoding( std::uint16_t packet_id, std::uint32_t keyframe_interval = packets::delta::default_keyframe_interval );
+
+		/*
+			Packets of this id go over the datagram channel of clients which asked for packets::wire::feature_datagram
+			(tcp:// only): unordered and unreliable, and packets older than the latest of their id which arrived are
+			dropped. Meant for latest-state packets like positions, which a retransmit would only deliver late.
+			Requests, packets which don't fit into a datagram and everything sent before the client bound its channel
+			still go over TCP. Has to be set before start.
+		*/
+		void set_unreliable( std::uint16_t packet_id, bool unreliable = true );
 
 		void send_packet( SOCKET to, packets::packet_base::base_packet* packet );
 		bool send_packet( SOCKET to, packets::packet_base::base_packet* packet, std::function< bool( SOCKET from, const std::vector< char >& buffer, const std::uint8_t flags ) > handler, std::chrono::milliseconds timeout = std::chrono::milliseconds( 250 ) );
 
+		class request_awaiter {
+		public:
+			request_awaiter( async_server* server, SOCKET to, packets::packet_base::base_packet* packet, std::chrono::milliseconds timeout ) : m_server( server ), m_to( to ), m_packet( packet ), m_timeout( timeout ) { }
+
+			bool await_ready( ) const noexcept { return false; }
+			bool await_suspend( coro::task::handle_t handle );
+			std::optional< std::vector< char > > await_resume( );
+
+		private:
+			async_server* m_server = nullptr;
+			SOCKET m_to = 0;
+			packets::packet_base::base_packet* m_packet = nullptr;
+			std::chrono::milliseconds m_timeout = { };
+
+			std::uint8_t m_identifier = 0;
+			std::shared_ptr< coro::waiter_t > m_waiter = nullptr;
+		};
+
+		/*
+			send_packet( ..., handler ) for task handlers: co_await it for the client's response, which is empty if
+			the client did not answer within timeout or disconnected. The packet is sent when it is awaited.
+		*/
+		request_awaiter request( SOCKET to, packets::packet_base::base_packet* packet, std::chrono::milliseconds timeout = std::chrono::milliseconds( 250 ) );
+
+		/*
+			Sends length bytes of a file, starting at offset, as the data of a single packet. The kernel copies
+			the data straight from the file to the socket (TransmitFile). Packets queued for the client before are
+			sent first, the send thread waits until the file is out. Packets larger than 64 KiB require the client
+			to have negotiated packets::wire::feature_large_frames.
+		*/
+		bool send_file( SOCKET to, std::uint16_t packet_id, HANDLE file, std::uint64_t offset, std::uint32_t length, std::uint8_t flags = 0 );
+
+		// Same as above for a buffer in memory, which is sent without copying it into a packet first
+		bool send_blob( SOCKET to, std::uint16_t packet_id, const char* data, std::uint32_t length, std::uint8_t flags = 0 );
+
 	private:
 		void send_packet_internal( SOCKET to, packets::packet_base::base_packet* packet, std::uint8_t packet_flags );
 
+		// Encodes a whole frame using the framing and features of a connection
+		std::vector< char > build_frame( packets::wire::framing_t framing, std::uint32_t features, const packets::wire::frame_header_t& header, const char* data );
+
+		// Writes the whole buffer, waiting for the client's socket to take it. Only the calling thread waits
+		bool send_raw( SOCKET to, const char* data, std::size_t length );
+		bool write_all( SOCKET to, const char* data, std::size_t length );
+
+		// Writes as much as the client takes without waiting. Returns the amount written or -1 if the connection failed
+		int write_some( SOCKET to, const char* data, std::size_t length );
+
+		/*
+			Takes a client away from the send thread and sends everything queued for it, so a file or blob can't
+			overtake it. The send thread serves all other clients meanwhile. Returns false if the connection failed,
+			the client has to be released either way.
+		*/
+		bool acquire_client( SOCKET to );
+		void release_client( SOCKET to );
+
+		struct client_release_t {
+			async_server* server = nullptr;
+			SOCKET client = 0;
+
+			~client_release_t( ) {
+				server->release_client( client );
+			}
+		};
+
+		// Sends everything queued for an acquired client
+		bool send_queued_frames( SOCKET to );
+
+		// Detects the framing of a new connection and answers its handshake. Returns false until the framing is known
+		bool negotiate( SOCKET client, std::vector< char >& packet_buffer, packets::wire::framing_t& framing, std::uint32_t& features, void*& context );
+
+		// Falls back to the legacy framing for clients which stayed silent for too long
+		void expire_framing_detection( std::chrono::steady_clock::time_point now );
+
+		// Encodes the header for a blob, returns 0 if the client can't receive it (yet). The blob needs a checksum if checksummed is set
+		std::size_t encode_blob_header( SOCKET to, std::uint16_t packet_id, std::uint32_t length, std::uint8_t flags, char* out, bool& checksummed );
+
+		struct ready_packet_t {
+			SOCKET from = 0;
+			packets::wire::frame_header_t header = { };
+			std::vector< char > data = { };
+
+			// Set for packets with a batch handler, data is empty then
+			bool batched = false;
+			packets::packet_batch batch = { };
+
+			// Non-zero if the packet is traced
+			std::uint64_t trace_id = 0;
+
+			// Set if its responses are cached, key is the hash of its data then
+			bool cached = false;
+			std::uint64_t cache_key = 0;
+
+			// Of its connection, looked up once for all packets we extract from it
+			void* context = nullptr;
+		};
+
+		// Opens the UDP socket of the datagram channel next to our listening socket, the channel is off if it fails
+		void create_datagram_socket( const sockaddr* address, int address_length );
+
+		// Tells a client the token of its datagram channel, 0 if it can't use it. m_connection_mtx has to be held by the caller
+		void send_datagram_token( SOCKET client, std::uint64_t token );
+
+		void receive_datagrams( );
+
+		// Binds the sender of a datagram to its connection and collects the packets it carries
+		void handle_datagram( const sockaddr_storage& address, int address_length, const char* data, std::size_t length, std::vector< ready_packet_t >& packets );
+
+		// Moves the packets which arrived over the datagram channel into the ready lists, m_process_mtx has to be held by the caller
+		void take_datagram_packets( std::chrono::steady_clock::time_point now );
+
+		// Sends the datagrams queued since the last round, returns whether there were any
+		bool send_datagrams( );
+
+		// Starts our threads (or prepares pump( )) once we have a listening socket
+		void launch( );
+		void stop_threads( );
+
+		// Drops everything we know about our clients, their sockets have to be closed already
+		void forget_connections( );
+
 		void accept( );
 		void receive( );
 		void process_packets( );
+		void send_frames( );
+
+		// One round of the threads above, also used by pump( )
+		void accept_once( );
+		void receive_once( );
+		void process_once( );
+		bool send_once( );
+
+		// Queues a new connection for the receive thread
+		void add_client( SOCKET client );
+
+		// Moves queued connections into m_connected_clients, m_client_mtx has to be held by the caller (or our threads stopped)
+		void adopt_accepted_clients( );
+
+		// Brings m_poll_fds up to date with our clients and their limits, m_client_mtx has to be held by the caller
+		void update_poll_fds( std::chrono::steady_clock::time_point now );
+
+		// Drives the TLS handshake of a connection the WSAPoll reported, makes it a client once it completed. Returns true
+		// then, false while it waits for the peer or if it failed and was closed. m_client_mtx has to be held by the caller
+		bool continue_tls_handshake( SOCKET client );
+
+		// Closes connections which didn't finish their TLS handshake within handshake_timeout, m_client_mtx has to be held by the caller
+		void expire_tls_handshakes( std::chrono::steady_clock::time_point now );
+
+		// Reads once from a client into its receive buffer. Returns 0 if a channel had nothing queued, -1 if the connection is gone
+		int receive_from( SOCKET client, std::chrono::steady_clock::time_point now );
+
+		// Moves up to budget complete packets of a client into the ready lists of their priority class, returns how many
+		std::size_t extract_packets( SOCKET from, std::vector< char >& packet_buffer, std::array< std::vector< ready_packet_t >, packets::packet_priority_count >& ready_packets, std::size_t budget, std::chrono::steady_clock::time_point now );
+
+		// Takes the tokens for a packet if its connection and packet id are within their limits
+		bool admit( SOCKET from, std::uint16_t packet_id, std::chrono::steady_clock::time_point now );
+
+		// Whether we may read from a client right now, called by the receive thread
+		bool may_receive( SOCKET client, std::chrono::steady_clock::time_point now );
+		void dispatch_packet( ready_packet_t& packet );
+		void dispatch_to_handler( ready_packet_t& packet );
+
+		void subscribe( SOCKET client, const std::string& topic );
+		void unsubscribe( SOCKET client, const std::string& topic );
+
+		void capture( SOCKET connection, diagnostics::capture_direction direction, const char* data, std::size_t length );
+
+		// Answers a request from the response cache, returns false on a miss
+		bool serve_from_cache( SOCKET to, std::uint16_t packet_id, std::uint8_t packet_flags, std::uint64_t key, const char* data, std::size_t size );
+
+		// Calls the handler of a cached packet id and caches the responses it sent
+		void dispatch_cached( ready_packet_t& packet, packet_handler_server_fn handler );
+
+		// Decides whether a packet we just extracted is traced and records the stages it went through so far
+		std::uint64_t trace_extraction( SOCKET from, std::uint16_t packet_id );
+
+		void enqueue_frame( SOCKET to, packets::packet_priority priority, std::vector< char > frame, std::uint64_t trace_id = 0 );
+		packets::packet_priority priority_of( std::uint16_t packet_id );
 
 		void close_client_connection( SOCKET client );
 
+		// Closes the connection from the receive thread, safe to call while holding any of our locks
+		void schedule_disconnect( SOCKET client );
+
+		void create_listen_socket( );
+		void attach_shm_channel( SOCKET client );
+		void start_tls_handshake( SOCKET client );
+		std::shared_ptr< transport::channel > find_channel( SOCKET client );
+
+		// Returns 0 if all identifiers of the connection are waiting for their response
 		std::uint8_t generate_packet_identifier( SOCKET to );
 		void remove_packet_identifier( SOCKET to, std::uint8_t identifier );
 
+		struct connection_info_t;
+		void* find_context( SOCKET client );
+
+		// Makes the contexts of the connections accepted since the last call and calls on_connect, on the process thread
+		void create_contexts( );
+
+		// Calls on_disconnect and destroys the context of a connection which is gone, if it has one
+		void destroy_context( SOCKET client, connection_info_t& info );
+
+		// Wakes the task handlers waiting for responses of a client, m_custom_mtx has to be held by the caller
+		void abandon_waiters( SOCKET client );
+
+		// Connects the upstreams of our relay routes, throws if a route can't reach any
+		void connect_upstreams( );
+		void disconnect_upstreams( );
+
+		// Forwards a frame to an upstream of its route, data is encoded like the header says
+		void relay_frame( SOCKET from, packets::wire::frame_header_t header, const char* data );
+
+		// Called by our upstreams with the response to a relayed request, header is nullptr if there is none
+		void relay_response( std::uint64_t tag, const packets::wire::frame_header_t* header, const char* data );
+
+		// Decompresses relayed data for a side which can't take it compressed, returns false if it is corrupt
+		bool decompress_relayed( packets::wire::frame_header_t& header, const char*& data, std::vector< char >& buffer );
+
 		bool m_running = false;
 		int m_bytes_received = 0;
 
@@ -53,17 +502,228 @@ namespace forceinline::remote {
 		WSADATA m_wsa_data = { };
 	#endif // WIN32
 
-		std::thread m_accept_thread, m_receive_thread, m_process_thread;
+		std::thread m_accept_thread, m_receive_thread, m_process_thread, m_send_thread;
+
+		transport::endpoint_t m_endpoint = { };
+		transport::low_latency_config_t m_low_latency = { };
+
+		bool m_manual_pump = false;
+		transport::memory_channel_options_t m_memory_options = { };
+		transport::tls_options_t m_tls_options = { };
 
-		std::string m_port = "";
+		// Wakes the process thread when the receive thread buffered new data
+		transport::event_waiter m_process_waiter;
 
-		std::mutex m_send_mtx, m_client_mtx, m_process_mtx, m_custom_mtx;
+		std::mutex m_send_mtx, m_client_mtx, m_process_mtx, m_custom_mtx, m_channel_mtx, m_connection_mtx, m_disconnect_mtx;
 
 		const std::uint16_t m_buffer_size = 4096;
 
 		std::vector< SOCKET > m_connected_clients = { };
+
+		// Sockets of m_connected_clients the receive thread waits on, rebuilt once clients came or went. Protected by m_client_mtx
+		std::vector< WSAPOLLFD > m_poll_fds = { };
+		bool m_poll_fds_stale = false;
+
+		// Connections the accept thread handed to the receive thread, and those the process thread has to make a context for. Protected by m_accept_mtx
+		std::mutex m_accept_mtx;
+		std::vector< SOCKET > m_accepted_clients = { }, m_context_clients = { };
+		std::vector< SOCKET > m_disconnect_queue = { };
+
+		// TLS connections are no clients of ours before their handshake completed, the receive thread drives it. Accepted
+		// ones are protected by m_accept_mtx, the receive thread's by m_client_mtx
+		struct tls_handshake_t {
+			SOCKET client = INVALID_SOCKET;
+			std::shared_ptr< transport::tls_channel > channel = nullptr;
+			std::chrono::steady_clock::time_point deadline = { };
+		};
+
+		std::vector< tls_handshake_t > m_accepted_handshakes = { };
+		std::unordered_map< SOCKET, tls_handshake_t > m_tls_handshakes = { };
+
+		struct datagram_state_t {
+			std::uint64_t token = 0;
+
+			// Where the client's latest datagram came from, empty until it bound the channel
+			sockaddr_storage address = { };
+			int address_length = 0;
+
+			// Sequence numbers of the packets we sent by packet id, and of those we received
+			std::unordered_map< std::uint16_t, std::uint32_t > sequences = { };
+			packets::datagram::receiver_t receiver = { };
+		};
+
+		// Room for small connection contexts. Never copied or moved, the context may point into it
+		struct context_storage_t {
+			context_storage_t( ) = default;
+			context_storage_t( const context_storage_t& ) = delete;
+			context_storage_t& operator=( const context_storage_t& ) = delete;
+
+			alignas( std::max_align_t ) char buffer[ 64 ];
+		};
+
+		struct connection_info_t {
+			packets::wire::framing_t framing = packets::wire::framing_t::unknown;
+
+			// Features negotiated in the handshake
+			std::uint32_t features = 0;
+
+			// Frames sent before we knew which framing the client speaks, and their size
+			std::vector< std::pair< packets::wire::frame_header_t, std::vector< char > > > pending_frames = { };
+			std::size_t pending_bytes = 0;
+
+			// Legacy framing was assumed because the client stayed silent, not detected from its data
+			std::chrono::steady_clock::time_point connected_at = { };
+			bool framing_assumed = false;
+
+			// Last packets we sent of delta encoded ids, only allocated once we sent one
+			std::unique_ptr< std::unordered_map< std::uint16_t, packets::delta::sender_state_t > > delta_states = nullptr;
+
+			// Set with set_connection_context, points into context_storage unless T does not fit it
+			void* context = nullptr;
+			context_storage_t context_storage;
+
+			// Only allocated for clients which negotiated the datagram channel
+			std::unique_ptr< datagram_state_t > datagram = nullptr;
+		};
+
+		std::unordered_map< SOCKET, connection_info_t > m_connection_info = { };
+
+		// Connections whose framing is not known yet, in the order they connected (protected by m_connection_mtx)
+		std::deque< std::pair< SOCKET, std::chrono::steady_clock::time_point > > m_framing_deadlines = { };
+		std::chrono::milliseconds m_legacy_detection_timeout = std::chrono::seconds( 3 );
+
+		// Frames we hold for a client until we know its framing, it is disconnected beyond that
+		const std::size_t m_max_pending_bytes = 1024 * 1024;
+
+		// Outbound frames per client, protected by m_outbound_mtx
+		std::mutex m_outbound_mtx;
+		std::condition_variable m_outbound_cv;
+		std::unordered_map< SOCKET, packets::outbound_lanes > m_outbound_queues = { };
+		std::size_t m_outbound_frames = 0, m_outbound_in_flight = 0;
+
+		std::unordered_map< std::uint16_t, packets::packet_priority > m_packet_priorities = { };
+		std::uint32_t m_features = packets::wire::feature_compression | packets::wire::feature_checksum | packets::wire::feature_delta | packets::wire::feature_datagram;
+		std::uint32_t m_max_large_packet_size = packets::wire::max_large_packet_size;
+
+		// Keyframe interval of delta encoded packet ids
+		std::unordered_map< std::uint16_t, std::uint32_t > m_delta_packets = { };
+
+		// Datagram channel: packet ids sent over it, and which connection a token belongs to (protected by m_connection_mtx)
+		SOCKET m_datagram_socket = INVALID_SOCKET;
+		std::thread m_datagram_thread;
+		std::unordered_set< std::uint16_t > m_unreliable_packets = { };
+		std::unordered_map< std::uint64_t, SOCKET > m_datagram_tokens = { };
+		std::mt19937_64 m_token_random = std::mt19937_64( std::random_device( )( ) );
+
+		struct datagram_outbox_t {
+			sockaddr_storage address = { };
+			int address_length = 0;
+			packets::datagram::outbox_t outbox = { };
+		};
+
+		// Datagrams waiting for the send thread and packets waiting for the process thread, protected by m_datagram_mtx
+		std::mutex m_datagram_mtx;
+		std::unordered_map< SOCKET, datagram_outbox_t > m_datagram_outboxes = { };
+		std::vector< ready_packet_t > m_datagram_packets = { };
+
+		// Last packet received per client and delta encoded id, protected by m_process_mtx
+		std::unordered_map< SOCKET, std::unordered_map< std::uint16_t, std::vector< char > > > m_delta_bases = { };
+
+		packets::admission_options_t m_admission = { };
+		std::unordered_map< std::uint16_t, packets::rate_limit_t > m_rate_limits = { };
+
+		struct admission_state_t {
+			packets::token_bucket packets = { };
+			std::unordered_map< std::uint16_t, packets::token_bucket > packet_ids = { };
+		};
+
+		// Token buckets per client, protected by m_process_mtx
+		std::unordered_map< SOCKET, admission_state_t > m_admission_states = { };
+
+		// Received bytes per client, protected by m_client_mtx
+		std::unordered_map< SOCKET, packets::token_bucket > m_receive_buckets = { };
+
+		// Time to live of the cached responses per packet id
+		std::unordered_map< std::uint16_t, std::chrono::milliseconds > m_cached_packets = { };
+
+		std::mutex m_cache_mtx;
+		packets::response_cache m_response_cache = { };
+
+		// Compression is off until a threshold is set
+		std::uint32_t m_compression_threshold = UINT32_MAX;
+		std::uint32_t m_max_decompressed_size = packets::compression::default_max_decompressed_size;
+		std::unordered_map< std::uint16_t, std::vector< char > > m_compression_dictionaries = { };
+
+		// Clients which talk to us through something other than their socket (e.g. shared memory)
+		std::unordered_map< SOCKET, std::shared_ptr< transport::channel > > m_channels = { };
+		std::uint32_t m_channel_counter = 0;
+		// Received data per client, only clients with data in flight have a buffer (borrowed from m_buffer_pool)
 		std::unordered_map< SOCKET, std::vector< char > > m_packet_queue = { };
 
+		// Clients which have a buffer in m_packet_queue, in the order they take their turn in. Protected by m_process_mtx
+		std::deque< SOCKET > m_ready_clients = { };
+		packets::buffer_pool m_buffer_pool = { };
+
+		// Used by one round of the receive, process and send threads
+		std::vector< char > m_receive_buffer = { };
+		std::array< std::vector< ready_packet_t >, packets::packet_priority_count > m_ready_packets = { };
+
+		struct popped_frame_t {
+			SOCKET to = 0;
+			std::vector< char > data = { };
+			std::uint64_t trace_id = 0;
+
+			// How much of it the client's socket took so far
+			std::size_t offset = 0;
+		};
+
+		std::vector< popped_frame_t > m_popped_frames = { };
+
+		// Frames a client's socket did not take completely, continued in the next round (protected by m_send_mtx)
+		std::unordered_map< SOCKET, popped_frame_t > m_partial_writes = { };
+
+		// Clients send_file/send_blob are writing to, and whether they were closed meanwhile (protected by m_outbound_mtx)
+		std::unordered_map< SOCKET, bool > m_exclusive_clients = { };
+
+		// Bumped whenever there is something new to send, the send thread sleeps until it changes (protected by m_outbound_mtx)
+		std::uint64_t m_outbound_generation = 0, m_sent_generation = 0;
+
+		// When the receive buffer of a client was last filled, only kept while tracing
+		std::unordered_map< SOCKET, std::uint64_t > m_receive_timestamps = { };
+
+		diagnostics::tracer m_tracer;
+
+		// Set while capturing, the I/O threads keep their own reference to the writer while recording
+		std::mutex m_capture_mtx;
+		std::atomic< bool > m_capturing = false;
+		std::shared_ptr< diagnostics::capture_writer > m_capture = nullptr;
+
+		struct topic_subscriber_t {
+			SOCKET socket = 0;
+			packets::wire::framing_t framing = packets::wire::framing_t::unknown;
+			std::uint32_t features = 0;
+		};
+
+		struct topic_t {
+			// Identifies the topic's frames in the outbound lanes for conflation
+			std::uint64_t key = 0;
+
+			// Topics with options stay around without subscribers
+			bool configured = false;
+			packets::topic_options_t options = { };
+
+			std::vector< topic_subscriber_t > subscribers = { };
+		};
+
+		// Subscriptions, protected by m_topic_mtx
+		std::mutex m_topic_mtx;
+		std::unordered_map< std::string, topic_t > m_topics = { };
+		std::unordered_map< SOCKET, std::vector< std::string > > m_subscriptions = { };
+		std::uint64_t m_topic_counter = 0;
+
+		// When the process thread started waiting for m_process_mtx in its current round
+		std::uint64_t m_process_lock_timestamp = 0;
+
 		struct custom_process_info_t {
 			custom_process_info_t( std::uint8_t identifier ) : packet_identifier( identifier ) { }
 
@@ -74,21 +734,61 @@ namespace forceinline::remote {
 		std::unordered_map< SOCKET, std::vector< std::uint8_t > > m_packet_identifiers = { };
 		std::unordered_map< SOCKET, std::vector< custom_process_info_t > > m_custom_process_queue = { };
 
-		struct packet_header_t {
-			packet_header_t( packets::packet_base::base_packet* packet ) {
-				if ( !packet )
-					return;
+		// Task handlers run on the process thread, those waiting for a response are found by its identifier
+		std::shared_ptr< coro::event_loop > m_loop = nullptr;
+		std::unordered_map< SOCKET, std::unordered_map< std::uint8_t, std::shared_ptr< coro::waiter_t > > > m_waiters = { };
 
-				packet_id = packet->id( );
-				packet_size = packet->size( );
-				packet_flags = packet->flags( );
-			}
+		struct relay_state_t {
+			std::vector< async_client* > upstreams = { };
+			packets::relay_balance balance = packets::relay_balance::connection;
+			std::chrono::milliseconds timeout = { };
+
+			// Next upstream for round-robin, only used by the process thread
+			std::size_t next = 0;
+		};
 
-			std::uint16_t packet_id = 0;
-			std::uint16_t packet_size = 0;
-			std::uint8_t packet_flags = 0;
+		// One client per upstream endpoint, shared by the routes which use it
+		std::unordered_map< std::uint16_t, relay_state_t > m_relay_routes = { };
+		std::unordered_map< std::string, std::unique_ptr< async_client > > m_upstreams = { };
+
+		struct relayed_request_t {
+			SOCKET from = 0;
+			std::uint8_t identifier = 0;
 		};
 
+		// Requests waiting for their upstream's response by their tag, protected by m_relay_mtx
+		std::mutex m_relay_mtx;
+		std::unordered_map< std::uint64_t, relayed_request_t > m_relayed_requests = { };
+		std::uint64_t m_relay_counter = 0;
+
 		std::unordered_map< int, packet_handler_server_fn > m_packet_handlers = { };
+		std::unordered_map< int, batch_handler_server_fn > m_batch_handlers = { };
+		std::unordered_map< int, task_handler_server_fn > m_task_handlers = { };
+
+		// Type of the connection contexts and how they are made, set by set_connection_context
+		std::type_index m_context_type = typeid( void );
+
+		struct context_type_info_t {
+			std::size_t size = 0, alignment = 0;
+
+			// Placement new and destructor of T, nullptr if connections have no context
+			void( *construct )( void* storage ) = nullptr;
+			void( *destroy )( void* context ) = nullptr;
+
+			// on_connect and on_disconnect, only called through invoke which knows their type
+			void( *on_connect )( ) = nullptr;
+			void( *on_disconnect )( ) = nullptr;
+			void( *invoke )( void( *callback )( ), async_server* server, SOCKET client, void* context ) = nullptr;
+		};
+
+		context_type_info_t m_context_type_info = { };
+
+		struct context_handler_t {
+			// The typed handler, only called through invoke which knows its type
+			void( *handler )( ) = nullptr;
+			void( *invoke )( void( *handler )( ), async_server* server, SOCKET from, void* context, const std::vector< char >& data, std::uint8_t flags ) = nullptr;
+		};
+
+		std::unordered_map< int, context_handler_t > m_context_handlers = { };
 	};
 } // namespace forceinline::remote
\ No newline at end of file
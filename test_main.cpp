@@ -0,0 +1,308 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "server/server.h"
+#include "client/client.h"
+#include "packet/packet.h"
+#include "packet/compression.h"
+#include "transport/endpoint.h"
+#include "transport/memory_channel.h"
+
+/*
+	Checks the packet path end to end over mem:// with manual pumping. There are no sockets and no
+	threads, so every run takes exactly the same course. Reads and writes are capped to a few bytes,
+	so every frame arrives in pieces.
+
+		test
+
+	Prints one line per check and returns the number of checks which failed.
+*/
+
+namespace remote = forceinline::remote;
+namespace packets = remote::packets;
+
+using number_packet = packets::simple_packet< packets::packet_simple_t, packets::packet_id::simple >;
+using text_packet = packets::text_packet< packets::packet_id::text_one >;
+using bulk_packet = packets::text_packet< packets::packet_id::text_two >;
+
+// Handlers are plain functions, what they were called with is kept here
+std::vector< std::uint32_t > server_numbers = { }, client_numbers = { };
+std::vector< std::uint16_t > server_ids = { };
+std::vector< std::string > client_texts = { };
+
+remote::transport::memory_channel_options_t split_options( ) {
+	remote::transport::memory_channel_options_t options = { };
+	options.max_read = 3;
+	options.max_write = 5;
+
+	return options;
+}
+
+// Gives both sides enough rounds to move every frame through the capped pipes
+void pump( remote::async_server& server, remote::async_client& client, int rounds = 4096 ) {
+	for ( int i = 0; i < rounds; i++ ) {
+		client.pump( );
+		server.pump( );
+	}
+}
+
+// Answers with the number plus one
+void answer_number( remote::async_server* server, SOCKET from, const std::vector< char >& data, std::uint8_t flags ) {
+	number_packet request( data, flags );
+	server_numbers.push_back( request( ).some_number );
+
+	request( ).some_number++;
+	number_packet response( request( ), flags );
+
+	server->send_packet( from, &response );
+}
+
+void echo_text( remote::async_server* server, SOCKET from, const std::vector< char >& data, std::uint8_t flags ) {
+	text_packet request( data, flags );
+	text_packet response( request( ), flags );
+
+	server->send_packet( from, &response );
+}
+
+bool check_round_trip( ) {
+	remote::async_server server( "mem://test_round_trip" );
+	server.set_manual_pump( true );
+	server.set_memory_channel_options( split_options( ) );
+	server.set_packet_handler( packets::packet_id::simple, answer_number );
+	server.start( );
+
+	remote::async_client client( "mem://test_round_trip" );
+	client.set_manual_pump( true );
+	client.set_packet_handler( packets::packet_id::simple, [ ]( remote::async_client*, const std::vector< char >& data, std::uint8_t flags ) {
+		client_numbers.push_back( number_packet( data, flags )( ).some_number );
+	} );
+	client.connect( );
+
+	bool passed = true;
+
+	// Requests wait for their response, which pumps the server for us
+	for ( std::uint32_t i = 0; i < 50; i++ ) {
+		number_packet request( { i, 1.5f, { 1, 2, 3 } } );
+		std::uint32_t answer = 0;
+
+		auto answered = client.send_packet( &request, [ & ]( const std::vector< char >& data, std::uint8_t flags ) {
+			answer = number_packet( data, flags )( ).some_number;
+			return true;
+		}, std::chrono::seconds( 1 ) );
+
+		passed &= answered && answer == i + 1;
+	}
+
+	// Fire-and-forget packets come back through the packet handler, in the order they were sent
+	client_numbers.clear( );
+
+	for ( std::uint32_t i = 0; i < 20; i++ ) {
+		number_packet packet( { i, 1.5f, { 1, 2, 3 } } );
+		client.send_packet( &packet );
+	}
+
+	pump( server, client );
+
+	for ( std::uint32_t i = 0; i < 20; i++ )
+		passed &= client_numbers.size( ) == 20 && client_numbers[ i ] == i + 1;
+
+	client.disconnect( );
+	server.close( );
+
+	return passed;
+}
+
+bool check_compression( ) {
+	constexpr std::uint32_t threshold = 64;
+	auto text = std::string( 4096, 'x' ) + "the end";
+
+	remote::async_server server( "mem://test_compression" );
+	server.set_manual_pump( true );
+	server.set_memory_channel_options( split_options( ) );
+	server.set_compression( threshold );
+	server.set_packet_handler( packets::packet_id::text_one, echo_text );
+	server.start( );
+
+	// Both directions compressed, the text has to come back as it was
+	remote::async_client client( "mem://test_compression" );
+	client.set_manual_pump( true );
+	client.set_compression( threshold );
+	client.set_packet_handler( packets::packet_id::text_one, [ ]( remote::async_client*, const std::vector< char >& data, std::uint8_t flags ) {
+		client_texts.push_back( text_packet( data, flags )( ).some_string );
+	} );
+	client.connect( );
+
+	text_packet packet( { text } );
+	client.send_packet( &packet );
+
+	pump( server, client );
+
+	bool passed = client.features( ) & packets::wire::feature_compression && client_texts.size( ) == 1 && client_texts[ 0 ] == text;
+
+	client.disconnect( );
+
+	// A raw connection sees the frame as it went over the wire: compressed, and smaller than the packet
+	auto raw = remote::transport::memory_listener::connect( remote::transport::endpoint_t::parse( "mem://test_compression" ).path );
+
+	char handshake[ packets::wire::handshake_size ] = { };
+	packets::wire::encode_handshake( { packets::wire::protocol_version, packets::wire::feature_compression }, handshake );
+
+	std::vector< char > outgoing( handshake, handshake + sizeof handshake );
+	packets::wire::frame_header_t header( &packet );
+
+	char header_buffer[ packets::wire::max_header_size ] = { };
+	auto header_length = packets::wire::encode_header( header, header_buffer );
+
+	outgoing.insert( outgoing.end( ), header_buffer, header_buffer + header_length );
+	outgoing.insert( outgoing.end( ), packet.data( ), packet.data( ) + header.packet_size );
+
+	std::vector< char > incoming = { };
+	char buffer[ 256 ] = { };
+
+	for ( std::size_t written = 0, round = 0; round < 4096; round++ ) {
+		if ( written < outgoing.size( ) ) {
+			auto length = raw->write( outgoing.data( ) + written, int( outgoing.size( ) - written ) );
+			written += std::max( length, 0 );
+		}
+
+		server.pump( );
+
+		for ( int length = 0; ( length = raw->read( buffer, sizeof buffer ) ) > 0; )
+			incoming.insert( incoming.end( ), buffer, buffer + length );
+	}
+
+	packets::wire::frame_header_t response = { };
+	std::vector< char > decompressed = { };
+
+	if ( incoming.size( ) > sizeof handshake ) {
+		auto frame = incoming.data( ) + sizeof handshake;
+		auto frame_length = incoming.size( ) - sizeof handshake;
+		auto response_header_length = packets::wire::decode_header( frame, frame_length, response );
+
+		passed &= response_header_length > 0 && response.frame_flags & packets::wire::frame_flag_compressed && response.packet_size < header.packet_size / 4
+			&& packets::compression::decompress_payload( frame + response_header_length, response.packet_size, nullptr, decompressed, header.packet_size )
+			&& decompressed.size( ) == header.packet_size && memcmp( decompressed.data( ), packet.data( ), header.packet_size ) == 0;
+	} else
+		passed = false;
+
+	raw->close( );
+	server.close( );
+
+	return passed;
+}
+
+bool check_delta( ) {
+	constexpr std::uint32_t keyframe_interval = 8;
+
+	remote::async_server server( "mem://test_delta" );
+	server.set_manual_pump( true );
+	server.set_memory_channel_options( split_options( ) );
+	server.set_delta_encoding( packets::packet_id::simple, keyframe_interval );
+	server.set_packet_handler( packets::packet_id::simple, answer_number );
+	server.start( );
+
+	remote::async_client client( "mem://test_delta" );
+	client.set_manual_pump( true );
+	client.set_delta_encoding( packets::packet_id::simple, keyframe_interval );
+	client.set_packet_handler( packets::packet_id::simple, [ ]( remote::async_client*, const std::vector< char >& data, std::uint8_t flags ) {
+		client_numbers.push_back( number_packet( data, flags )( ).some_number );
+	} );
+	client.connect( );
+
+	server_numbers.clear( );
+	client_numbers.clear( );
+
+	// Only the number changes, the rest of every packet goes as a delta against the one before. Keyframes come in between
+	for ( std::uint32_t i = 0; i < 100; i++ ) {
+		number_packet packet( { i, 1.5f, { 1, 2, 3 } } );
+		client.send_packet( &packet );
+
+		// Rebuilding a delta depends on every packet before it, so they must not pile up and be merged
+		pump( server, client, 64 );
+	}
+
+	pump( server, client );
+
+	bool passed = client.features( ) & packets::wire::feature_delta && server_numbers.size( ) == 100 && client_numbers.size( ) == 100;
+
+	for ( std::uint32_t i = 0; passed && i < 100; i++ )
+		passed &= server_numbers[ i ] == i && client_numbers[ i ] == i + 1;
+
+	client.disconnect( );
+	server.close( );
+
+	return passed;
+}
+
+bool check_priority( ) {
+	remote::async_server server( "mem://test_priority" );
+	server.set_manual_pump( true );
+	server.set_memory_channel_options( split_options( ) );
+
+	server.set_packet_handler( packets::packet_id::text_one, [ ]( remote::async_server*, SOCKET, const std::vector< char >&, std::uint8_t ) {
+		server_ids.push_back( packets::packet_id::text_one );
+	}, packets::packet_priority::control );
+
+	server.set_packet_handler( packets::packet_id::text_two, [ ]( remote::async_server*, SOCKET, const std::vector< char >&, std::uint8_t ) {
+		server_ids.push_back( packets::packet_id::text_two );
+	}, packets::packet_priority::bulk );
+
+	server.start( );
+
+	remote::async_client client( "mem://test_priority" );
+	client.set_manual_pump( true );
+	client.set_packet_priority( packets::packet_id::text_one, packets::packet_priority::control );
+	client.set_packet_priority( packets::packet_id::text_two, packets::packet_priority::bulk );
+	client.connect( );
+
+	server_ids.clear( );
+
+	// The control packet is queued last and still has to overtake the bulk packets
+	for ( int i = 0; i < 5; i++ ) {
+		bulk_packet packet( { std::string( 256, 'b' ) } );
+		client.send_packet( &packet );
+	}
+
+	text_packet urgent( { "urgent" } );
+	client.send_packet( &urgent );
+
+	pump( server, client );
+
+	bool passed = server_ids.size( ) == 6 && server_ids[ 0 ] == packets::packet_id::text_one;
+
+	for ( std::size_t i = 1; passed && i < server_ids.size( ); i++ )
+		passed &= server_ids[ i ] == packets::packet_id::text_two;
+
+	client.disconnect( );
+	server.close( );
+
+	return passed;
+}
+
+int main( ) {
+	std::pair< const char*, bool( * )( ) > checks[ ] = {
+		{ "round trip", check_round_trip },
+		{ "compression", check_compression },
+		{ "delta", check_delta },
+		{ "priority", check_priority }
+	};
+
+	int failed = 0;
+
+	for ( auto& [ name, check ] : checks ) {
+		bool passed = false;
+
+		try {
+			passed = check( );
+		} catch ( const std::exception& e ) {
+			std::cout << name << ": " << e.what( ) << std::endl;
+		}
+
+		std::cout << name << ": " << ( passed ? "passed" : "FAILED" ) << std::endl;
+		failed += !passed;
+	}
+
+	return failed;
+}
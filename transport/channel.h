@@ -0,0 +1,26 @@
+#pragma once
+#include <chrono>
+
+namespace forceinline::remote::transport {
+	/*
+		A channel is a bidirectional byte stream which is not backed by a socket the
+		server/client can call send/recv on directly. The packet framing on top of it
+		is exactly the same as for sockets.
+	*/
+	class channel {
+	public:
+		virtual ~channel( ) { }
+
+		// Writes up to length bytes. Blocks until at least one byte was written. Returns -1 if the channel is closed.
+		virtual int write( const char* data, int length ) = 0;
+
+		// Reads up to length bytes without blocking. Returns 0 if nothing is queued, -1 if the channel is closed.
+		virtual int read( char* buffer, int length ) = 0;
+
+		// Waits until there is something to read or the timeout elapsed
+		virtual bool wait_readable( std::chrono::microseconds timeout ) = 0;
+
+		// Closes the channel for both ends
+		virtual void close( ) = 0;
+	};
+} // namespace forceinline::remote::transport
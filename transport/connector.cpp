@@ -0,0 +1,334 @@
+#include "connector.h"
+#include <algorithm>
+#include <utility>
+#include <thread>
+
+namespace forceinline::remote::transport {
+	namespace {
+		using clock = std::chrono::steady_clock;
+
+		// Resolving completes through an event, which WSAPoll can't wait for, so we check it at least this often
+		constexpr auto resolve_poll_interval = std::chrono::milliseconds( 5 );
+
+		struct address_t {
+			sockaddr_storage address = { };
+			int length = 0, family = 0;
+		};
+
+		struct attempt_t {
+			SOCKET socket = INVALID_SOCKET;
+			clock::time_point deadline = { };
+		};
+
+		struct target_state_t {
+			const connect_target_t* target = nullptr;
+			clock::time_point deadline = { };
+
+			// GetAddrInfoExW call in progress, has to stay at the same address until it completed
+			std::wstring host = L"", port = L"";
+			OVERLAPPED overlapped = { };
+			PADDRINFOEXW result = nullptr;
+			HANDLE cancel = NULL;
+			bool resolving = false;
+
+			// Addresses in the order we try them
+			std::vector< address_t > addresses = { };
+			std::size_t next_address = 0;
+			clock::time_point next_attempt = { };
+
+			std::vector< attempt_t > attempts = { };
+
+			SOCKET connected = INVALID_SOCKET;
+			bool done = false;
+		};
+
+		std::wstring widen( const std::string& text ) {
+			if ( text.empty( ) )
+				return { };
+
+			auto length = MultiByteToWideChar( CP_UTF8, 0, text.data( ), int( text.size( ) ), NULL, 0 );
+
+			std::wstring wide( std::size_t( std::max( length, 0 ) ), L'\0' );
+			MultiByteToWideChar( CP_UTF8, 0, text.data( ), int( text.size( ) ), wide.data( ), length );
+
+			return wide;
+		}
+
+		void finish_resolving( target_state_t& state, int error ) {
+			state.resolving = false;
+
+			if ( error != NO_ERROR || !state.result ) {
+				state.done = true;
+				return;
+			}
+
+			// Alternate between the address families, starting with the one the resolver put first
+			std::vector< address_t > preferred = { }, other = { };
+
+			for ( auto info = state.result; info; info = info->ai_next ) {
+				if ( ( info->ai_family != AF_INET && info->ai_family != AF_INET6 ) || info->ai_addrlen > sizeof( sockaddr_storage ) )
+					continue;
+
+				address_t address = { };
+				address.family = info->ai_family;
+				address.length = int( info->ai_addrlen );
+				memcpy( &address.address, info->ai_addr, info->ai_addrlen );
+
+				( info->ai_family == state.result->ai_family ? preferred : other ).push_back( address );
+			}
+
+			FreeAddrInfoExW( state.result );
+			state.result = nullptr;
+
+			for ( std::size_t i = 0; i < std::max( preferred.size( ), other.size( ) ); i++ ) {
+				if ( i < preferred.size( ) )
+					state.addresses.push_back( preferred[ i ] );
+
+				if ( i < other.size( ) )
+					state.addresses.push_back( other[ i ] );
+			}
+
+			if ( state.addresses.empty( ) )
+				state.done = true;
+		}
+
+		void start_resolving( target_state_t& state ) {
+			ADDRINFOEXW hints = { };
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_protocol = IPPROTO_TCP;
+
+			state.host = widen( state.target->host );
+			state.port = widen( state.target->port );
+
+			state.overlapped.hEvent = CreateEventW( NULL, TRUE, FALSE, NULL );
+
+			if ( !state.overlapped.hEvent ) {
+				state.done = true;
+				return;
+			}
+
+			auto error = GetAddrInfoExW( state.host.c_str( ), state.port.c_str( ), NS_ALL, NULL, &hints, &state.result, NULL, &state.overlapped, NULL, &state.cancel );
+
+			if ( error == WSA_IO_PENDING ) {
+				state.resolving = true;
+				return;
+			}
+
+			// Answered right away, e.g. for numeric addresses
+			finish_resolving( state, error );
+		}
+
+		void close_attempts( target_state_t& state ) {
+			for ( auto& attempt : state.attempts ) {
+				if ( attempt.socket != INVALID_SOCKET )
+					closesocket( attempt.socket );
+			}
+
+			state.attempts.clear( );
+		}
+
+		void give_up( target_state_t& state ) {
+			close_attempts( state );
+
+			// The OVERLAPPED is written to until the cancelled call completed
+			if ( state.resolving ) {
+				GetAddrInfoExCancel( &state.cancel );
+				WaitForSingleObject( state.overlapped.hEvent, INFINITE );
+				state.resolving = false;
+			}
+
+			if ( state.result ) {
+				FreeAddrInfoExW( state.result );
+				state.result = nullptr;
+			}
+
+			state.done = true;
+		}
+
+		void start_attempt( target_state_t& state, clock::time_point now ) {
+			const auto& address = state.addresses[ state.next_address++ ];
+			state.next_attempt = now + state.target->options.attempt_delay;
+
+			auto socket = ::socket( address.family, SOCK_STREAM, IPPROTO_TCP );
+
+			// E.g. no IPv6 on this machine, go on with the next address right away
+			if ( socket == INVALID_SOCKET ) {
+				state.next_attempt = now;
+				return;
+			}
+
+			apply_socket_options( socket, state.target->low_latency );
+
+			u_long non_blocking = 1;
+			ioctlsocket( socket, FIONBIO, &non_blocking );
+
+			if ( ::connect( socket, reinterpret_cast< const sockaddr* >( &address.address ), address.length ) == SOCKET_ERROR && WSAGetLastError( ) != WSAEWOULDBLOCK ) {
+				closesocket( socket );
+				state.next_attempt = now;
+				return;
+			}
+
+			state.attempts.push_back( { socket, now + state.target->options.attempt_timeout } );
+		}
+
+		void finish_attempt( target_state_t& state, std::size_t attempt_index ) {
+			auto socket = std::exchange( state.attempts[ attempt_index ].socket, INVALID_SOCKET );
+
+			// The socket goes back to blocking mode, like any other socket we hand out
+			u_long non_blocking = 0;
+			ioctlsocket( socket, FIONBIO, &non_blocking );
+
+			close_attempts( state );
+
+			state.connected = socket;
+			state.done = true;
+		}
+
+		bool has_error( SOCKET socket ) {
+			int error = 0, length = sizeof error;
+			return getsockopt( socket, SOL_SOCKET, SO_ERROR, reinterpret_cast< char* >( &error ), &length ) == SOCKET_ERROR || error != 0;
+		}
+	} // namespace
+
+	std::vector< SOCKET > connect_all( const std::vector< connect_target_t >& targets ) {
+		// Never resized, pending GetAddrInfoExW calls point into the states
+		std::vector< target_state_t > states( targets.size( ) );
+
+		auto start = clock::now( );
+
+		for ( std::size_t i = 0; i < targets.size( ); i++ ) {
+			states[ i ].target = &targets[ i ];
+			states[ i ].deadline = start + targets[ i ].options.timeout;
+			states[ i ].next_attempt = start;
+
+			start_resolving( states[ i ] );
+		}
+
+		std::vector< WSAPOLLFD > poll_fds = { };
+		std::vector< std::pair< std::size_t, std::size_t > > poll_owners = { };
+
+		while ( true ) {
+			auto now = clock::now( );
+			auto wake = clock::time_point::max( );
+			bool pending = false;
+
+			poll_fds.clear( );
+			poll_owners.clear( );
+
+			for ( std::size_t i = 0; i < states.size( ); i++ ) {
+				auto& state = states[ i ];
+
+				if ( state.resolving && WaitForSingleObject( state.overlapped.hEvent, 0 ) == WAIT_OBJECT_0 )
+					finish_resolving( state, GetAddrInfoExOverlappedResult( &state.overlapped ) );
+
+				if ( state.done )
+					continue;
+
+				if ( now >= state.deadline ) {
+					give_up( state );
+					continue;
+				}
+
+				pending = true;
+				wake = std::min( wake, state.deadline );
+
+				if ( state.resolving ) {
+					wake = std::min( wake, now + resolve_poll_interval );
+					continue;
+				}
+
+				// Drop attempts which ran out of time
+				auto expired = std::remove_if( state.attempts.begin( ), state.attempts.end( ), [ & ]( const attempt_t& attempt ) {
+					if ( attempt.deadline > now )
+						return false;
+
+					closesocket( attempt.socket );
+					return true;
+				} );
+
+				state.attempts.erase( expired, state.attempts.end( ) );
+
+				// The next address starts once the running attempts had their head start, right away if none is left
+				if ( state.next_address < state.addresses.size( ) && ( state.attempts.empty( ) || now >= state.next_attempt ) )
+					start_attempt( state, now );
+
+				if ( state.attempts.empty( ) && state.next_address >= state.addresses.size( ) ) {
+					state.done = true;
+					continue;
+				}
+
+				if ( state.next_address < state.addresses.size( ) )
+					wake = std::min( wake, state.attempts.empty( ) ? now : state.next_attempt );
+
+				for ( std::size_t j = 0; j < state.attempts.size( ); j++ ) {
+					wake = std::min( wake, state.attempts[ j ].deadline );
+
+					poll_fds.push_back( { state.attempts[ j ].socket, POLLWRNORM, 0 } );
+					poll_owners.emplace_back( i, j );
+				}
+			}
+
+			if ( !pending )
+				break;
+
+			auto timeout = std::max( std::chrono::ceil< std::chrono::milliseconds >( wake - now ), std::chrono::milliseconds( 0 ) );
+
+			if ( poll_fds.empty( ) ) {
+				std::this_thread::sleep_for( timeout );
+				continue;
+			}
+
+			if ( WSAPoll( poll_fds.data( ), ULONG( poll_fds.size( ) ), int( timeout.count( ) ) ) <= 0 )
+				continue;
+
+			now = clock::now( );
+
+			for ( std::size_t k = 0; k < poll_fds.size( ); k++ ) {
+				auto [ target_index, attempt_index ] = poll_owners[ k ];
+				auto& state = states[ target_index ];
+
+				// Another attempt of the target won in this round already
+				if ( state.done || !poll_fds[ k ].revents )
+					continue;
+
+				auto& attempt = state.attempts[ attempt_index ];
+
+				// Connected sockets turn writable, refused ones report an error (older WSAPoll versions don't, those attempts time out instead)
+				if ( ( poll_fds[ k ].revents & POLLWRNORM ) && !has_error( attempt.socket ) ) {
+					finish_attempt( state, attempt_index );
+					continue;
+				}
+
+				if ( poll_fds[ k ].revents & ( POLLERR | POLLHUP | POLLWRNORM ) ) {
+					closesocket( attempt.socket );
+					attempt.socket = INVALID_SOCKET;
+
+					// A failed attempt doesn't hold back the next address
+					state.next_attempt = now;
+				}
+			}
+
+			for ( auto& state : states ) {
+				state.attempts.erase( std::remove_if( state.attempts.begin( ), state.attempts.end( ), [ ]( const attempt_t& attempt ) {
+					return attempt.socket == INVALID_SOCKET;
+				} ), state.attempts.end( ) );
+			}
+		}
+
+		std::vector< SOCKET > sockets( states.size( ), INVALID_SOCKET );
+
+		for ( std::size_t i = 0; i < states.size( ); i++ ) {
+			sockets[ i ] = states[ i ].connected;
+
+			if ( states[ i ].overlapped.hEvent )
+				CloseHandle( states[ i ].overlapped.hEvent );
+		}
+
+		return sockets;
+	}
+
+	SOCKET connect_one( const connect_target_t& target ) {
+		return connect_all( { target } ).front( );
+	}
+} // namespace forceinline::remote::transport
@@ -0,0 +1,41 @@
+#pragma once
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "low_latency.h"
+
+/*
+	Connects TCP sockets without blocking on any single host. Names are resolved asynchronously, the
+	host's IPv6 and IPv4 addresses race each other (happy eyeballs, RFC 8305) and every attempt has its
+	own timeout. Any number of targets is connected at once, from one thread.
+*/
+
+namespace forceinline::remote::transport {
+	struct connect_options_t {
+		// An address which did not answer within this time is given up on
+		std::chrono::milliseconds attempt_timeout = std::chrono::seconds( 3 );
+
+		// Head start of an attempt before the next address is tried alongside it
+		std::chrono::milliseconds attempt_delay = std::chrono::milliseconds( 250 );
+
+		// For the whole connect, resolving included
+		std::chrono::milliseconds timeout = std::chrono::seconds( 10 );
+	};
+
+	struct connect_target_t {
+		std::string host = "", port = "";
+
+		connect_options_t options = { };
+		low_latency_config_t low_latency = { };
+	};
+
+	// Connects to every target at once. Returns a connected, blocking socket per target, INVALID_SOCKET where it failed
+	std::vector< SOCKET > connect_all( const std::vector< connect_target_t >& targets );
+
+	// Same for a single target
+	SOCKET connect_one( const connect_target_t& target );
+} // namespace forceinline::remote::transport
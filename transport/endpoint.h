@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+/*
+	Endpoints are given as URIs. The scheme selects the transport used underneath the packet API:
+
+		tcp://host:port		Regular TCP socket (default if no scheme is given)
+		tls://host:port		TCP socket encrypted with TLS (see tls_channel.h)
+		unix://path			AF_UNIX stream socket, for client/server pairs on the same host
+		shm://path			Shared memory ring pair, bootstrapped over an AF_UNIX socket at path
+		mem://name			In-process byte pipes (see memory_channel.h), no networking involved
+
+	For backwards compatibility a string without a scheme is treated as "host:port" (client) or "port" (server).
+*/
+
+namespace forceinline::remote::transport {
+	enum class scheme_t {
+		tcp,
+		tls,
+		unix_socket,
+		shm,
+		memory
+	};
+
+	struct endpoint_t {
+		scheme_t scheme = scheme_t::tcp;
+
+		// Only used by tcp and tls
+		std::string host = "", port = "";
+
+		// Only used by unix, shm and mem
+		std::string path = "";
+
+		static endpoint_t parse( std::string_view uri ) {
+			endpoint_t endpoint = { };
+
+			auto scheme_end = uri.find( "://" );
+			auto rest = scheme_end == std::string_view::npos ? uri : uri.substr( scheme_end + 3 );
+
+			if ( scheme_end != std::string_view::npos ) {
+				auto scheme = uri.substr( 0, scheme_end );
+
+				if ( scheme == "tcp" )
+					endpoint.scheme = scheme_t::tcp;
+				else if ( scheme == "tls" )
+					endpoint.scheme = scheme_t::tls;
+				else if ( scheme == "unix" )
+					endpoint.scheme = scheme_t::unix_socket;
+				else if ( scheme == "shm" )
+					endpoint.scheme = scheme_t::shm;
+				else if ( scheme == "mem" )
+					endpoint.scheme = scheme_t::memory;
+				else
+					throw std::invalid_argument( "endpoint_t::parse: unknown scheme" );
+			}
+
+			if ( rest.empty( ) )
+				throw std::invalid_argument( "endpoint_t::parse: endpoint is empty" );
+
+			if ( endpoint.scheme != scheme_t::tcp && endpoint.scheme != scheme_t::tls ) {
+				endpoint.path = rest;
+				return endpoint;
+			}
+
+			// Split host and port, keeping brackets around IPv6 literals intact until the end
+			auto port_start = rest.rfind( ':' );
+			if ( port_start == std::string_view::npos || ( rest.front( ) == '[' && rest.find( ']' ) > port_start ) ) {
+				endpoint.port = rest;
+				return endpoint;
+			}
+
+			auto host = rest.substr( 0, port_start );
+			if ( host.size( ) >= 2 && host.front( ) == '[' && host.back( ) == ']' )
+				host = host.substr( 1, host.size( ) - 2 );
+
+			endpoint.host = host;
+			endpoint.port = rest.substr( port_start + 1 );
+
+			if ( endpoint.port.empty( ) )
+				throw std::invalid_argument( "endpoint_t::parse: port is empty" );
+
+			return endpoint;
+		}
+	};
+} // namespace forceinline::remote::transport
@@ -0,0 +1,73 @@
+#pragma once
+#include <Windows.h>
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+namespace forceinline::remote::transport {
+	/*
+		Lets a thread wait for work without sleeping in fixed slices. The waiting thread first spins
+		for a budget of iterations and only parks on a condition variable if nothing arrived. The
+		budget adapts: it grows while spinning pays off and shrinks while we keep ending up parked,
+		so an idle thread does not burn a core forever.
+	*/
+	class event_waiter {
+	public:
+		// A spin count of 0 always parks right away
+		void configure( std::uint32_t spin_count, std::chrono::microseconds park_timeout ) {
+			m_max_spin_count = spin_count;
+			m_spin_count = spin_count;
+			m_park_timeout = park_timeout;
+		}
+
+		// Wakes the waiting thread. Only touches the condition variable if the thread actually parked
+		void notify( ) {
+			m_signaled.store( true, std::memory_order_seq_cst );
+
+			if ( m_parked.load( std::memory_order_seq_cst ) ) {
+				std::lock_guard lock( m_mtx );
+				m_cv.notify_one( );
+			}
+		}
+
+		// Returns once notified or after the park timeout
+		void wait( ) {
+			for ( std::uint32_t spins = 0; spins < m_spin_count; spins++ ) {
+				if ( m_signaled.exchange( false, std::memory_order_acquire ) ) {
+					// Spinning paid off, allow a little more next time
+					m_spin_count = std::min( m_max_spin_count, m_spin_count * 2 + 1 );
+					return;
+				}
+
+				YieldProcessor( );
+			}
+
+			{
+				std::unique_lock lock( m_mtx );
+				m_parked.store( true, std::memory_order_seq_cst );
+
+				m_cv.wait_for( lock, m_park_timeout, [ this ]( ) {
+					return m_signaled.load( std::memory_order_seq_cst );
+				} );
+
+				m_parked.store( false, std::memory_order_relaxed );
+			}
+
+			m_signaled.store( false, std::memory_order_relaxed );
+
+			// We spun for nothing, spin less next time
+			m_spin_count /= 2;
+		}
+
+	private:
+		std::atomic< bool > m_signaled = false, m_parked = false;
+		std::uint32_t m_spin_count = 0, m_max_spin_count = 0;
+		std::chrono::microseconds m_park_timeout = std::chrono::milliseconds( 1 );
+
+		std::mutex m_mtx;
+		std::condition_variable m_cv;
+	};
+} // namespace forceinline::remote::transport
@@ -0,0 +1,272 @@
+#include "handoff.h"
+#include <cstdio>
+#include <thread>
+#include <stdexcept>
+
+namespace forceinline::remote::transport::handoff {
+	namespace {
+		sockaddr_un make_address( const std::string& path ) {
+			sockaddr_un address = { };
+			address.sun_family = AF_UNIX;
+
+			if ( path.size( ) >= sizeof address.sun_path )
+				throw std::invalid_argument( "handoff: socket path too long" );
+
+			memcpy( address.sun_path, path.data( ), path.size( ) );
+			return address;
+		}
+
+		bool wait_readable( SOCKET socket, std::chrono::milliseconds timeout ) {
+			WSAPOLLFD poll_fd = { socket, POLLRDNORM, 0 };
+			return WSAPoll( &poll_fd, 1, int( timeout.count( ) ) ) > 0;
+		}
+
+		bool send_all( SOCKET socket, const char* data, std::size_t length ) {
+			std::size_t total_bytes_sent = 0;
+
+			while ( total_bytes_sent < length ) {
+				int bytes_sent = send( socket, data + total_bytes_sent, int( length - total_bytes_sent ), NULL );
+				if ( bytes_sent <= 0 )
+					return false;
+
+				total_bytes_sent += bytes_sent;
+			}
+
+			return true;
+		}
+
+		bool receive_all( SOCKET socket, char* data, std::size_t length, std::chrono::milliseconds timeout ) {
+			std::size_t total_bytes_received = 0;
+
+			while ( total_bytes_received < length ) {
+				if ( !wait_readable( socket, timeout ) )
+					return false;
+
+				int bytes_received = recv( socket, data + total_bytes_received, int( length - total_bytes_received ), NULL );
+				if ( bytes_received <= 0 )
+					return false;
+
+				total_bytes_received += bytes_received;
+			}
+
+			return true;
+		}
+
+		// Little-endian fields back to back, both processes run on the same machine
+		class writer {
+		public:
+			template < typename T >
+			void write( const T& value ) {
+				auto bytes = reinterpret_cast< const char* >( &value );
+				m_buffer.insert( m_buffer.end( ), bytes, bytes + sizeof( T ) );
+			}
+
+			void write_bytes( const char* data, std::size_t length ) {
+				write( std::uint32_t( length ) );
+				m_buffer.insert( m_buffer.end( ), data, data + length );
+			}
+
+			std::vector< char >& buffer( ) {
+				return m_buffer;
+			}
+
+		private:
+			std::vector< char > m_buffer = { };
+		};
+
+		class reader {
+		public:
+			reader( const std::vector< char >& buffer ) : m_buffer( buffer ) { }
+
+			template < typename T >
+			T read( ) {
+				if ( m_buffer.size( ) - m_offset < sizeof( T ) )
+					throw std::exception( "handoff: state is truncated" );
+
+				T value = { };
+				memcpy( &value, m_buffer.data( ) + m_offset, sizeof( T ) );
+				m_offset += sizeof( T );
+
+				return value;
+			}
+
+			const char* read_bytes( std::size_t& length ) {
+				length = read< std::uint32_t >( );
+
+				if ( m_buffer.size( ) - m_offset < length )
+					throw std::exception( "handoff: state is truncated" );
+
+				auto data = m_buffer.data( ) + m_offset;
+				m_offset += length;
+
+				return data;
+			}
+
+		private:
+			const std::vector< char >& m_buffer;
+			std::size_t m_offset = 0;
+		};
+	} // namespace
+
+	SOCKET wait_for_successor( const std::string& path, std::chrono::milliseconds timeout, DWORD& process_id ) {
+		auto address = make_address( path );
+
+		// Remove the socket file a previous hand-off might have left behind
+		std::remove( path.data( ) );
+
+		SOCKET listener = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+
+		if ( listener == INVALID_SOCKET )
+			throw std::exception( "handoff::wait_for_successor: socket creation failed" );
+
+		if ( bind( listener, reinterpret_cast< sockaddr* >( &address ), sizeof address ) == SOCKET_ERROR || listen( listener, 1 ) == SOCKET_ERROR ) {
+			closesocket( listener );
+			throw std::exception( "handoff::wait_for_successor: failed to listen on unix socket" );
+		}
+
+		SOCKET successor = INVALID_SOCKET;
+
+		if ( wait_readable( listener, timeout ) )
+			successor = ::accept( listener, NULL, NULL );
+
+		closesocket( listener );
+		std::remove( path.data( ) );
+
+		if ( successor == INVALID_SOCKET )
+			return INVALID_SOCKET;
+
+		// The new process introduces itself with its process id
+		if ( !receive_all( successor, reinterpret_cast< char* >( &process_id ), sizeof process_id, timeout ) ) {
+			closesocket( successor );
+			return INVALID_SOCKET;
+		}
+
+		return successor;
+	}
+
+	bool duplicate( SOCKET socket, DWORD process_id, WSAPROTOCOL_INFOW& protocol_info ) {
+		return WSADuplicateSocketW( socket, process_id, &protocol_info ) == 0;
+	}
+
+	bool send_state( SOCKET successor, const state_t& state, std::chrono::milliseconds timeout ) {
+		writer out = { };
+		out.write( state.listener );
+		out.write( std::uint32_t( state.connections.size( ) ) );
+
+		for ( auto& connection : state.connections ) {
+			out.write( connection.protocol_info );
+			out.write( connection.framing );
+			out.write( connection.features );
+			out.write_bytes( connection.receive_buffer.data( ), connection.receive_buffer.size( ) );
+
+			out.write( std::uint32_t( connection.delta_bases.size( ) ) );
+			for ( auto& [ packet_id, base ] : connection.delta_bases ) {
+				out.write( packet_id );
+				out.write_bytes( base.data( ), base.size( ) );
+			}
+
+			out.write( std::uint32_t( connection.topics.size( ) ) );
+			for ( auto& topic : connection.topics )
+				out.write_bytes( topic.data( ), topic.size( ) );
+		}
+
+		std::uint32_t header[ 2 ] = { magic, std::uint32_t( out.buffer( ).size( ) ) };
+
+		if ( !send_all( successor, reinterpret_cast< const char* >( header ), sizeof header ) || !send_all( successor, out.buffer( ).data( ), out.buffer( ).size( ) ) )
+			return false;
+
+		// Wait until every socket has been opened on the other side
+		char acknowledged = 0;
+		return receive_all( successor, &acknowledged, sizeof acknowledged, timeout ) && acknowledged == 1;
+	}
+
+	SOCKET connect_to_predecessor( const std::string& path, std::chrono::milliseconds timeout, state_t& state ) {
+		auto address = make_address( path );
+		auto deadline = std::chrono::steady_clock::now( ) + timeout;
+
+		SOCKET predecessor = INVALID_SOCKET;
+
+		// The old process may not be listening yet
+		while ( true ) {
+			predecessor = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+
+			if ( predecessor == INVALID_SOCKET )
+				throw std::exception( "handoff::connect_to_predecessor: socket creation failed" );
+
+			if ( ::connect( predecessor, reinterpret_cast< sockaddr* >( &address ), sizeof address ) != SOCKET_ERROR )
+				break;
+
+			closesocket( predecessor );
+
+			if ( std::chrono::steady_clock::now( ) >= deadline )
+				throw std::exception( "handoff::connect_to_predecessor: no server is handing off at the path" );
+
+			std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+		}
+
+		auto process_id = GetCurrentProcessId( );
+
+		std::uint32_t header[ 2 ] = { };
+		std::vector< char > buffer = { };
+
+		auto received = send_all( predecessor, reinterpret_cast< const char* >( &process_id ), sizeof process_id )
+			&& receive_all( predecessor, reinterpret_cast< char* >( header ), sizeof header, timeout )
+			&& header[ 0 ] == magic;
+
+		if ( received ) {
+			buffer.resize( header[ 1 ] );
+			received = receive_all( predecessor, buffer.data( ), buffer.size( ), timeout );
+		}
+
+		if ( !received ) {
+			closesocket( predecessor );
+			throw std::exception( "handoff::connect_to_predecessor: failed to receive the server's state" );
+		}
+
+		try {
+			reader in( buffer );
+			state.listener = in.read< WSAPROTOCOL_INFOW >( );
+			state.connections.resize( in.read< std::uint32_t >( ) );
+
+			for ( auto& connection : state.connections ) {
+				std::size_t length = 0;
+
+				connection.protocol_info = in.read< WSAPROTOCOL_INFOW >( );
+				connection.framing = in.read< std::uint8_t >( );
+				connection.features = in.read< std::uint32_t >( );
+
+				auto receive_buffer = in.read_bytes( length );
+				connection.receive_buffer.assign( receive_buffer, receive_buffer + length );
+
+				connection.delta_bases.resize( in.read< std::uint32_t >( ) );
+				for ( auto& [ packet_id, base ] : connection.delta_bases ) {
+					packet_id = in.read< std::uint16_t >( );
+
+					auto data = in.read_bytes( length );
+					base.assign( data, data + length );
+				}
+
+				connection.topics.resize( in.read< std::uint32_t >( ) );
+				for ( auto& topic : connection.topics ) {
+					auto data = in.read_bytes( length );
+					topic.assign( data, length );
+				}
+			}
+		} catch ( const std::exception& ) {
+			closesocket( predecessor );
+			throw;
+		}
+
+		return predecessor;
+	}
+
+	SOCKET open( const WSAPROTOCOL_INFOW& protocol_info ) {
+		auto info = protocol_info;
+		return WSASocketW( FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &info, 0, WSA_FLAG_OVERLAPPED );
+	}
+
+	bool acknowledge( SOCKET predecessor ) {
+		char acknowledged = 1;
+		return send_all( predecessor, &acknowledged, sizeof acknowledged );
+	}
+} // namespace forceinline::remote::transport::handoff
@@ -0,0 +1,60 @@
+#pragma once
+#include <WinSock2.h>
+#include <afunix.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace forceinline::remote::transport {
+	/*
+		Hands the sockets of a running server to a new process (hot restart). The old process listens on an
+		AF_UNIX socket, the new one connects and tells it its process id. The old process duplicates its sockets
+		for that process (WSADuplicateSocket) and sends them along with the state of every connection. Once the
+		new process opened all of them it acknowledges, and the old one can close its handles without touching
+		the connections.
+	*/
+	namespace handoff {
+		constexpr std::uint32_t magic = 0x46464F48; // "HOFF"
+
+		struct connection_state_t {
+			WSAPROTOCOL_INFOW protocol_info = { };
+
+			// packets::wire::framing_t and negotiated features
+			std::uint8_t framing = 0;
+			std::uint32_t features = 0;
+
+			// Received bytes which were not processed yet
+			std::vector< char > receive_buffer = { };
+
+			// Last packet received per delta encoded id
+			std::vector< std::pair< std::uint16_t, std::vector< char > > > delta_bases = { };
+
+			std::vector< std::string > topics = { };
+		};
+
+		struct state_t {
+			WSAPROTOCOL_INFOW listener = { };
+			std::vector< connection_state_t > connections = { };
+		};
+
+		// Old process: waits for the new process to connect. Returns INVALID_SOCKET on timeout
+		SOCKET wait_for_successor( const std::string& path, std::chrono::milliseconds timeout, DWORD& process_id );
+
+		// Old process: fills in protocol_info for the process. Returns false if the socket can't be duplicated
+		bool duplicate( SOCKET socket, DWORD process_id, WSAPROTOCOL_INFOW& protocol_info );
+
+		// Old process: sends our state and waits until the new process opened all sockets
+		bool send_state( SOCKET successor, const state_t& state, std::chrono::milliseconds timeout );
+
+		// New process: connects to the old one, retrying until the timeout, and receives its state. Throws on failure
+		SOCKET connect_to_predecessor( const std::string& path, std::chrono::milliseconds timeout, state_t& state );
+
+		// New process: opens a socket from its duplicated protocol info. Returns INVALID_SOCKET on failure
+		SOCKET open( const WSAPROTOCOL_INFOW& protocol_info );
+
+		// New process: lets the old process know it may close its handles
+		bool acknowledge( SOCKET predecessor );
+	} // namespace handoff
+} // namespace forceinline::remote::transport
@@ -0,0 +1,39 @@
+#include "low_latency.h"
+#include <WS2tcpip.h>
+
+namespace forceinline::remote::transport {
+	void pin_current_thread( const low_latency_config_t& config, std::size_t thread_index ) {
+		if ( !config.enabled )
+			return;
+
+		if ( !config.cores.empty( ) ) {
+			auto core = config.cores[ thread_index % config.cores.size( ) ];
+
+			if ( core >= 0 && core < int( sizeof DWORD_PTR * 8 ) )
+				SetThreadAffinityMask( GetCurrentThread( ), DWORD_PTR( 1 ) << core );
+
+			return;
+		}
+
+		if ( config.numa_node >= 0 ) {
+			GROUP_AFFINITY affinity = { };
+
+			if ( GetNumaNodeProcessorMaskEx( WORD( config.numa_node ), &affinity ) )
+				SetThreadGroupAffinity( GetCurrentThread( ), &affinity, NULL );
+		}
+	}
+
+	void apply_socket_options( SOCKET socket, const low_latency_config_t& config ) {
+		if ( !config.enabled )
+			return;
+
+		// Don't hold back small packets
+		BOOL no_delay = TRUE;
+		setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast< const char* >( &no_delay ), sizeof no_delay );
+
+		// Skip most of the TCP stack for loopback connections, has no effect on anything else
+		int fast_path = 1;
+		DWORD bytes_returned = 0;
+		WSAIoctl( socket, SIO_LOOPBACK_FAST_PATH, &fast_path, sizeof fast_path, NULL, 0, &bytes_returned, NULL, NULL );
+	}
+} // namespace forceinline::remote::transport
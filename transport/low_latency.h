@@ -0,0 +1,36 @@
+#pragma once
+#include <WinSock2.h>
+#include <Windows.h>
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace forceinline::remote::transport {
+	/*
+		Settings for latency-sensitive deployments, where wake-up latency matters more than CPU usage.
+		With low latency enabled, our threads busy-poll their sockets/rings and queues for spin_count
+		iterations before they park, and stay on the cores they were given.
+	*/
+	struct low_latency_config_t {
+		bool enabled = false;
+
+		// Iterations a thread busy-polls for new work before it parks
+		std::uint32_t spin_count = 1 << 16;
+
+		// How long a parked thread sleeps at most before polling again
+		std::chrono::microseconds park_timeout = std::chrono::milliseconds( 1 );
+
+		// Logical processors our threads are pinned to, in the order receive, process, send (and accept on the server). Empty to not pin
+		std::vector< int > cores = { };
+
+		// Pin all threads to the processors of a NUMA node instead, -1 to not pin
+		int numa_node = -1;
+	};
+
+	// Pins the calling thread according to the config. thread_index picks the core if cores are given
+	void pin_current_thread( const low_latency_config_t& config, std::size_t thread_index );
+
+	// Disables Nagle and enables the loopback fast path for TCP sockets. Has to be called before connecting/listening
+	void apply_socket_options( SOCKET socket, const low_latency_config_t& config );
+} // namespace forceinline::remote::transport
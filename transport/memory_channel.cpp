@@ -0,0 +1,187 @@
+#include "memory_channel.h"
+
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <condition_variable>
+
+namespace forceinline::remote::transport {
+	struct memory_channel::pipe_t {
+		// Bytes written by each side, consumed from read_offsets on
+		std::vector< char > buffers[ 2 ] = { };
+		std::size_t read_offsets[ 2 ] = { };
+
+		bool closed = false;
+		memory_channel_options_t options = { };
+
+		std::mutex mtx;
+		std::condition_variable cv;
+
+		std::size_t queued( int side ) {
+			return buffers[ side ].size( ) - read_offsets[ side ];
+		}
+	};
+
+	std::pair< std::shared_ptr< memory_channel >, std::shared_ptr< memory_channel > > memory_channel::create_pair( const memory_channel_options_t& options ) {
+		auto pipe = std::make_shared< pipe_t >( );
+		pipe->options = options;
+
+		return { std::shared_ptr< memory_channel >( new memory_channel( pipe, 0 ) ), std::shared_ptr< memory_channel >( new memory_channel( pipe, 1 ) ) };
+	}
+
+	int memory_channel::write( const char* data, int length ) {
+		std::unique_lock lock( m_pipe->mtx );
+
+		auto& options = m_pipe->options;
+
+		// Wait for the reader to make room
+		if ( options.capacity ) {
+			m_pipe->cv.wait( lock, [ this, &options ]( ) {
+				return m_pipe->closed || m_pipe->queued( m_side ) < options.capacity;
+			} );
+		}
+
+		if ( m_pipe->closed )
+			return -1;
+
+		auto to_write = std::size_t( length );
+		if ( options.max_write )
+			to_write = std::min< std::size_t >( to_write, options.max_write );
+
+		if ( options.capacity )
+			to_write = std::min( to_write, options.capacity - m_pipe->queued( m_side ) );
+
+		auto& buffer = m_pipe->buffers[ m_side ];
+		buffer.insert( buffer.end( ), data, data + to_write );
+
+		m_pipe->cv.notify_all( );
+		return int( to_write );
+	}
+
+	int memory_channel::read( char* buffer, int length ) {
+		std::lock_guard lock( m_pipe->mtx );
+
+		auto side = 1 - m_side;
+		auto queued = m_pipe->queued( side );
+
+		// Whatever was written before the other end closed can still be read
+		if ( queued == 0 )
+			return m_pipe->closed ? -1 : 0;
+
+		auto to_read = std::min< std::size_t >( queued, length );
+		if ( m_pipe->options.max_read )
+			to_read = std::min< std::size_t >( to_read, m_pipe->options.max_read );
+
+		auto& source = m_pipe->buffers[ side ];
+		auto& offset = m_pipe->read_offsets[ side ];
+
+		memcpy( buffer, source.data( ) + offset, to_read );
+		offset += to_read;
+
+		// Move the rest to the front once we consumed most of the buffer
+		if ( offset == source.size( ) ) {
+			source.clear( );
+			offset = 0;
+		} else if ( offset > source.size( ) / 2 ) {
+			source.erase( source.begin( ), source.begin( ) + offset );
+			offset = 0;
+		}
+
+		m_pipe->cv.notify_all( );
+		return int( to_read );
+	}
+
+	bool memory_channel::wait_readable( std::chrono::microseconds timeout ) {
+		auto readable = [ this ]( ) {
+			return m_pipe->closed || m_pipe->queued( 1 - m_side ) > 0;
+		};
+
+		if ( m_idle_callback ) {
+			{
+				std::lock_guard lock( m_pipe->mtx );
+				if ( readable( ) )
+					return true;
+			}
+
+			m_idle_callback( );
+		}
+
+		std::unique_lock lock( m_pipe->mtx );
+		return m_pipe->cv.wait_for( lock, timeout, readable );
+	}
+
+	void memory_channel::close( ) {
+		std::lock_guard lock( m_pipe->mtx );
+
+		m_pipe->closed = true;
+		m_pipe->cv.notify_all( );
+	}
+
+	void memory_channel::set_idle_callback( std::function< void( ) > callback ) {
+		m_idle_callback = std::move( callback );
+	}
+
+	namespace memory_listener {
+		namespace {
+			struct listener_t {
+				memory_channel_options_t options = { };
+				std::function< void( ) > idle_callback = nullptr;
+				std::deque< std::shared_ptr< memory_channel > > pending = { };
+			};
+
+			std::mutex g_listener_mtx;
+			std::unordered_map< std::string, listener_t > g_listeners = { };
+		} // namespace
+
+		void listen( const std::string& name, const memory_channel_options_t& options, std::function< void( ) > idle_callback ) {
+			std::lock_guard lock( g_listener_mtx );
+
+			if ( !g_listeners.try_emplace( name, listener_t { options, std::move( idle_callback ) } ).second )
+				throw std::invalid_argument( "memory_listener::listen: name already in use" );
+		}
+
+		void stop( const std::string& name ) {
+			std::lock_guard lock( g_listener_mtx );
+
+			auto listener_it = g_listeners.find( name );
+			if ( listener_it == g_listeners.end( ) )
+				return;
+
+			// Nobody is going to accept these anymore
+			for ( auto& channel : listener_it->second.pending )
+				channel->close( );
+
+			g_listeners.erase( listener_it );
+		}
+
+		std::shared_ptr< memory_channel > connect( const std::string& name ) {
+			std::lock_guard lock( g_listener_mtx );
+
+			auto listener_it = g_listeners.find( name );
+			if ( listener_it == g_listeners.end( ) )
+				throw std::exception( "memory_listener::connect: nobody listens on this name" );
+
+			auto [ server_end, client_end ] = memory_channel::create_pair( listener_it->second.options );
+			client_end->set_idle_callback( listener_it->second.idle_callback );
+
+			listener_it->second.pending.push_back( server_end );
+			return client_end;
+		}
+
+		std::shared_ptr< memory_channel > accept( const std::string& name ) {
+			std::lock_guard lock( g_listener_mtx );
+
+			auto listener_it = g_listeners.find( name );
+			if ( listener_it == g_listeners.end( ) || listener_it->second.pending.empty( ) )
+				return nullptr;
+
+			auto channel = listener_it->second.pending.front( );
+			listener_it->second.pending.pop_front( );
+
+			return channel;
+		}
+	} // namespace memory_listener
+} // namespace forceinline::remote::transport
@@ -0,0 +1,75 @@
+#pragma once
+#include <WinSock2.h>
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+#include "channel.h"
+
+/*
+	In-process transport (mem://name). Both ends of a connection share a pair of byte buffers, so
+	servers and clients in the same process can talk to each other without any networking. Reads
+	and writes can be capped to reproduce partial transfers exactly, and together with the manual
+	pump of async_server/async_client everything runs deterministically on a single thread.
+*/
+
+namespace forceinline::remote::transport {
+	struct memory_channel_options_t {
+		// Most bytes a single read/write transfers, 0 for no limit
+		std::uint32_t max_read = 0, max_write = 0;
+
+		// Bytes buffered per direction before writes block, 0 for no limit
+		std::uint32_t capacity = 0;
+	};
+
+	class memory_channel : public channel {
+	public:
+		// Creates both ends of a connection
+		static std::pair< std::shared_ptr< memory_channel >, std::shared_ptr< memory_channel > > create_pair( const memory_channel_options_t& options = { } );
+
+		virtual int write( const char* data, int length );
+		virtual int read( char* buffer, int length );
+		virtual bool wait_readable( std::chrono::microseconds timeout );
+		virtual void close( );
+
+		// Called instead of waiting when there is nothing to read, lets a single thread drive the other end
+		void set_idle_callback( std::function< void( ) > callback );
+
+	private:
+		struct pipe_t;
+
+		memory_channel( std::shared_ptr< pipe_t > pipe, int side ) : m_pipe( std::move( pipe ) ), m_side( side ) { }
+
+		std::shared_ptr< pipe_t > m_pipe = nullptr;
+		int m_side = 0;
+
+		std::function< void( ) > m_idle_callback = nullptr;
+	};
+
+	/*
+		Servers listen on a name, clients connecting to it get one end of a new channel pair and the
+		server picks up the other one with accept.
+	*/
+	namespace memory_listener {
+		// The idle callback is installed on the client ends, so a client waiting for the server can drive it
+		void listen( const std::string& name, const memory_channel_options_t& options = { }, std::function< void( ) > idle_callback = nullptr );
+		void stop( const std::string& name );
+
+		// Throws if nobody listens on the name
+		std::shared_ptr< memory_channel > connect( const std::string& name );
+
+		// Returns nullptr if no connection is pending
+		std::shared_ptr< memory_channel > accept( const std::string& name );
+	} // namespace memory_listener
+
+	// Memory connections get pseudo socket handles. Real socket handles are multiples of 4, these never are.
+	inline SOCKET make_memory_socket( std::uint32_t index ) {
+		return SOCKET( ( std::uint64_t( index ) << 2 ) | 1 );
+	}
+
+	inline bool is_memory_socket( SOCKET socket ) {
+		return socket != INVALID_SOCKET && ( socket & 3 ) == 1;
+	}
+} // namespace forceinline::remote::transport
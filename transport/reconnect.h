@@ -0,0 +1,50 @@
+#pragma once
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+
+namespace forceinline::remote::transport {
+	/*
+		How a client gets its connection back once it dropped. Attempts are spaced by an exponential
+		backoff with random jitter, so a restarted server is not hit by all of its clients at once.
+	*/
+	struct reconnect_policy_t {
+		bool enabled = false;
+
+		std::chrono::milliseconds initial_delay = std::chrono::milliseconds( 50 );
+		std::chrono::milliseconds max_delay = std::chrono::seconds( 5 );
+		double multiplier = 2.0;
+
+		// Delays are picked at random from [ delay * ( 1 - jitter ), delay ]
+		double jitter = 0.5;
+
+		// Attempts after which we give up, 0 to keep trying until disconnect( )
+		std::uint32_t max_attempts = 0;
+
+		// Keep a second connection through its handshake in reserve, failing over to it takes no round trips
+		bool standby = false;
+	};
+
+	class backoff {
+	public:
+		backoff( const reconnect_policy_t& policy ) : m_policy( policy ), m_delay( policy.initial_delay ), m_random( std::random_device( )( ) ) { }
+
+		std::chrono::milliseconds next( ) {
+			auto delay = m_delay;
+			m_delay = std::min( m_policy.max_delay, std::chrono::duration_cast< std::chrono::milliseconds >( m_delay * m_policy.multiplier ) );
+
+			std::uniform_real_distribution< double > distribution( 1.0 - std::clamp( m_policy.jitter, 0.0, 1.0 ), 1.0 );
+			return std::chrono::milliseconds( std::int64_t( double( delay.count( ) ) * distribution( m_random ) ) );
+		}
+
+		void reset( ) {
+			m_delay = m_policy.initial_delay;
+		}
+
+	private:
+		reconnect_policy_t m_policy = { };
+		std::chrono::milliseconds m_delay = { };
+		std::minstd_rand m_random;
+	};
+} // namespace forceinline::remote::transport
@@ -0,0 +1,208 @@
+#include "shm_channel.h"
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+
+namespace forceinline::remote::transport {
+	shm_channel::shm_channel( std::string_view name, bool create, std::uint32_t capacity ) {
+		if ( name.empty( ) )
+			throw std::invalid_argument( "shm_channel::shm_channel: name argument is empty" );
+
+		// Keep our positions cheap to wrap
+		if ( create && ( capacity == 0 || ( capacity & ( capacity - 1 ) ) != 0 ) )
+			throw std::invalid_argument( "shm_channel::shm_channel: capacity has to be a power of two" );
+
+		m_name = name;
+
+		auto mapping_name = "Local\\" + m_name;
+		auto header_size = ( sizeof shared_header_t + 63 ) & ~std::size_t( 63 );
+
+		if ( create ) {
+			std::uint64_t mapping_size = header_size + std::uint64_t( capacity ) * 2;
+			m_mapping = CreateFileMappingA( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD( mapping_size >> 32 ), DWORD( mapping_size & 0xFFFFFFFF ), mapping_name.data( ) );
+		} else
+			m_mapping = OpenFileMappingA( FILE_MAP_ALL_ACCESS, FALSE, mapping_name.data( ) );
+
+		if ( !m_mapping )
+			throw std::exception( "shm_channel::shm_channel: failed to create/open file mapping" );
+
+		auto view = reinterpret_cast< char* >( MapViewOfFile( m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0 ) );
+
+		if ( !view ) {
+			CloseHandle( m_mapping );
+			throw std::exception( "shm_channel::shm_channel: failed to map view of file" );
+		}
+
+		m_header = reinterpret_cast< shared_header_t* >( view );
+
+		if ( create ) {
+			// Construct the shared state in place, the mapping is zeroed by the OS
+			new ( m_header ) shared_header_t( );
+			m_header->capacity = capacity;
+			m_header->magic = m_magic;
+		} else if ( m_header->magic != m_magic ) {
+			UnmapViewOfFile( view );
+			CloseHandle( m_mapping );
+			throw std::exception( "shm_channel::shm_channel: mapping has an invalid header" );
+		}
+
+		m_capacity = m_header->capacity;
+
+		// The creating side writes into ring 0, the opening side into ring 1
+		int tx_index = create ? 0 : 1, rx_index = create ? 1 : 0;
+
+		m_tx = &m_header->rings[ tx_index ];
+		m_rx = &m_header->rings[ rx_index ];
+		m_tx_data = view + header_size + std::size_t( m_capacity ) * tx_index;
+		m_rx_data = view + header_size + std::size_t( m_capacity ) * rx_index;
+
+		// Auto-reset events, named after the ring they belong to
+		auto open_event = [ & ]( const char* kind, int index ) {
+			auto event_name = mapping_name + "_" + kind + std::to_string( index );
+			return CreateEventA( NULL, FALSE, FALSE, event_name.data( ) );
+		};
+
+		m_tx_data_event = open_event( "data", tx_index );
+		m_rx_data_event = open_event( "data", rx_index );
+		m_tx_space_event = open_event( "space", tx_index );
+		m_rx_space_event = open_event( "space", rx_index );
+	}
+
+	shm_channel::~shm_channel( ) {
+		close( );
+
+		for ( auto event : { m_tx_data_event, m_rx_data_event, m_tx_space_event, m_rx_space_event } ) {
+			if ( event )
+				CloseHandle( event );
+		}
+
+		if ( m_header )
+			UnmapViewOfFile( m_header );
+
+		if ( m_mapping )
+			CloseHandle( m_mapping );
+	}
+
+	int shm_channel::write( const char* data, int length ) {
+		if ( !data || length <= 0 )
+			return 0;
+
+		std::uint32_t spins = 0;
+		while ( !is_closed( ) ) {
+			auto write_position = m_tx->write_position.load( std::memory_order_relaxed );
+			auto read_position = m_tx->read_position.load( std::memory_order_acquire );
+			auto free_space = m_capacity - std::uint32_t( write_position - read_position );
+
+			if ( free_space == 0 ) {
+				// Busy-poll first, only park if the reader does not make progress
+				if ( spins++ < m_spin_count ) {
+					YieldProcessor( );
+					continue;
+				}
+
+				m_tx->writer_parked.store( 1, std::memory_order_seq_cst );
+
+				// Re-check after announcing ourselves so we can't miss the signal
+				if ( m_tx->read_position.load( std::memory_order_seq_cst ) == read_position )
+					WaitForSingleObject( m_tx_space_event, 1 );
+
+				m_tx->writer_parked.store( 0, std::memory_order_relaxed );
+				spins = 0;
+				continue;
+			}
+
+			// Copy as much as fits, wrapping around the end of the ring
+			auto to_write = std::min< std::uint32_t >( free_space, std::uint32_t( length ) );
+			auto offset = std::uint32_t( write_position & ( m_capacity - 1 ) );
+			auto first_part = std::min( to_write, m_capacity - offset );
+
+			memcpy( m_tx_data + offset, data, first_part );
+			memcpy( m_tx_data, data + first_part, to_write - first_part );
+
+			m_tx->write_position.store( write_position + to_write, std::memory_order_release );
+
+			// Only ring the doorbell if the reader actually sleeps
+			std::atomic_thread_fence( std::memory_order_seq_cst );
+			if ( m_tx->reader_parked.load( std::memory_order_relaxed ) )
+				SetEvent( m_tx_data_event );
+
+			return int( to_write );
+		}
+
+		return -1;
+	}
+
+	int shm_channel::read( char* buffer, int length ) {
+		if ( !buffer || length <= 0 )
+			return 0;
+
+		auto read_position = m_rx->read_position.load( std::memory_order_relaxed );
+		auto write_position = m_rx->write_position.load( std::memory_order_acquire );
+		auto available = std::uint32_t( write_position - read_position );
+
+		// Drain what is left even if the other side is gone already
+		if ( available == 0 )
+			return is_closed( ) ? -1 : 0;
+
+		auto to_read = std::min< std::uint32_t >( available, std::uint32_t( length ) );
+		auto offset = std::uint32_t( read_position & ( m_capacity - 1 ) );
+		auto first_part = std::min( to_read, m_capacity - offset );
+
+		memcpy( buffer, m_rx_data + offset, first_part );
+		memcpy( buffer + first_part, m_rx_data, to_read - first_part );
+
+		m_rx->read_position.store( read_position + to_read, std::memory_order_release );
+
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if ( m_rx->writer_parked.load( std::memory_order_relaxed ) )
+			SetEvent( m_rx_space_event );
+
+		return int( to_read );
+	}
+
+	bool shm_channel::wait_readable( std::chrono::microseconds timeout ) {
+		auto has_data = [ this ]( ) {
+			return m_rx->write_position.load( std::memory_order_acquire ) != m_rx->read_position.load( std::memory_order_relaxed ) || is_closed( );
+		};
+
+		for ( std::uint32_t spins = 0; spins < m_spin_count; spins++ ) {
+			if ( has_data( ) )
+				return true;
+
+			YieldProcessor( );
+		}
+
+		m_rx->reader_parked.store( 1, std::memory_order_seq_cst );
+
+		if ( !has_data( ) ) {
+			auto timeout_ms = std::chrono::duration_cast< std::chrono::milliseconds >( timeout ).count( );
+			WaitForSingleObject( m_rx_data_event, DWORD( std::max< long long >( timeout_ms, 1 ) ) );
+		}
+
+		m_rx->reader_parked.store( 0, std::memory_order_relaxed );
+		return has_data( );
+	}
+
+	void shm_channel::close( ) {
+		if ( !m_header || m_header->closed.exchange( 1 ) )
+			return;
+
+		// Wake up everyone so they notice
+		for ( auto event : { m_tx_data_event, m_rx_data_event, m_tx_space_event, m_rx_space_event } ) {
+			if ( event )
+				SetEvent( event );
+		}
+	}
+
+	void shm_channel::set_spin_count( std::uint32_t spin_count ) {
+		m_spin_count = spin_count;
+	}
+
+	const std::string& shm_channel::name( ) {
+		return m_name;
+	}
+
+	bool shm_channel::is_closed( ) {
+		return m_header->closed.load( std::memory_order_acquire ) != 0;
+	}
+} // namespace forceinline::remote::transport
@@ -0,0 +1,75 @@
+#pragma once
+#include <Windows.h>
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+#include "channel.h"
+
+/*
+	Shared memory transport. Both ends map the same named file mapping which holds two
+	single-producer/single-consumer byte rings, one per direction:
+
+	[
+		shared_header_t		magic, capacity, closed flag and the ring positions (each on its own cache line)
+		uint8[ capacity ]	ring 0 data, written by the creating side (server)
+		uint8[ capacity ]	ring 1 data, written by the opening side (client)
+	]
+
+	While data is flowing nothing but atomic loads and stores are involved. A side only falls
+	back to its doorbell event after spinning for m_spin_count iterations without progress, and
+	the other side only signals the event if it sees that flag set.
+*/
+
+namespace forceinline::remote::transport {
+	class shm_channel : public channel {
+	public:
+		// Creates a new mapping if create is set, opens an existing one otherwise
+		shm_channel( std::string_view name, bool create, std::uint32_t capacity = 1 << 20 );
+		~shm_channel( );
+
+		virtual int write( const char* data, int length );
+		virtual int read( char* buffer, int length );
+		virtual bool wait_readable( std::chrono::microseconds timeout );
+		virtual void close( );
+
+		// Amount of iterations we busy-poll before parking on the doorbell
+		void set_spin_count( std::uint32_t spin_count );
+
+		const std::string& name( );
+
+	private:
+		struct ring_state_t {
+			alignas( 64 ) std::atomic< std::uint64_t > write_position;
+			alignas( 64 ) std::atomic< std::uint64_t > read_position;
+			alignas( 64 ) std::atomic< std::uint32_t > reader_parked;
+			std::atomic< std::uint32_t > writer_parked;
+		};
+
+		struct shared_header_t {
+			std::uint32_t magic;
+			std::uint32_t capacity;
+			std::atomic< std::uint32_t > closed;
+			ring_state_t rings[ 2 ];
+		};
+
+		static constexpr std::uint32_t m_magic = 0x52484d46; // 'FMHR'
+
+		bool is_closed( );
+
+		std::string m_name = "";
+		std::uint32_t m_capacity = 0, m_spin_count = 4096;
+
+		HANDLE m_mapping = NULL;
+		shared_header_t* m_header = nullptr;
+
+		// Which ring we write into and which one we read from
+		ring_state_t* m_tx = nullptr, * m_rx = nullptr;
+		char* m_tx_data = nullptr, * m_rx_data = nullptr;
+
+		// Doorbells: "data available" for our rx ring, "space available" for our tx ring and the peer's counterparts
+		HANDLE m_rx_data_event = NULL, m_tx_data_event = NULL;
+		HANDLE m_rx_space_event = NULL, m_tx_space_event = NULL;
+	};
+} // namespace forceinline::remote::transport
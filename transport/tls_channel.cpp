@@ -0,0 +1,361 @@
+#include "tls_channel.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace forceinline::remote::transport {
+	namespace {
+		constexpr ULONG client_flags = ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY | ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM;
+		constexpr ULONG server_flags = ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY | ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM;
+
+		// Largest TLS record plus some room for its header and trailer
+		constexpr std::size_t receive_size = 16 * 1024 + 512;
+	} // namespace
+
+	tls_channel::tls_channel( SOCKET socket, const tls_options_t& options, bool server, bool deferred ) : m_socket( socket ), m_server( server ), m_server_name( options.server_name ) {
+		if ( socket == INVALID_SOCKET )
+			throw std::invalid_argument( "tls_channel::tls_channel: socket argument is invalid" );
+
+		try {
+			acquire_credentials( options );
+
+			// The client speaks first, a deferred server waits for its hello in continue_handshake
+			if ( !deferred )
+				handshake( options.handshake_timeout );
+			else if ( !m_server && handshake_step( false ) != SEC_I_CONTINUE_NEEDED )
+				throw std::exception( "tls_channel::tls_channel: handshake failed" );
+		} catch ( const std::exception& ) {
+			release( );
+			throw;
+		}
+	}
+
+	tls_channel::~tls_channel( ) {
+		release( );
+	}
+
+	bool tls_channel::continue_handshake( ) {
+		std::lock_guard lock( m_read_mtx );
+
+		if ( m_established )
+			return true;
+
+		auto received = receive( std::chrono::milliseconds( 0 ) );
+
+		if ( received < 0 )
+			throw std::exception( "tls_channel::continue_handshake: the connection was closed" );
+
+		if ( received == 0 )
+			return false;
+
+		// The peer's flight can hold several messages, go on until we need more of its data
+		auto status = SEC_I_CONTINUE_NEEDED;
+
+		do {
+			status = handshake_step( true );
+		} while ( status == SEC_I_CONTINUE_NEEDED && !m_encrypted.empty( ) );
+
+		if ( status == SEC_I_CONTINUE_NEEDED || status == SEC_E_INCOMPLETE_MESSAGE )
+			return false;
+
+		finish_handshake( status );
+		return true;
+	}
+
+	int tls_channel::write( const char* data, int length ) {
+		std::lock_guard lock( m_write_mtx );
+
+		if ( m_closed || !m_established )
+			return -1;
+
+		// Every write is one record, larger writes are split by the caller's send loop
+		auto chunk = std::min< ULONG >( ULONG( length ), m_sizes.cbMaximumMessage );
+
+		m_record.resize( m_sizes.cbHeader + chunk + m_sizes.cbTrailer );
+		memcpy( m_record.data( ) + m_sizes.cbHeader, data, chunk );
+
+		SecBuffer buffers[ 4 ] = {
+			{ m_sizes.cbHeader, SECBUFFER_STREAM_HEADER, m_record.data( ) },
+			{ chunk, SECBUFFER_DATA, m_record.data( ) + m_sizes.cbHeader },
+			{ m_sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, m_record.data( ) + m_sizes.cbHeader + chunk },
+			{ 0, SECBUFFER_EMPTY, NULL }
+		};
+
+		SecBufferDesc description = { SECBUFFER_VERSION, 4, buffers };
+
+		if ( EncryptMessage( &m_context, 0, &description, 0 ) != SEC_E_OK )
+			return -1;
+
+		// The trailer may come out shorter than its maximum size
+		if ( !send_all( m_record.data( ), std::size_t( buffers[ 0 ].cbBuffer ) + buffers[ 1 ].cbBuffer + buffers[ 2 ].cbBuffer ) )
+			return -1;
+
+		return int( chunk );
+	}
+
+	int tls_channel::read( char* buffer, int length ) {
+		std::lock_guard lock( m_read_mtx );
+
+		if ( m_closed || !m_established )
+			return -1;
+
+		if ( m_decrypted_offset == m_decrypted.size( ) ) {
+			m_decrypted.clear( );
+			m_decrypted_offset = 0;
+
+			// Take whatever the socket has queued without blocking
+			if ( receive( std::chrono::milliseconds( 0 ) ) < 0 )
+				return -1;
+
+			// Decrypt every whole record, only a partial one stays behind
+			for ( int decrypted = 1; decrypted > 0; ) {
+				decrypted = decrypt( );
+
+				if ( decrypted < 0 )
+					return -1;
+			}
+
+			if ( m_decrypted.empty( ) )
+				return 0;
+		}
+
+		auto to_read = std::min< std::size_t >( length, m_decrypted.size( ) - m_decrypted_offset );
+		memcpy( buffer, m_decrypted.data( ) + m_decrypted_offset, to_read );
+		m_decrypted_offset += to_read;
+
+		return int( to_read );
+	}
+
+	bool tls_channel::wait_readable( std::chrono::microseconds timeout ) {
+		{
+			std::lock_guard lock( m_read_mtx );
+
+			if ( m_closed || m_decrypted_offset < m_decrypted.size( ) )
+				return true;
+		}
+
+		// Anything left in m_encrypted is a partial record, so only the socket can make progress
+		WSAPOLLFD poll_fd = { m_socket, POLLRDNORM, 0 };
+		return WSAPoll( &poll_fd, 1, int( ( timeout.count( ) + 999 ) / 1000 ) ) > 0;
+	}
+
+	void tls_channel::close( ) {
+		if ( m_closed.exchange( true ) )
+			return;
+
+		std::scoped_lock lock( m_write_mtx, m_read_mtx );
+
+		if ( !m_has_context )
+			return;
+
+		// Let the peer know we are done (close_notify), it's fine if that does not make it out
+		DWORD type = SCHANNEL_SHUTDOWN;
+		SecBuffer token = { sizeof type, SECBUFFER_TOKEN, &type };
+		SecBufferDesc description = { SECBUFFER_VERSION, 1, &token };
+
+		if ( ApplyControlToken( &m_context, &description ) == SEC_E_OK )
+			handshake_step( false );
+	}
+
+	void tls_channel::acquire_credentials( const tls_options_t& options ) {
+		// TLS 1.3 sends messages after the handshake which would need handling in the middle of our reads
+		SCHANNEL_CRED credentials = { };
+		credentials.dwVersion = SCHANNEL_CRED_VERSION;
+
+		PCCERT_CONTEXT certificate = NULL;
+
+		if ( m_server ) {
+			if ( options.certificate_subject.empty( ) )
+				throw std::invalid_argument( "tls_channel::tls_channel: servers need a certificate subject" );
+
+			auto location = options.machine_store ? CERT_SYSTEM_STORE_LOCAL_MACHINE : CERT_SYSTEM_STORE_CURRENT_USER;
+			auto store = CertOpenStore( CERT_STORE_PROV_SYSTEM_A, 0, NULL, location | CERT_STORE_READONLY_FLAG, options.certificate_store.data( ) );
+
+			if ( !store )
+				throw std::exception( "tls_channel::tls_channel: failed to open certificate store" );
+
+			certificate = CertFindCertificateInStore( store, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, 0, CERT_FIND_SUBJECT_STR_A, options.certificate_subject.data( ), NULL );
+			CertCloseStore( store, 0 );
+
+			if ( !certificate )
+				throw std::exception( "tls_channel::tls_channel: certificate not found" );
+
+			credentials.cCreds = 1;
+			credentials.paCred = &certificate;
+			credentials.grbitEnabledProtocols = SP_PROT_TLS1_2_SERVER;
+		} else {
+			credentials.grbitEnabledProtocols = SP_PROT_TLS1_2_CLIENT;
+			credentials.dwFlags = SCH_CRED_NO_DEFAULT_CREDS;
+			credentials.dwFlags |= options.verify_server ? SCH_CRED_AUTO_CRED_VALIDATION : SCH_CRED_MANUAL_CRED_VALIDATION | SCH_CRED_NO_SERVERNAME_CHECK;
+		}
+
+		auto status = AcquireCredentialsHandleA( NULL, const_cast< char* >( UNISP_NAME_A ), m_server ? SECPKG_CRED_INBOUND : SECPKG_CRED_OUTBOUND,
+			NULL, &credentials, NULL, NULL, &m_credentials, NULL );
+
+		// Schannel keeps its own reference to the certificate
+		if ( certificate )
+			CertFreeCertificateContext( certificate );
+
+		if ( status != SEC_E_OK )
+			throw std::exception( "tls_channel::tls_channel: failed to acquire credentials" );
+
+		m_has_credentials = true;
+	}
+
+	void tls_channel::handshake( std::chrono::milliseconds timeout ) {
+		auto deadline = std::chrono::steady_clock::now( ) + timeout;
+
+		// The client speaks first
+		auto status = m_server ? SEC_I_CONTINUE_NEEDED : handshake_step( false );
+
+		while ( status == SEC_I_CONTINUE_NEEDED || status == SEC_E_INCOMPLETE_MESSAGE ) {
+			// Wait for the peer if it consumed everything we had or we don't have its whole message yet
+			if ( m_encrypted.empty( ) || status == SEC_E_INCOMPLETE_MESSAGE ) {
+				auto remaining = std::chrono::duration_cast< std::chrono::milliseconds >( deadline - std::chrono::steady_clock::now( ) );
+
+				if ( remaining.count( ) <= 0 || receive( remaining ) <= 0 )
+					throw std::exception( "tls_channel::tls_channel: handshake timed out or the connection was closed" );
+			}
+
+			status = handshake_step( true );
+		}
+
+		finish_handshake( status );
+	}
+
+	void tls_channel::finish_handshake( SECURITY_STATUS status ) {
+		if ( status != SEC_E_OK )
+			throw std::exception( "tls_channel::tls_channel: handshake failed" );
+
+		if ( QueryContextAttributes( &m_context, SECPKG_ATTR_STREAM_SIZES, &m_sizes ) != SEC_E_OK )
+			throw std::exception( "tls_channel::tls_channel: failed to query stream sizes" );
+
+		// Records which arrived together with the end of the handshake
+		for ( int decrypted = 1; decrypted > 0; ) {
+			decrypted = decrypt( );
+
+			if ( decrypted < 0 )
+				throw std::exception( "tls_channel::tls_channel: connection was closed after the handshake" );
+		}
+
+		m_established = true;
+	}
+
+	void tls_channel::release( ) {
+		if ( m_has_context )
+			DeleteSecurityContext( &m_context );
+
+		if ( m_has_credentials )
+			FreeCredentialsHandle( &m_credentials );
+
+		m_has_context = m_has_credentials = false;
+	}
+
+	SECURITY_STATUS tls_channel::handshake_step( bool with_input ) {
+		SecBuffer input[ 2 ] = { { ULONG( m_encrypted.size( ) ), SECBUFFER_TOKEN, m_encrypted.data( ) }, { 0, SECBUFFER_EMPTY, NULL } };
+		SecBufferDesc input_description = { SECBUFFER_VERSION, 2, input };
+
+		SecBuffer output = { 0, SECBUFFER_TOKEN, NULL };
+		SecBufferDesc output_description = { SECBUFFER_VERSION, 1, &output };
+
+		auto context = m_has_context ? &m_context : NULL;
+		ULONG attributes = 0;
+		SECURITY_STATUS status = SEC_E_OK;
+
+		if ( m_server )
+			status = AcceptSecurityContext( &m_credentials, context, with_input ? &input_description : NULL, server_flags, 0, &m_context, &output_description, &attributes, NULL );
+		else {
+			status = InitializeSecurityContextA( &m_credentials, context, m_server_name.empty( ) ? NULL : m_server_name.data( ), client_flags, 0, 0,
+				with_input ? &input_description : NULL, 0, &m_context, &output_description, &attributes, NULL );
+		}
+
+		if ( !FAILED( status ) )
+			m_has_context = true;
+
+		// Send our part of the handshake, failures can come with an alert for the peer as well
+		if ( output.cbBuffer > 0 && output.pvBuffer ) {
+			auto sent = send_all( static_cast< const char* >( output.pvBuffer ), output.cbBuffer );
+			FreeContextBuffer( output.pvBuffer );
+
+			if ( !sent )
+				return SEC_E_INTERNAL_ERROR;
+		}
+
+		if ( !with_input || status == SEC_E_INCOMPLETE_MESSAGE )
+			return status;
+
+		// Keep what belongs to the peer's next message
+		if ( input[ 1 ].BufferType == SECBUFFER_EXTRA )
+			m_encrypted.erase( m_encrypted.begin( ), m_encrypted.end( ) - input[ 1 ].cbBuffer );
+		else
+			m_encrypted.clear( );
+
+		return status;
+	}
+
+	int tls_channel::decrypt( ) {
+		if ( m_encrypted.empty( ) )
+			return 0;
+
+		SecBuffer buffers[ 4 ] = {
+			{ ULONG( m_encrypted.size( ) ), SECBUFFER_DATA, m_encrypted.data( ) },
+			{ 0, SECBUFFER_EMPTY, NULL },
+			{ 0, SECBUFFER_EMPTY, NULL },
+			{ 0, SECBUFFER_EMPTY, NULL }
+		};
+
+		SecBufferDesc description = { SECBUFFER_VERSION, 4, buffers };
+		auto status = DecryptMessage( &m_context, &description, 0, NULL );
+
+		if ( status == SEC_E_INCOMPLETE_MESSAGE )
+			return 0;
+
+		// SEC_I_CONTEXT_EXPIRED is the peer's close_notify. We don't renegotiate, so a request to do so ends the connection too
+		if ( status != SEC_E_OK )
+			return -1;
+
+		std::size_t extra = 0;
+		for ( auto& buffer : buffers ) {
+			if ( buffer.BufferType == SECBUFFER_DATA ) {
+				auto plaintext = static_cast< const char* >( buffer.pvBuffer );
+				m_decrypted.insert( m_decrypted.end( ), plaintext, plaintext + buffer.cbBuffer );
+			} else if ( buffer.BufferType == SECBUFFER_EXTRA )
+				extra = buffer.cbBuffer;
+		}
+
+		// The record was decrypted in place, move the ones after it to the front
+		memmove( m_encrypted.data( ), m_encrypted.data( ) + m_encrypted.size( ) - extra, extra );
+		m_encrypted.resize( extra );
+
+		return 1;
+	}
+
+	int tls_channel::receive( std::chrono::milliseconds timeout ) {
+		WSAPOLLFD poll_fd = { m_socket, POLLRDNORM, 0 };
+		auto ready = WSAPoll( &poll_fd, 1, int( timeout.count( ) ) );
+
+		if ( ready <= 0 )
+			return ready < 0 ? -1 : 0;
+
+		auto offset = m_encrypted.size( );
+		m_encrypted.resize( offset + receive_size );
+
+		int received = recv( m_socket, m_encrypted.data( ) + offset, int( receive_size ), NULL );
+		m_encrypted.resize( offset + std::max( received, 0 ) );
+
+		return received > 0 ? received : -1;
+	}
+
+	bool tls_channel::send_all( const char* data, std::size_t length ) {
+		std::size_t total_bytes_sent = 0;
+
+		while ( total_bytes_sent < length ) {
+			int bytes_sent = send( m_socket, data + total_bytes_sent, int( length - total_bytes_sent ), NULL );
+			if ( bytes_sent <= 0 )
+				return false;
+
+			total_bytes_sent += bytes_sent;
+		}
+
+		return true;
+	}
+} // namespace forceinline::remote::transport
@@ -0,0 +1,95 @@
+#pragma once
+#include <WinSock2.h>
+#include <Windows.h>
+
+#define SECURITY_WIN32
+#include <security.h>
+#include <schannel.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "channel.h"
+
+#pragma comment (lib, "Secur32.lib")
+#pragma comment (lib, "Crypt32.lib")
+
+/*
+	TLS 1.2 over a connected socket, using Schannel. The handshake runs when the channel is
+	created, or step by step through continue_handshake for owners which can't block on it.
+	Afterwards every write goes out as one record and reads decrypt whatever records arrived. Both sides speak the normal packet framing over it, like over any other channel.
+*/
+
+namespace forceinline::remote::transport {
+	struct tls_options_t {
+		// Server: subject of the certificate which identifies us, looked up in the certificate store
+		std::string certificate_subject = "";
+
+		// System store the certificate is in, of the local machine instead of the current user if machine_store is set
+		std::string certificate_store = "MY";
+		bool machine_store = false;
+
+		// Client: name the server's certificate has to be issued for, the endpoint's host if empty
+		std::string server_name = "";
+
+		// Client: check the server's certificate chain and name. Only turn this off for tests with self-signed certificates
+		bool verify_server = true;
+
+		std::chrono::milliseconds handshake_timeout = std::chrono::seconds( 5 );
+	};
+
+	class tls_channel : public channel {
+	public:
+		// Performs the handshake over a connected socket, throws if it fails. The socket stays owned by the caller.
+		// A deferred handshake only starts here, the owner finishes it with continue_handshake
+		tls_channel( SOCKET socket, const tls_options_t& options, bool server, bool deferred = false );
+		~tls_channel( );
+
+		// Advances a deferred handshake with what the socket has queued, never blocks on the peer. Returns true once
+		// the channel is established, throws if the handshake failed or the connection was closed
+		bool continue_handshake( );
+
+		virtual int write( const char* data, int length );
+		virtual int read( char* buffer, int length );
+		virtual bool wait_readable( std::chrono::microseconds timeout );
+		virtual void close( );
+
+	private:
+		void acquire_credentials( const tls_options_t& options );
+		void handshake( std::chrono::milliseconds timeout );
+		void finish_handshake( SECURITY_STATUS status );
+		void release( );
+
+		// One call to InitializeSecurityContext/AcceptSecurityContext, sends the token it produced
+		SECURITY_STATUS handshake_step( bool with_input );
+
+		// Decrypts the next record in m_encrypted. Returns -1 if the peer closed the connection, 0 if the record is incomplete
+		int decrypt( );
+
+		// Appends what the socket has queued to m_encrypted, waiting at most timeout. Returns -1 if the connection is closed
+		int receive( std::chrono::milliseconds timeout );
+
+		bool send_all( const char* data, std::size_t length );
+
+		SOCKET m_socket = INVALID_SOCKET;
+		bool m_server = false;
+		std::string m_server_name = "";
+
+		CredHandle m_credentials = { };
+		CtxtHandle m_context = { };
+		bool m_has_credentials = false, m_has_context = false, m_established = false;
+
+		SecPkgContext_StreamSizes m_sizes = { };
+
+		// Schannel lets one thread encrypt while another one decrypts
+		std::mutex m_write_mtx, m_read_mtx;
+		std::atomic< bool > m_closed = false;
+
+		// Records we received but did not decrypt yet, plaintext not read yet and the record being encrypted
+		std::vector< char > m_encrypted = { }, m_decrypted = { }, m_record = { };
+		std::size_t m_decrypted_offset = 0;
+	};
+} // namespace forceinline::remote::transport